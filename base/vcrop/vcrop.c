@@ -75,6 +75,7 @@ none.
 
 /* From the Vista library: */
 #include "viaio/Vlib.h"
+#include "viaio/file.h"
 #include "viaio/mu.h"
 #include "viaio/option.h"
 #include "viaio/os.h"
@@ -101,10 +102,11 @@ int main(int argc, char *argv[])
 	     "Height of cropped region in rows"}
     };
     FILE *in_file, *out_file;
+    VCatalog cat;
+    VCatalogEntry *e;
     VAttrList list;
-    VAttrListPosn posn;
-    VImage src, result;
-    int nimages = 0;
+    VPointer value;
+    int i, nimages = 0;
     char prg[50];	
     sprintf(prg,"vcrop V%s", getVersion());
     fprintf (stderr, "%s\n", prg);
@@ -134,21 +136,27 @@ int main(int argc, char *argv[])
     if (width <= 0)
 	VError ("Width of cropped region must be positive");
 
-    /* Read the input file: */
-    if (! (list = VReadFile (in_file, NULL)))
+    /* Read the header of the input file: */
+    if (! (cat = VReadCatalog (in_file)))
 	exit (EXIT_FAILURE);
+    list = VCreateAttrList ();
 
-    /* Replace each image with a cropped version: */
-    for (VFirstAttr (list, & posn); VAttrExists (& posn); VNextAttr (& posn)) {
-	if (VGetAttrRepn (& posn) != VImageRepn)
+    /* Copy each attribute, reading only the cropped region of images: */
+    for (i = 0; i < cat->nentries; i++) {
+	e = & cat->entries[i];
+	if (e->repn == VStringRepn) {
+	    VAppendAttr (list, e->name, NULL, VStringRepn, e->value);
 	    continue;
-	VGetAttrValue (& posn, NULL, VImageRepn, & src);
-	result = VCropImage (src, NULL, VAllBands, top, left, height, width);
-	if (! result)
+	}
+	if (e->repn == VImageRepn) {
+	    value = VCatalogImage (cat, i, 0, top, left,
+				   e->nbands, height, width);
+	    nimages++;
+	} else
+	    value = VCatalogObject (cat, i);
+	if (! value)
 	    exit (EXIT_FAILURE);
-	VSetAttrValue (& posn, NULL, VImageRepn, result);
-	VDestroyImage (src);
-	nimages++;
+	VAppendAttr (list, e->name, NULL, e->repn, value);
     }
 
     /* Write the output file: */
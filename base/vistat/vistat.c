@@ -34,41 +34,24 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#define ABS(x) ((x) > 0 ? (x) : -(x))
 
-
-VImage
+void
 VImStats(VImage src)
 {
-  int b,r,c,n,i;
-  double v,sum1,sum2,nx,xmin,xmax,tiny=1.0e-6;
-  double mean,sigma;
-
-  xmin = VRepnMaxValue(VDoubleRepn);
-  xmax = VRepnMinValue(VDoubleRepn);
+  double tiny=1.0e-6;
+  VPixelStats stats;
 
-  sum1 = sum2 = nx = 0;
-  for (b=0; b<VImageNBands(src); b++) {
-    for (r=0; r<VImageNRows(src); r++) {
-      for (c=0; c<VImageNColumns(src); c++) {
-	v = VGetPixel(src,b,r,c);
-	if (v < xmin) xmin = v;
-	if (v > xmax) xmax = v;
-	if (ABS(v) < tiny) continue;
-	sum1 += v;
-	sum2 += v*v;
-	nx++;
-      }
-    }
-  }
-  if (nx < 1) VError(" no non-zero voxels found");
-  mean = sum1/nx;
-  sigma = sqrt((sum2 - nx * mean * mean) / (nx - 1.0));
+  stats = VComputePixelStats(src,VAllBands,NULL,tiny,TRUE);
+  if (stats->n < 1) VError(" no non-zero voxels found");
 
-  
-  fprintf(stderr,"\n image stats:\n");
-  fprintf(stderr," min = %g, max= %g\n",xmin,xmax);
-  fprintf(stderr," mean= %g, std= %g\n\n",mean,sigma);
+  fprintf(stderr,"\n image stats of %.0f non-zero voxels:\n",stats->n);
+  fprintf(stderr," min = %g, max= %g\n",stats->min,stats->max);
+  fprintf(stderr," mean= %g, std= %g\n",stats->mean,
+	  stats->n > 1 ? sqrt(stats->var * stats->n / (stats->n - 1.0)) : 0);
+  fprintf(stderr," 1%%= %g, median= %g, 99%%= %g\n\n",
+	  VPixelPercentile(stats,0.01),VPixelPercentile(stats,0.5),
+	  VPixelPercentile(stats,0.99));
+  VDestroyPixelStats(stats);
 }
 
 
@@ -31,6 +31,9 @@ image and a scalar value.
 <p>
 3. It can perform a binary (two-operand) operation between each pixel of an  input
 image and the corresponding pixel of a second image.
+<p>
+4. It can evaluate an arbitrary expression (-expr) over the input image and the
+images given by -image, in a single pass without intermediate images.
 The  mode,  operation,  and  operands  are specified by command line options.  Input
 images come from a data file; the specified operation is performed on each  to  pro
 duce an output image of the same properties.
@@ -68,7 +71,13 @@ warning messages.
         \param -value  Specifies  a  scalar  constant  to be used as the second operand 
                        of a binary operation.
         \param -image  Specifies a Vista data file containing a single image to serve as the
-                       second operand of a binary operation.
+                       second operand of a binary operation. With -expr, several files may
+                       be given, their first images are named b, c, d, ...
+        \param -expr   Per-pixel expression, e.g. "sqrt(a*a+b*b) > 3 ? a : 0", where a is the
+                       input image. Supports + - * / % ^, comparisons, && || !, ?:, and the
+                       functions abs,sqrt,exp,log,sin,cos,tan,floor,ceil,round,min,max,pow,atan2.
+                       Replaces -op.
+        \param -repn   Output pixel representation for -expr. Default: that of the input image.
         \param -min    Sets  a  lower  bound  for clipping output pixel values. Default: the
                        minimum value that can be represented by an output pixel.
 
@@ -191,16 +200,23 @@ static void SunFPEHandler (int, siginfo_t *, void *);
 int main (int argc, char *argv[])
 {
   static VImageOpKind op;
-  static VBoolean value_found, image_found, min_found, max_found;
-  static VString image_filename;
+  static VBoolean op_found, value_found, image_found, min_found, max_found;
+  static VBoolean expr_found;
+  static VArgVector image_filenames;
+  static VString expr_text;
+  static VLong repn = VUnknownRepn;
   static VDouble value, min, max;
   static VOptionDescRec  options[] = {
-    { "op", VLongRepn, 1, & op, VRequiredOpt, op_dict,
+    { "op", VLongRepn, 1, & op, & op_found, op_dict,
       "Operation to be performed" },
+    { "expr", VStringRepn, 1, & expr_text, & expr_found, NULL,
+      "Per-pixel expression over images a (input), b, c, ... (-image)" },
     { "value", VDoubleRepn, 1, & value, & value_found, NULL,
       "Constant operand for binary operation" },
-    { "image", VStringRepn, 1, & image_filename, & image_found, NULL,
-      "Image operand for binary operation" },
+    { "image", VStringRepn, 0, & image_filenames, & image_found, NULL,
+      "Image operand(s) for binary operation or expression" },
+    { "repn", VLongRepn, 1, & repn, VOptionalOpt, VNumericRepnDict,
+      "Output pixel representation for -expr" },
     { "min", VDoubleRepn, 1, & min, & min_found, NULL,
       "Clipping lower bound" },
     { "max", VDoubleRepn, 1, & max, & max_found, NULL,
@@ -209,8 +225,10 @@ int main (int argc, char *argv[])
   FILE *in_file, *out_file, *image_file = NULL;
   VAttrList list;
   VAttrListPosn posn;
-  VImage *images, src;
-  int nimages = 0;
+  VImage *images, src, *operands = NULL;
+  VStringConst image_filename;
+  VExpr expr = NULL;
+  int i, nimages = 0, noperands = 1;
   VDouble *minp, *maxp;
   char prg[50];	
   sprintf(prg,"vop V%s", getVersion());
@@ -223,7 +241,33 @@ int main (int argc, char *argv[])
   maxp = max_found ? & max : NULL;
 
   /* Check consistency between type of operation and operands provided: */
-  if (Unary (op)) {
+  if (! (op_found ^ expr_found))
+    VError ("Either -op or -expr must be specified");
+  if (expr_found) {
+    if (value_found)
+      VWarning ("-value is ignored with -expr, use a constant instead");
+    value_found = FALSE;
+    noperands = 1 + (image_found ? image_filenames.number : 0);
+    operands = VMalloc (noperands * sizeof (VImage));
+    if (! (expr = VParseExpr (expr_text, noperands)))
+      exit (EXIT_FAILURE);
+
+    /* Load the images named b, c, ...: */
+    for (i = 1; i < noperands; i++) {
+      image_filename = ((VStringConst *) image_filenames.vector)[i-1];
+      if (strcmp (image_filename, "-") == 0)
+	image_file = stdin;
+      else if (! (image_file = fopen (image_filename, "r")))
+	VError ("Failed to open image file %s", image_filename);
+      if ((nimages = VReadImages (image_file, & list, & images)) == 0)
+	exit (EXIT_FAILURE);
+      if (nimages > 1)
+	VWarning ("Using only the first image in %s", image_filename);
+      operands[i] = images[0];
+      VDestroyAttrList (list);
+      fclose (image_file);
+    }
+  } else if (Unary (op)) {
     if (value_found || image_found) {
       VWarning ("Unary operation requires neither -value nor -image");
       value_found = image_found = FALSE;
@@ -234,6 +278,10 @@ int main (int argc, char *argv[])
     if (image_found) {
 
       /* Load the image serving as the second operand: */
+      if (image_filenames.number > 1)
+	VWarning ("Using only the first of %d -image files",
+		  image_filenames.number);
+      image_filename = ((VStringConst *) image_filenames.vector)[0];
       if (strcmp (image_filename, "-") == 0)
 	image_file = stdin;
       else if (! (image_file = fopen (image_filename, "r")))
@@ -275,7 +323,17 @@ int main (int argc, char *argv[])
       continue;
     VGetAttrValue (& posn, NULL, VImageRepn, & src);
     memset (& error_counts, 0, sizeof (error_counts));
-    if (value_found) {
+    if (expr_found) {
+
+      /* Evaluate the expression in one pass: */
+      operands[0] = src;
+      src = VImageExpr (expr, noperands, operands, NULL,
+			(VRepnKind) repn, minp, maxp);
+      if (src) {
+	VSetAttrValue (& posn, NULL, VImageRepn, src);
+	VDestroyImage (operands[0]);
+      }
+    } else if (value_found) {
 
       /* Operation between image and constant: */
       src = VImageOpV (src, src, VAllBands, op, value, minp, maxp);
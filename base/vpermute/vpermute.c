@@ -0,0 +1,126 @@
+/****************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *****************************************************************/
+
+/*! \brief vpermute -- reorient images by permuting and flipping their axes.
+
+\par Description
+vpermute reslices each image of its input, e.g. from axial to sagittal
+or coronal slices, by permuting its axes (see VPermuteAxes). The new
+order of the axes is given as a permutation of the letters b (bands),
+r (rows) and c (columns): the first letter names the input axis that
+becomes the bands, the second the one that becomes the rows, and the
+third the one that becomes the columns. Output axes named by -flip
+are reversed.
+
+\par Usage
+
+        <code>vpermute</code>
+
+        \param -in     input image
+        \param -out    output image
+        \param -order  input axes for the output bands, rows and columns
+        \param -flip   output axes to reverse. Default: none
+
+\par Examples
+<br>
+<code>vpermute -in axial.v -out coronal.v -order rbc -flip b</code>
+
+\par Known bugs
+none.
+
+\file vpermute.c
+\author G.Lohmann, MPI-CBS
+*/
+
+/* From the Vista library: */
+#include <viaio/Vlib.h>
+#include <viaio/mu.h>
+#include <viaio/option.h>
+#include <viaio/VImage.h>
+
+/* From the standard C library: */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* The letters naming the bands, rows and columns: */
+static char axes[] = "brc";
+
+int
+main (int argc,char *argv[])
+{
+  static VString order_str = NULL;
+  static VString flip_str = "";
+  static VOptionDescRec options[] = {
+    { "order", VStringRepn, 1, (VPointer) & order_str,
+      VRequiredOpt, NULL, "Input axes (b, r, c) for output bands, rows, columns" },
+    { "flip", VStringRepn, 1, (VPointer) & flip_str,
+      VOptionalOpt, NULL, "Output axes (b, r, c) to reverse" }
+  };
+
+  FILE *in_file, *out_file;
+  VAttrList list;
+  VAttrListPosn posn;
+  VImage src, dest;
+  int order[3];
+  VBoolean flip[3];
+  char *p;
+  int i, nimages = 0;
+  char prg[50];
+  sprintf(prg,"vpermute V%s", getVersion());
+  fprintf (stderr, "%s\n", prg);
+
+  /* Parse command line arguments and identify files: */
+  VParseFilterCmd (VNumber (options), options, argc, argv,& in_file, & out_file);
+  if (strlen (order_str) != 3)
+    VError ("parameter <order> must have 3 letters, e.g. rbc");
+  for (i=0; i<3; i++) {
+    if (! (p = strchr (axes, order_str[i])) ||
+	strchr (order_str + i + 1, order_str[i]))
+      VError ("parameter <order>: illegal or repeated axis '%c'", order_str[i]);
+    order[i] = p - axes;
+    flip[i] = FALSE;
+  }
+  for (i=0; flip_str[i]; i++) {
+    if (! (p = strchr (axes, flip_str[i])))
+      VError ("parameter <flip>: illegal axis '%c'", flip_str[i]);
+    flip[p - axes] = TRUE;
+  }
+
+  /* Read the input file: */
+  if (! (list = VReadFile (in_file, NULL))) exit (1);
+  fclose(in_file);
+
+
+  /* process */
+  for (VFirstAttr (list, & posn); VAttrExists (& posn); VNextAttr (& posn)) {
+    if (VGetAttrRepn (& posn) != VImageRepn) continue;
+    VGetAttrValue (& posn, NULL, VImageRepn, & src);
+    if (! (dest = VPermuteAxes (src, NULL, order, flip))) exit (1);
+    VSetAttrValue (& posn, NULL, VImageRepn, dest);
+    VDestroyImage (src);
+    nimages++;
+  }
+
+
+  /* Write out the results: */
+  VHistory(VNumber(options),options,prg,&list,&list);
+  if (! VWriteFile (out_file, list)) exit (1);
+  fprintf (stderr, "%s: Permuted %d image(s).\n", argv[0], nimages);
+  return 0;
+}
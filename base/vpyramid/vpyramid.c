@@ -0,0 +1,136 @@
+/****************************************************************
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *****************************************************************/
+
+/*! \brief vpyramid -- add a multi-resolution pyramid to images.
+
+\par Description
+vpyramid follows each image of its input by downsampled versions
+of it, each half the size of the previous one (see VImagePyramid).
+The levels carry a "pyramid_level" attribute, so that readers can
+select them by level (see VCatalogLevel). Levels already present
+in the input are replaced.
+
+\par Usage
+
+        <code>vpyramid</code>
+
+        \param -in      input image
+        \param -out     output image
+        \param -levels  number of levels. Default: 3
+        \param -type    reduction: box | gauss | mode. Default: box
+        \param -chunk   store all images in chunks of this edge length,
+                        0 for no chunks. Default: 0
+        \param -compress  compress chunks. Default: false
+
+\par Examples
+<br>
+<code>vpyramid -in labels.v -out pyr.v -levels 4 -type mode -chunk 32</code>
+
+\par Known bugs
+none.
+
+\file vpyramid.c
+\author G.Lohmann, MPI-CBS
+*/
+
+/* From the Vista library: */
+#include <viaio/Vlib.h>
+#include <viaio/mu.h>
+#include <viaio/option.h>
+#include <viaio/VImage.h>
+#include <via.h>
+
+/* From the standard C library: */
+#include <stdio.h>
+#include <stdlib.h>
+
+VDictEntry TypeDict[] = {
+  { "box", VReduceBox },
+  { "gauss", VReduceGauss },
+  { "mode", VReduceMode },
+  { NULL }
+};
+
+int 
+main (int argc,char *argv[])
+{
+  static VShort levels = 3;
+  static VLong type = VReduceBox;
+  static VShort chunk = 0;
+  static VBoolean compress = FALSE;
+  static VOptionDescRec options[] = {
+    { "levels", VShortRepn, 1, (VPointer) & levels,
+      VOptionalOpt, NULL, "Number of levels" },
+    { "type", VLongRepn, 1, (VPointer) & type,
+      VOptionalOpt, TypeDict, "Reduction" },
+    { "chunk", VShortRepn, 1, (VPointer) & chunk,
+      VOptionalOpt, NULL, "Edge length of chunks, 0 for none" },
+    { "compress", VBooleanRepn, 1, (VPointer) & compress,
+      VOptionalOpt, NULL, "Whether to compress chunks" }
+  };
+
+  FILE *in_file, *out_file;
+  VAttrList list, out_list;
+  VAttrListPosn posn, level;
+  VImage src, *pyramid;
+  VPointer value;
+  int i,n;
+  char prg[50];	
+  sprintf(prg,"vpyramid V%s", getVersion());
+  fprintf (stderr, "%s\n", prg);
+
+  /* Parse command line arguments and identify files: */
+  VParseFilterCmd (VNumber (options), options, argc, argv,& in_file, & out_file);
+  if (levels < 0) VError("parameter <levels> must be positive");
+  if (chunk < 0) VError("parameter <chunk> must be positive");
+
+  /* Read the input file: */
+  if (! (list = VReadFile (in_file, NULL))) exit (1);
+  fclose(in_file);
+  pyramid = (VImage *) VCalloc(levels > 0 ? levels : 1,sizeof(VImage));
+
+
+  /* process */
+  out_list = VCreateAttrList ();
+  for (VFirstAttr (list, & posn); VAttrExists (& posn); VNextAttr (& posn)) {
+    if (VGetAttrRepn (& posn) != VImageRepn) {
+      VGetAttrValue (& posn, NULL, VGetAttrRepn (& posn), & value);
+      VAppendAttr (out_list, VGetAttrName (& posn), NULL,
+		   VGetAttrRepn (& posn), value);
+      continue;
+    }
+    VGetAttrValue (& posn, NULL, VImageRepn, & src);
+    if (VLookupAttr (VImageAttrList (src), VPyramidLevelAttr, & level))
+      continue;
+
+    n = VImagePyramid (src, levels, (VReduceKind) type, pyramid);
+    VSetImageChunks (src, chunk, chunk, chunk, compress);
+    VAppendAttr (out_list, VGetAttrName (& posn), NULL, VImageRepn, src);
+    for (i=0; i<n; i++) {
+      VSetImageChunks (pyramid[i], chunk, chunk, chunk, compress);
+      VAppendAttr (out_list, VGetAttrName (& posn), NULL, VImageRepn, pyramid[i]);
+    }
+  }
+
+
+  /* Write out the results: */
+  VHistory(VNumber(options),options,prg,&list,&out_list);
+  if (! VWriteFile (out_file, out_list)) exit (1);
+  fprintf (stderr, "%s: done.\n", argv[0]);
+  return 0;
+}
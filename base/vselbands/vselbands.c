@@ -83,10 +83,7 @@ none.
 
 /* From the standard C library: */
 #include <stdio.h>
-
-/* Later in this file: */
-extern VImage VSelSlices (VImage,VImage,VShort,VShort);
-
+#include <stdlib.h>
 
 int 
 main (int argc,char *argv[])
@@ -101,31 +98,46 @@ main (int argc,char *argv[])
   };
 
   FILE *in_file, *out_file;
+  VCatalog cat;
+  VCatalogEntry *e;
   VAttrList list;
-  VAttrListPosn posn;
-  VImage src=NULL, result=NULL;
+  VPointer value;
+  int i,b0,b1;
   char prg[50];	
   sprintf(prg,"vselbands V%s", getVersion());
   fprintf (stderr, "%s\n", prg);
 
   /* Parse command line arguments and identify files: */
   VParseFilterCmd (VNumber (options), options, argc, argv,& in_file, & out_file);
+  if (first < 0) VError("parameter <first> must be positive");
 
 
-  /* Read the input file: */
-  list = VReadFile (in_file, NULL);
-  if (! list) exit (1);
+  /* Read the header of the input file, only the selected slices are read: */
+  cat = VReadCatalog (in_file);
+  if (! cat) exit (1);
+  list = VCreateAttrList ();
 
 
   /* process */
-  for (VFirstAttr (list, & posn); VAttrExists (& posn); VNextAttr (& posn)) {
-
-    if (VGetAttrRepn (& posn) != VImageRepn) continue;
-    VGetAttrValue (& posn, NULL, VImageRepn, & src);
-    result = VSelSlices (src, NULL,first,last);
-    if (! result) exit (1);
-    VSetAttrValue (& posn, NULL, VImageRepn, result);
-    VDestroyImage (src);
+  for (i=0; i<cat->nentries; i++) {
+    e = & cat->entries[i];
+
+    if (e->repn == VStringRepn) {
+      VAppendAttr (list, e->name, NULL, VStringRepn, e->value);
+      continue;
+    }
+    if (e->repn != VImageRepn) {
+      if (! (value = VCatalogObject (cat, i))) exit (1);
+      VAppendAttr (list, e->name, NULL, e->repn, value);
+      continue;
+    }
+
+    b0 = first;
+    b1 = (last < 0 || last >= e->nbands) ? e->nbands-1 : last;
+    if (b0 > b1) VError("<first> must be less than <last>.");
+    value = VCatalogImage (cat, i, b0, 0, 0, b1-b0+1, e->nrows, e->ncolumns);
+    if (! value) exit (1);
+    VAppendAttr (list, e->name, NULL, VImageRepn, value);
   }
 
 
@@ -135,4 +147,3 @@ main (int argc,char *argv[])
   fprintf (stderr, "%s: done.\n", argv[0]);
   return 0;
 }
-
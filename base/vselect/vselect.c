@@ -94,6 +94,7 @@ none.
 
 /* From the V library: */
 #include "viaio/Vlib.h"
+#include "viaio/file.h"
 #include "viaio/mu.h"
 #include "viaio/option.h"
 #include "viaio/os.h"
@@ -125,12 +126,13 @@ int main (int argc, char **argv)
       "Invert selection criteria" }
   };
   FILE *in_file, *out_file;
+  VCatalog cat;
+  VCatalogEntry *e;
   VAttrList list;
   int i, n;
-  VAttrListPosn posn;
   VBoolean selected;
   VStringConst str;
-  VBundle b;
+  VPointer value;
   char prg[50];	
   sprintf(prg,"vselect V%s", getVersion());
   fprintf (stderr, "%s\n", prg);
@@ -148,21 +150,23 @@ int main (int argc, char **argv)
     VError ("Object index must be >= 0");
 
   /* ==> Special hack: remove registration of standard object types such as
-     "image" and "edges" so that VReadFile will leave them
-     as VBundles rather than convert them to VImage, VEdges, etc.
+     "image" and "edges" so that they are read as VBundles rather than
+     converted to VImage, VEdges, etc.
      This simplifies support for such things as selecting images
-     by their pixel representation. */
+     by their pixel representation, and their data is copied unchanged. */
   VRepnInfo[VEdgesRepn].name = "";
   VRepnInfo[VImageRepn].name = "";
 
-  /* Read the contents of the input file: */
-  if (! (list = VReadFile (in_file, NULL)))
+  /* Read the header of the input file. The data of an object is read
+     only if it is selected: */
+  if (! (cat = VReadCatalog (in_file)))
     exit (EXIT_FAILURE);
+  list = VCreateAttrList ();
     
   /* For each object in that file: */
-  i = n = 0;
-  VFirstAttr (list, & posn);
-  while (VAttrExists (& posn)) {
+  n = 0;
+  for (i = 0; i < cat->nentries; i++) {
+    e = & cat->entries[i];
 
     /* Determine whether it is one of those selected: */
     if (object_found)
@@ -170,27 +174,31 @@ int main (int argc, char **argv)
 
     else if (name_found)
 
-      selected = (strcmp (VGetAttrName (& posn), name_str) == 0);
+      selected = (strcmp (e->name, name_str) == 0);
 
     else if (type_found) {
 
-      selected = (VGetAttrRepn (& posn) == VBundleRepn &&
-		  VGetAttrValue (& posn, NULL, VBundleRepn, & b) &&
-		  strcmp (b->type_name, type_str) == 0);
+      selected = (VGetAttrRepn (& e->posn) == VBundleRepn &&
+		  strcmp (((VBundle) e->value)->type_name, type_str) == 0);
 
     } else if (attr_found)
 
-      selected = (str = ObjectAttribute (& posn, attr_str[0])) &&
+      selected = (str = ObjectAttribute (& e->posn, attr_str[0])) &&
 	(strcmp (str, attr_str[1]) == 0);
 
     else selected = FALSE;
 
-    /* Delete the attribute if its not among those selected: */
-    if (selected != not) {
-      n++;
-      VNextAttr (& posn);
-    } else VDeleteAttr (& posn);
-    i++;
+    /* Copy the attribute if it is among those selected: */
+    if (selected == not)
+      continue;
+    if (e->repn == VStringRepn)
+      VAppendAttr (list, e->name, NULL, VStringRepn, e->value);
+    else {
+      if (! (value = VCatalogObject (cat, i)))
+	exit (EXIT_FAILURE);
+      VAppendAttr (list, e->name, NULL, e->repn, value);
+    }
+    n++;
   }
 
   if (object_found && object >= i)
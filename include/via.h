@@ -35,11 +35,14 @@ extern VImage VDTClose(VImage,VImage,VDouble);
 extern VImage VDTOpen(VImage,VImage,VDouble);
 extern VImage VDTErode(VImage,VImage,VDouble);
 extern VImage VDTDilate(VImage,VImage,VDouble);
+extern VBoolean VDTMorphology(VImage,VMorphOp,VDouble *,int,VBoolean,VImage *);
+extern void   VDTFreeCache(void);
 
 /* distance transforms */
 extern VImage VEuclideanDist3d(VImage,VImage,VRepnKind);
 extern VImage VChamferDist3d(VImage,VImage,VRepnKind);
 extern VImage VChamferDist2d(VImage,VImage,VBand);
+extern VImage VEuclideanDist2d(VImage,VImage,VImage *);
 extern VImage VCDT3d (VImage,VImage,VLong,VLong,VLong,VRepnKind);
 
 /* connected components */
@@ -53,26 +56,34 @@ extern VImage VDeleteSmall(VImage,VImage,int);
 extern VImage VBorderImage3d (VImage,VImage);
 extern int    VBorderPoint(VImage,int,int,int);
 extern int    VSimplePoint(VImage,int,int,int,int);
+extern int    VSimplePointMask(unsigned int,int);
 extern VImage VTopoclass(VImage,VImage);
 extern int    VGenusLee (VImage,VShort);
 extern VImage VThin3d(VImage,VImage,int);
 extern VImage VSkel3d(VImage,VImage);
 extern VImage VSkel2d(VImage,VImage);
+extern void   VQueueThinning(VImage,VImage,float,int,int,int (*)(VImage,int,int,int,int));
 
 
 /* resampling, geometric transformations */
+extern VImage VResample3d(VImage,VImage,VImage,float,float,float,int,int,int,VRepnKind,VInterpolKind);
+extern VImage VResampleScale3d(VImage,VImage,int,int,int,float[3],float[3],VRepnKind,VInterpolKind);
 extern VImage VTriLinearSample3d(VImage,VImage,VImage,float,float,float,int,int,int);
 extern VImage VNNSample3d(VImage,VImage,VImage,float,float,float,int,int,int);
 extern VImage VCubicSplineSample3d(VImage,VImage,VImage,float,float,float,int,int,int);
 extern VImage VTriLinearScale3d (VImage,VImage,int,int,int,float[3],float[3]);
 extern VImage VNNScale3d (VImage,VImage,int,int,int,float[3],float[3]);
 extern VImage VCubicSplineScale3d (VImage,VImage,int,int,int,float[3],float[3]);
+extern VImage VCubicSplineCoeff3d(VImage,VImage);
+extern VImage VCubicSplineCoeffSample3d(VImage,VImage,VImage,float,float,float,int,int,int,VRepnKind);
 extern VImage VBicubicScale2d(VImage,VImage,VFloat);
 extern VImage VBiLinearScale2d(VImage,VImage,int,int,float[2],float[2]);
 extern VImage VRotateImage2d(VImage,VImage,VBand,double);
 extern VImage VRotateImage3d(VImage,VImage,VFloat,VShort);
 extern VImage VShearImageX (VImage src, VImage dest, VBand band, double shear);
 extern VImage VShearImageY (VImage src, VImage dest, VBand band, double shear);
+extern VImage VReduceImage3d(VImage,VImage,VReduceKind);
+extern int    VImagePyramid(VImage,int,VReduceKind,VImage *);
 
 
 /* filters */
@@ -87,7 +98,13 @@ extern VImage VLeeImage(VImage,VImage,VLong,VDouble,VLong,VLong);
 extern VImage VSmoothImage3d(VImage,VImage,VLong,VLong);
 extern VImage VFilterGauss2d(VImage,VImage,double);
 extern VImage VFilterGauss3d(VImage,VImage,double);
+extern VImage VRecursiveGauss3d(VImage,VImage,VFloat *,int *,VRepnKind);
+extern void   VFilterLines3d(VFloat *,int,int,int,int,void (*)(float *,int,void *,double *),void *);
+extern void   VVoxelSigma(VImage,VDouble,VFloat *);
 extern VImage VFilterBox3d(VImage,VImage,int);
+extern VBoolean VLocalMoments3d(VImage,int,VConvolvePadMethod,VImage *,VImage *);
+extern VImage VLocalMean3d(VImage,VImage,int,VConvolvePadMethod);
+extern VImage VLocalVariance3d(VImage,VImage,int,VConvolvePadMethod);
 extern VImage VMedianImage3d (VImage,VImage,int,VBoolean);
 extern VImage VMedianImage2d (VImage,VImage,int,VBoolean);
 
@@ -96,11 +113,13 @@ extern VImage VMedianImage2d (VImage,VImage,int,VBoolean);
 /* segmentation, clustering, binarization */
 extern VImage VBinarizeImage(VImage,VImage,VDouble,VDouble);
 extern VImage VIsodataImage3d(VImage,VImage,VLong,VLong);
+extern VImage VIsodataMask3d(VImage,VImage,VImage,VLong,VLong);
 
 /* edge detection and curvature */
 extern void   VCanny3d(VImage,int,VImage *,VImage *,VImage *);
 extern void   VCanny2d(VImage,int,VImage *,VImage *);
 extern void   VDeriche3d(VImage,VFloat,VImage *,VImage *,VImage *);
+extern VImage VDericheMagnitude3d(VImage,VFloat,VImage);
 extern void   VDeriche2d(VImage,VFloat,VImage *,VImage *);
 extern VImage VMagnitude3d(VImage,VImage,VImage,VImage);
 extern VImage VMagnitude2d(VImage,VImage,VImage);
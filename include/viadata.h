@@ -120,6 +120,40 @@ typedef struct pointStruct{
 
 
 
+/*!
+  \enum VInterpolKind
+  \brief interpolation methods for 3D resampling.
+*/
+typedef enum {
+  VInterpolNN,             /* nearest neighbour */
+  VInterpolTriLinear,      /* trilinear */
+  VInterpolCubicSpline     /* cubic B-spline, from a coefficient image */
+} VInterpolKind;
+
+
+/*!
+  \enum VMorphOp
+  \brief binary morphological operations (see VDTMorphology).
+*/
+typedef enum {
+  VMorphErode,
+  VMorphDilate,
+  VMorphOpen,
+  VMorphClose
+} VMorphOp;
+
+
+/*!
+  \enum VReduceKind
+  \brief reductions of 2x2x2 blocks for pyramids (see VReduceImage3d).
+*/
+typedef enum {
+  VReduceBox,              /* mean */
+  VReduceGauss,            /* binomial low pass filter */
+  VReduceMode              /* most frequent value, for label images */
+} VReduceKind;
+
+
 /*
 ** access to a pixel
 */
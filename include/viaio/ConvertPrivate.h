@@ -0,0 +1,39 @@
+/*
+ *  This file contains private declarations shared by the pixel conversion
+ *  routines in ConvertC.c, ConvertL.c, ConvertR.c and ConvertV.c.
+ */
+
+#ifndef V_ConvertPrivate_h
+#define V_ConvertPrivate_h 1
+
+/* From the Vista library: */
+#include "viaio/Vlib.h"
+#include "viaio/VImage.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ *  Pixels are converted in blocks of BlockSize, in parallel. The kernels
+ *  avoid branches so that compilers can vectorize them: values are
+ *  clipped with conditional expressions, clipping is detected by OR-ing
+ *  the results of comparisons, and values are rounded by Round, which
+ *  adds and subtracts 1.5 * 2^52 in double precision. For |x| < 2^51 this
+ *  gives what rint() gives in the default rounding mode, without a call.
+ *  (It relies on strict IEEE arithmetic, so don't use -ffast-math.)
+ */
+
+#define BlockSize	65536
+#define RoundMagic	6755399441055744.0
+#define Round(x)	(((VDouble) (x) + RoundMagic) - RoundMagic)
+
+/* From ConvertV.c: */
+extern int VConvertFloatUByte (const VFloat *, VUByte *, long, double, double);
+extern int VConvertFloatShort (const VFloat *, VShort *, long, double, double);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* V_ConvertPrivate_h */
@@ -145,6 +145,9 @@ enum {
  *  Attributes used to represent an image.
  */
 
+#define VChunkCompressionAttr	"chunk_compression"
+#define VChunkDataAttr		"chunk_data"
+#define VChunkSizeAttr		"chunk_size"
 #define VColorInterpAttr	"color_interp"
 #define VComponentInterpAttr	"component_interp"
 #define VFrameInterpAttr	"frame_interp"
@@ -154,6 +157,8 @@ enum {
 #define VNFramesAttr		"nframes"
 #define VNViewpointsAttr	"nviewpoints"
 #define VPixelAspectRatioAttr	"pixel_aspect_ratio"
+#define VPixelStatsAttr		"pixel_stats"
+#define VPyramidLevelAttr	"pyramid_level"
 #define VViewpointInterpAttr	"viewpoint_interp"
 
 /* Values of band interpretation attributes: */
@@ -229,6 +234,33 @@ typedef enum {
     VImageOpXor
 } VImageOpKind;
 
+/* A parsed per-pixel expression (see VParseExpr): */
+typedef struct V_ExprRec *VExpr;
+
+/* Statistics of the pool allocator (see VPoolGetStats): */
+typedef struct {
+    size_t limit;			/* max. bytes kept for reuse */
+    size_t in_use;			/* bytes currently requested */
+    size_t peak;			/* max. bytes requested at once */
+    size_t cached;			/* bytes kept for reuse */
+    unsigned long nrequests;		/* number of allocations */
+    unsigned long nhits;		/* allocations served from the cache */
+} VPoolStatsRec;
+
+/* Statistics of pixel values (see VComputePixelStats): */
+typedef struct V_PixelStatsRec {
+    VBand band;				/* band(s) described */
+    VDouble background;			/* |values| below this were ignored */
+    VBoolean masked;			/* whether restricted to a mask */
+    VDouble n;				/* number of pixels counted */
+    VDouble min, max;			/* range of their values */
+    VDouble mean, var;			/* mean and variance of their values */
+    int nbins;				/* number of histogram bins, or 0 */
+    VBoolean exact;			/* whether bin k holds just min + k */
+    VDouble lo, width;			/* bin k covers lo + k * width ... */
+    VDouble *histo;			/* histogram, or NULL */
+} VPixelStatsRec, *VPixelStats;
+
 
 /*
  *  Declarations of library routines.
@@ -391,6 +423,33 @@ extern VBoolean VDither (
 #endif
 );
 
+/* From Expr.c: */
+
+extern VExpr VParseExpr (
+#if NeedFunctionPrototypes
+    VStringConst	/* text */,
+    int			/* nvars */
+#endif
+);
+
+extern void VDestroyExpr (
+#if NeedFunctionPrototypes
+    VExpr		/* expr */
+#endif
+);
+
+extern VImage VImageExpr (
+#if NeedFunctionPrototypes
+    VExpr		/* expr */,
+    int			/* nsrc */,
+    VImage []		/* src */,
+    VImage		/* dest */,
+    VRepnKind		/* repn */,
+    VDouble *		/* minptr */,
+    VDouble *		/* maxptr */
+#endif
+);
+
 /* From Fft.c: */
 
 extern VImage VImageFFT (
@@ -634,6 +693,58 @@ extern VBoolean VWriteImages (
 #endif
 );
 
+/* From ImageChunks.c: */
+
+extern void VSetImageChunks (
+#if NeedFunctionPrototypes
+    VImage		/* image */,
+    int			/* nbands */,
+    int			/* nrows */,
+    int			/* ncolumns */,
+    VBoolean		/* compress */
+#endif
+);
+
+/* From ImagePool.c: */
+
+extern VPointer VPoolAlloc (
+#if NeedFunctionPrototypes
+    size_t		/* size */
+#endif
+);
+
+extern void VPoolFree (
+#if NeedFunctionPrototypes
+    VPointer		/* p */,
+    size_t		/* size */
+#endif
+);
+
+extern void VPoolConfig (
+#if NeedFunctionPrototypes
+    size_t		/* limit */,
+    VBoolean		/* hugepages */
+#endif
+);
+
+extern void VPoolTrim (
+#if NeedFunctionPrototypes
+    void
+#endif
+);
+
+extern void VPoolGetStats (
+#if NeedFunctionPrototypes
+    VPoolStatsRec *	/* stats */
+#endif
+);
+
+extern void VPoolReport (
+#if NeedFunctionPrototypes
+    FILE *		/* f */
+#endif
+);
+
 /* From ImageDpy.c: */
 
 extern void VImageWindowSize (
@@ -883,6 +994,36 @@ extern VBoolean VImageStats (
 #endif
 );
 
+extern VPixelStats VComputePixelStats (
+#if NeedFunctionPrototypes
+    VImage		/* src */,
+    VBand		/* band */,
+    VImage		/* mask */,
+    VDouble		/* background */,
+    VBoolean		/* histo */
+#endif
+);
+
+extern VDouble VPixelPercentile (
+#if NeedFunctionPrototypes
+    VPixelStats		/* stats */,
+    VDouble		/* fraction */
+#endif
+);
+
+extern VBoolean VCachePixelStats (
+#if NeedFunctionPrototypes
+    VImage		/* image */,
+    VPixelStats		/* stats */
+#endif
+);
+
+extern void VDestroyPixelStats (
+#if NeedFunctionPrototypes
+    VPixelStats		/* stats */
+#endif
+);
+
 /* From Synth.c: */
 
 /* Later in this file: */
@@ -960,6 +1101,15 @@ extern VImage VTransposeImage (
 #endif
 );
 
+extern VImage VPermuteAxes (
+#if NeedFunctionPrototypes
+    VImage		/* src */,
+    VImage		/* dest */,
+    int *		/* order */,
+    VBoolean *		/* flip */
+#endif
+);
+
 /* From UbcIff.c: */
 
 extern VImage VReadUbcIff (
@@ -623,6 +623,36 @@ void VUnpackBits (
 #endif
 );
 
+/* From Trace.c: */
+
+extern int V_TraceOn;
+
+extern double VTraceClock (
+#if NeedFunctionPrototypes
+    void
+#endif
+);
+
+extern void VTraceRecord (
+#if NeedFunctionPrototypes
+    VStringConst	/* name */,
+    double		/* t0 */,
+    double		/* nvoxels */,
+    double		/* nbytes */
+#endif
+);
+
+/* Timing of a library call, enabled by the environment variable VIA_TRACE:
+     double t0 = VTraceBegin ();
+     ...
+     VTraceEnd ("VFunction", t0, nvoxels, nbytes);
+   If tracing is off, each costs a test of V_TraceOn. */
+#define VTraceBegin()	(V_TraceOn ? VTraceClock () : 0.0)
+#define VTraceEnd(name, t0, nvoxels, nbytes) \
+    do { if (V_TraceOn) VTraceRecord ((name), (t0), \
+				      (double) (nvoxels), (double) (nbytes)); \
+    } while (0)
+
 /* From Type.c: */
 
 VRepnKind VRegisterType (
@@ -69,6 +69,36 @@ typedef VBoolean VReadFileFilterProc (
 );
 
 
+/*
+ *  Catalog of the top-level attributes of a Vista data file, made by
+ *  VReadCatalog from the file's header.
+ */
+
+typedef struct {
+    VStringConst name;		/* attribute name */
+    VRepnKind repn;		/* type of its value, VBundleRepn if the
+				   type of an object is not registered */
+    VPointer value;		/* value; for objects in a regular file the
+				   bundle read from the header */
+    long data;			/* position of the object's binary data
+				   relative to the catalog's base, or -1 */
+    size_t length;		/* length of the object's binary data */
+    VLong nbands, nrows, ncolumns; /* size of an image */
+    VRepnKind pixel_repn;	/* pixel representation of an image */
+    VAttrListPosn posn;		/* attribute within the catalog's list */
+} VCatalogEntry;
+
+typedef struct V_CatalogRec {
+    FILE *file;			/* stream the catalog was read from */
+    VAttrList list;		/* attributes read from the header */
+    long base;			/* file position of the binary data, or -1
+				   if the whole stream has been read */
+    int nentries;		/* number of top-level attributes */
+    VCatalogEntry *entries;	/* their descriptions */
+    VPointer cache;		/* chunks read by VCatalogImage */
+} VCatalogRec, *VCatalog;
+
+
 /*
  *  Declarations of library routines.
 
@@ -108,6 +138,51 @@ extern VAttrList VReadFile (
 #endif
 );
 
+/* Read the header of a Vista data file: */
+extern VCatalog VReadCatalog (
+#if NeedFunctionPrototypes
+    FILE *		/* f */
+#endif
+);
+
+/* Read one object listed in a catalog: */
+extern VPointer VCatalogObject (
+#if NeedFunctionPrototypes
+    VCatalog		/* cat */,
+    int			/* i */
+#endif
+);
+
+/* Read part of an image listed in a catalog: */
+extern VImage VCatalogImage (
+#if NeedFunctionPrototypes
+    VCatalog		/* cat */,
+    int			/* i */,
+    int			/* band */,
+    int			/* top */,
+    int			/* left */,
+    int			/* nbands */,
+    int			/* nrows */,
+    int			/* ncolumns */
+#endif
+);
+
+/* Find a pyramid level of an image in a catalog: */
+extern int VCatalogLevel (
+#if NeedFunctionPrototypes
+    VCatalog		/* cat */,
+    int			/* i */,
+    int			/* level */
+#endif
+);
+
+/* Discard a catalog: */
+extern void VDestroyCatalog (
+#if NeedFunctionPrototypes
+    VCatalog		/* cat */
+#endif
+);
+
 /* Write objects of a certain type: */
 extern VBoolean VWriteObjects (
 #if NeedFunctionPrototypes
@@ -127,6 +202,36 @@ extern VBoolean VWriteFile (
 #endif
 );
 
+/* Pack an array of data elements and write them to a stream: */
+extern VBoolean VWritePackedData (
+#if NeedFunctionPrototypes
+    FILE *		/* f */,
+    long		/* offset */,
+    VRepnKind		/* repn */,
+    size_t		/* nels */,
+    VPointer		/* unpacked */,
+    VPackOrder		/* packed_order */
+#endif
+);
+
+/* Write the binary data of an image: */
+extern VBoolean VImageWriteData (
+#if NeedFunctionPrototypes
+    FILE *		/* f */,
+    long		/* offset */,
+    VPointer		/* image */,
+    VAttrList		/* list */,
+    size_t		/* length */
+#endif
+);
+
+/* Discard what was prepared for writing the data of an image: */
+extern void VImageDropChunks (
+#if NeedFunctionPrototypes
+    VPointer		/* image */
+#endif
+);
+
 #ifdef __cplusplus
 }
 #endif
@@ -35,3 +35,7 @@ typedef struct V_ImageInfo {
   long repetition_time;
 } VImageInfo;
 
+
+
+/* read a box of bands, rows and columns of an image (BlockFileIO_2.c) */
+extern VImage VReadRegion(int,VImageInfo *,int,int,int,int,int,int);
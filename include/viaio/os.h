@@ -42,7 +42,9 @@
  *  Header files that are on all platforms of interest.
  */
 
+#ifndef _XOPEN_SOURCE
 #define _XOPEN_SOURCE
+#endif
 
 #include <limits.h>
 #include <stdarg.h>
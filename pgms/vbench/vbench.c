@@ -0,0 +1,587 @@
+/****************************************************************
+ *
+ * Copyright (C) Max Planck Institute
+ * for Human Cognitive and Brain Sciences, Leipzig
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *****************************************************************/
+
+/*! \brief vbench -- timing and regression checks for vialib kernels
+
+\par Description
+vbench generates synthetic 3D volumes and times the major vialib entry points
+on them, for each combination of volume size, pixel repn and thread count.
+The input volumes are
+<pre>
+  grey     spheres of different intensity plus Gaussian noise (any repn)
+  binary   union of random balls (bit repn)
+</pre>
+Results are written as JSON, one record per line, holding the best and mean
+wall clock time over all repetitions and a checksum of the output pixels.
+The checksums of a previous run can be given by -check, in which case every
+kernel whose output differs from the reference is reported and vbench exits
+with a non-zero status. This is used to verify that an optimization does not
+change results.
+<p>
+The cmake target "benchmark" runs vbench with default settings and writes
+vbench.json into the build directory.
+
+\par Usage
+
+        <code>vbench</code>
+
+        \param -out     output file (JSON). Default: stdout
+        \param -size    volume sizes (cube edge length). Default: 64
+        \param -repn    pixel repns of grey input volumes. Default: ubyte float
+        \param -threads thread counts. Default: 1 and the number of processors
+        \param -repeat  number of repetitions of each measurement. Default: 3
+        \param -kernel  run only kernels whose name contains this string
+        \param -check   reference JSON file of an earlier run
+
+\par Examples
+<br>
+vbench -size 64 128 -out before.json
+<br>
+vbench -size 64 128 -check before.json -out after.json
+
+\par Known bugs
+none.
+
+\file vbench.c
+*/
+
+#include <viaio/Vlib.h>
+#include <viaio/VImage.h>
+#include <viaio/mu.h>
+#include <viaio/option.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include <via.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+
+/* Input volumes: */
+enum { InGrey, InBinary };
+
+typedef VImage (*BenchProc)(VImage,VImage);
+
+typedef struct {
+  char *name;
+  int input;
+  BenchProc proc;
+} BenchKernel;
+
+/* Reference checksums read by -check: */
+typedef struct {
+  char kernel[64];
+  char repn[16];
+  int size;
+  char checksum[20];
+} BenchRef;
+
+static VImage kernel3d=NULL;
+static VImage transform=NULL;
+
+
+/*
+** kernels, all called as proc(src,dest)
+*/
+static VImage
+Convolve3d(VImage src,VImage dest)
+{
+  return VConvolve3d(src,dest,kernel3d);
+}
+
+static VImage
+Gauss3d(VImage src,VImage dest)
+{
+  return VFilterGauss3d(src,dest,1.5);
+}
+
+static VImage
+RecursiveGauss3d(VImage src,VImage dest)
+{
+  VFloat sigma[3] = {4.0,4.0,4.0};
+  return VRecursiveGauss3d(src,dest,sigma,NULL,VUnknownRepn);
+}
+
+static VImage
+Deriche3d(VImage src,VImage dest)
+{
+  return VDericheMagnitude3d(src,1.0,dest);
+}
+
+static VImage
+Median3d(VImage src,VImage dest)
+{
+  return VMedianImage3d(src,dest,3,FALSE);
+}
+
+static VImage
+Lee3d(VImage src,VImage dest)
+{
+  return VLeeImage(src,dest,7,20.0,1,-1);
+}
+
+static VImage
+Aniso3d(VImage src,VImage dest)
+{
+  return VAniso3d(src,dest,3,0,20.0,0.0);
+}
+
+static VImage
+Box3d(VImage src,VImage dest)
+{
+  return VLocalMean3d(src,dest,5,VConvolvePadBorder);
+}
+
+static VImage
+TriLinear3d(VImage src,VImage dest)
+{
+  int nbands=VImageNBands(src),nrows=VImageNRows(src),ncols=VImageNColumns(src);
+
+  /* rotation about the image center */
+  VPixel(transform,0,0,0,VDouble) = (float)nbands/2;
+  VPixel(transform,0,1,0,VDouble) = (float)nrows/2;
+  VPixel(transform,0,2,0,VDouble) = (float)ncols/2;
+  return VTriLinearSample3d(src,dest,transform,
+			    (float)nbands/2,(float)nrows/2,(float)ncols/2,nbands,nrows,ncols);
+}
+
+static VImage
+Label3d(VImage src,VImage dest)
+{
+  int nl=0;
+  return VLabelImage3d(src,dest,26,VShortRepn,&nl);
+}
+
+static VImage
+EuclideanDist3d(VImage src,VImage dest)
+{
+  return VEuclideanDist3d(src,dest,VFloatRepn);
+}
+
+static VImage
+Skel3d(VImage src,VImage dest)
+{
+  return VSkel3d(src,dest);
+}
+
+static VImage
+ReadWrite(VImage src,VImage dest)
+{
+  FILE *fp;
+  VAttrList list;
+  VAttrListPosn posn;
+  VImage tmp=NULL;
+
+  if ((fp = tmpfile()) == NULL) VError(" error creating temporary file");
+  list = VCreateAttrList();
+  VAppendAttr(list,"image",NULL,VImageRepn,src);
+  if (! VWriteFile(fp,list)) VError(" error writing temporary file");
+  rewind(fp);
+
+  /* detach src from the list before it is destroyed */
+  VFirstAttr(list,&posn);
+  VSetAttrValue(&posn,NULL,VImageRepn,NULL);
+  VDestroyAttrList(list);
+
+  if (! (list = VReadFile(fp,NULL))) VError(" error reading temporary file");
+  fclose(fp);
+  for (VFirstAttr(list,&posn); VAttrExists(&posn); VNextAttr(&posn)) {
+    if (VGetAttrRepn(&posn) != VImageRepn) continue;
+    VGetAttrValue(&posn,NULL,VImageRepn,&tmp);
+    VSetAttrValue(&posn,NULL,VImageRepn,NULL);
+    break;
+  }
+  VDestroyAttrList(list);
+  if (dest) VDestroyImage(dest);
+  return tmp;
+}
+
+static BenchKernel kernels[] = {
+  {"convolve3d", InGrey,   Convolve3d},
+  {"gauss3d",    InGrey,   Gauss3d},
+  {"rgauss3d",   InGrey,   RecursiveGauss3d},
+  {"deriche3d",  InGrey,   Deriche3d},
+  {"median3d",   InGrey,   Median3d},
+  {"aniso3d",    InGrey,   Aniso3d},
+  {"lee3d",      InGrey,   Lee3d},
+  {"box3d",      InGrey,   Box3d},
+  {"trilinear3d",InGrey,   TriLinear3d},
+  {"readwrite",  InGrey,   ReadWrite},
+  {"label3d",    InBinary, Label3d},
+  {"edt3d",      InBinary, EuclideanDist3d},
+  {"skel3d",     InBinary, Skel3d},
+  {"readwrite",  InBinary, ReadWrite}
+};
+
+
+/*
+** synthetic volumes. A private random number generator is used so that
+** the volumes, and hence the checksums, do not depend on the platform.
+*/
+static unsigned long long seed = 1;
+
+static double
+Random(void)
+{
+  seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+  return (double) (seed >> 11) / 9007199254740992.0;
+}
+
+static VImage
+SynthGrey(int n,VRepnKind repn)
+{
+  VImage dest;
+  int b,r,c,i;
+  double x,y,z,u,v,s,t,rad,cb[8],cr[8],cc[8],rr[8],val[8];
+  double vmin=VRepnMinValue(repn),vmax=VRepnMaxValue(repn);
+  VBoolean phase=FALSE;
+
+  if (vmin < 0) vmin = 0;
+  if (vmax > 255) vmax = 255;
+
+  seed = 4711;
+  for (i=0; i<8; i++) {
+    cb[i] = n * (0.2 + 0.6*Random());
+    cr[i] = n * (0.2 + 0.6*Random());
+    cc[i] = n * (0.2 + 0.6*Random());
+    rr[i] = n * (0.05 + 0.15*Random());
+    val[i] = 60 + 150*Random();
+  }
+
+  dest = VCreateImage(n,n,n,repn);
+  s = t = 0;
+  for (b=0; b<n; b++) {
+    for (r=0; r<n; r++) {
+      for (c=0; c<n; c++) {
+	u = 20;
+	for (i=0; i<8; i++) {
+	  x = c-cc[i]; y = r-cr[i]; z = b-cb[i];
+	  rad = rr[i];
+	  if (x*x+y*y+z*z < rad*rad) u = val[i];
+	}
+
+	/* Gaussian noise, generated in pairs as in VNormalNoiseImage */
+	if (phase) v = s * sin(t);
+	else {
+	  s = sqrt(-2.0 * log(1.0 - Random()));
+	  t = 2.0 * M_PI * Random();
+	  v = s * cos(t);
+	}
+	phase = ! phase;
+	u += 10.0 * v;
+
+	if (u < vmin) u = vmin;
+	if (u > vmax) u = vmax;
+	VSetPixel(dest,b,r,c,u);
+      }
+    }
+  }
+  return dest;
+}
+
+static VImage
+SynthBinary(int n)
+{
+  VImage dest;
+  int b,r,c,i,k,nballs,b0,b1,r0,r1,c0,c1;
+  double x,y,z,rad,cb,cr,cc;
+
+  seed = 815;
+  dest = VCreateImage(n,n,n,VBitRepn);
+  VFillImage(dest,VAllBands,0);
+
+  nballs = 24;
+  for (k=0; k<nballs; k++) {
+    cb  = n * (0.15 + 0.7*Random());
+    cr  = n * (0.15 + 0.7*Random());
+    cc  = n * (0.15 + 0.7*Random());
+    rad = n * (0.03 + 0.1*Random());
+    b0 = cb-rad; b1 = cb+rad+1; if (b0 < 1) b0 = 1; if (b1 > n-1) b1 = n-1;
+    r0 = cr-rad; r1 = cr+rad+1; if (r0 < 1) r0 = 1; if (r1 > n-1) r1 = n-1;
+    c0 = cc-rad; c1 = cc+rad+1; if (c0 < 1) c0 = 1; if (c1 > n-1) c1 = n-1;
+    for (b=b0; b<b1; b++) {
+      for (r=r0; r<r1; r++) {
+	for (c=c0; c<c1; c++) {
+	  x = c-cc; y = r-cr; z = b-cb;
+	  if (x*x+y*y+z*z <= rad*rad) VPixel(dest,b,r,c,VBit) = 1;
+	}
+      }
+    }
+  }
+
+  /* a few random voxels for the labelling */
+  i = n*n*n / 1000;
+  for (k=0; k<i; k++) {
+    b = 1 + (n-2)*Random();
+    r = 1 + (n-2)*Random();
+    c = 1 + (n-2)*Random();
+    VPixel(dest,b,r,c,VBit) = 1;
+  }
+  return dest;
+}
+
+
+/*
+** FNV-1a hash of the image dimensions, repn and pixel data
+*/
+static void
+Checksum(VImage image,char *str)
+{
+  unsigned long long h = 14695981039346656037ULL;
+  unsigned char *p;
+  size_t i,n;
+  int dims[4];
+
+  dims[0] = VImageNBands(image);
+  dims[1] = VImageNRows(image);
+  dims[2] = VImageNColumns(image);
+  dims[3] = VPixelRepn(image);
+  p = (unsigned char *) dims;
+  for (i=0; i<sizeof(dims); i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+
+  p = (unsigned char *) VImageData(image);
+  n = (size_t) VImageNPixels(image) * VPixelSize(image);
+  for (i=0; i<n; i++) {
+    h ^= p[i];
+    h *= 1099511628211ULL;
+  }
+  sprintf(str,"%016llx",h);
+}
+
+
+static double
+WallTime(void)
+{
+  struct timeval tv;
+  gettimeofday(&tv,NULL);
+  return (double) tv.tv_sec + 1.0e-6 * (double) tv.tv_usec;
+}
+
+
+/*
+** read reference checksums written by an earlier run
+*/
+static BenchRef *
+ReadReference(VString filename,int *nref)
+{
+  FILE *fp;
+  char line[1024],*p;
+  BenchRef *ref=NULL;
+  int n=0,nalloc=0;
+
+  if ((fp = fopen(filename,"r")) == NULL) VError(" error opening %s",filename);
+  while (fgets(line,sizeof(line),fp)) {
+    if (strstr(line,"\"kernel\"") == NULL) continue;
+    if (n >= nalloc) {
+      nalloc += 64;
+      ref = (BenchRef *) VRealloc(ref,nalloc * sizeof(BenchRef));
+    }
+    if ((p = strstr(line,"\"kernel\":")) == NULL ||
+	sscanf(p,"\"kernel\": \"%63[^\"]\"",ref[n].kernel) != 1) continue;
+    if ((p = strstr(line,"\"size\":")) == NULL ||
+	sscanf(p,"\"size\": %d",&ref[n].size) != 1) continue;
+    if ((p = strstr(line,"\"repn\":")) == NULL ||
+	sscanf(p,"\"repn\": \"%15[^\"]\"",ref[n].repn) != 1) continue;
+    if ((p = strstr(line,"\"checksum\":")) == NULL ||
+	sscanf(p,"\"checksum\": \"%19[^\"]\"",ref[n].checksum) != 1) continue;
+    n++;
+  }
+  fclose(fp);
+  *nref = n;
+  return ref;
+}
+
+
+int
+main (int argc,char *argv[])
+{
+  static VArgVector sizes;
+  static VArgVector repns;
+  static VArgVector threads;
+  static VShort repeat = 3;
+  static VString only = NULL;
+  static VString check = NULL;
+  static VBoolean sizes_found,repns_found,threads_found;
+  static VOptionDescRec  options[] = {
+    {"size",VShortRepn,0,(VPointer) &sizes,&sizes_found,NULL,"volume sizes"},
+    {"repn",VStringRepn,0,(VPointer) &repns,&repns_found,NULL,"pixel repns of grey volumes"},
+    {"threads",VShortRepn,0,(VPointer) &threads,&threads_found,NULL,"thread counts"},
+    {"repeat",VShortRepn,1,(VPointer) &repeat,VOptionalOpt,NULL,"number of repetitions"},
+    {"kernel",VStringRepn,1,(VPointer) &only,VOptionalOpt,NULL,"run only kernels containing this string"},
+    {"check",VStringRepn,1,(VPointer) &check,VOptionalOpt,NULL,"reference JSON file"}
+  };
+  FILE *out_file;
+  VImage src=NULL,dest=NULL;
+  VRepnKind repn;
+  VDictEntry *entry;
+  BenchRef *ref=NULL;
+  static VShort default_size[1] = {64};
+  static VStringConst default_repn[2] = {"ubyte","float"};
+  VShort default_threads[2];
+  VShort *size_list,*thread_list;
+  VStringConst *repn_list,repn_name;
+  int nsizes,nrepns,nthreads,nref=0,nfail=0,nrec=0;
+  int i,j,k,t,s,rep,n;
+  double t0,dt,tmin,tsum;
+  char sum[20],first[20];
+  VBoolean mismatch;
+  char prg[50];
+  sprintf(prg,"vbench V%s", getVersion());
+  fprintf (stderr, "%s\n", prg);
+
+  VParseFilterCmd (VNumber (options),options,argc,argv,NULL,&out_file);
+  if (repeat < 1) repeat = 1;
+
+  size_list = sizes_found ? (VShort *) sizes.vector : default_size;
+  nsizes = sizes_found ? sizes.number : 1;
+  repn_list = repns_found ? (VStringConst *) repns.vector : default_repn;
+  nrepns = repns_found ? repns.number : 2;
+
+  default_threads[0] = default_threads[1] = 1;
+  nthreads = 1;
+#ifdef _OPENMP
+  default_threads[1] = omp_get_num_procs();
+  if (default_threads[1] > 1) nthreads = 2;
+#endif
+  thread_list = threads_found ? (VShort *) threads.vector : default_threads;
+  if (threads_found) nthreads = threads.number;
+
+  if (check) ref = ReadReference(check,&nref);
+
+  /* 5x5x5 Gaussian kernel for VConvolve3d */
+  kernel3d = VCreateImage(5,5,5,VFloatRepn);
+  tsum = 0;
+  for (i=0; i<5; i++)
+    for (j=0; j<5; j++)
+      for (k=0; k<5; k++)
+	tsum += VPixel(kernel3d,i,j,k,VFloat) =
+	  exp(-((i-2)*(i-2)+(j-2)*(j-2)+(k-2)*(k-2))/(2.0*1.5*1.5));
+  for (i=0; i<5; i++)
+    for (j=0; j<5; j++)
+      for (k=0; k<5; k++)
+	VPixel(kernel3d,i,j,k,VFloat) /= tsum;
+
+  /* rotation by 10 degrees about the band axis */
+  transform = VCreateImage(1,3,4,VDoubleRepn);
+  VFillImage(transform,VAllBands,0);
+  VPixel(transform,0,0,1,VDouble) = 1;
+  VPixel(transform,0,1,2,VDouble) = VPixel(transform,0,2,3,VDouble) = cos(10.0*M_PI/180.0);
+  VPixel(transform,0,1,3,VDouble) = -sin(10.0*M_PI/180.0);
+  VPixel(transform,0,2,2,VDouble) =  sin(10.0*M_PI/180.0);
+
+  fprintf(out_file,"{\n  \"program\": \"%s\",\n  \"repeat\": %d,\n  \"results\": [\n",
+	  prg,repeat);
+
+  for (s=0; s<nsizes; s++) {
+    n = size_list[s];
+    if (n < 8) VError(" size must be at least 8");
+
+    for (i=0; i<=nrepns; i++) {
+
+      /* grey volume in each repn, then the binary volume */
+      if (i < nrepns) {
+	repn_name = repn_list[i];
+	if ((entry = VLookupDictKeyword(VNumericRepnDict,repn_name)) == NULL)
+	  VError(" unknown repn '%s'",repn_name);
+	repn = (VRepnKind) entry->ivalue;
+	src = SynthGrey(n,repn);
+      }
+      else {
+	repn_name = "bit";
+	repn = VBitRepn;
+	src = SynthBinary(n);
+      }
+
+      for (k=0; k<VNumber(kernels); k++) {
+	if ((kernels[k].input == InBinary) != (repn == VBitRepn)) continue;
+	if (only && strstr(kernels[k].name,only) == NULL) continue;
+	first[0] = '\0';
+
+	for (t=0; t<nthreads; t++) {
+#ifdef _OPENMP
+	  omp_set_num_threads(thread_list[t]);
+#endif
+	  tmin = 1.0e30;
+	  tsum = 0;
+	  for (rep=0; rep<repeat; rep++) {
+	    t0 = WallTime();
+	    dest = kernels[k].proc(src,dest);
+	    dt = WallTime() - t0;
+	    if (dest == NULL) VError(" %s failed",kernels[k].name);
+	    tsum += dt;
+	    if (dt < tmin) tmin = dt;
+	  }
+	  Checksum(dest,sum);
+	  VDestroyImage(dest);
+	  dest = NULL;
+
+	  /* compare with the reference run, and across thread counts */
+	  mismatch = FALSE;
+	  if (first[0] == '\0') strcpy(first,sum);
+	  else if (strcmp(first,sum) != 0) {
+	    VWarning(" %s, size %d, %s: result depends on the number of threads",
+		     kernels[k].name,n,repn_name);
+	    mismatch = TRUE;
+	  }
+	  for (j=0; j<nref; j++) {
+	    if (strcmp(ref[j].kernel,kernels[k].name) == 0 && ref[j].size == n
+		&& strcmp(ref[j].repn,repn_name) == 0) {
+	      if (strcmp(ref[j].checksum,sum) != 0) {
+		VWarning(" %s, size %d, %s: checksum differs from reference",
+			 kernels[k].name,n,repn_name);
+		mismatch = TRUE;
+	      }
+	      break;
+	    }
+	  }
+	  if (mismatch) nfail++;
+
+	  fprintf(out_file,"%s    {\"kernel\": \"%s\", \"size\": %d, \"repn\": \"%s\", "
+		  "\"threads\": %d, \"min_s\": %.6f, \"mean_s\": %.6f, "
+		  "\"mvoxels_per_s\": %.3f, \"checksum\": \"%s\"}",
+		  nrec ? ",\n" : "",kernels[k].name,n,repn_name,thread_list[t],
+		  tmin,tsum/repeat,(double)n*n*n/tmin*1.0e-6,sum);
+	  fflush(out_file);
+	  nrec++;
+	  fprintf(stderr," %-12s %4d %-6s %2d threads: %9.4f s\n",
+		  kernels[k].name,n,repn_name,thread_list[t],tmin);
+	}
+      }
+      VDestroyImage(src);
+    }
+  }
+  fprintf(out_file,"\n  ],\n  \"mismatches\": %d\n}\n",nfail);
+
+  if (nfail > 0) {
+    fprintf (stderr, "%s: %d mismatches.\n", argv[0],nfail);
+    return 1;
+  }
+  fprintf (stderr, "%s: done.\n", argv[0]);
+  return 0;
+}
@@ -38,7 +38,7 @@ IEEE Transactions on Pattern Analysis and Machine Intelligence,
 
         <code>vderiche3d</code>
 
-        \param -in     input image
+        \param -in     input image (any repn)
         \param -out    output image
         \param -alpha  Edge parameter. Default: 1
 	\param -nonmax Whether non-maximum suppression is performed (true | false). Default: false
@@ -100,13 +100,15 @@ int main (int argc, char **argv)
     if (VGetAttrRepn (& posn) != VImageRepn) continue;
     VGetAttrValue (& posn, NULL, VImageRepn, & src);
 
-    VDeriche3d (src,alpha,&gradb,&gradr,&gradc);
-
     if (flag_nonmax == FALSE) {
-      dest = VMagnitude3d(gradb,gradr,gradb,NULL);
+      dest = VDericheMagnitude3d(src,alpha,NULL);
     }
     else {
-      dest = VNonmaxSuppression(gradb,gradr,gradc,NULL);
+      VDeriche3d (src,alpha,&gradb,&gradr,&gradc);
+      dest = VNonmaxSuppression(gradc,gradr,gradb,NULL);
+      VDestroyImage(gradb);
+      VDestroyImage(gradr);
+      VDestroyImage(gradc);
     }
 
     if (dest == NULL) VError(" dest NULL");
@@ -36,6 +36,8 @@
         \param -in     input image
         \param -out    output image
         \param -sigma  sigma. Default: 1.5
+        \param -recursive use the recursive filter, whose cost does not depend on sigma. Default: false
+        \param -mm     sigma is given in units of the voxel attribute (recursive filter only). Default: false
 
 
 \par Examples
@@ -73,9 +75,16 @@ int
 main (int argc,char *argv[])
 {  
   static VFloat sigma = 1.5;
+  static VBoolean recursive = FALSE;
+  static VBoolean mm = FALSE;
   static VOptionDescRec  options[] = {
-    {"sigma",VFloatRepn,1,(VPointer) &sigma,VOptionalOpt,NULL,"standard deviation"}
+    {"sigma",VFloatRepn,1,(VPointer) &sigma,VOptionalOpt,NULL,"standard deviation"},
+    {"recursive",VBooleanRepn,1,(VPointer) &recursive,VOptionalOpt,NULL,
+     "use recursive filter"},
+    {"mm",VBooleanRepn,1,(VPointer) &mm,VOptionalOpt,NULL,
+     "sigma in units of voxel attribute (recursive filter only)"}
   };
+  VFloat s[3];
   FILE *in_file,*out_file;
   VAttrList list=NULL;
   VAttrListPosn posn;
@@ -93,7 +102,13 @@ main (int argc,char *argv[])
     if (VGetAttrRepn (& posn) != VImageRepn) continue;
     VGetAttrValue (& posn, NULL,VImageRepn, & src);
 
-    dest = VFilterGauss3d (src,NULL,(double)sigma);
+    if (recursive) {
+      if (mm) VVoxelSigma(src,(VDouble)sigma,s);
+      else s[0] = s[1] = s[2] = sigma;
+      dest = VRecursiveGauss3d (src,NULL,s,NULL,VUnknownRepn);
+    }
+    else
+      dest = VFilterGauss3d (src,NULL,(double)sigma);
     VSetAttrValue (& posn, NULL,VImageRepn,dest);
   }
   if (src == NULL) VError(" no input image found");
@@ -26,7 +26,13 @@
 /*! \brief visodata - isodata clustering
 
 \par Description
-perform isodata clustering. Only works on ubyte images.
+perform isodata clustering of the grey values. Works on images of any
+repn except bit. Grey values are clustered over their full range.
+If a mask is given, only voxels where the mask is non-zero are clustered,
+clusters are labelled 1 ... n and voxels outside the mask are set to 0.
+Clustering stops after at most 100 iterations, and a cluster that becomes
+empty keeps its center. Earlier versions stopped after 15 iterations and
+moved the center of an empty cluster to 0, so their results may differ.
 
 \par Usage
 
@@ -35,6 +41,8 @@ perform isodata clustering. Only works on ubyte images.
         \param -in      input image
         \param -out     output image
         \param -n       number of clusters. Default: 3
+        \param -ignore  grey value to be ignored in clustering. Default: 0
+        \param -mask    file containing a mask image (optional)
 
 
 \par Examples
@@ -53,6 +61,7 @@ none.
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <via.h>
 
 
@@ -60,19 +69,37 @@ int
 main (int argc,char *argv[])
 {  
   static VLong n = 3;
+  static VLong ignore = 0;
+  static VString mask_filename = " ";
   static VOptionDescRec  options[] = {
     {"n",VLongRepn,1,(VPointer) &n,VOptionalOpt,NULL,"number of clusters"},
+    {"ignore",VLongRepn,1,(VPointer) &ignore,VOptionalOpt,NULL,
+     "grey value to be ignored in clustering"},
+    {"mask",VStringRepn,1,(VPointer) &mask_filename,VOptionalOpt,NULL,
+     "file containing a mask image"},
   };
-  FILE *in_file,*out_file;
-  VAttrList list=NULL;
+  FILE *in_file,*out_file,*mask_file;
+  VAttrList list=NULL,list2=NULL;
   VAttrListPosn posn;
-  VImage src=NULL,dest=NULL;
+  VImage src=NULL,dest=NULL,mask=NULL;
   char prg[50];	
   sprintf(prg,"visodata V%s", getVersion());
   fprintf (stderr, "%s\n", prg);
 
   VParseFilterCmd (VNumber (options),options,argc,argv,&in_file,&out_file);
 
+  if (strlen(mask_filename) > 1) {
+    mask_file = VOpenInputFile (mask_filename, TRUE);
+    if (! (list2 = VReadFile (mask_file, NULL))) exit (1);
+    fclose(mask_file);
+    for (VFirstAttr (list2, & posn); VAttrExists (& posn); VNextAttr (& posn)) {
+      if (VGetAttrRepn (& posn) != VImageRepn) continue;
+      VGetAttrValue (& posn, NULL,VImageRepn, & mask);
+      break;
+    }
+    if (mask == NULL) VError(" no mask image found");
+  }
+
   if (! (list = VReadFile (in_file, NULL))) exit (1);
   fclose(in_file);
 
@@ -80,7 +107,7 @@ main (int argc,char *argv[])
     if (VGetAttrRepn (& posn) != VImageRepn) continue;
     VGetAttrValue (& posn, NULL,VImageRepn, & src);
 
-    dest = VIsodataImage3d (src,NULL,n,(VLong) 0);
+    dest = VIsodataMask3d (src,NULL,mask,n,ignore);
     VSetAttrValue (& posn, NULL,VImageRepn,dest);
   }
   if (src == NULL) VError(" no input image found");
@@ -0,0 +1,430 @@
+/****************************************************************
+ *
+ * Copyright (C) Max Planck Institute
+ * for Human Cognitive and Brain Sciences, Leipzig
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ *
+ *****************************************************************/
+
+/*! \brief vpipe -- run a chain of image operators in one process
+
+\par Description
+vpipe applies a sequence of vialib operators to every image of the input file
+and writes only the final result. Intermediate results stay in memory, so no
+time is spent reading, writing and converting intermediate files. Image buffers
+are reused between stages where the output of a stage has the same
+representation as an earlier intermediate. The images of a multi-image file
+are processed concurrently if OpenMP is enabled.
+<p>
+A pipeline is a list of stages separated by '|'. Each stage is an operator name,
+optionally followed by parameters of the form name=value. Parameters that are
+omitted take the defaults listed below.
+<pre>
+  gauss3d   sigma=1.5          3D Gauss filter
+  box3d     dim=3              3D box filter
+  median3d  dim=3              3D median filter
+  smooth3d  n=26 iter=1        3D smoothing of binary images
+  binarize  min=0 max=255      threshold, bit output
+  isodata   n=2                ISODATA clustering, ubyte output
+  convert   repn=ubyte         convert pixel repn
+  label3d   n=26 repn=short    connected component labelling
+  selbig                       biggest component of a label image, bit output
+  delsmall  msize=1            delete small components of a label image
+  dist3d    exact=0 repn=float distance transform (chamfer or Euclidean)
+  erode     radius=3           morphology by distance transforms
+  dilate    radius=3
+  open      radius=3
+  close     radius=3
+  thin3d    n=26               3D topological thinning
+  skel3d                       3D skeletonization
+  topoclass                    topological classification
+</pre>
+
+\par Usage
+
+        <code>vpipe</code>
+
+        \param -in     input image
+        \param -out    output image
+        \param -pipe   pipeline, e.g. "gauss3d sigma=1 | binarize min=100 | label3d | selbig | close radius=2"
+
+\par Examples
+<br>
+vpipe -in t1.v -out mask.v -pipe "gauss3d sigma=1 | binarize min=90 | label3d | selbig | close radius=3"
+
+\par Known bugs
+none.
+
+\file vpipe.c
+*/
+
+#include <viaio/Vlib.h>
+#include <viaio/VImage.h>
+#include <viaio/mu.h>
+#include <viaio/option.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <via.h>
+
+#define MAXARGS  4
+#define MAXSTAGES 64
+
+typedef VImage (*StageProc)(VImage,VImage,double *);
+
+/* operator table entry */
+typedef struct {
+  VStringConst name;
+  StageProc proc;
+  VStringConst argname[MAXARGS];
+  double argdefault[MAXARGS];
+  VRepnKind repn;      /* output repn, VUnknownRepn: same as input */
+  int repnarg;         /* argument that selects the output repn, or -1 */
+  VBoolean reuse;      /* operator overwrites every pixel of a given dest */
+  VBoolean serial;     /* operator keeps global state, never run concurrently */
+} StageDesc;
+
+/* one stage of a parsed pipeline */
+typedef struct {
+  StageDesc *desc;
+  double arg[MAXARGS];
+} Stage;
+
+
+/*
+** operators
+*/
+static VImage
+Gauss3d(VImage src,VImage dest,double *arg)
+{
+  return VFilterGauss3d(src,dest,arg[0]);
+}
+
+static VImage
+Box3d(VImage src,VImage dest,double *arg)
+{
+  return VFilterBox3d(src,dest,(int) arg[0]);
+}
+
+static VImage
+Median3d(VImage src,VImage dest,double *arg)
+{
+  return VMedianImage3d(src,dest,(int) arg[0],FALSE);
+}
+
+static VImage
+Smooth3d(VImage src,VImage dest,double *arg)
+{
+  VLong neighb = (arg[0] == 6) ? 0 : (arg[0] == 18 ? 1 : 2);
+  return VSmoothImage3d(src,dest,neighb,(VLong) arg[1]);
+}
+
+static VImage
+Binarize(VImage src,VImage dest,double *arg)
+{
+  return VBinarizeImage(src,dest,arg[0],arg[1]);
+}
+
+static VImage
+Isodata(VImage src,VImage dest,double *arg)
+{
+  return VIsodataImage3d(src,dest,(VLong) arg[0],(VLong) 0);
+}
+
+static VImage
+Convert(VImage src,VImage dest,double *arg)
+{
+  return VConvertImageCopy(src,dest,VAllBands,(VRepnKind) arg[0]);
+}
+
+static VImage
+Label3d(VImage src,VImage dest,double *arg)
+{
+  int nl=0;
+  return VLabelImage3d(src,dest,(int) arg[0],(VRepnKind) arg[1],&nl);
+}
+
+static VImage
+SelBig(VImage src,VImage dest,double *arg)
+{
+  return VSelectBig(src,dest);
+}
+
+static VImage
+DelSmall(VImage src,VImage dest,double *arg)
+{
+  return VDeleteSmall(src,dest,(int) arg[0]);
+}
+
+static VImage
+Dist3d(VImage src,VImage dest,double *arg)
+{
+  if (arg[0] != 0)
+    return VEuclideanDist3d(src,dest,(VRepnKind) arg[1]);
+  return VChamferDist3d(src,dest,(VRepnKind) arg[1]);
+}
+
+static VImage
+Erode(VImage src,VImage dest,double *arg)
+{
+  return VDTErode(src,dest,arg[0]);
+}
+
+static VImage
+Dilate(VImage src,VImage dest,double *arg)
+{
+  return VDTDilate(src,dest,arg[0]);
+}
+
+static VImage
+Open(VImage src,VImage dest,double *arg)
+{
+  return VDTOpen(src,dest,arg[0]);
+}
+
+static VImage
+Close(VImage src,VImage dest,double *arg)
+{
+  return VDTClose(src,dest,arg[0]);
+}
+
+static VImage
+Thin3d(VImage src,VImage dest,double *arg)
+{
+  return VThin3d(src,dest,(int) arg[0]);
+}
+
+static VImage
+Skel3d(VImage src,VImage dest,double *arg)
+{
+  return VSkel3d(src,dest);
+}
+
+static VImage
+Topoclass(VImage src,VImage dest,double *arg)
+{
+  return VTopoclass(src,dest);
+}
+
+
+static StageDesc stages[] = {
+  {"gauss3d",  Gauss3d,  {"sigma"},{1.5},        VUnknownRepn,-1,TRUE, FALSE},
+  {"box3d",    Box3d,    {"dim"},{3},            VUnknownRepn,-1,TRUE, FALSE},
+  {"median3d", Median3d, {"dim"},{3},            VUnknownRepn,-1,FALSE,FALSE},
+  {"smooth3d", Smooth3d, {"n","iter"},{26,1},    VUnknownRepn,-1,FALSE,FALSE},
+  {"binarize", Binarize, {"min","max"},{0,255},  VBitRepn,    -1,TRUE, FALSE},
+  {"isodata",  Isodata,  {"n"},{2},              VUByteRepn,  -1,FALSE,FALSE},
+  {"convert",  Convert,  {"repn"},{VUByteRepn},  VUnknownRepn, 0,TRUE, FALSE},
+  {"label3d",  Label3d,  {"n","repn"},{26,VShortRepn},VUnknownRepn,1,TRUE,FALSE},
+  {"selbig",   SelBig,   {NULL},{0},             VBitRepn,    -1,TRUE, FALSE},
+  {"delsmall", DelSmall, {"msize"},{1},          VBitRepn,    -1,TRUE, FALSE},
+  {"dist3d",   Dist3d,   {"exact","repn"},{0,VFloatRepn},VUnknownRepn,1,TRUE,FALSE},
+  {"erode",    Erode,    {"radius"},{3},         VBitRepn,    -1,TRUE, TRUE},
+  {"dilate",   Dilate,   {"radius"},{3},         VBitRepn,    -1,TRUE, TRUE},
+  {"open",     Open,     {"radius"},{3},         VBitRepn,    -1,TRUE, TRUE},
+  {"close",    Close,    {"radius"},{3},         VBitRepn,    -1,TRUE, TRUE},
+  {"thin3d",   Thin3d,   {"n"},{26},             VBitRepn,    -1,TRUE, FALSE},
+  {"skel3d",   Skel3d,   {NULL},{0},             VBitRepn,    -1,TRUE, TRUE},
+  {"topoclass",Topoclass,{NULL},{0},             VUByteRepn,  -1,TRUE, FALSE}
+};
+
+
+/*
+** parse a value, either a number or the name of a pixel repn
+*/
+static double
+ParseValue(VStringConst stage,VStringConst name,char *value)
+{
+  char *end;
+  double x;
+  VDictEntry *entry;
+
+  x = strtod(value,&end);
+  if (end != value && *end == '\0') return x;
+
+  if ((entry = VLookupDictKeyword(VNumericRepnDict,value)) != NULL)
+    return (double) entry->ivalue;
+
+  VError(" %s: illegal value '%s' for parameter '%s'",stage,value,name);
+  return 0;
+}
+
+
+/*
+** parse a pipeline description into stages
+*/
+static int
+ParsePipe(VStringConst text,Stage *pipe)
+{
+  char *buf,*s,*tok,*save=NULL,*word,*save2=NULL,*eq;
+  int i,k,n=0;
+
+  buf = VNewString(text);
+  for (s = buf; (tok = strtok_r(s,"|",&save)) != NULL; s = NULL) {
+    if (n >= MAXSTAGES) VError(" too many stages");
+
+    word = strtok_r(tok," \t\n",&save2);
+    if (word == NULL) VError(" empty stage in pipeline");
+
+    for (i=0; i<(int) VNumber(stages); i++)
+      if (strcmp(word,stages[i].name) == 0) break;
+    if (i >= (int) VNumber(stages)) VError(" unknown operator '%s'",word);
+
+    pipe[n].desc = &stages[i];
+    for (k=0; k<MAXARGS; k++) pipe[n].arg[k] = stages[i].argdefault[k];
+
+    while ((word = strtok_r(NULL," \t\n",&save2)) != NULL) {
+      eq = strchr(word,'=');
+      if (eq == NULL) VError(" %s: parameters must be given as name=value",stages[i].name);
+      *eq = '\0';
+      for (k=0; k<MAXARGS && stages[i].argname[k]; k++)
+	if (strcmp(word,stages[i].argname[k]) == 0) break;
+      if (k >= MAXARGS || stages[i].argname[k] == NULL)
+	VError(" %s: unknown parameter '%s'",stages[i].name,word);
+      pipe[n].arg[k] = ParseValue(stages[i].name,word,eq+1);
+    }
+    n++;
+  }
+  VFree(buf);
+  if (n == 0) VError(" empty pipeline");
+  return n;
+}
+
+
+/*
+** run all stages on one image. Intermediate images that are no longer
+** needed are kept as spare buffers and handed to later stages as
+** destination. The input image belongs to the caller and is never reused.
+*/
+static VImage
+RunPipe(Stage *pipe,int nstages,VImage src)
+{
+  VImage dest=NULL,given,spare[2]={NULL,NULL};
+  VImage orig=src;
+  VRepnKind repn;
+  StageDesc *desc;
+  int k,j;
+
+  for (k=0; k<nstages; k++) {
+    desc = pipe[k].desc;
+    repn = desc->repn;
+    if (desc->repnarg >= 0) repn = (VRepnKind) pipe[k].arg[desc->repnarg];
+    if (repn == VUnknownRepn) repn = VPixelRepn(src);
+
+    /* look for a spare buffer of the right shape */
+    dest = NULL;
+    if (desc->reuse) {
+      for (j=0; j<2; j++) {
+	if (spare[j] && VPixelRepn(spare[j]) == repn
+	    && VImageNBands(spare[j]) == VImageNBands(src)
+	    && VImageNRows(spare[j]) == VImageNRows(src)
+	    && VImageNColumns(spare[j]) == VImageNColumns(src)) {
+	  dest = spare[j];
+	  spare[j] = NULL;
+	  break;
+	}
+      }
+    }
+    given = dest;
+
+    if (desc->serial) {
+#pragma omp critical (vpipe_serial)
+      dest = desc->proc(src,dest,pipe[k].arg);
+    }
+    else
+      dest = desc->proc(src,dest,pipe[k].arg);
+    if (dest == NULL) VError(" stage '%s' failed",desc->name);
+
+    /* a stage may return a new image instead of the buffer it was given */
+    if (given && given != dest) VDestroyImage(given);
+
+    /* the input of this stage becomes a spare buffer */
+    if (dest != src && src != orig) {
+      if (spare[1]) VDestroyImage(spare[1]);
+      spare[1] = spare[0];
+      spare[0] = src;
+    }
+    src = dest;
+  }
+
+  for (j=0; j<2; j++)
+    if (spare[j]) VDestroyImage(spare[j]);
+  return src;
+}
+
+
+int
+main (int argc,char *argv[])
+{
+  static VString pipetext = NULL;
+  static VOptionDescRec  options[] = {
+    {"pipe",VStringRepn,1,(VPointer) &pipetext,VRequiredOpt,NULL,
+     "pipeline, e.g. \"gauss3d sigma=1 | binarize min=100 | label3d | selbig\""}
+  };
+  FILE *in_file,*out_file;
+  VAttrList list=NULL;
+  VAttrListPosn posn;
+  VImage src=NULL,*images=NULL,*results=NULL;
+  Stage pipe[MAXSTAGES];
+  int i,n,nimages,nstages;
+  char prg[50];
+  sprintf(prg,"vpipe V%s", getVersion());
+  fprintf (stderr, "%s\n", prg);
+
+  VParseFilterCmd (VNumber (options),options,argc,argv,&in_file,&out_file);
+  nstages = ParsePipe(pipetext,pipe);
+
+  if (! (list = VReadFile (in_file, NULL))) exit (1);
+  fclose(in_file);
+
+  /* collect all images */
+  nimages = 0;
+  for (VFirstAttr (list, & posn); VAttrExists (& posn); VNextAttr (& posn))
+    if (VGetAttrRepn (& posn) == VImageRepn) nimages++;
+  if (nimages == 0) VError(" no input image found");
+
+  images  = (VImage *) VCalloc(nimages,sizeof(VImage));
+  results = (VImage *) VCalloc(nimages,sizeof(VImage));
+  n = 0;
+  for (VFirstAttr (list, & posn); VAttrExists (& posn); VNextAttr (& posn)) {
+    if (VGetAttrRepn (& posn) != VImageRepn) continue;
+    VGetAttrValue (& posn, NULL,VImageRepn, & src);
+    images[n++] = src;
+  }
+
+  /* independent images are processed concurrently */
+#pragma omp parallel for schedule(dynamic)
+  for (i=0; i<nimages; i++)
+    results[i] = RunPipe(pipe,nstages,images[i]);
+
+  n = 0;
+  for (VFirstAttr (list, & posn); VAttrExists (& posn); VNextAttr (& posn)) {
+    if (VGetAttrRepn (& posn) != VImageRepn) continue;
+    if (results[n] != images[n]) {
+      VSetAttrValue (& posn, NULL,VImageRepn,results[n]);
+      VDestroyImage(images[n]);
+    }
+    n++;
+  }
+
+  VHistory(VNumber(options),options,prg,&list,&list);
+  if (! VWriteFile (out_file, list)) exit (1);
+  fprintf (stderr, "%s: %d stage%s on %d image%s, done.\n", argv[0],
+	   nstages, nstages == 1 ? "" : "s", nimages, nimages == 1 ? "" : "s");
+  return 0;
+}
@@ -41,12 +41,21 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/uio.h>
 
 /* Macro used in WriteFile, WriteAttrList, etc.: */
 #define FailTest(put)	    if ((put) == EOF) goto Fail
 
 #define STRLEN 256
 
+/* Limits of a vectored read in VReadRegionData: */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+#define MAXGAP  (64*1024)   /* largest gap between row segments read along */
+
 extern VBoolean ReadHeader (FILE *);
 extern VAttrList ReadAttrList (FILE *);
 extern VPackOrder MachineByteOrder  (void);
@@ -186,6 +195,13 @@ VGetImageInfo(FILE *fp,VAttrList list,int object_id,VImageInfo *imageInfo)
     if (!VGetAttrValue (& posn, NULL, VBundleRepn, & b))
       VWarning("could not read bundle");
 
+    /* images stored in chunks can only be read via VCatalogImage */
+    if (VLookupAttr (b->list, VChunkDataAttr, & subposn)) {
+      VWarning ("VGetImageInfo: %s image is stored in chunks",
+		VGetAttrName (& posn));
+      return FALSE;
+    }
+
     /* get image dimensions */
     if (VLookupAttr (b->list, "nbands", & subposn)) {
       if (! VGetAttrValue (& subposn, NULL, VLongRepn, &x)) {
@@ -519,6 +535,7 @@ VBoolean
 VReadBlockData (FILE *fp,VImageInfo *imageInfo,
 		int row,int num_rows,VImage *buf)
 {
+  double tbegin = VTraceBegin();
   int i,column;
   size_t offset,offset2,ncolumns,nrows,nbands;
   size_t size,nitems;
@@ -544,9 +561,6 @@ VReadBlockData (FILE *fp,VImageInfo *imageInfo,
   offset  = imageInfo->data + (row*ncolumns + column) * size;
   offset2 = (nrows * ncolumns - num_rows * ncolumns) * size;
 
-  fprintf(stderr, "offset: %d\n", offset);
-  fprintf(stderr, "offset2: %d\n", offset2);
-
   /* read data from file */
   for (i=0; i<nbands; i++) {
     if (fseek(fp,offset,SEEK_CUR) != 0) return FALSE;
@@ -564,6 +578,7 @@ VReadBlockData (FILE *fp,VImageInfo *imageInfo,
       SwapBytes(nitems,size,(char*)dest_pp);
     }
   }
+  VTraceEnd("VReadBlockData",tbegin,nitems * nbands,nitems * nbands * size);
   return TRUE;
 }
 
@@ -833,3 +848,151 @@ VReadBandDataFD (int fd,VImageInfo *imageInfo,
   return TRUE;
 }
 
+
+
+/*
+** read a vector of buffers from a file descriptor at a given position,
+** resuming after partial reads. The iovec array is modified.
+*/
+static VBoolean
+ReadvAt(int fd,struct iovec *iov,int n,off_t pos)
+{
+  ssize_t k;
+
+  while (n > 0) {
+    if ((k = preadv(fd,iov,n,pos)) <= 0) {
+      if (k < 0 && errno == EINTR) continue;
+      return FALSE;
+    }
+    pos += k;
+    while (n > 0 && (size_t) k >= iov->iov_len) {
+      k -= iov->iov_len;
+      iov++;
+      n--;
+    }
+    if (n > 0) {
+      iov->iov_base = (char *) iov->iov_base + k;
+      iov->iov_len -= k;
+    }
+  }
+  return TRUE;
+}
+
+
+/*
+** read a box of nb bands, nr rows and nc columns starting at (b0,r0,c0)
+** from an image of nbands x nrows x ncolumns pixels of <size> bytes
+** stored at file position <pos>, into <dest> in file byte order.
+** Any part of the box outside the image is set to zero.
+** The row segments of a band are read with one vectored read: segments
+** adjacent in the file and in <dest> are merged, and small gaps between
+** them are read into a scratch buffer. Bands are read in parallel if
+** there are many segments.
+*/
+VBoolean
+VReadRegionData(int fd,off_t pos,size_t size,
+		long nbands,long nrows,long ncolumns,
+		int b0,int r0,int c0,int nb,int nr,int nc,char *dest)
+{
+  long bb0,bb1,rr0,rr1,cc0,cc1;
+  VBoolean result = TRUE;
+
+  bb0 = b0 > 0 ? b0 : 0;
+  bb1 = b0 + nb < nbands ? b0 + nb : nbands;
+  rr0 = r0 > 0 ? r0 : 0;
+  rr1 = r0 + nr < nrows ? r0 + nr : nrows;
+  cc0 = c0 > 0 ? c0 : 0;
+  cc1 = c0 + nc < ncolumns ? c0 + nc : ncolumns;
+
+  if (bb0 > b0 || bb1 < b0 + nb || rr0 > r0 || rr1 < r0 + nr ||
+      cc0 > c0 || cc1 < c0 + nc)
+    memset(dest,0,(size_t) nb * nr * nc * size);
+  if (bb0 >= bb1 || rr0 >= rr1 || cc0 >= cc1) return TRUE;
+
+#pragma omp parallel if ((bb1 - bb0) > 1 && (bb1 - bb0) * (rr1 - rr0) >= 256)
+  {
+    struct iovec *iov = (struct iovec *) VMalloc(sizeof(struct iovec) * IOV_MAX);
+    char *gap = NULL,*dp;
+    off_t start=0,next=0,p;
+    size_t len = (cc1 - cc0) * size;
+    long bb,r;
+    int n;
+
+#pragma omp for schedule(dynamic,1)
+    for (bb = bb0; bb < bb1; bb++) {
+      n = 0;
+      for (r = rr0; r < rr1; r++) {
+	p  = pos + (((off_t) bb * nrows + r) * ncolumns + cc0) * size;
+	dp = dest + (((size_t) (bb - b0) * nr + r - r0) * nc + cc0 - c0) * size;
+
+	if (n > 0 && p == next &&
+	    dp == (char *) iov[n-1].iov_base + iov[n-1].iov_len) {
+	  iov[n-1].iov_len += len;
+	  next += len;
+	  continue;
+	}
+	if (n > 0 && p > next && p - next <= MAXGAP && n < IOV_MAX - 1) {
+	  if (! gap) gap = (char *) VMalloc(MAXGAP);
+	  iov[n].iov_base = gap;
+	  iov[n].iov_len = p - next;
+	  n++;
+	}
+	else if (n > 0 && (p != next || n == IOV_MAX)) {
+	  if (! ReadvAt(fd,iov,n,start)) result = FALSE;
+	  n = 0;
+	}
+	if (n == 0) start = p;
+	iov[n].iov_base = dp;
+	iov[n].iov_len = len;
+	n++;
+	next = p + len;
+      }
+      if (n > 0 && ! ReadvAt(fd,iov,n,start)) result = FALSE;
+    }
+    VFree(iov);
+    VFree(gap);
+  }
+  return result;
+}
+
+
+/*
+** read a box of nb bands, nr rows and nc columns starting at band b0,
+** row r0 and column c0 of the image described by <info> (see VGetImageInfo).
+** Only the rows and columns within the box are read. Any part of the box
+** outside the image is filled with zeros.
+*/
+VImage
+VReadRegion(int fd,VImageInfo *info,int b0,int r0,int c0,int nb,int nr,int nc)
+{
+  double tbegin = VTraceBegin();
+  VImage dest;
+  size_t size;
+
+  if (info->repn == VBitRepn || info->repn == VUnknownRepn) {
+    VWarning("VReadRegion: pixel repn %s not supported",VRepnName(info->repn));
+    return NULL;
+  }
+  if (nb <= 0 || nr <= 0 || nc <= 0) {
+    VWarning("VReadRegion: size of region must be positive");
+    return NULL;
+  }
+  size = VRepnPrecision(info->repn) / 8;
+
+  dest = VCreateImage(nb,nr,nc,info->repn);
+  if (! dest) return NULL;
+  if (! VReadRegionData(fd,(off_t) (info->offsetHdr + info->data),size,
+			info->nbands,info->nrows,info->ncolumns,
+			b0,r0,c0,nb,nr,nc,(char *) VImageData(dest))) {
+    VWarning("VReadRegion: read failed");
+    VDestroyImage(dest);
+    return NULL;
+  }
+
+  /* if little-endian, then swap bytes: */
+  if (MachineByteOrder() == VLsbFirst)
+    SwapBytes(VImageNPixels(dest),size,(char *) VImageData(dest));
+
+  VTraceEnd("VReadRegion",tbegin,VImageNPixels(dest),VImageSize(dest));
+  return dest;
+}
@@ -23,6 +23,7 @@
 #include "viaio/Vlib.h"
 #include "viaio/os.h"
 #include "viaio/VImage.h"
+#include "viaio/ConvertPrivate.h"
 
 /* From the standard C library: */
 #include <math.h>
@@ -30,236 +31,291 @@
 /* File identification string: */
 VRcsId ("$Id: ConvertC.c 3177 2008-04-01 14:47:24Z karstenm $");
 
-extern double rint(double);
-
 /*
  *  Some macros for converting one type to another.
  */
 
-#define Cast(src_type, result_type, op)					\
+#define Cast(src_type, result_type)					\
+    {									\
+	src_type *src_pp = (src_type *) src_first;			\
+	result_type *res_pp = (result_type *) res_first;		\
+									\
+	for (i = i0; i < i1; i++)					\
+	    res_pp[i] = src_pp[i];					\
+    }
+
+#define CastClip(src_type, result_type, lower, upper, round)		\
     {									\
 	src_type pixel, *src_pp = (src_type *) src_first;		\
-	result_type *res_pp = VImageData (result);			\
+	result_type *res_pp = (result_type *) res_first;		\
 									\
-	for (i = 0; i < npixels; i++) {					\
-	    pixel = *src_pp++;						\
-	    op;								\
-	    *res_pp++ = pixel;						\
+	for (i = i0; i < i1; i++) {					\
+	    pixel = src_pp[i];						\
+	    clipped |= (pixel < lower) | (pixel > upper);		\
+	    pixel = pixel < lower ? lower : pixel;			\
+	    pixel = pixel > upper ? upper : pixel;			\
+	    res_pp[i] = round (pixel);					\
 	}								\
     }
 
-#define Clip(test, limit) if (pixel test limit) { pixel = limit; clipped = TRUE; }
+/* Like CastClip, for source types that can't be below (above) lower (upper): */
+#define CastClipUpper(src_type, result_type, upper)			\
+    {									\
+	src_type pixel, *src_pp = (src_type *) src_first;		\
+	result_type *res_pp = (result_type *) res_first;		\
+									\
+	for (i = i0; i < i1; i++) {					\
+	    pixel = src_pp[i];						\
+	    clipped |= pixel > upper;					\
+	    res_pp[i] = pixel > upper ? upper : pixel;			\
+	}								\
+    }
 
-#define Bracket(lower, upper) Clip (<, lower); Clip (>, upper);
+#define CastClipLower(src_type, result_type, lower)			\
+    {									\
+	src_type pixel, *src_pp = (src_type *) src_first;		\
+	result_type *res_pp = (result_type *) res_first;		\
+									\
+	for (i = i0; i < i1; i++) {					\
+	    pixel = src_pp[i];						\
+	    clipped |= pixel < lower;					\
+	    res_pp[i] = pixel < lower ? lower : pixel;			\
+	}								\
+    }
 
 #define Nothing
 
+
 /*
- *  VConvertImageCopy
+ *  CopyBlock
  *
- *  Converts an image from one pixel representation to another by copying
- *  (and perhaps rounding) pixel values, not mapping them from one range
- *  to another.
- *
- *  Note: This uses rint() to round a floating point value to the nearest
- *	  integer (under the default rounding mode). It isn't part of
- *	  ANSI C, but it's widely available.
+ *  Convert pixels i0 ... i1-1 by copying them, and return whether any
+ *  were clipped.
  */
 
-VImage VConvertImageCopy (VImage src, VImage dest, VBand band,
-			  VRepnKind pixel_repn)
+static int CopyBlock (VRepnKind src_repn, VPointer src_first,
+		      VRepnKind res_repn, VPointer res_first, long i0, long i1)
 {
-    VImage result;
-    int npixels, i;
-    VPointer src_first;
-    VBoolean clipped = FALSE;
-
-    /* If src already has the requested representation, simply copy: */
-    if (pixel_repn == VPixelRepn (src))
-	return (src == dest) ? src : VCopyImage (src, dest, band);
-    
-    /* Prepare to iterate over all source pixels: */
-    if (! VSelectBand ("VConvertImageCopy", src, band, & npixels, & src_first))
-	return NULL;
+    long i;
+    int clipped = 0;
 
-    /* Check dest if it exists; create it if it doesn't: */
-    result = VSelectDestImage ("VConvertImageCopy", dest,
-			       band == VAllBands ? VImageNBands (src) : 1,
-			       VImageNRows (src), VImageNColumns (src),
-			       pixel_repn);
-    if (! result)
-	return NULL;
-
-    /* Copy pixels, casting or rounding them: */
-    switch (VPixelRepn (src)) {
+    switch (src_repn) {
 	
     case VBitRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 	    
-	case VUByteRepn: Cast (VBit, VUByte, Nothing); break;
+	case VUByteRepn: Cast (VBit, VUByte); break;
 	    
-	case VSByteRepn: Cast (VBit, VSByte, Nothing); break;
+	case VSByteRepn: Cast (VBit, VSByte); break;
 	    
-	case VShortRepn: Cast (VBit, VShort, Nothing); break;
+	case VShortRepn: Cast (VBit, VShort); break;
 	    
-	case VLongRepn: Cast (VBit, VLong, Nothing); break;
+	case VLongRepn: Cast (VBit, VLong); break;
 	    
-	case VFloatRepn: Cast (VBit, VFloat, Nothing); break;
+	case VFloatRepn: Cast (VBit, VFloat); break;
 	    
-	case VDoubleRepn: Cast (VBit, VDouble, Nothing); break;
+	case VDoubleRepn: Cast (VBit, VDouble); break;
 
 	default: break;
 	}
 	break;
 	
     case VUByteRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 	    
-	case VBitRepn: Cast (VUByte, VBit, Clip (>, 1)); break;
+	case VBitRepn: CastClipUpper (VUByte, VBit, 1); break;
 	    
-	case VSByteRepn: Cast (VUByte, VSByte, Clip (>, 127)); break;
+	case VSByteRepn: CastClipUpper (VUByte, VSByte, 127); break;
 	    
-	case VShortRepn: Cast (VUByte, VShort, Nothing); break;
+	case VShortRepn: Cast (VUByte, VShort); break;
 	    
-	case VLongRepn: Cast (VUByte, VLong, Nothing); break;
+	case VLongRepn: Cast (VUByte, VLong); break;
 	    
-	case VFloatRepn: Cast (VUByte, VFloat, Nothing); break;
+	case VFloatRepn: Cast (VUByte, VFloat); break;
 	    
-	case VDoubleRepn: Cast (VUByte, VDouble, Nothing); break;
+	case VDoubleRepn: Cast (VUByte, VDouble); break;
 
 	default: break;
 	}
 	break;
 	
     case VSByteRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 	    
-	case VBitRepn: Cast (VSByte, VBit, Bracket (0, 1)); break;
+	case VBitRepn: CastClip (VSByte, VBit, 0, 1, Nothing); break;
 	    
-	case VUByteRepn: Cast (VSByte, VUByte, Clip (<, 0)); break;
+	case VUByteRepn: CastClipLower (VSByte, VUByte, 0); break;
 	    
-	case VShortRepn: Cast (VSByte, VShort, Nothing); break;
+	case VShortRepn: Cast (VSByte, VShort); break;
 	    
-	case VLongRepn: Cast (VSByte, VLong, Nothing); break;
+	case VLongRepn: Cast (VSByte, VLong); break;
 	    
-	case VFloatRepn: Cast (VSByte, VFloat, Nothing); break;
+	case VFloatRepn: Cast (VSByte, VFloat); break;
 	    
-	case VDoubleRepn: Cast (VSByte, VDouble, Nothing); break;
+	case VDoubleRepn: Cast (VSByte, VDouble); break;
 
 	default: break;
 	}
 	break;
 	
     case VShortRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 	    
-	case VBitRepn: Cast (VShort, VBit, Bracket (0, 1)); break;
+	case VBitRepn: CastClip (VShort, VBit, 0, 1, Nothing); break;
 	    
-	case VUByteRepn: Cast (VShort, VUByte, Bracket (0, 255)); break;
+	case VUByteRepn: CastClip (VShort, VUByte, 0, 255, Nothing); break;
 	    
-	case VSByteRepn: Cast (VShort, VSByte, Bracket (-128, 127)); break;
+	case VSByteRepn: CastClip (VShort, VSByte, -128, 127, Nothing); break;
 	    
-	case VLongRepn: Cast (VShort, VLong, Nothing); break;
+	case VLongRepn: Cast (VShort, VLong); break;
 	    
-	case VFloatRepn: Cast (VShort, VFloat, Nothing); break;
+	case VFloatRepn: Cast (VShort, VFloat); break;
 	    
-	case VDoubleRepn: Cast (VShort, VDouble, Nothing); break;
+	case VDoubleRepn: Cast (VShort, VDouble); break;
 
 	default: break;
 	}
 	break;
 	
     case VLongRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 	    
-	case VBitRepn: Cast (VLong, VBit, Bracket (0, 1)); break;
+	case VBitRepn: CastClip (VLong, VBit, 0, 1, Nothing); break;
 	    
-	case VUByteRepn: Cast (VLong, VUByte, Bracket (0, 255)); break;
+	case VUByteRepn: CastClip (VLong, VUByte, 0, 255, Nothing); break;
 	    
-	case VSByteRepn: Cast (VLong, VSByte, Bracket (-128, 127)); break;
+	case VSByteRepn: CastClip (VLong, VSByte, -128, 127, Nothing); break;
 	    
-	case VShortRepn: Cast (VLong, VShort, Bracket (-32768, 32767)); break;
+	case VShortRepn:
+	    CastClip (VLong, VShort, -32768, 32767, Nothing);
+	    break;
 	    
-	case VFloatRepn: Cast (VLong, VFloat, Nothing); break;
+	case VFloatRepn: Cast (VLong, VFloat); break;
 	    
-	case VDoubleRepn: Cast (VLong, VDouble, Nothing); break;
+	case VDoubleRepn: Cast (VLong, VDouble); break;
 
 	default: break;
 	}
 	break;
 	
     case VFloatRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 	    
-	case VBitRepn:
-	    Cast (VFloat, VBit, Bracket (0, 1); pixel = rint (pixel));
-	    break;
+	case VBitRepn: CastClip (VFloat, VBit, 0, 1, Round); break;
 	    
 	case VUByteRepn:
-	    Cast (VFloat, VUByte,
-		  Bracket (0, 255);  pixel = rint (pixel));
+	    clipped = VConvertFloatUByte ((VFloat *) src_first + i0,
+					  (VUByte *) res_first + i0,
+					  i1 - i0, 1.0, 0.0);
 	    break;
 	    
-	case VSByteRepn:
-	    Cast (VFloat, VSByte,
-		  Bracket (-128, 127);  pixel = rint (pixel));
-	    break;
+	case VSByteRepn: CastClip (VFloat, VSByte, -128, 127, Round); break;
 	    
 	case VShortRepn:
-	    Cast (VFloat, VShort,
-		  Bracket (-32768, 32767); pixel = rint (pixel));
+	    clipped = VConvertFloatShort ((VFloat *) src_first + i0,
+					  (VShort *) res_first + i0,
+					  i1 - i0, 1.0, 0.0);
 	    break;
 	    
 	case VLongRepn:
-	    Cast (VFloat, VLong,
-		  Bracket (VRepnMinValue (VLongRepn),
-			   VRepnMaxValue (VLongRepn)); );
+	    CastClip (VFloat, VLong, VRepnMinValue (VLongRepn),
+		      VRepnMaxValue (VLongRepn), Nothing);
 	    break;
 	    
-	case VDoubleRepn: Cast (VFloat, VDouble, Nothing); break;
+	case VDoubleRepn: Cast (VFloat, VDouble); break;
 
 	default: break;
 	}
 	break;
 	
     case VDoubleRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 	    
-	case VBitRepn:
-	    Cast (VDouble, VBit, Bracket (0, 1);  pixel = rint (pixel));
-	    break;
+	case VBitRepn: CastClip (VDouble, VBit, 0, 1, Round); break;
 	    
-	case VUByteRepn:
-	    Cast (VDouble, VUByte, Bracket (0, 255);  pixel = rint (pixel));
-	    break;
+	case VUByteRepn: CastClip (VDouble, VUByte, 0, 255, Round); break;
 	    
-	case VSByteRepn:
-	    Cast (VDouble, VSByte, Bracket (-128, 127);  pixel = rint (pixel));
-	    break;
+	case VSByteRepn: CastClip (VDouble, VSByte, -128, 127, Round); break;
 	    
 	case VShortRepn:
-	    Cast (VDouble, VShort, Bracket (-32768, 32767);  pixel = rint (pixel));
+	    CastClip (VDouble, VShort, -32768, 32767, Round);
 	    break;
 	    
 	case VLongRepn:
-	    Cast (VDouble, VLong,
-		  Bracket (VRepnMinValue (VLongRepn),
-			   VRepnMaxValue (VLongRepn)));
+	    CastClip (VDouble, VLong, VRepnMinValue (VLongRepn),
+		      VRepnMaxValue (VLongRepn), Nothing);
 	    break;
 	    
-	case VFloatRepn: Cast (VDouble, VFloat, Nothing); break;
+	case VFloatRepn: Cast (VDouble, VFloat); break;
 
 	default: break;
 	}
+	break;
 
     default: break;
     }
+    return clipped;
+}
+
+
+/*
+ *  VConvertImageCopy
+ *
+ *  Converts an image from one pixel representation to another by copying
+ *  (and perhaps rounding) pixel values, not mapping them from one range
+ *  to another. If dest is src and both representations have pixels of
+ *  the same size, the image is converted in place.
+ */
+
+VImage VConvertImageCopy (VImage src, VImage dest, VBand band,
+			  VRepnKind pixel_repn)
+{
+    double tbegin = VTraceBegin ();
+    VImage result;
+    int npixels;
+    long b, nblocks;
+    VPointer src_first;
+    VRepnKind src_repn = VPixelRepn (src);
+    int clipped = 0;
+
+    /* If src already has the requested representation, simply copy: */
+    if (pixel_repn == VPixelRepn (src))
+	return (src == dest) ? src : VCopyImage (src, dest, band);
+    
+    /* Prepare to iterate over all source pixels: */
+    if (! VSelectBand ("VConvertImageCopy", src, band, & npixels, & src_first))
+	return NULL;
+
+    /* Use src if asked to and its pixels have the right size; otherwise
+       check dest if it exists and create it if it doesn't: */
+    if (dest == src && band == VAllBands &&
+	VRepnSize (pixel_repn) == VPixelSize (src))
+	result = src;
+    else result = VSelectDestImage ("VConvertImageCopy", dest,
+				    band == VAllBands ? VImageNBands (src) : 1,
+				    VImageNRows (src), VImageNColumns (src),
+				    pixel_repn);
+    if (! result)
+	return NULL;
+
+    /* Copy pixels, casting or rounding them: */
+    nblocks = ((long) npixels + BlockSize - 1) / BlockSize;
+#pragma omp parallel for reduction(|:clipped) schedule(static) if (nblocks > 1)
+    for (b = 0; b < nblocks; b++)
+	clipped |= CopyBlock (src_repn, src_first, pixel_repn,
+			      VImageData (result), b * BlockSize,
+			      b < nblocks - 1 ? (b + 1) * BlockSize : npixels);
 
     if (clipped)
 	VWarning ("VConvertImageCopy: "
 		  "Source pixel value exceeds destination range");
 
-    VCopyImageAttrs (src, result);
+    if (result == src) {
+	VPixelRepn (src) = pixel_repn;
+	VExtractAttr (VImageAttrList (src), VPixelStatsAttr, NULL,
+		      VAttrListRepn, NULL, FALSE);
+    } else VCopyImageAttrs (src, result);
 
+    VTraceEnd ("VConvertImageCopy", tbegin, VImageNPixels (src), VImageSize (src));
     return result;
 }
@@ -23,6 +23,7 @@
 #include "viaio/Vlib.h"
 #include "viaio/os.h"
 #include "viaio/VImage.h"
+#include "viaio/ConvertPrivate.h"
 #include "viaio/mu.h"
 
 /* From the standard C library: */
@@ -31,8 +32,6 @@
 /* File identification string: */
 VRcsId ("$Id: ConvertL.c 3177 2008-04-01 14:47:24Z karstenm $");
 
-extern double rint(double);
-
 /*
  *  Some macros for converting one type to another.
  */
@@ -45,117 +44,105 @@ extern double rint(double);
 #define Convert(src_type, result_type, op)				\
     {									\
 	src_type *src_pp = (src_type *) src_first;			\
-	result_type *res_pp = VImageData (result);			\
+	result_type *res_pp = (result_type *) res_first;		\
 									\
-	for (i = 0; i < npixels; i++) {					\
+	for (i = i0; i < i1; i++) {					\
 	    op;								\
 	}								\
     }
 
-#define Bracket(t, lower, upper)					\
-    if (t < lower) {							\
-	t = lower;							\
-	clipped = TRUE;							\
-    } else if (t > upper) {						\
-	t = upper;							\
-	clipped = TRUE;							\
-    }
+#define Bracket(t)							\
+    t = t < d_min ? d_min : t;						\
+    t = t > d_max ? d_max : t
+
+/* Map x, recording in clip[i] whether it's clipped, into table[i]: */
+#define FillClipTable(table, x)						\
+    FillTable (table, t = (x) * a + b;					\
+	       clip[i] = (t < d_min) | (t > d_max);			\
+	       Bracket (t); table[i] = Round (t))
+
+#define MapClip(src_type, result_type)					\
+    Convert (src_type, result_type,					\
+	     t = src_pp[i] * a + b;					\
+	     clipped |= (t < d_min) | (t > d_max);			\
+	     Bracket (t); res_pp[i] = Round (t))
 
 
 /*
- *  VConvertImageLinear
- *
- *  Converts an image from one pixel representation to another using a
- *  linear mapping between source and destination pixel values:
+ *  LinearBlock
  *
- *	dest_pixel = src_pixel * a + b
- *
- *  for a pair a, b supplied as parameters.
+ *  Map pixels i0 ... i1-1 linearly, and return whether any were clipped.
+ *  Pixels of 8 bits or less are mapped through tables.
  */
 
-VImage VConvertImageLinear (VImage src, VImage dest, VBand band,
-			    VRepnKind pixel_repn, double a, double b)
+static int LinearBlock (VRepnKind src_repn, VPointer src_first,
+			VRepnKind res_repn, VPointer res_first, long i0, long i1,
+			double a, double b, VDouble d_min, VDouble d_max)
 {
-    VImage result;
-    int npixels, i;
-    VPointer src_first;
-    VDouble a_min, a_max, d0, d1, t;
-    VDouble d_min =
-	VIsFloatPtRepn (pixel_repn) ? -1.0 : VRepnMinValue (pixel_repn);
-    VDouble d_max = 
-	VIsFloatPtRepn (pixel_repn) ? 1.0 : VRepnMaxValue (pixel_repn);
-    VBoolean clipped = FALSE;
-
-    /* Prepare to iterate over all source pixels: */
-    if (! VSelectBand ("VConvertImageLinear",
-		       src, band, & npixels, & src_first))
-	return NULL;
-
-    /* Check dest if it exists; create it if it doesn't: */
-    result = VSelectDestImage ("VConvertImageLinear", dest,
-			       band == VAllBands ? VImageNBands (src) : 1,
-			       VImageNRows (src), VImageNColumns (src),
-			       pixel_repn);
-    if (! result)
-	return NULL;
+    long i;
+    VDouble d0, d1, t;
+    char clip[256];
+    int clipped = 0;
 
-    /* Map pixels from one representation to the other: */
-    switch (VPixelRepn (src)) {
+    switch (src_repn) {
 
     case VBitRepn:
 	d0 = b;
 	d1 = a + b;
-	if (pixel_repn != VFloatRepn && pixel_repn != VDoubleRepn) {
-	    Bracket (d0, d_min, d_max);
-	    Bracket (d1, d_min, d_max);
+	if (res_repn != VFloatRepn && res_repn != VDoubleRepn) {
+	    clip[0] = (d0 < d_min) | (d0 > d_max);
+	    clip[1] = (d1 < d_min) | (d1 > d_max);
+	    Bracket (d0);
+	    Bracket (d1);
 	}
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 
 	case VBitRepn:
 	    {
-		VBit dd0 = rint (d0), dd1 = rint (d1);
-		Convert (VBit, VBit, *res_pp++ = *src_pp++ ? dd1 : dd0);
+		VBit dd0 = Round (d0), dd1 = Round (d1);
+		Convert (VBit, VBit, res_pp[i] = src_pp[i] ? dd1 : dd0;
+			 clipped |= clip[src_pp[i] != 0]);
 	    }
 	    break;
 
 	case VUByteRepn:
 	    {
-		VUByte dd0 = rint (d0), dd1= rint (d1);
-		Convert (VBit, VUByte, *res_pp++ = *src_pp++ ? dd1 : dd0);
+		VUByte dd0 = Round (d0), dd1 = Round (d1);
+		Convert (VBit, VUByte, res_pp[i] = src_pp[i] ? dd1 : dd0;
+			 clipped |= clip[src_pp[i] != 0]);
 	    }
 	    break;
 
 	case VSByteRepn:
 	    {
-		VSByte dd0 = rint (d0), dd1= rint (d1);
-		Convert (VBit, VUByte, *res_pp++ = *src_pp++ ? dd1 : dd0);
+		VSByte dd0 = Round (d0), dd1 = Round (d1);
+		Convert (VBit, VSByte, res_pp[i] = src_pp[i] ? dd1 : dd0;
+			 clipped |= clip[src_pp[i] != 0]);
 	    }
 	    break;
 
 	case VShortRepn:
 	    {
-		VShort dd0 = rint (d0), dd1= rint (d1);
-		Convert (VBit, VUByte, *res_pp++ = *src_pp++ ? dd1 : dd0);
+		VShort dd0 = Round (d0), dd1 = Round (d1);
+		Convert (VBit, VShort, res_pp[i] = src_pp[i] ? dd1 : dd0;
+			 clipped |= clip[src_pp[i] != 0]);
 	    }
 	    break;
 
 	case VLongRepn:
 	    {
-		VLong dd0 = rint (d0), dd1= rint (d1);
-		Convert (VBit, VUByte, *res_pp++ = *src_pp++ ? dd1 : dd0);
+		VLong dd0 = Round (d0), dd1 = Round (d1);
+		Convert (VBit, VLong, res_pp[i] = src_pp[i] ? dd1 : dd0;
+			 clipped |= clip[src_pp[i] != 0]);
 	    }
 	    break;
 
 	case VFloatRepn:
-	    {
-		Convert (VBit, VFloat, *res_pp++ = *src_pp++ ? d1 : d0);
-	    }
+	    Convert (VBit, VFloat, res_pp[i] = src_pp[i] ? d1 : d0);
 	    break;
 
 	case VDoubleRepn:
-	    {
-		Convert (VBit, VDouble, *res_pp++ = *src_pp++ ? d1 : d0);
-	    }
+	    Convert (VBit, VDouble, res_pp[i] = src_pp[i] ? d1 : d0);
 	    break;
 
 	default:
@@ -164,50 +151,50 @@ VImage VConvertImageLinear (VImage src, VImage dest, VBand band,
 	break;
 
     case VUByteRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 
 	case VBitRepn:
 	    {
 		VBit table[256];
-		FillTable (table, t = i * a + b;
-			   Bracket (t, d_min, d_max); table[i] = rint (t));
-		Convert (VUByte, VBit, *res_pp++ = table[*src_pp++]);
+		FillClipTable (table, i);
+		Convert (VUByte, VBit, res_pp[i] = table[src_pp[i]];
+			 clipped |= clip[src_pp[i]]);
 	    }
 	    break;
 
 	case VUByteRepn:
 	    {
 		VUByte table[256];
-		FillTable (table, t = i * a + b;
-			   Bracket (t, d_min, d_max); table[i] = rint (t));
-		Convert (VUByte, VUByte, *res_pp++ = table[*src_pp++]);
+		FillClipTable (table, i);
+		Convert (VUByte, VUByte, res_pp[i] = table[src_pp[i]];
+			 clipped |= clip[src_pp[i]]);
 	    }
 	    break;
 
 	case VSByteRepn:
 	    {
 		VSByte table[256];
-		FillTable (table, t = i * a + b;
-			   Bracket (t, d_min, d_max); table[i] = rint (t));
-		Convert (VUByte, VSByte, *res_pp++ = table[*src_pp++]);
+		FillClipTable (table, i);
+		Convert (VUByte, VSByte, res_pp[i] = table[src_pp[i]];
+			 clipped |= clip[src_pp[i]]);
 	    }
 	    break;
 
 	case VShortRepn:
 	    {
 		VShort table[256];
-		FillTable (table, t = i * a + b;
-			   Bracket (t, d_min, d_max); table[i] = rint (t));
-		Convert (VUByte, VShort, *res_pp++ = table[*src_pp++]);
+		FillClipTable (table, i);
+		Convert (VUByte, VShort, res_pp[i] = table[src_pp[i]];
+			 clipped |= clip[src_pp[i]]);
 	    }
 	    break;
 
 	case VLongRepn:
 	    {
 		VLong table[256];
-		FillTable (table, t = i * a + b;
-			   Bracket (t, d_min, d_max); table[i] = rint (t));
-		Convert (VUByte, VLong, *res_pp++ = table[*src_pp++]);
+		FillClipTable (table, i);
+		Convert (VUByte, VLong, res_pp[i] = table[src_pp[i]];
+			 clipped |= clip[src_pp[i]]);
 	    }
 	    break;
 
@@ -215,7 +202,7 @@ VImage VConvertImageLinear (VImage src, VImage dest, VBand band,
 	    {
 		VFloat table[256];
 		FillTable (table, table[i] = i * a + b);
-		Convert (VUByte, VFloat, *res_pp++ = table[*src_pp++]);
+		Convert (VUByte, VFloat, res_pp[i] = table[src_pp[i]]);
 	    }
 	    break;
 
@@ -223,7 +210,7 @@ VImage VConvertImageLinear (VImage src, VImage dest, VBand band,
 	    {
 		VDouble table[256];
 		FillTable (table, table[i] = i * a + b);
-		Convert (VUByte, VFloat, *res_pp++ = table[*src_pp++]);
+		Convert (VUByte, VDouble, res_pp[i] = table[src_pp[i]]);
 	    }
 	    break;
 
@@ -233,50 +220,50 @@ VImage VConvertImageLinear (VImage src, VImage dest, VBand band,
 	break;
 
     case VSByteRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 
 	case VBitRepn:
 	    {
 		VBit table[256];
-		FillTable (table, t = (i - 128) * a + b;
-			   Bracket (t, d_min, d_max); table[i] = rint (t));
-		Convert (VSByte, VBit, *res_pp++ = table[*src_pp++ + 128]);
+		FillClipTable (table, (i - 128));
+		Convert (VSByte, VBit, res_pp[i] = table[src_pp[i] + 128];
+			 clipped |= clip[src_pp[i] + 128]);
 	    }
 	    break;
 
 	case VUByteRepn:
 	    {
 		VUByte table[256];
-		FillTable (table, t = (i - 128) * a + b;
-			   Bracket (t, d_min, d_max); table[i] = rint (t));
-		Convert (VSByte, VUByte, *res_pp++ = table[*src_pp++ + 128]);
+		FillClipTable (table, (i - 128));
+		Convert (VSByte, VUByte, res_pp[i] = table[src_pp[i] + 128];
+			 clipped |= clip[src_pp[i] + 128]);
 	    }
 	    break;
 
 	case VSByteRepn:
 	    {
 		VSByte table[256];
-		FillTable (table, t = (i - 128) * a + b;
-			   Bracket (t, d_min, d_max); table[i] = rint (t));
-		Convert (VSByte, VSByte, *res_pp++ = table[*src_pp++ + 128]);
+		FillClipTable (table, (i - 128));
+		Convert (VSByte, VSByte, res_pp[i] = table[src_pp[i] + 128];
+			 clipped |= clip[src_pp[i] + 128]);
 	    }
 	    break;
 
 	case VShortRepn:
 	    {
 		VShort table[256];
-		FillTable (table, t = (i - 128) * a + b;
-			   Bracket (t, d_min, d_max); table[i] = rint (t));
-		Convert (VSByte, VShort, *res_pp++ = table[*src_pp++ + 128]);
+		FillClipTable (table, (i - 128));
+		Convert (VSByte, VShort, res_pp[i] = table[src_pp[i] + 128];
+			 clipped |= clip[src_pp[i] + 128]);
 	    }
 	    break;
 
 	case VLongRepn:
 	    {
 		VLong table[256];
-		FillTable (table, t = (i - 128) * a + b;
-			   Bracket (t, d_min, d_max); table[i] = rint (t));
-		Convert (VSByte, VLong, *res_pp++ = table[*src_pp++ + 128]);
+		FillClipTable (table, (i - 128));
+		Convert (VSByte, VLong, res_pp[i] = table[src_pp[i] + 128];
+			 clipped |= clip[src_pp[i] + 128]);
 	    }
 	    break;
 
@@ -284,7 +271,7 @@ VImage VConvertImageLinear (VImage src, VImage dest, VBand band,
 	    {
 		VFloat table[256];
 		FillTable (table, table[i] = (i - 128) * a + b);
-		Convert (VSByte, VFloat, *res_pp++ = table[*src_pp++ + 128]);
+		Convert (VSByte, VFloat, res_pp[i] = table[src_pp[i] + 128]);
 	    }
 	    break;
 
@@ -292,7 +279,7 @@ VImage VConvertImageLinear (VImage src, VImage dest, VBand band,
 	    {
 		VDouble table[256];
 		FillTable (table, table[i] = (i - 128) * a + b);
-		Convert (VSByte, VFloat, *res_pp++ = table[*src_pp++ + 128]);
+		Convert (VSByte, VDouble, res_pp[i] = table[src_pp[i] + 128]);
 	    }
 	    break;
 
@@ -302,39 +289,34 @@ VImage VConvertImageLinear (VImage src, VImage dest, VBand band,
 	break;
 
     case VShortRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 
 	case VBitRepn:
-	    Convert (VShort, VBit, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VShort, VBit);
 	    break;
 
 	case VUByteRepn:
-	    Convert (VShort, VUByte, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VShort, VUByte);
 	    break;
 
 	case VSByteRepn:
-	    Convert (VShort, VSByte, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VShort, VSByte);
 	    break;
 
 	case VShortRepn:
-	    Convert (VShort, VShort, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VShort, VShort);
 	    break;
 
 	case VLongRepn:
-	    Convert (VShort, VLong, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VShort, VLong);
 	    break;
 
 	case VFloatRepn:
-	    Convert (VShort, VFloat, *res_pp++ = *src_pp++ * a + b);
+	    Convert (VShort, VFloat, res_pp[i] = src_pp[i] * a + b);
 	    break;
 
 	case VDoubleRepn:
-	    Convert (VShort, VDouble, *res_pp++ = *src_pp++ * a + b);
+	    Convert (VShort, VDouble, res_pp[i] = src_pp[i] * a + b);
 	    break;
 
 	default:
@@ -343,39 +325,34 @@ VImage VConvertImageLinear (VImage src, VImage dest, VBand band,
 	break;
 
     case VLongRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 
 	case VBitRepn:
-	    Convert (VLong, VBit, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VLong, VBit);
 	    break;
 
 	case VUByteRepn:
-	    Convert (VLong, VUByte, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VLong, VUByte);
 	    break;
 
 	case VSByteRepn:
-	    Convert (VLong, VSByte, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VLong, VSByte);
 	    break;
 
 	case VShortRepn:
-	    Convert (VLong, VShort, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VLong, VShort);
 	    break;
 
 	case VLongRepn:
-	    Convert (VLong, VLong, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VLong, VLong);
 	    break;
 
 	case VFloatRepn:
-	    Convert (VLong, VFloat, *res_pp++ = *src_pp++ * a + b);
+	    Convert (VLong, VFloat, res_pp[i] = src_pp[i] * a + b);
 	    break;
 
 	case VDoubleRepn:
-	    Convert (VLong, VDouble, *res_pp++ = *src_pp++ * a + b);
+	    Convert (VLong, VDouble, res_pp[i] = src_pp[i] * a + b);
 	    break;
 
 	default:
@@ -384,39 +361,38 @@ VImage VConvertImageLinear (VImage src, VImage dest, VBand band,
 	break;
 
     case VFloatRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 
 	case VBitRepn:
-	    Convert (VFloat, VBit, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VFloat, VBit);
 	    break;
 
 	case VUByteRepn:
-	    Convert (VFloat, VUByte, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    clipped = VConvertFloatUByte ((VFloat *) src_first + i0,
+					  (VUByte *) res_first + i0,
+					  i1 - i0, a, b);
 	    break;
 
 	case VSByteRepn:
-	    Convert (VFloat, VSByte, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VFloat, VSByte);
 	    break;
 
 	case VShortRepn:
-	    Convert (VFloat, VShort,  t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    clipped = VConvertFloatShort ((VFloat *) src_first + i0,
+					  (VShort *) res_first + i0,
+					  i1 - i0, a, b);
 	    break;
 
 	case VLongRepn:
-	    Convert (VFloat, VLong, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VFloat, VLong);
 	    break;
 
 	case VFloatRepn:
-	    Convert (VFloat, VFloat, *res_pp++ = *src_pp++ * a + b);
+	    Convert (VFloat, VFloat, res_pp[i] = src_pp[i] * a + b);
 	    break;
 
 	case VDoubleRepn:
-	    Convert (VFloat, VDouble, *res_pp++ = *src_pp++ * a + b);
+	    Convert (VFloat, VDouble, res_pp[i] = src_pp[i] * a + b);
 	    break;
 
 	default:
@@ -425,69 +401,110 @@ VImage VConvertImageLinear (VImage src, VImage dest, VBand band,
 	break;
 
     case VDoubleRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 
 	case VBitRepn:
-	    Convert (VDouble, VBit, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VDouble, VBit);
 	    break;
 
 	case VUByteRepn:
-	    Convert (VDouble, VUByte, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VDouble, VUByte);
 	    break;
 
 	case VSByteRepn:
-	    Convert (VDouble, VSByte, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VDouble, VSByte);
 	    break;
 
 	case VShortRepn:
-	    Convert (VDouble, VShort, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VDouble, VShort);
 	    break;
 
 	case VLongRepn:
-	    Convert (VDouble, VLong, t = *src_pp++ * a + b;
-		     Bracket (t, d_min, d_max); *res_pp++ = rint (t));
+	    MapClip (VDouble, VLong);
 	    break;
 
 	case VFloatRepn:
-	    Convert (VDouble, VFloat, *res_pp++ = *src_pp++ * a + b);
+	    Convert (VDouble, VFloat, res_pp[i] = src_pp[i] * a + b);
 	    break;
 
 	case VDoubleRepn:
-	    Convert (VDouble, VDouble, *res_pp++ = *src_pp++ * a + b);
+	    Convert (VDouble, VDouble, res_pp[i] = src_pp[i] * a + b);
 	    break;
 
 	default:
 	    break;
 	}
+	break;
 
     default:
 	break;
     }
+    return clipped;
+}
+
+
+/*
+ *  VConvertImageLinear
+ *
+ *  Converts an image from one pixel representation to another using a
+ *  linear mapping between source and destination pixel values:
+ *
+ *	dest_pixel = src_pixel * a + b
+ *
+ *  for a pair a, b supplied as parameters. If dest is src and both
+ *  representations have pixels of the same size, the image is converted
+ *  in place.
+ */
 
-    /* In the cases were a table was used for the conversion, we don't know
-       for sure whether any pixel values were clipped. This determines
-       with certainty: */
-    if (clipped && (pixel_repn == VBitRepn ||
-		    pixel_repn == VUByteRepn || pixel_repn == VSByteRepn)) {
-	clipped = FALSE;
-	VImageStats (src, band, & a_min, & a_max, NULL, NULL);
-	t = a_min * a + b;
-	if (t < d_min || t > d_max)
-	    clipped = TRUE;
-	t = a_max * a + b;
-	if (t < d_min || t > d_max)
-	    clipped = TRUE;
-    }	   
+VImage VConvertImageLinear (VImage src, VImage dest, VBand band,
+			    VRepnKind pixel_repn, double a, double b)
+{
+    VImage result;
+    int npixels;
+    long k, nblocks;
+    VPointer src_first;
+    VRepnKind src_repn = VPixelRepn (src);
+    VDouble d_min =
+	VIsFloatPtRepn (pixel_repn) ? -1.0 : VRepnMinValue (pixel_repn);
+    VDouble d_max = 
+	VIsFloatPtRepn (pixel_repn) ? 1.0 : VRepnMaxValue (pixel_repn);
+    int clipped = 0;
+
+    /* Prepare to iterate over all source pixels: */
+    if (! VSelectBand ("VConvertImageLinear",
+		       src, band, & npixels, & src_first))
+	return NULL;
+
+    /* Use src if asked to and its pixels have the right size; otherwise
+       check dest if it exists and create it if it doesn't: */
+    if (dest == src && band == VAllBands &&
+	VRepnSize (pixel_repn) == VPixelSize (src))
+	result = src;
+    else result = VSelectDestImage ("VConvertImageLinear", dest,
+				    band == VAllBands ? VImageNBands (src) : 1,
+				    VImageNRows (src), VImageNColumns (src),
+				    pixel_repn);
+    if (! result)
+	return NULL;
+
+    /* Map pixels from one representation to the other: */
+    nblocks = ((long) npixels + BlockSize - 1) / BlockSize;
+#pragma omp parallel for reduction(|:clipped) schedule(static) if (nblocks > 1)
+    for (k = 0; k < nblocks; k++)
+	clipped |= LinearBlock (src_repn, src_first, pixel_repn,
+				VImageData (result), k * BlockSize,
+				k < nblocks - 1 ? (k + 1) * BlockSize : npixels,
+				a, b, d_min, d_max);
 
     if (clipped)
 	VWarning ("VConvertImageLinear: "
 		  "Pixel value exceeds destination range");
 
-    VCopyImageAttrs (src, result);
+    if (result == src) {
+	VPixelRepn (src) = pixel_repn;
+	VExtractAttr (VImageAttrList (src), VPixelStatsAttr, NULL,
+		      VAttrListRepn, NULL, FALSE);
+    } else VCopyImageAttrs (src, result);
 
     return result;
 }
@@ -24,6 +24,7 @@
 #include "viaio/Vlib.h"
 #include "viaio/os.h"
 #include "viaio/VImage.h"
+#include "viaio/ConvertPrivate.h"
 #include "viaio/mu.h"
 
 /* From the standard C library: */
@@ -32,8 +33,6 @@
 /* File identification string: */
 VRcsId ("$Id: ConvertR.c 3177 2008-04-01 14:47:24Z karstenm $");
 
-extern double rint(double);
-
 /*
  *  Some macros for converting one type to another.
  */
@@ -45,97 +44,71 @@ extern double rint(double);
 #define Convert(src_type, result_type, op)				\
     {									\
 	src_type *src_pp = (src_type *) src_first;			\
-	result_type *res_pp = VImageData (result);			\
+	result_type *res_pp = (result_type *) res_first;		\
 									\
-	for (i = 0; i < npixels; i++) {					\
+	for (i = i0; i < i1; i++) {					\
 	    op;								\
 	}								\
     }
 
 #define Clip								\
-    if (t < 0) {							\
-	t = 0;								\
-	clipped = TRUE;							\
-    }
+    clipped |= t < 0;							\
+    t = t < 0 ? 0 : t
 
 #define Bracket(a,b)							\
-    if (t < a) {							\
-	t = a;								\
-	clipped = TRUE;							\
-    } else if (t > b) {							\
-	t = b;								\
-	clipped = TRUE;							\
-    }
+    clipped |= (t < a) | (t > b);					\
+    t = t < a ? a : t;							\
+    t = t > b ? b : t
+
 
 /*
- *  VConvertImageRange
+ *  RangeBlock
  *
- *  Converts an image from one pixel representation to another using a
- *  mapping from all possible source pixel values to all destination pixel
- *  values.
+ *  Map pixels i0 ... i1-1 from the range of one representation to that of
+ *  another, and return whether any were clipped.
  *
  *  Note: In ANSI C, left shifting a signed, negative value may or may
  *	  produce a negative result. Where we now the value's positive,
  *	  we use >>; where it could be negative, we use /.
  */
 
-VImage VConvertImageRange (VImage src, VImage dest, VBand band,
-			   VRepnKind pixel_repn)
+static int RangeBlock (VRepnKind src_repn, VPointer src_first,
+		       VRepnKind res_repn, VPointer res_first, long i0, long i1)
 {
-    VImage result;
-    int npixels, i;
+    long i;
     double v;
-    VPointer src_first;
-    VBoolean clipped = FALSE;
+    int clipped = 0;
 
-    /* If src already has the requested representation, simply copy: */
-    if (pixel_repn == VPixelRepn (src))
-	return (src == dest) ? src : VCopyImage (src, dest, band);
-    
-    /* Prepare to iterate over all source pixels: */
-    if (! VSelectBand ("VConvertImageRange", src, band,
-		       & npixels, & src_first))
-	return NULL;
-
-    /* Check dest if it exists; create it if it doesn't: */
-    result = VSelectDestImage ("VConvertImageRange", dest,
-			       band == VAllBands ? VImageNBands (src) : 1,
-			       VImageNRows (src), VImageNColumns (src),
-			       pixel_repn);
-    if (! result)
-	return NULL;
-
-    /* Map pixels from one representation to the other: */
-    switch (VPixelRepn (src)) {
+    switch (src_repn) {
 	
     case VBitRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 	    
 	case VUByteRepn: 
-	    Convert (VBit, VUByte, *res_pp++ = *src_pp++ ? 255 : 0); 
+	    Convert (VBit, VUByte, res_pp[i] = src_pp[i] ? 255 : 0); 
 	    break;
 	    
 	case VSByteRepn:
-	    Convert (VBit, VSByte, *res_pp++ = *src_pp++ ? 127 : 0);
+	    Convert (VBit, VSByte, res_pp[i] = src_pp[i] ? 127 : 0);
 	    break;
 	    
 	case VShortRepn:
-	    Convert (VBit, VShort, *res_pp++ = *src_pp++ ? 32767 : 0);
+	    Convert (VBit, VShort, res_pp[i] = src_pp[i] ? 32767 : 0);
 	    break;
 	    
 	case VLongRepn:
-	    Convert (VBit, VLong, *res_pp++ = *src_pp++ ? 0x7FFFFFFFl : 0);
+	    Convert (VBit, VLong, res_pp[i] = src_pp[i] ? 0x7FFFFFFFl : 0);
 	    break;
 	    
 	case VFloatRepn:
 	    Convert (VBit, VFloat,
-		     *res_pp++ = (*src_pp++ ?
+		     res_pp[i] = (src_pp[i] ?
 				  VFloatConst (1.0) : VFloatConst (0.0)));
 	    break;
 	        
 	case VDoubleRepn:
 	    Convert (VBit, VDouble,
-		     *res_pp++ = (*src_pp++ ?
+		     res_pp[i] = (src_pp[i] ?
 				  VDoubleConst (1.0) : VDoubleConst (0.0)));
 	    break;
 
@@ -145,29 +118,29 @@ VImage VConvertImageRange (VImage src, VImage dest, VBand band,
 	break;
 	
     case VUByteRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 	    
 	case VBitRepn:
-	    Convert (VUByte, VBit, *res_pp++ = *src_pp++ >> 7);
+	    Convert (VUByte, VBit, res_pp[i] = src_pp[i] >> 7);
 	    break;
 	    
 	case VSByteRepn:
-	    Convert (VUByte, VSByte, *res_pp++ = *src_pp++ >> 1);
+	    Convert (VUByte, VSByte, res_pp[i] = src_pp[i] >> 1);
 	    break;
 	    	    
 	case VShortRepn:
-	    Convert (VUByte, VShort, *res_pp++ = *src_pp++ << 7);
+	    Convert (VUByte, VShort, res_pp[i] = src_pp[i] << 7);
 	    break;
 	    
 	case VLongRepn:
-	    Convert (VUByte, VLong, *res_pp++ = *src_pp++ << 23);
+	    Convert (VUByte, VLong, res_pp[i] = src_pp[i] << 23);
 	    break;
 	    
 	case VFloatRepn:
 	    {
 		VFloat table[256];
 		FillTable (table, (i / VFloatConst (255.0)));
-		Convert (VUByte, VFloat, *res_pp++ = table[*src_pp++]);
+		Convert (VUByte, VFloat, res_pp[i] = table[src_pp[i]]);
 	    }
 	    break;
 	    
@@ -175,7 +148,7 @@ VImage VConvertImageRange (VImage src, VImage dest, VBand band,
 	    {
 		VDouble table[256];
 		FillTable (table, (i / VDoubleConst (255.0)));
-		Convert (VUByte, VDouble, *res_pp++ = table[*src_pp++]);
+		Convert (VUByte, VDouble, res_pp[i] = table[src_pp[i]]);
 	    }
 	    break;
 
@@ -185,13 +158,13 @@ VImage VConvertImageRange (VImage src, VImage dest, VBand band,
 	break;
 	
     case VSByteRepn:
-	switch (VPixelRepn (result)) {
+	switch (res_repn) {
 	    
 	case VBitRepn:
 	    {
 		VSByte t;
 		Convert (VSByte, VBit,
-			 t = *src_pp++; Clip; *res_pp++ = t >> 6);
+			 t = src_pp[i]; Clip; res_pp[i] = t >> 6);
 	    }
 	    break;
 	    
@@ -199,16 +172,16 @@ VImage VConvertImageRange (VImage src, VImage dest, VBand band,
 	    {
 		VSByte t;
 		Convert (VSByte, VUByte,
-			 t = *src_pp++; Clip; *res_pp++ = t << 1);
+			 t = src_pp[i]; Clip; res_pp[i] = t << 1);
 	    }
 	    break;
 
 	case VShortRepn:
-	    Convert (VSByte, VShort, *res_pp++ = ((VShort) *src_pp++ << 8));
+	    Convert (VSByte, VShort, res_pp[i] = ((VShort) src_pp[i] << 8));
 	    break;
 	    
 	case VLongRepn:
-	    Convert (VSByte, VLong, *res_pp++ = ((VLong) *src_pp++ << 24));
+	    Convert (VSByte, VLong, res_pp[i] = ((VLong) src_pp[i] << 24));
 	    break;
 	    
 	case VFloatRepn:
@@ -216,7 +189,7 @@ VImage VConvertImageRange (VImage src, VImage dest, VBand band,
 		VFloat table[256];
 		FillTable (table,
 			   (i - VFloatConst (128.0)) / VFloatConst (128.0));
-		Convert (VSByte, VFloat, *res_pp++ = table[*src_pp++ + 128]);
+		Convert (VSByte, VFloat, res_pp[i] = table[src_pp[i] + 128]);
 	    }
 	    break;
 	    
@@ -225,7 +198,7 @@ VImage VConvertImageRange (VImage src, VImage dest, VBand band,
 		VDouble table[256];
 		FillTable (table,
 			   (i - VDoubleConst (128)) / VDoubleConst (128.0));
-		Convert (VSByte, VDouble, *res_pp++ = table[*src_pp++ + 128]);
+		Convert (VSByte, VDouble, res_pp[i] = table[src_pp[i] + 128]);
 	    }
 	    break;
 
@@ -235,14 +208,14 @@ VImage VConvertImageRange (VImage src, VImage dest, VBand band,
 	break;
 	
     case VShortRepn:
-	v = -VPixelMinValue (src);
-	switch (VPixelRepn (result)) {
+	v = -VRepnMinValue (src_repn);
+	switch (res_repn) {
 	    
 	case VBitRepn:
 	    {
 		VShort t;
 		Convert (VShort, VBit,
-			 t = *src_pp++; Clip; *res_pp++ = t >> 14);
+			 t = src_pp[i]; Clip; res_pp[i] = t >> 14);
 	    }
 	    break;
 	    
@@ -250,24 +223,24 @@ VImage VConvertImageRange (VImage src, VImage dest, VBand band,
 	    {
 		VShort t;
 		Convert (VShort, VUByte,
-			 t = *src_pp++; Clip; *res_pp++ = t >> 7);
+			 t = src_pp[i]; Clip; res_pp[i] = t >> 7);
 	    }
 	    break;
 
 	case VSByteRepn:
-	    Convert (VShort, VSByte, *res_pp++ = (*src_pp++ / 256));
+	    Convert (VShort, VSByte, res_pp[i] = (src_pp[i] / 256));
 	    break;
 	    
 	case VLongRepn:
-	    Convert (VShort, VLong, *res_pp++ = ((VLong) *src_pp++ << 8));
+	    Convert (VShort, VLong, res_pp[i] = ((VLong) src_pp[i] << 8));
 	    break;
 	    
 	case VFloatRepn:
-	    Convert (VShort, VFloat, *res_pp++ = *src_pp++ / v);
+	    Convert (VShort, VFloat, res_pp[i] = src_pp[i] / v);
 	    break;
 	    
 	case VDoubleRepn:
-	    Convert (VShort, VDouble, *res_pp++ = *src_pp++ / v);
+	    Convert (VShort, VDouble, res_pp[i] = src_pp[i] / v);
 	    break;
 
 	default:
@@ -276,14 +249,14 @@ VImage VConvertImageRange (VImage src, VImage dest, VBand band,
 	break;
 	
     case VLongRepn:
-	v = -VPixelMinValue (src);
-	switch (VPixelRepn (result)) {
+	v = -VRepnMinValue (src_repn);
+	switch (res_repn) {
 	    
 	case VBitRepn:
 	    {
 		VLong t;
 		Convert (VLong, VBit,
-			 t = *src_pp++; Clip; *res_pp++ = t >> 30);
+			 t = src_pp[i]; Clip; res_pp[i] = t >> 30);
 	    }
 	    break;
 	    
@@ -291,25 +264,25 @@ VImage VConvertImageRange (VImage src, VImage dest, VBand band,
 	    {
 		VLong t;
 		Convert (VLong, VUByte,
-			 t = *src_pp++; Clip; *res_pp++ = t >> 23);
+			 t = src_pp[i]; Clip; res_pp[i] = t >> 23);
 	    }
 	    break;
 
 	case VSByteRepn:
-	    Convert (VLong, VSByte, *res_pp++ = (*src_pp++ / (1 << 23)));
+	    Convert (VLong, VSByte, res_pp[i] = (src_pp[i] / (1 << 23)));
 	    break;
 	    
 	case VShortRepn:
 	    Convert (VLong, VShort,
-		     *res_pp++ = ((VLong) *src_pp++ / (1 << 16)));
+		     res_pp[i] = ((VLong) src_pp[i] / (1 << 16)));
 	    break;
 	    
 	case VFloatRepn:
-	    Convert (VLong, VFloat, *res_pp++ = *src_pp++ / v);
+	    Convert (VLong, VFloat, res_pp[i] = src_pp[i] / v);
 	    break;
 	    
 	case VDoubleRepn:
-	    Convert (VLong, VDouble, *res_pp++ = *src_pp++ / v);
+	    Convert (VLong, VDouble, res_pp[i] = src_pp[i] / v);
 	    break;
 
 	default:
@@ -319,41 +292,41 @@ VImage VConvertImageRange (VImage src, VImage dest, VBand band,
 	
     case VFloatRepn:
         {
-	    VFloat t, m = VPixelMaxValue (result);
-	    switch (VPixelRepn (result)) {
+	    VFloat t, m = VRepnMaxValue (res_repn);
+	    switch (res_repn) {
 	    
 	    case VBitRepn:
 		Convert (VFloat, VBit,
-			 t = *src_pp++; Bracket (0, 1);
-			 *res_pp++ = t >= 0.5);
+			 t = src_pp[i]; Bracket (0, 1);
+			 res_pp[i] = t >= 0.5);
 		break;
 	    
 	    case VUByteRepn:
 		Convert (VFloat, VUByte,
-			 t = *src_pp++; Bracket (0, 1);
-			 *res_pp++ = rint (t * m));
+			 t = src_pp[i]; Bracket (0, 1);
+			 res_pp[i] = Round (t * m));
 		break;
 	    
 	    case VSByteRepn:
 		Convert (VFloat, VSByte,
-			 t = *src_pp++; Bracket (-1, 1);
-			 *res_pp++ = rint (t * m));
+			 t = src_pp[i]; Bracket (-1, 1);
+			 res_pp[i] = Round (t * m));
 		break;
 	    
 	    case VShortRepn:
 		Convert (VFloat, VShort,
-			 t = *src_pp++; Bracket (-1, 1);
-			 *res_pp++ = rint (t * m));
+			 t = src_pp[i]; Bracket (-1, 1);
+			 res_pp[i] = Round (t * m));
 		break;
 	    
 	    case VLongRepn:
 		Convert (VFloat, VLong,
-			 t = *src_pp++; Bracket (-1, 1);
-			 *res_pp++ = rint (t * m));
+			 t = src_pp[i]; Bracket (-1, 1);
+			 res_pp[i] = Round (t * m));
 		break;
 	    
 	    case VDoubleRepn:
-		Convert (VFloat, VDouble, *res_pp++ = *src_pp++);
+		Convert (VFloat, VDouble, res_pp[i] = src_pp[i]);
 		break;
 
 	    default:
@@ -364,41 +337,41 @@ VImage VConvertImageRange (VImage src, VImage dest, VBand band,
 	
     case VDoubleRepn:
         {
-	    VDouble t, m = VPixelMaxValue (result);
-	    switch (VPixelRepn (result)) {
+	    VDouble t, m = VRepnMaxValue (res_repn);
+	    switch (res_repn) {
 	    
 	    case VBitRepn:
 		Convert (VDouble, VBit,
-			 t = *src_pp++; Bracket (0, 1);
-			 *res_pp++ = t >= 0.5);
+			 t = src_pp[i]; Bracket (0, 1);
+			 res_pp[i] = t >= 0.5);
 		break;
 	    
 	    case VUByteRepn:
 		Convert (VDouble, VUByte,
-			 t = *src_pp++; Bracket (0, 1);
-			 *res_pp++ = rint (t * m));
+			 t = src_pp[i]; Bracket (0, 1);
+			 res_pp[i] = Round (t * m));
 		break;
 	    
 	    case VSByteRepn:
 		Convert (VDouble, VSByte,
-			 t = *src_pp++; Bracket (-1, 1);
-			 *res_pp++ = rint (t * m));
+			 t = src_pp[i]; Bracket (-1, 1);
+			 res_pp[i] = Round (t * m));
 		break;
 	    
 	    case VShortRepn:
 		Convert (VDouble, VShort,
-			 t = *src_pp++; Bracket (-1, 1);
-			 *res_pp++ = rint (t * m));
+			 t = src_pp[i]; Bracket (-1, 1);
+			 res_pp[i] = Round (t * m));
 		break;
 	    
 	    case VLongRepn:
 		Convert (VDouble, VLong,
-			 t = *src_pp++; Bracket (-1, 1);
-			 *res_pp++ = rint (t * m));
+			 t = src_pp[i]; Bracket (-1, 1);
+			 res_pp[i] = Round (t * m));
 		break;
 	    
 	    case VFloatRepn:
-		Convert (VDouble, VFloat, *res_pp++ = *src_pp++);
+		Convert (VDouble, VFloat, res_pp[i] = src_pp[i]);
 		break;
 
 	    default:
@@ -411,12 +384,67 @@ VImage VConvertImageRange (VImage src, VImage dest, VBand band,
     default:
 	break;
     }
+    return clipped;
+}
+
+
+/*
+ *  VConvertImageRange
+ *
+ *  Converts an image from one pixel representation to another using a
+ *  mapping from all possible source pixel values to all destination pixel
+ *  values. If dest is src and both representations have pixels of the
+ *  same size, the image is converted in place.
+ */
+
+VImage VConvertImageRange (VImage src, VImage dest, VBand band,
+			   VRepnKind pixel_repn)
+{
+    VImage result;
+    int npixels;
+    long k, nblocks;
+    VPointer src_first;
+    VRepnKind src_repn = VPixelRepn (src);
+    int clipped = 0;
+
+    /* If src already has the requested representation, simply copy: */
+    if (pixel_repn == VPixelRepn (src))
+	return (src == dest) ? src : VCopyImage (src, dest, band);
+    
+    /* Prepare to iterate over all source pixels: */
+    if (! VSelectBand ("VConvertImageRange", src, band,
+		       & npixels, & src_first))
+	return NULL;
+
+    /* Use src if asked to and its pixels have the right size; otherwise
+       check dest if it exists and create it if it doesn't: */
+    if (dest == src && band == VAllBands &&
+	VRepnSize (pixel_repn) == VPixelSize (src))
+	result = src;
+    else result = VSelectDestImage ("VConvertImageRange", dest,
+				    band == VAllBands ? VImageNBands (src) : 1,
+				    VImageNRows (src), VImageNColumns (src),
+				    pixel_repn);
+    if (! result)
+	return NULL;
+
+    /* Map pixels from one representation to the other: */
+    nblocks = ((long) npixels + BlockSize - 1) / BlockSize;
+#pragma omp parallel for reduction(|:clipped) schedule(static) if (nblocks > 1)
+    for (k = 0; k < nblocks; k++)
+	clipped |= RangeBlock (src_repn, src_first, pixel_repn,
+			       VImageData (result), k * BlockSize,
+			       k < nblocks - 1 ? (k + 1) * BlockSize : npixels);
 
     if (clipped)
 	VWarning ("VConvertImageRange: "
 		  "Pixel value exceeds destination range");
 
-    VCopyImageAttrs (src, result);
+    if (result == src) {
+	VPixelRepn (src) = pixel_repn;
+	VExtractAttr (VImageAttrList (src), VPixelStatsAttr, NULL,
+		      VAttrListRepn, NULL, FALSE);
+    } else VCopyImageAttrs (src, result);
 
     return result;
 }
@@ -0,0 +1,180 @@
+/*
+ *  This file contains kernels for the most common narrowing conversions,
+ *  float pixels to ubyte and short pixels, used by VConvertImageCopy and
+ *  VConvertImageLinear. Compilers don't vectorize the clipping and rounding
+ *  of floating point values on their own, so where SSE2 is available it is
+ *  done explicitly: values are clamped with min/max, rounded by the
+ *  conversion instructions (which round to nearest even, like rint()), and
+ *  packed with saturation.
+ */
+
+/* From the Vista library: */
+#include "viaio/Vlib.h"
+#include "viaio/VImage.h"
+#include "viaio/ConvertPrivate.h"
+
+/* From the SSE2 intrinsics: */
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Map one pixel the portable way, for the tail of a block: */
+#define MapPixel(lower, upper)						\
+    {									\
+	t = src[i] * a + b;						\
+	t = t == t ? t : 0.0;						\
+	clipped |= (t < lower) | (t > upper);				\
+	t = t < lower ? lower : t;					\
+	t = t > upper ? upper : t;					\
+	dest[i] = Round (t);						\
+    }
+
+
+#ifdef __SSE2__
+
+/*
+ *  Clamp four floats, noting in clip whether any was out of range, and
+ *  convert them to 32-bit integers. NaNs become 0.
+ */
+
+static __m128i ClampPs (const VFloat *src, __m128 lo, __m128 hi, __m128 *clip)
+{
+    __m128 x = _mm_loadu_ps (src);
+
+    x = _mm_and_ps (x, _mm_cmpord_ps (x, x));
+    *clip = _mm_or_ps (*clip, _mm_or_ps (_mm_cmplt_ps (x, lo),
+					 _mm_cmpgt_ps (x, hi)));
+    return _mm_cvtps_epi32 (_mm_min_ps (_mm_max_ps (x, lo), hi));
+}
+
+
+/*
+ *  Map four floats by x * a + b in double precision, clamp them, noting
+ *  in clip whether any was out of range, and convert them to 32-bit
+ *  integers. NaNs become 0.
+ */
+
+static __m128i MapPd (const VFloat *src, __m128d a, __m128d b,
+		      __m128d lo, __m128d hi, __m128d *clip)
+{
+    __m128 x = _mm_loadu_ps (src);
+    __m128d t0 = _mm_add_pd (_mm_mul_pd (_mm_cvtps_pd (x), a), b);
+    __m128d t1 = _mm_add_pd (_mm_mul_pd (_mm_cvtps_pd (_mm_movehl_ps (x, x)),
+					 a), b);
+
+    t0 = _mm_and_pd (t0, _mm_cmpord_pd (t0, t0));
+    t1 = _mm_and_pd (t1, _mm_cmpord_pd (t1, t1));
+    *clip = _mm_or_pd (*clip, _mm_or_pd (_mm_cmplt_pd (t0, lo),
+					 _mm_cmpgt_pd (t0, hi)));
+    *clip = _mm_or_pd (*clip, _mm_or_pd (_mm_cmplt_pd (t1, lo),
+					 _mm_cmpgt_pd (t1, hi)));
+    t0 = _mm_min_pd (_mm_max_pd (t0, lo), hi);
+    t1 = _mm_min_pd (_mm_max_pd (t1, lo), hi);
+    return _mm_unpacklo_epi64 (_mm_cvtpd_epi32 (t0), _mm_cvtpd_epi32 (t1));
+}
+
+#endif /* __SSE2__ */
+
+
+/*
+ *  VConvertFloatUByte
+ *
+ *  Map n float pixels by x * a + b to ubyte pixels, clipping and rounding
+ *  them, and return whether any were clipped. When a is 1 and b is 0 the
+ *  pixels are simply copied, otherwise x * a + b is computed in double
+ *  precision, as VConvertImageLinear does for other pixel types. NaN
+ *  pixels become 0.
+ */
+
+int VConvertFloatUByte (const VFloat *src, VUByte *dest, long n,
+			double a, double b)
+{
+    long i = 0;
+    VDouble t;
+    int clipped = 0;
+
+#ifdef __SSE2__
+    __m128i k[4];
+    int j;
+
+    if (a == 1.0 && b == 0.0) {
+	__m128 lo = _mm_set1_ps (0.0), hi = _mm_set1_ps (255.0);
+	__m128 clip = _mm_setzero_ps ();
+
+	for ( ; i + 16 <= n; i += 16) {
+	    for (j = 0; j < 4; j++)
+		k[j] = ClampPs (src + i + 4 * j, lo, hi, & clip);
+	    _mm_storeu_si128 ((__m128i *) (dest + i),
+			      _mm_packus_epi16 (_mm_packs_epi32 (k[0], k[1]),
+						_mm_packs_epi32 (k[2], k[3])));
+	}
+	clipped = _mm_movemask_ps (clip) != 0;
+    } else {
+	__m128d va = _mm_set1_pd (a), vb = _mm_set1_pd (b);
+	__m128d lo = _mm_set1_pd (0.0), hi = _mm_set1_pd (255.0);
+	__m128d clip = _mm_setzero_pd ();
+
+	for ( ; i + 16 <= n; i += 16) {
+	    for (j = 0; j < 4; j++)
+		k[j] = MapPd (src + i + 4 * j, va, vb, lo, hi, & clip);
+	    _mm_storeu_si128 ((__m128i *) (dest + i),
+			      _mm_packus_epi16 (_mm_packs_epi32 (k[0], k[1]),
+						_mm_packs_epi32 (k[2], k[3])));
+	}
+	clipped = _mm_movemask_pd (clip) != 0;
+    }
+#endif
+
+    for ( ; i < n; i++)
+	MapPixel (0.0, 255.0);
+    return clipped;
+}
+
+
+/*
+ *  VConvertFloatShort
+ *
+ *  Like VConvertFloatUByte, but for short result pixels.
+ */
+
+int VConvertFloatShort (const VFloat *src, VShort *dest, long n,
+			double a, double b)
+{
+    long i = 0;
+    VDouble t;
+    int clipped = 0;
+
+#ifdef __SSE2__
+    __m128i k[2];
+    int j;
+
+    if (a == 1.0 && b == 0.0) {
+	__m128 lo = _mm_set1_ps (-32768.0), hi = _mm_set1_ps (32767.0);
+	__m128 clip = _mm_setzero_ps ();
+
+	for ( ; i + 8 <= n; i += 8) {
+	    for (j = 0; j < 2; j++)
+		k[j] = ClampPs (src + i + 4 * j, lo, hi, & clip);
+	    _mm_storeu_si128 ((__m128i *) (dest + i),
+			      _mm_packs_epi32 (k[0], k[1]));
+	}
+	clipped = _mm_movemask_ps (clip) != 0;
+    } else {
+	__m128d va = _mm_set1_pd (a), vb = _mm_set1_pd (b);
+	__m128d lo = _mm_set1_pd (-32768.0), hi = _mm_set1_pd (32767.0);
+	__m128d clip = _mm_setzero_pd ();
+
+	for ( ; i + 8 <= n; i += 8) {
+	    for (j = 0; j < 2; j++)
+		k[j] = MapPd (src + i + 4 * j, va, vb, lo, hi, & clip);
+	    _mm_storeu_si128 ((__m128i *) (dest + i),
+			      _mm_packs_epi32 (k[0], k[1]));
+	}
+	clipped = _mm_movemask_pd (clip) != 0;
+    }
+#endif
+
+    for ( ; i < n; i++)
+	MapPixel (-32768.0, 32767.0);
+    return clipped;
+}
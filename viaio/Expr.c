@@ -0,0 +1,680 @@
+/*
+ *  This file contains routines for evaluating per-pixel arithmetic
+ *  expressions over several images in a single pass.
+ *
+ *  An expression such as "sqrt(a*a+b*b) > 3 ? a : 0" is parsed once into
+ *  postfix code. The code is then executed on blocks of pixels: each
+ *  instruction is a tight loop over one block, so no full-size intermediate
+ *  images are created. Blocks are distributed over threads if OpenMP is
+ *  enabled.
+ */
+
+/* From the Vista library: */
+#include "viaio/Vlib.h"
+#include "viaio/mu.h"
+#include "viaio/os.h"
+#include "viaio/VImage.h"
+
+/* From the standard C library: */
+#include <ctype.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+extern double rint(double);
+
+/* Number of pixels processed by one instruction: */
+#define BlockSize 512
+
+/* Instructions of the postfix code: */
+typedef enum {
+    OpVar, OpConst,
+    OpNeg, OpNot, OpAbs, OpSqrt, OpExp, OpLog, OpSin, OpCos, OpTan,
+    OpFloor, OpCeil, OpRound,
+    OpAdd, OpSub, OpMul, OpDiv, OpMod, OpPow, OpMin, OpMax, OpAtan2,
+    OpLt, OpLe, OpGt, OpGe, OpEq, OpNe, OpAnd, OpOr,
+    OpSelect
+} ExprOpcode;
+
+typedef struct {
+    ExprOpcode op;
+    int var;				/* image index, for OpVar */
+    double value;			/* for OpConst */
+} ExprInstr;
+
+typedef struct V_ExprRec {
+    int ninstr;				/* length of code */
+    ExprInstr *code;			/* postfix code */
+    int depth;				/* stack depth needed */
+    int nvars;				/* number of images referenced */
+} VExprRec;
+
+/* Functions callable from expressions: */
+static struct {
+    VStringConst name;
+    int nargs;
+    ExprOpcode op;
+} functions[] = {
+    { "abs", 1, OpAbs }, { "sqrt", 1, OpSqrt }, { "exp", 1, OpExp },
+    { "log", 1, OpLog }, { "sin", 1, OpSin }, { "cos", 1, OpCos },
+    { "tan", 1, OpTan }, { "floor", 1, OpFloor }, { "ceil", 1, OpCeil },
+    { "round", 1, OpRound }, { "min", 2, OpMin }, { "max", 2, OpMax },
+    { "pow", 2, OpPow }, { "atan2", 2, OpAtan2 }
+};
+
+/* State of the parser: */
+typedef struct {
+    VStringConst text, p;
+    VExpr expr;
+    int size, depth;
+    VBoolean failed;
+} Parser;
+
+static VStringConst routine = "VParseExpr";
+
+static void ParseCond (Parser *);
+
+
+/*
+ *  Code generation.
+ */
+
+static void Emit (Parser *ps, ExprOpcode op, int var, double value)
+{
+    VExpr expr = ps->expr;
+
+    if (expr->ninstr >= ps->size) {
+	ps->size = ps->size ? 2 * ps->size : 32;
+	expr->code = VRealloc (expr->code, ps->size * sizeof (ExprInstr));
+    }
+    expr->code[expr->ninstr].op = op;
+    expr->code[expr->ninstr].var = var;
+    expr->code[expr->ninstr].value = value;
+    expr->ninstr++;
+
+    /* Track the stack depth: */
+    if (op == OpVar || op == OpConst)
+	ps->depth++;
+    else if (op == OpSelect)
+	ps->depth -= 2;
+    else if (op >= OpAdd)
+	ps->depth--;
+    if (ps->depth > expr->depth)
+	expr->depth = ps->depth;
+}
+
+static void Fail (Parser *ps, VStringConst msg)
+{
+    if (! ps->failed)
+	VWarning ("%s: %s at position %d of \"%s\"",
+		  routine, msg, (int) (ps->p - ps->text) + 1, ps->text);
+    ps->failed = TRUE;
+}
+
+
+/*
+ *  Recursive descent parser.
+ */
+
+static void SkipSpace (Parser *ps)
+{
+    while (isspace ((unsigned char) *ps->p))
+	ps->p++;
+}
+
+static VBoolean Accept (Parser *ps, VStringConst token)
+{
+    size_t n = strlen (token);
+
+    SkipSpace (ps);
+    if (strncmp (ps->p, token, n) != 0)
+	return FALSE;
+
+    /* Don't mistake "<=" for "<", "==" for "=", etc.: */
+    if (n == 1 && (*token == '<' || *token == '>' || *token == '!') &&
+	ps->p[1] == '=')
+	return FALSE;
+    ps->p += n;
+    return TRUE;
+}
+
+static void Expect (Parser *ps, VStringConst token)
+{
+    if (! Accept (ps, token))
+	Fail (ps, token[0] == ')' ? "Missing )" :
+	      token[0] == ':' ? "Missing :" : "Syntax error");
+}
+
+static void ParsePrimary (Parser *ps)
+{
+    char name[32];
+    int i, n;
+
+    if (ps->failed)
+	return;
+    SkipSpace (ps);
+
+    /* Parenthesized expression: */
+    if (Accept (ps, "(")) {
+	ParseCond (ps);
+	Expect (ps, ")");
+	return;
+    }
+
+    /* Numeric constant: */
+    if (isdigit ((unsigned char) *ps->p) || *ps->p == '.') {
+	char *end;
+	double value = strtod (ps->p, & end);
+	if (end == ps->p)
+	    Fail (ps, "Bad number");
+	ps->p = end;
+	Emit (ps, OpConst, 0, value);
+	return;
+    }
+
+    /* Identifier: */
+    if (! isalpha ((unsigned char) *ps->p)) {
+	Fail (ps, *ps->p ? "Syntax error" : "Unexpected end of expression");
+	return;
+    }
+    for (n = 0; isalnum ((unsigned char) ps->p[n]) || ps->p[n] == '_'; n++)
+	if (n < (int) sizeof (name) - 1)
+	    name[n] = ps->p[n];
+    name[n < (int) sizeof (name) - 1 ? n : (int) sizeof (name) - 1] = 0;
+    ps->p += n;
+
+    /* Single letters name the images a, b, c, ...: */
+    if (n == 1 && islower ((unsigned char) name[0])) {
+	i = name[0] - 'a';
+	if (i >= ps->expr->nvars) {
+	    Fail (ps, "No such image");
+	    return;
+	}
+	Emit (ps, OpVar, i, 0.0);
+	return;
+    }
+    if (strcmp (name, "pi") == 0) {
+	Emit (ps, OpConst, 0, M_PI);
+	return;
+    }
+
+    /* Function call: */
+    for (i = 0; i < (int) VNumber (functions); i++)
+	if (strcmp (name, functions[i].name) == 0)
+	    break;
+    if (i == VNumber (functions)) {
+	Fail (ps, "Unknown identifier");
+	return;
+    }
+    Expect (ps, "(");
+    ParseCond (ps);
+    for (n = 1; Accept (ps, ","); n++)
+	ParseCond (ps);
+    Expect (ps, ")");
+    if (n != functions[i].nargs)
+	Fail (ps, "Wrong number of function arguments");
+    Emit (ps, functions[i].op, 0, 0.0);
+}
+
+static void ParseUnary (Parser *ps)
+{
+    if (ps->failed)
+	return;
+    if (Accept (ps, "-")) {
+	ParseUnary (ps);
+	Emit (ps, OpNeg, 0, 0.0);
+    } else if (Accept (ps, "!")) {
+	ParseUnary (ps);
+	Emit (ps, OpNot, 0, 0.0);
+    } else if (Accept (ps, "+")) {
+	ParseUnary (ps);
+    } else {
+	ParsePrimary (ps);
+
+	/* Exponentiation is right-associative and binds tighter: */
+	if (Accept (ps, "^")) {
+	    ParseUnary (ps);
+	    Emit (ps, OpPow, 0, 0.0);
+	}
+    }
+}
+
+static void ParseMul (Parser *ps)
+{
+    ParseUnary (ps);
+    while (! ps->failed) {
+	if (Accept (ps, "*")) {
+	    ParseUnary (ps);
+	    Emit (ps, OpMul, 0, 0.0);
+	} else if (Accept (ps, "/")) {
+	    ParseUnary (ps);
+	    Emit (ps, OpDiv, 0, 0.0);
+	} else if (Accept (ps, "%")) {
+	    ParseUnary (ps);
+	    Emit (ps, OpMod, 0, 0.0);
+	} else break;
+    }
+}
+
+static void ParseAdd (Parser *ps)
+{
+    ParseMul (ps);
+    while (! ps->failed) {
+	if (Accept (ps, "+")) {
+	    ParseMul (ps);
+	    Emit (ps, OpAdd, 0, 0.0);
+	} else if (Accept (ps, "-")) {
+	    ParseMul (ps);
+	    Emit (ps, OpSub, 0, 0.0);
+	} else break;
+    }
+}
+
+static void ParseCompare (Parser *ps)
+{
+    static struct {
+	VStringConst token;
+	ExprOpcode op;
+    } ops[] = {
+	{ "<=", OpLe }, { ">=", OpGe }, { "==", OpEq }, { "!=", OpNe },
+	{ "<", OpLt }, { ">", OpGt }
+    };
+    int i;
+
+    ParseAdd (ps);
+    while (! ps->failed) {
+	for (i = 0; i < (int) VNumber (ops); i++)
+	    if (Accept (ps, ops[i].token))
+		break;
+	if (i == VNumber (ops))
+	    break;
+	ParseAdd (ps);
+	Emit (ps, ops[i].op, 0, 0.0);
+    }
+}
+
+static void ParseAnd (Parser *ps)
+{
+    ParseCompare (ps);
+    while (! ps->failed && Accept (ps, "&&")) {
+	ParseCompare (ps);
+	Emit (ps, OpAnd, 0, 0.0);
+    }
+}
+
+static void ParseOr (Parser *ps)
+{
+    ParseAnd (ps);
+    while (! ps->failed && Accept (ps, "||")) {
+	ParseAnd (ps);
+	Emit (ps, OpOr, 0, 0.0);
+    }
+}
+
+static void ParseCond (Parser *ps)
+{
+    ParseOr (ps);
+    if (! ps->failed && Accept (ps, "?")) {
+	ParseCond (ps);
+	Expect (ps, ":");
+	ParseCond (ps);
+	Emit (ps, OpSelect, 0, 0.0);
+    }
+}
+
+
+/*
+ *  VParseExpr
+ *
+ *  Parse an expression over nvars images, named a, b, c, ... in the
+ *  expression. Returns NULL, with a warning, if the expression is not
+ *  well formed.
+ */
+
+VExpr VParseExpr (VStringConst text, int nvars)
+{
+    Parser ps;
+
+    if (nvars < 0 || nvars > 26) {
+	VWarning ("%s: Too many images (%d)", routine, nvars);
+	return NULL;
+    }
+
+    ps.text = ps.p = text;
+    ps.expr = VCalloc (1, sizeof (VExprRec));
+    ps.expr->nvars = nvars;
+    ps.size = ps.depth = 0;
+    ps.failed = FALSE;
+
+    ParseCond (& ps);
+    SkipSpace (& ps);
+    if (! ps.failed && *ps.p)
+	Fail (& ps, "Syntax error");
+
+    if (ps.failed) {
+	VDestroyExpr (ps.expr);
+	return NULL;
+    }
+    return ps.expr;
+}
+
+
+/*
+ *  VDestroyExpr
+ *
+ *  Release an expression returned by VParseExpr.
+ */
+
+void VDestroyExpr (VExpr expr)
+{
+    if (! expr)
+	return;
+    VFree (expr->code);
+    VFree (expr);
+}
+
+
+/*
+ *  LoadBlock, StoreBlock
+ *
+ *  Convert n pixels starting at pixel index i between an image and a
+ *  block of doubles.
+ */
+
+#define LoadPixels(type)						\
+    {									\
+	type *pp = (type *) VImageData (image) + i;			\
+	for (k = 0; k < n; k++)						\
+	    v[k] = pp[k];						\
+    }
+
+static void LoadBlock (VImage image, size_t i, int n, double *v)
+{
+    int k;
+
+    switch (VPixelRepn (image)) {
+    case VBitRepn:	LoadPixels (VBit); break;
+    case VUByteRepn:	LoadPixels (VUByte); break;
+    case VSByteRepn:	LoadPixels (VSByte); break;
+    case VShortRepn:	LoadPixels (VShort); break;
+    case VLongRepn:	LoadPixels (VLong); break;
+    case VFloatRepn:	LoadPixels (VFloat); break;
+    case VDoubleRepn:	LoadPixels (VDouble); break;
+    default: break;
+    }
+}
+
+#undef LoadPixels
+
+/* Floating point results are rounded to the nearest integer for storing
+   in an integer pixel, as in VImageOpU. NaN results are stored as nanval,
+   which is NaN for a floating point pixel and 0 for an integer one. They
+   are not counted as clipped. */
+#define StorePixels(type, round, nanval)					\
+    {									\
+	type *pp = (type *) VImageData (image) + i;			\
+	double t;							\
+	for (k = 0; k < n; k++) {					\
+	    t = v[k];							\
+	    if (t != t)							\
+		t = nanval;						\
+	    else if (t < min) {						\
+		t = min;						\
+		clipped = TRUE;						\
+	    } else if (t > max) {					\
+		t = max;						\
+		clipped = TRUE;						\
+	    }								\
+	    pp[k] = round (t);						\
+	}								\
+    }
+
+#define Nothing
+
+static VBoolean StoreBlock (VImage image, size_t i, int n, double *v,
+			    double min, double max)
+{
+    int k;
+    VBoolean clipped = FALSE;
+
+    switch (VPixelRepn (image)) {
+    case VBitRepn:	StorePixels (VBit, rint, 0.0); break;
+    case VUByteRepn:	StorePixels (VUByte, rint, 0.0); break;
+    case VSByteRepn:	StorePixels (VSByte, rint, 0.0); break;
+    case VShortRepn:	StorePixels (VShort, rint, 0.0); break;
+    case VLongRepn:	StorePixels (VLong, rint, 0.0); break;
+    case VFloatRepn:	StorePixels (VFloat, Nothing, t); break;
+    case VDoubleRepn:	StorePixels (VDouble, Nothing, t); break;
+    default: break;
+    }
+    return clipped;
+}
+
+#undef StorePixels
+
+
+/*
+ *  Execute
+ *
+ *  Run the code of expr on n pixels. Operands of image i are read from
+ *  src[i] starting at pixel index index[i]; the result is left in stack[0].
+ */
+
+#define Unary(expr)							\
+    for (k = 0; k < n; k++) {						\
+	x = s1[k];							\
+	s1[k] = (expr);							\
+    }
+
+#define Binary(expr)							\
+    for (k = 0; k < n; k++) {						\
+	x = s1[k];							\
+	y = s2[k];							\
+	s1[k] = (expr);							\
+    }
+
+static void Execute (VExpr expr, VImage *src, size_t *index, int n,
+		     double *stack)
+{
+    int j, k, top = -1;
+    double *s1, *s2, *s3, x, y;
+    ExprInstr *ins;
+
+    for (j = 0; j < expr->ninstr; j++) {
+	ins = & expr->code[j];
+
+	switch (ins->op) {
+	case OpVar:
+	    top++;
+	    LoadBlock (src[ins->var], index[ins->var], n,
+		       stack + top * BlockSize);
+	    continue;
+	case OpConst:
+	    top++;
+	    s1 = stack + top * BlockSize;
+	    for (k = 0; k < n; k++)
+		s1[k] = ins->value;
+	    continue;
+	case OpSelect:
+	    top -= 2;
+	    s1 = stack + top * BlockSize;
+	    s2 = s1 + BlockSize;
+	    s3 = s2 + BlockSize;
+	    for (k = 0; k < n; k++)
+		s1[k] = s1[k] != 0 ? s2[k] : s3[k];
+	    continue;
+	default:
+	    break;
+	}
+
+	/* Unary operations work on the top of the stack: */
+	if (ins->op < OpAdd) {
+	    s1 = stack + top * BlockSize;
+	    switch (ins->op) {
+	    case OpNeg:   Unary (-x); break;
+	    case OpNot:   Unary (x == 0); break;
+	    case OpAbs:   Unary (fabs (x)); break;
+	    case OpSqrt:  Unary (sqrt (x)); break;
+	    case OpExp:   Unary (exp (x)); break;
+	    case OpLog:   Unary (log (x)); break;
+	    case OpSin:   Unary (sin (x)); break;
+	    case OpCos:   Unary (cos (x)); break;
+	    case OpTan:   Unary (tan (x)); break;
+	    case OpFloor: Unary (floor (x)); break;
+	    case OpCeil:  Unary (ceil (x)); break;
+	    case OpRound: Unary (rint (x)); break;
+	    default: break;
+	    }
+	    continue;
+	}
+
+	/* Binary operations combine the top two entries: */
+	top--;
+	s1 = stack + top * BlockSize;
+	s2 = s1 + BlockSize;
+	switch (ins->op) {
+	case OpAdd:   Binary (x + y); break;
+	case OpSub:   Binary (x - y); break;
+	case OpMul:   Binary (x * y); break;
+	case OpDiv:   Binary (x / y); break;
+	case OpMod:   Binary (fmod (x, y)); break;
+	case OpPow:   Binary (pow (x, y)); break;
+	case OpMin:   Binary (x < y ? x : y); break;
+	case OpMax:   Binary (x > y ? x : y); break;
+	case OpAtan2: Binary (atan2 (x, y)); break;
+	case OpLt:    Binary (x < y); break;
+	case OpLe:    Binary (x <= y); break;
+	case OpGt:    Binary (x > y); break;
+	case OpGe:    Binary (x >= y); break;
+	case OpEq:    Binary (x == y); break;
+	case OpNe:    Binary (x != y); break;
+	case OpAnd:   Binary (x != 0 && y != 0); break;
+	case OpOr:    Binary (x != 0 || y != 0); break;
+	default: break;
+	}
+    }
+}
+
+#undef Unary
+#undef Binary
+
+
+/*
+ *  VImageExpr
+ *
+ *  Evaluate an expression for every pixel of nsrc source images.
+ *
+ *  The source images must have the same numbers of rows and columns,
+ *  and either the same number of bands or a single band, which is then
+ *  used with every band of the others. Their pixel representations may
+ *  differ. All arithmetic is done in double precision. The result is
+ *  clipped to [*minp, *maxp], or to the range of the destination pixel
+ *  representation, and rounded if that representation is an integer one.
+ *  NaN results are stored as NaN in a floating point destination and as 0
+ *  in an integer one. If repn is VUnknownRepn, the representation of the first source image
+ *  is used.
+ */
+
+VImage VImageExpr (VExpr expr, int nsrc, VImage src[], VImage dest,
+		   VRepnKind repn, VDouble *minp, VDouble *maxp)
+{
+    double tbegin = VTraceBegin ();
+    int i, nbands = 1, nrows, ncols;
+    size_t nblocks, bandsize;
+    double min, max;
+    VImage result;
+    VBoolean clipped = FALSE;
+    static VStringConst routine = "VImageExpr";
+
+    if (nsrc < expr->nvars || nsrc < 1) {
+	VWarning ("%s: Expression needs %d source images", routine,
+		  expr->nvars);
+	return NULL;
+    }
+
+    /* Check the source images: */
+    nrows = VImageNRows (src[0]);
+    ncols = VImageNColumns (src[0]);
+    for (i = 0; i < nsrc; i++) {
+	if (VImageNRows (src[i]) != nrows ||
+	    VImageNColumns (src[i]) != ncols) {
+	    VWarning ("%s: Source images have dissimilar properties",
+		      routine);
+	    return NULL;
+	}
+	if (VImageNBands (src[i]) > nbands)
+	    nbands = VImageNBands (src[i]);
+    }
+    for (i = 0; i < nsrc; i++)
+	if (VImageNBands (src[i]) != 1 && VImageNBands (src[i]) != nbands) {
+	    VWarning ("%s: Source images have differing numbers of bands",
+		      routine);
+	    return NULL;
+	}
+
+    /* Locate the destination pixels: */
+    if (repn == VUnknownRepn)
+	repn = VPixelRepn (src[0]);
+    result = VSelectDestImage (routine, dest, nbands, nrows, ncols, repn);
+    if (! result)
+	return NULL;
+
+    /* Establish the clipping range: */
+    if (VIsFloatPtRepn (repn)) {
+	min = -HUGE_VAL;
+	max = HUGE_VAL;
+    } else {
+	min = VRepnMinValue (repn);
+	max = VRepnMaxValue (repn);
+    }
+    if (minp) {
+	if (*minp < min)
+	    VWarning ("%s: Clipping bound out of range; set to %g",
+		      routine, min);
+	else min = *minp;
+    }
+    if (maxp) {
+	if (*maxp > max)
+	    VWarning ("%s: Clipping bound out of range; set to %g",
+		      routine, max);
+	else max = *maxp;
+    }
+    if (min > max)
+	VWarning ("%s: Clipping range is empty", routine);
+
+    /* Blocks never straddle a band boundary, so that single-band sources
+       can be addressed with one offset per block: */
+    bandsize = (size_t) nrows * ncols;
+    nblocks = (bandsize + BlockSize - 1) / BlockSize;
+
+#pragma omp parallel reduction(||:clipped)
+    {
+	double *stack = VMalloc ((expr->depth + 1) * BlockSize * sizeof (double));
+	size_t index[26];
+	long blk;
+	int b, k, n;
+	size_t i0;
+
+#pragma omp for schedule(static)
+	for (blk = 0; blk < (long) (nbands * nblocks); blk++) {
+	    b  = blk / nblocks;
+	    i0 = (blk % nblocks) * BlockSize;
+	    n  = (bandsize - i0 < BlockSize) ? bandsize - i0 : BlockSize;
+
+	    for (k = 0; k < expr->nvars; k++)
+		index[k] = (VImageNBands (src[k]) == 1 ? 0 : b * bandsize) + i0;
+	    Execute (expr, src, index, n, stack);
+	    if (StoreBlock (result, b * bandsize + i0, n, stack, min, max))
+		clipped = TRUE;
+	}
+	VFree (stack);
+    }
+
+    if (clipped)
+	VWarning ("%s: Destination pixel value(s) clipped", routine);
+
+    VCopyImageAttrs (src[0], result);
+    VTraceEnd ("VImageExpr", tbegin, VImageNPixels (result),
+	       (double) VImageSize (result) * nsrc);
+    return result;
+}
@@ -24,14 +24,17 @@
 #include "viaio/file.h"
 #include "viaio/mu.h"
 #include "viaio/os.h"
-#ifdef SupportUbcIff
 #include "viaio/VImage.h"
-#endif
 #include "viaio/VList.h"
 
 /* From the standard C library: */
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 /* File identification string: */
 VRcsId ("$Id: FileIO.c 3177 2008-04-01 14:47:24Z karstenm $");
@@ -49,8 +52,62 @@ typedef struct {
     VAttrListPosn posn;		/* identify of object's attribute */
     VAttrList list;		/* attr list value referring to data */
     size_t length;		/* length of data block */
+    long offset;		/* offset of data block in file's binary data */
 } DataBlock;
 
+/* Description of object with data block to be read by ReadDataAt: */
+typedef struct {
+    VAttrListPosn posn;		/* identify of object's attribute */
+    VBundle b;			/* its value, as read from the header */
+    VRepnKind repn;		/* its type */
+    VBoolean read_data;		/* whether its data is wanted */
+    VLong data, length;		/* position and length of its data block,
+				   data < 0 if it has none */
+    int depth;			/* nesting level within other objects */
+    VPointer value;		/* decoded object */
+} ReadBlock;
+
+typedef struct {
+    ReadBlock *blocks;
+    int nblocks, nalloc;
+} ReadBlockList;
+
+/* From BlockFileIO_2.c: */
+extern VBoolean VReadRegionData (int, off_t, size_t, long, long, long,
+				 int, int, int, int, int, int, char *);
+
+/* From ImageChunks.c: */
+extern VBoolean VChunkLayout (VStringConst, long [3], VBoolean *);
+extern long VChunkCount (long [3], long [3], long [3]);
+extern void VChunkBox (long, long [3], long [3], long [3], long [3], long [3]);
+extern VBoolean VChunkExpand (VPointer, size_t, VPointer, size_t);
+extern long *VChunkIndex (VPointer, long, size_t);
+
+/* Chunks of images stored in chunks, as cached by VCatalogImage: */
+typedef struct V_ChunkRec {
+    struct V_ChunkRec *prev, *next;	/* most recently used first */
+    struct V_ChunkIndex *index;	/* index of the image it belongs to */
+    long k;			/* its number */
+    char *data;			/* its packed pixel data */
+    size_t length;
+} ChunkRec;
+
+typedef struct V_ChunkIndex {
+    long size[3];		/* chunk size */
+    long n[3];			/* number of chunks along each axis */
+    long *offsets;		/* nchunks + 1 offsets, from the file */
+    ChunkRec **chunks;		/* cached chunks, or NULL */
+} ChunkIndex;
+
+typedef struct {
+    ChunkIndex **index;		/* for each catalog entry, read on first use */
+    ChunkRec *first, *last;
+    size_t size;		/* total length of cached chunks */
+} ChunkCache;
+
+/* Maximum total length of cached chunks, per catalog: */
+#define ChunkCacheSize	(64 * 1024 * 1024)
+
 /* Local variables: */
 static long offset;		/* current offset into file's binary data */
 static VList data_list;		/* list of data blocks to write later */
@@ -61,9 +118,14 @@ static VAttrList ReadAttrList (FILE *);
 static char *ReadString (FILE *, char, VStringConst);
 static VBoolean ReadDelimiter (FILE *);
 static VBoolean ReadData (FILE *, VAttrList, VReadFileFilterProc *);
+static VBoolean ReadDataAt (FILE *, VAttrList, VReadFileFilterProc *);
 static VBoolean WriteAttrList (FILE *, VAttrList, int);
 static VBoolean WriteAttr (FILE *, VAttrListPosn *, int);
 static VBoolean WriteString (FILE *, const char *);
+static VBoolean WriteDataBlock (FILE *, long, DataBlock *);
+static void DiscardDataBlocks (void);
+static VBoolean IsRegularFile (FILE *);
+static VBoolean CanWriteAt (FILE *);
 static VBoolean MySeek (FILE *, long);
 
 
@@ -156,6 +218,7 @@ int VReadObjects (FILE *file, VRepnKind repn, VAttrList *attributes,
 
 VAttrList VReadFile (FILE *f, VReadFileFilterProc *filter)
 {
+    double tbegin = VTraceBegin ();
     VAttrList list;
     int i;
 
@@ -186,9 +249,12 @@ VAttrList VReadFile (FILE *f, VReadFileFilterProc *filter)
     if (! (list = ReadAttrList (f)))
 	return NULL;
 
-    /* Swallow the delimiter and read the binary data following it: */
+    /* Swallow the delimiter and read the binary data following it. From
+       a regular file all data blocks are read and decoded concurrently: */
     offset = 0;
-    if (! ReadDelimiter (f) || ! ReadData (f, list, filter)) {
+    if (! ReadDelimiter (f) ||
+	! (IsRegularFile (f) ? ReadDataAt (f, list, filter) :
+	   ReadData (f, list, filter))) {
 	VDestroyAttrList (list);
 	return NULL;
     }
@@ -199,6 +265,7 @@ VAttrList VReadFile (FILE *f, VReadFileFilterProc *filter)
 	ungetc (i, f);
 	VWarning ("VReadFile: File continues beyond expected EOF");
     }
+    VTraceEnd ("VReadFile", tbegin, 0, offset);
     return list;
 }
 
@@ -574,6 +641,816 @@ static VBoolean ReadData (FILE *f, VAttrList list, VReadFileFilterProc *filter)
 }
 
 
+/*
+ *  CollectData
+ *
+ *  Extract the data and length attributes of all objects in an attribute
+ *  list, as ReadData does, and record them in rl.
+ */
+
+static VBoolean CollectData (VAttrList list, VReadFileFilterProc *filter,
+			     int depth, ReadBlockList *rl)
+{
+    VAttrListPosn posn, subposn;
+    VAttrList sublist;
+    VBundle b;
+    VBoolean data_found, length_found;
+    VLong data = -1, length = 0;
+    ReadBlock *rb;
+
+    for (VFirstAttr (list, & posn); VAttrExists (& posn); VNextAttr (& posn)) {
+	switch (VGetAttrRepn (& posn)) {
+
+	case VAttrListRepn:
+
+	    /* Recurse on nested attribute list: */
+	    VGetAttrValue (& posn, NULL, VAttrListRepn, & sublist);
+	    if (! CollectData (sublist, filter, depth, rl))
+		return FALSE;
+	    break;
+
+	case VBundleRepn:
+	    VGetAttrValue (& posn, NULL, VBundleRepn, & b);
+
+	    /* Extract any data and length attributes in the object's value: */
+	    if (data_found = VLookupAttr (b->list, VDataAttr, & subposn)) {
+		if (! VGetAttrValue (& subposn, NULL, VLongRepn, & data) ||
+		    data < 0) {
+		    VWarning ("VReadFile: "
+			      "%s attribute's data attribute incorrect",
+			      VGetAttrName (& posn));
+		    return FALSE;
+		}
+		VDeleteAttr (& subposn);
+	    }
+	    if (length_found = VLookupAttr (b->list, VLengthAttr, & subposn)) {
+		if (! VGetAttrValue (& subposn, NULL, VLongRepn, & length)) {
+		    VWarning ("VReadFile: "
+			      "%s attribute's length attribute incorrect",
+			      VGetAttrName (& posn));
+		    return FALSE;
+		}
+		VDeleteAttr (& subposn);
+	    }
+
+	    /* None or both must be present: */
+	    if (data_found ^ length_found) {
+		VWarning ("VReadFile: %s attribute has %s but not %s",
+			  VGetAttrName (& posn),
+			  data_found ? "data" : "length",
+			  data_found ? "length" : "data");
+		return FALSE;
+	    }
+
+	    if (rl->nblocks == rl->nalloc) {
+		rl->nalloc = rl->nalloc ? 2 * rl->nalloc : 64;
+		rl->blocks = VRealloc (rl->blocks,
+				       rl->nalloc * sizeof (ReadBlock));
+	    }
+	    rb = & rl->blocks[rl->nblocks++];
+	    rb->posn = posn;
+	    rb->b = b;
+	    rb->repn = VLookupType (b->type_name);
+	    rb->read_data = ! filter || (*filter) (b, rb->repn);
+	    rb->data = data_found ? data : -1;
+	    rb->length = data_found ? length : 0;
+	    rb->depth = depth;
+	    rb->value = NULL;
+
+	    /* Recurse to collect binary data for sublist attributes: */
+	    if (! CollectData (b->list, filter, depth + 1, rl))
+		return FALSE;
+	    break;
+
+	default:
+	    break;
+	}
+    }
+    return TRUE;
+}
+
+
+/*
+ *  ReadAt
+ *
+ *  Read a buffer from a file descriptor at a given position.
+ */
+
+static VBoolean ReadAt (int fd, char *buf, size_t len, long pos)
+{
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = pread (fd, buf, len, (off_t) pos)) <= 0) {
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    return FALSE;
+	}
+	buf += n;
+	len -= n;
+	pos += n;
+    }
+    return TRUE;
+}
+
+
+/*
+ *  ReadBlocksAt
+ *
+ *  Read and decode the binary data of all objects in an attribute list,
+ *  whose data blocks start at file position base. All data blocks are
+ *  first located from the header, then read with pread and decoded
+ *  concurrently. Objects nested in other objects are decoded first, as in
+ *  ReadData. The end of the last data block, relative to base, is
+ *  returned in *endp.
+ */
+
+static VBoolean ReadBlocksAt (int fd, long base, VAttrList list,
+			      VReadFileFilterProc *filter, long *endp)
+{
+    ReadBlockList rl;
+    ReadBlock *rb;
+    VTypeMethods *methods;
+    VBoolean result = TRUE;
+    long end = 0;
+    int i, depth, maxdepth = 0;
+
+    rl.blocks = NULL;
+    rl.nblocks = rl.nalloc = 0;
+    if (! CollectData (list, filter, 0, & rl)) {
+	VFree (rl.blocks);
+	return FALSE;
+    }
+    for (i = 0; i < rl.nblocks; i++) {
+	rb = & rl.blocks[i];
+	if (rb->data >= 0 && rb->data + rb->length > end)
+	    end = rb->data + rb->length;
+	if (rb->depth > maxdepth)
+	    maxdepth = rb->depth;
+    }
+
+    /* Read and decode the data blocks, innermost objects first. Each
+       block is decoded right after it is read, so that the packed data
+       can be freed again: */
+    for (depth = maxdepth; depth >= 0 && result; depth--) {
+
+#pragma omp parallel for schedule(dynamic,1) private(rb,methods)
+	for (i = 0; i < rl.nblocks; i++) {
+	    rb = & rl.blocks[i];
+	    if (rb->depth != depth || ! rb->read_data)
+		continue;
+	    if (rb->data >= 0) {
+		rb->b->data = VMalloc (rb->b->length = rb->length);
+		if (! ReadAt (fd, rb->b->data, rb->length, base + rb->data)) {
+		    VWarning ("VReadFile: Read from stream failed");
+		    result = FALSE;
+		    continue;
+		}
+	    }
+	    if (rb->repn == VUnknownRepn ||
+		! (methods = VRepnMethods (rb->repn)) || ! methods->decode)
+		continue;
+	    if (! (rb->value = (methods->decode)
+		   (VGetAttrName (& rb->posn), rb->b)))
+		result = FALSE;
+	    else {
+		VFree (rb->b->data);
+		rb->b->data = NULL;
+		rb->b->length = 0;
+	    }
+	}
+
+	/* Replace the old typed values with the newly decoded ones: */
+	for (i = 0; i < rl.nblocks; i++) {
+	    rb = & rl.blocks[i];
+	    if (rb->depth != depth || ! rb->value)
+		continue;
+	    VSetAttrValue (& rb->posn, NULL, rb->repn, rb->value);
+	    VDestroyBundle (rb->b);
+	}
+    }
+    VFree (rl.blocks);
+
+    *endp = end;
+    return result;
+}
+
+
+/*
+ *  ReadDataAt
+ *
+ *  Read the binary data accompanying attributes, like ReadData, from a
+ *  stream that refers to a regular file (see ReadBlocksAt).
+ *  On return the stream is positioned after the last data block.
+ */
+
+static VBoolean ReadDataAt (FILE *f, VAttrList list,
+			    VReadFileFilterProc *filter)
+{
+    long base, end;
+    VBoolean result;
+
+    if ((base = ftell (f)) < 0)
+	return ReadData (f, list, filter);
+
+    result = ReadBlocksAt (fileno (f), base, list, filter, & end);
+    if (! result)
+	return FALSE;
+
+    offset = end;
+    if (fseek (f, base + end, SEEK_SET) != 0) {
+	VSystemWarning ("VReadFile: Seek within file failed");
+	return FALSE;
+    }
+    return TRUE;
+}
+
+
+/*
+ *  VReadCatalog
+ *
+ *  Read the header of a Vista data file and return a catalog of its
+ *  top-level attributes, with the size and file position of each
+ *  object's binary data. No binary data is read: objects, bands or
+ *  sub-volumes of images are read on demand by VCatalogObject and
+ *  VCatalogImage. If the stream is not a regular file, it cannot be
+ *  positioned, so the whole file is read by VReadFile instead.
+ */
+
+VCatalog VReadCatalog (FILE *f)
+{
+    double tbegin = VTraceBegin ();
+    VCatalog cat;
+    VCatalogEntry *e;
+    VAttrListPosn posn, subposn;
+    VBundle b;
+    VImage image;
+    VLong data, length;
+    int n;
+
+    cat = VMalloc (sizeof (VCatalogRec));
+    cat->file = f;
+    cat->list = NULL;
+    cat->base = -1;
+    cat->nentries = 0;
+    cat->entries = NULL;
+    cat->cache = NULL;
+
+    if (IsRegularFile (f)) {
+	if (! ReadHeader (f) || ! (cat->list = ReadAttrList (f)) ||
+	    ! ReadDelimiter (f) || (cat->base = ftell (f)) < 0)
+	    goto Fail;
+    } else if (! (cat->list = VReadFile (f, NULL)))
+	goto Fail;
+
+    for (VFirstAttr (cat->list, & posn), n = 0; VAttrExists (& posn);
+	 VNextAttr (& posn))
+	n++;
+    cat->entries = VCalloc (n > 0 ? n : 1, sizeof (VCatalogEntry));
+
+    for (VFirstAttr (cat->list, & posn); VAttrExists (& posn);
+	 VNextAttr (& posn)) {
+	e = & cat->entries[cat->nentries++];
+	e->name = VGetAttrName (& posn);
+	e->repn = VGetAttrRepn (& posn);
+	e->posn = posn;
+	e->data = -1;
+	e->length = 0;
+	e->nbands = e->nrows = e->ncolumns = 0;
+	e->pixel_repn = VUnknownRepn;
+	VGetAttrValue (& posn, NULL, e->repn, & e->value);
+
+	if (e->repn == VImageRepn) {
+
+	    /* A decoded image, read from a stream: */
+	    image = e->value;
+	    e->nbands = VImageNBands (image);
+	    e->nrows = VImageNRows (image);
+	    e->ncolumns = VImageNColumns (image);
+	    e->pixel_repn = VPixelRepn (image);
+	    continue;
+	}
+	if (e->repn != VBundleRepn)
+	    continue;
+
+	/* An object as described by the header. Take its data and length
+	   attributes, which refer to the file, out of its attribute list: */
+	b = e->value;
+	if (cat->base >= 0 && VLookupAttr (b->list, VDataAttr, & subposn)) {
+	    if (! VGetAttrValue (& subposn, NULL, VLongRepn, & data) ||
+		data < 0 ||
+		VGetAttr (b->list, VLengthAttr, NULL,
+			  VLongRepn, & length) != VAttrFound) {
+		VWarning ("VReadCatalog: "
+			  "%s attribute's data attribute incorrect", e->name);
+		goto Fail;
+	    }
+	    VDeleteAttr (& subposn);
+	    VLookupAttr (b->list, VLengthAttr, & subposn);
+	    VDeleteAttr (& subposn);
+	    e->data = data;
+	    e->length = length;
+	}
+	if ((e->repn = VLookupType (b->type_name)) == VUnknownRepn)
+	    e->repn = VBundleRepn;
+
+	/* For images, note their size: */
+	if (e->repn == VImageRepn) {
+	    e->nbands = 1;
+	    VGetAttr (b->list, VNBandsAttr, NULL, VLongRepn, & e->nbands);
+	    if (VGetAttr (b->list, VNRowsAttr, NULL,
+			  VLongRepn, & e->nrows) != VAttrFound ||
+		VGetAttr (b->list, VNColumnsAttr, NULL,
+			  VLongRepn, & e->ncolumns) != VAttrFound ||
+		VGetAttr (b->list, VRepnAttr, VNumericRepnDict,
+			  VLongRepn, & data) != VAttrFound) {
+		VWarning ("VReadCatalog: %s image has incomplete header",
+			  e->name);
+		goto Fail;
+	    }
+	    e->pixel_repn = (VRepnKind) data;
+	}
+    }
+    VTraceEnd ("VReadCatalog", tbegin, 0, 0);
+    return cat;
+
+Fail:
+    VDestroyCatalog (cat);
+    return NULL;
+}
+
+
+/*
+ *  VCatalogObject
+ *
+ *  Read the value of the i-th attribute of a catalog, decoding any
+ *  objects in it as VReadFile does. The value returned is owned by the
+ *  caller; its type is that of the catalog entry. If the catalog was made
+ *  from a stream that is not a regular file, the object is taken out of
+ *  the catalog, so it can be obtained only once.
+ */
+
+VPointer VCatalogObject (VCatalog cat, int i)
+{
+    double tbegin = VTraceBegin ();
+    VCatalogEntry *e;
+    VAttrList list;
+    VAttrListPosn posn;
+    VBundle b;
+    VPointer value;
+    long end;
+
+    if (i < 0 || i >= cat->nentries) {
+	VWarning ("VCatalogObject: No object %d in catalog", i);
+	return NULL;
+    }
+    e = & cat->entries[i];
+    if (! e->value) {
+	VWarning ("VCatalogObject: %s was already taken from catalog",
+		  e->name);
+	return NULL;
+    }
+
+    /* The file has been read entirely: hand over the value, leaving the
+       attribute in the catalog's list with a null pointer. (Deleting it
+       would free the name that e->name points to.) */
+    if (VGetAttrRepn (& e->posn) == VStringRepn)
+	return VNewString (e->value);
+    if (cat->base < 0) {
+	value = e->value;
+	VSetAttrValue (& e->posn, NULL, VPointerRepn, (VPointer) NULL);
+	e->value = NULL;
+	return value;
+    }
+
+    /* Otherwise make a copy of the header's attribute, with its data
+       attributes restored, and read its data: */
+    list = VCreateAttrList ();
+    if (VGetAttrRepn (& e->posn) == VBundleRepn) {
+	b = e->value;
+	b = VCreateBundle (b->type_name, VCopyAttrList (b->list), 0, NULL);
+	if (e->data >= 0) {
+	    VSetAttr (b->list, VDataAttr, NULL, VLongRepn, (VLong) e->data);
+	    VSetAttr (b->list, VLengthAttr, NULL,
+		      VLongRepn, (VLong) e->length);
+	}
+	VAppendAttr (list, e->name, NULL, VBundleRepn, b);
+    } else
+	VAppendAttr (list, e->name, NULL, VAttrListRepn,
+		     VCopyAttrList (e->value));
+
+    if (! ReadBlocksAt (fileno (cat->file), cat->base, list, NULL, & end)) {
+	VDestroyAttrList (list);
+	return NULL;
+    }
+    VFirstAttr (list, & posn);
+    VGetAttrValue (& posn, NULL, VGetAttrRepn (& posn), & value);
+    VDeleteAttr (& posn);
+    VDestroyAttrList (list);
+    VTraceEnd ("VCatalogObject", tbegin, 0, e->length);
+    return value;
+}
+
+
+/*
+ *  CopyBox
+ *
+ *  Copy a box of bands, rows and columns of src to dest, filling the part
+ *  of the box outside src with zeros.
+ */
+
+static void CopyBox (VImage src, VImage dest, int band, int top, int left)
+{
+    int b, r, b0, b1, r0, r1, c0, c1;
+    size_t size = VPixelSize (src);
+
+    memset (VImageData (dest), 0, VImageSize (dest));
+    b0 = band > 0 ? band : 0;
+    b1 = band + VImageNBands (dest);
+    if (b1 > VImageNBands (src)) b1 = VImageNBands (src);
+    r0 = top > 0 ? top : 0;
+    r1 = top + VImageNRows (dest);
+    if (r1 > VImageNRows (src)) r1 = VImageNRows (src);
+    c0 = left > 0 ? left : 0;
+    c1 = left + VImageNColumns (dest);
+    if (c1 > VImageNColumns (src)) c1 = VImageNColumns (src);
+    if (c0 >= c1)
+	return;
+
+    for (b = b0; b < b1; b++)
+	for (r = r0; r < r1; r++)
+	    memcpy (VPixelPtr (dest, b - band, r - top, c0 - left),
+		    VPixelPtr (src, b, r, c0), (c1 - c0) * size);
+}
+
+
+/*
+ *  ReadChunkBox
+ *
+ *  Collect the packed pixel data of a box of an image stored in chunks
+ *  (see ImageChunks.c), as VReadRegionData does for an image stored band
+ *  by band. The chunk index is read on first use. Chunks not in the cache
+ *  are read and expanded in parallel; the least recently used ones are
+ *  dropped when the cache exceeds ChunkCacheSize.
+ */
+
+static VBoolean ReadChunkBox (VCatalog cat, int i, VStringConst layout,
+			      int band, int top, int left,
+			      int nbands, int nrows, int ncolumns, char *dest)
+{
+    VCatalogEntry *e = & cat->entries[i];
+    ChunkCache *cache;
+    ChunkIndex *index;
+    ChunkRec *c, **need;
+    long dims[3], box[3], ext[3], lo[3], hi[3], kb, kr, kc, j, m, nchunks;
+    size_t size = VRepnPrecision (e->pixel_repn) / 8, len;
+    int fd = fileno (cat->file), a;
+    char *buf;
+    VBoolean ok = TRUE;
+
+    dims[0] = e->nbands;
+    dims[1] = e->nrows;
+    dims[2] = e->ncolumns;
+    box[0] = band;
+    box[1] = top;
+    box[2] = left;
+    ext[0] = nbands;
+    ext[1] = nrows;
+    ext[2] = ncolumns;
+
+    /* Read the chunk index: */
+    if (! (cache = cat->cache)) {
+	cache = cat->cache = VCalloc (1, sizeof (ChunkCache));
+	cache->index = VCalloc (cat->nentries, sizeof (ChunkIndex *));
+    }
+    if (! (index = cache->index[i])) {
+	index = VCalloc (1, sizeof (ChunkIndex));
+	if (! VChunkLayout (layout, index->size, NULL)) {
+	    VWarning ("VCatalogImage: %s image has bad %s attribute",
+		      e->name, VChunkDataAttr);
+	    VFree (index);
+	    return FALSE;
+	}
+	nchunks = VChunkCount (dims, index->size, index->n);
+	len = (nchunks + 1) * 8;
+	buf = VMalloc (len);
+	if (e->length < len ||
+	    ! ReadAt (fd, buf, len, cat->base + e->data) ||
+	    ! (index->offsets = VChunkIndex (buf, nchunks, e->length))) {
+	    VFree (buf);
+	    VFree (index);
+	    return FALSE;
+	}
+	VFree (buf);
+	index->chunks = VCalloc (nchunks, sizeof (ChunkRec *));
+	cache->index[i] = index;
+    }
+
+    /* Clip the box to the image, zeroing it if it extends beyond: */
+    for (a = 0; a < 3; a++) {
+	lo[a] = box[a] > 0 ? box[a] : 0;
+	hi[a] = box[a] + ext[a] < dims[a] ? box[a] + ext[a] : dims[a];
+	if (lo[a] != box[a] || hi[a] != box[a] + ext[a])
+	    ok = FALSE;
+    }
+    if (! ok)
+	memset (dest, 0, (size_t) nbands * nrows * ncolumns * size);
+    for (a = 0; a < 3; a++)
+	if (lo[a] >= hi[a])
+	    return TRUE;
+    ok = TRUE;
+
+    /* List the chunks overlapping the box, making records for those not
+       in the cache: */
+    m = 1;
+    for (a = 0; a < 3; a++)
+	m *= (hi[a] - 1) / index->size[a] - lo[a] / index->size[a] + 1;
+    need = VMalloc (m * sizeof (ChunkRec *));
+    j = 0;
+    for (kb = lo[0] / index->size[0]; kb <= (hi[0] - 1) / index->size[0]; kb++)
+	for (kr = lo[1] / index->size[1];
+	     kr <= (hi[1] - 1) / index->size[1]; kr++)
+	    for (kc = lo[2] / index->size[2];
+		 kc <= (hi[2] - 1) / index->size[2]; kc++) {
+		long k = (kb * index->n[1] + kr) * index->n[2] + kc;
+
+		if (! (c = index->chunks[k])) {
+		    c = VCalloc (1, sizeof (ChunkRec));
+		    c->index = index;
+		    c->k = k;
+		}
+		need[j++] = c;
+	    }
+
+    /* Read and expand the missing chunks, and copy the part of each
+       chunk within the box: */
+#pragma omp parallel for schedule(dynamic,1) private(c,a)
+    for (j = 0; j < m; j++) {
+	long start[3], cext[3], s[3], t[3], b, r, *off = index->offsets;
+	char *stored;
+
+	c = need[j];
+	VChunkBox (c->k, dims, index->size, index->n, start, cext);
+	if (! c->data) {
+	    if (! ok)
+		continue;
+	    c->length = cext[0] * cext[1] * cext[2] * size;
+	    c->data = VMalloc (c->length);
+	    stored = VMalloc (off[c->k + 1] - off[c->k]);
+	    if (! ReadAt (fd, stored, off[c->k + 1] - off[c->k],
+			  cat->base + e->data + off[c->k]) ||
+		! VChunkExpand (stored, off[c->k + 1] - off[c->k],
+				c->data, c->length))
+		ok = FALSE;
+	    VFree (stored);
+	}
+	for (a = 0; a < 3; a++) {
+	    s[a] = start[a] > lo[a] ? start[a] : lo[a];
+	    t[a] = start[a] + cext[a] < hi[a] ? start[a] + cext[a] : hi[a];
+	}
+	for (b = s[0]; b < t[0]; b++)
+	    for (r = s[1]; r < t[1]; r++)
+		memcpy (dest + (((b - box[0]) * nrows + r - box[1]) * ncolumns +
+				s[2] - box[2]) * size,
+			c->data + (((b - start[0]) * cext[1] + r - start[1]) *
+				   cext[2] + s[2] - start[2]) * size,
+			(t[2] - s[2]) * size);
+    }
+
+    /* Move the chunks to the front of the cache, keeping new ones only if
+       all were read: */
+    for (j = m - 1; j >= 0; j--) {
+	c = need[j];
+	if (index->chunks[c->k] == c) {
+	    if (c->prev)
+		c->prev->next = c->next;
+	    else cache->first = c->next;
+	    if (c->next)
+		c->next->prev = c->prev;
+	    else cache->last = c->prev;
+	} else if (! ok) {
+	    VFree (c->data);
+	    VFree (c);
+	    continue;
+	} else {
+	    index->chunks[c->k] = c;
+	    cache->size += c->length;
+	}
+	c->prev = NULL;
+	c->next = cache->first;
+	if (cache->first)
+	    cache->first->prev = c;
+	else cache->last = c;
+	cache->first = c;
+    }
+    VFree (need);
+
+    /* Drop the least recently used chunks: */
+    while (cache->size > ChunkCacheSize && (c = cache->last)) {
+	cache->last = c->prev;
+	if (c->prev)
+	    c->prev->next = NULL;
+	else cache->first = NULL;
+	c->index->chunks[c->k] = NULL;
+	cache->size -= c->length;
+	VFree (c->data);
+	VFree (c);
+    }
+    return ok;
+}
+
+
+/*
+ *  VCatalogImage
+ *
+ *  Read a box of bands, rows and columns of the i-th attribute of a
+ *  catalog, which must be an image. Only the pixels within the box are
+ *  read from the file (see VReadRegionData). Of an image stored in chunks,
+ *  only the chunks covering the box are read, and recently used chunks are
+ *  kept in a cache (see ReadChunkBox). Any part of the box outside the
+ *  image is filled with zeros. The image returned has the attributes of
+ *  the stored image.
+ */
+
+VImage VCatalogImage (VCatalog cat, int i, int band, int top, int left,
+		      int nbands, int nrows, int ncolumns)
+{
+    double tbegin = VTraceBegin ();
+    VCatalogEntry *e;
+    VImage src, dest;
+    VBundle b;
+    VAttrList list;
+    VAttrListPosn posn;
+    VString layout;
+    char *data;
+    size_t size, length;
+    long nb, nr, nc, end;
+    int fd, k;
+    VBoolean ok;
+
+    if (i < 0 || i >= cat->nentries || cat->entries[i].repn != VImageRepn) {
+	VWarning ("VCatalogImage: Object %d is not an image", i);
+	return NULL;
+    }
+    e = & cat->entries[i];
+    if (nbands <= 0 || nrows <= 0 || ncolumns <= 0) {
+	VWarning ("VCatalogImage: Size of %s box must be positive", e->name);
+	return NULL;
+    }
+    nb = e->nbands;
+    nr = e->nrows;
+    nc = e->ncolumns;
+
+    /* A decoded image, or bits which are not addressable individually in
+       the file, are cropped in memory: */
+    if (cat->base < 0 || e->pixel_repn == VBitRepn || e->data < 0) {
+	if (cat->base < 0) {
+	    if (! (src = e->value)) {
+		VWarning ("VCatalogImage: %s was already taken from catalog",
+			  e->name);
+		return NULL;
+	    }
+	} else if (! (src = VCatalogObject (cat, i)))
+	    return NULL;
+	dest = VCreateImage (nbands, nrows, ncolumns, e->pixel_repn);
+	CopyBox (src, dest, band, top, left);
+	VCopyImageAttrs (src, dest);
+	if (cat->base >= 0)
+	    VDestroyImage (src);
+	VTraceEnd ("VCatalogImage", tbegin, VImageNPixels (dest), 0);
+	return dest;
+    }
+
+    /* Collect the packed pixel data of the box, which is zero outside the
+       image, and decode it as if it had been stored that way: */
+    size = VRepnPrecision (e->pixel_repn) / 8;
+    length = (size_t) nbands * nrows * ncolumns * size;
+    data = VMalloc (length);
+    fd = fileno (cat->file);
+
+    if (VGetAttr (((VBundle) e->value)->list, VChunkDataAttr, NULL,
+		  VStringRepn, & layout) == VAttrFound)
+	ok = ReadChunkBox (cat, i, layout, band, top, left,
+			   nbands, nrows, ncolumns, data);
+    else ok = VReadRegionData (fd, (off_t) (cat->base + e->data), size,
+			       nb, nr, nc, band, top, left,
+			       nbands, nrows, ncolumns, data);
+    if (! ok) {
+	VWarning ("VCatalogImage: Read from stream failed");
+	VFree (data);
+	return NULL;
+    }
+
+    /* The box has its own size. The subdivision of bands into frames,
+       colors etc. holds only if all bands are read. Objects among the
+       image's attributes are read whole: */
+    list = VCopyAttrList (((VBundle) e->value)->list);
+    if (! ReadBlocksAt (fd, cat->base, list, NULL, & end)) {
+	VDestroyAttrList (list);
+	VFree (data);
+	return NULL;
+    }
+    if (VLookupAttr (list, VChunkDataAttr, & posn))
+	VDeleteAttr (& posn);
+    VSetAttr (list, VNBandsAttr, NULL, VLongRepn, (VLong) nbands);
+    VSetAttr (list, VNRowsAttr, NULL, VLongRepn, (VLong) nrows);
+    VSetAttr (list, VNColumnsAttr, NULL, VLongRepn, (VLong) ncolumns);
+    if (band != 0 || nbands != nb) {
+
+	/* As VCopyImageAttrs does, the bands become frames: */
+	static VStringConst interp[] = {
+	    VNViewpointsAttr, VNColorsAttr, VNComponentsAttr,
+	    VFrameInterpAttr, VViewpointInterpAttr, VColorInterpAttr,
+	    VComponentInterpAttr
+	};
+	for (k = 0; k < VNumber (interp); k++)
+	    if (VLookupAttr (list, interp[k], & posn))
+		VDeleteAttr (& posn);
+	VSetAttr (list, VNFramesAttr, NULL, VLongRepn, (VLong) nbands);
+    }
+    b = VCreateBundle (((VBundle) e->value)->type_name, list, length, data);
+    dest = (VRepnMethods (VImageRepn)->decode) (e->name, b);
+    VDestroyBundle (b);
+    VTraceEnd ("VCatalogImage", tbegin, (double) nbands * nrows * ncolumns,
+	       length);
+    return dest;
+}
+
+
+/*
+ *  VCatalogLevel
+ *
+ *  Return the index of the catalog entry holding pyramid level `level' of
+ *  the image in entry i, or -1 if there is none. The levels of an image
+ *  are the images following it with a pyramid_level attribute, as written
+ *  by vpyramid; level 0 is the image itself. An image that is a level has
+ *  no levels.
+ */
+
+int VCatalogLevel (VCatalog cat, int i, int level)
+{
+    VCatalogEntry *e;
+    VAttrList list;
+    VLong k;
+    int j;
+
+    if (i < 0 || i >= cat->nentries || cat->entries[i].repn != VImageRepn)
+	return -1;
+    if (level == 0)
+	return i;
+    for (j = i; j < cat->nentries; j++) {
+	e = & cat->entries[j];
+	if (e->repn != VImageRepn || ! e->value)
+	    break;
+	list = cat->base < 0 ? VImageAttrList ((VImage) e->value) :
+	    ((VBundle) e->value)->list;
+	if (VGetAttr (list, VPyramidLevelAttr, NULL, VLongRepn, & k) !=
+	    VAttrFound)
+	    k = 0;
+	if ((j == i) != (k <= 0))
+	    break;
+	if (k == level)
+	    return j;
+    }
+    return -1;
+}
+
+
+/*
+ *  VDestroyCatalog
+ *
+ *  Discard a catalog and any objects in it not yet obtained from it.
+ *  The catalog's stream is not closed.
+ */
+
+void VDestroyCatalog (VCatalog cat)
+{
+    ChunkCache *cache = cat->cache;
+    ChunkRec *c;
+    int i;
+
+    if (cache) {
+	while ((c = cache->first)) {
+	    cache->first = c->next;
+	    VFree (c->data);
+	    VFree (c);
+	}
+	for (i = 0; i < cat->nentries; i++)
+	    if (cache->index[i]) {
+		VFree (cache->index[i]->offsets);
+		VFree (cache->index[i]->chunks);
+		VFree (cache->index[i]);
+	    }
+	VFree (cache->index);
+	VFree (cache);
+    }
+    if (cat->list)
+	VDestroyAttrList (cat->list);
+    VFree (cat->entries);
+    VFree (cat);
+}
+
+
 /*
  *  VWriteObjects
  *
@@ -615,12 +1492,11 @@ VBoolean VWriteObjects (FILE *file, VRepnKind repn, VAttrList attributes,
 
 VBoolean VWriteFile (FILE *f, VAttrList list)
 {
-    DataBlock *db;
-    VBundle b;
-    VTypeMethods *methods;
-    VRepnKind repn;
-    VPointer value, ptr;
-    VBoolean result, free_it;
+    double tbegin = VTraceBegin ();
+    DataBlock *db, **blocks;
+    long base;
+    int i, n;
+    VBoolean result = TRUE;
 
     /* Write the Vista data file header, attribute list, and delimeter
        while queuing on data_list any binary data blocks to be written: */
@@ -628,54 +1504,160 @@ VBoolean VWriteFile (FILE *f, VAttrList list)
     data_list = VListCreate ();
     FailTest (fprintf (f, "%s %d ", VFileHeader, VFileVersion));
     if (! WriteAttrList (f, list, 1)) {
-	VListDestroy (data_list, VFree);
+	DiscardDataBlocks ();
 	return FALSE;
     }
     FailTest (fputs ("\n" VFileDelimiter, f));
-    fflush (f);
+    if (fflush (f) == EOF)
+	goto Fail;
 
-    /* Traverse data_list to write the binary data blocks: */
-    for (db = VListFirst (data_list); db; db = VListNext (data_list)) {
-	repn = VGetAttrRepn (& db->posn);
-	if (repn == VBundleRepn) {
+    if (CanWriteAt (f) && (base = ftell (f)) >= 0) {
 
-	    /* A typed value includes its binary data block explicitly: */
-	    VGetAttrValue (& db->posn, NULL, VBundleRepn, & b);
-	    ptr = b->data;
-	    free_it = FALSE;
+	/* The offset of each data block is known, so the blocks can be
+	   encoded and written concurrently with pwrite. Afterwards the
+	   stream is positioned at the end of the data: */
+	n = VListCount (data_list);
+	blocks = VMalloc (n * sizeof (DataBlock *));
+	for (i = 0, db = VListFirst (data_list); db;
+	     db = VListNext (data_list))
+	    blocks[i++] = db;
 
-	} else {
+#pragma omp parallel for schedule(dynamic,1) if (n > 1)
+	for (i = 0; i < n; i++)
+	    if (! WriteDataBlock (f, base + blocks[i]->offset, blocks[i]))
+		result = FALSE;
 
-	    /* For any other representation, obtain the binary data block
-	       from its encode_data method: */
-	    VGetAttrValue (& db->posn, NULL, repn, & value);
-	    methods = VRepnMethods (repn);
-	    ptr = (methods->encode_data)
-		(value, db->list, db->length, & free_it);
-	    if (! ptr)
-		goto Fail;
-	}
+	VFree (blocks);
+	if (fseek (f, base + offset, SEEK_SET) != 0)
+	    result = FALSE;
 
-	/* Write the binary data and free the buffer containing it if it was
-	   allocated temporarily by an encode_data method: */
-	if (db->length > 0) {
-	    result = fwrite (ptr, 1, db->length, f) == db->length;
-	    if (free_it)
-		VFree (ptr);
-	    if (! result)
-		goto Fail;
-	}
+    } else {
+
+	/* Traverse data_list to write the binary data blocks: */
+	for (db = VListFirst (data_list); db && result;
+	     db = VListNext (data_list))
+	    result = WriteDataBlock (f, -1, db);
     }
+    if (! result)
+	goto Fail;
+
     VListDestroy (data_list, VFree);
+    VTraceEnd ("VWriteFile", tbegin, 0, offset);
     return TRUE;
 
 Fail:
     VWarning ("VWriteFile: Write to stream failed");
-    VListDestroy (data_list, VFree);
+    DiscardDataBlocks ();
     return FALSE;
 }
 
 
+/*
+ *  DiscardDataBlocks
+ *
+ *  Empty the queue of binary data blocks after a failed write, discarding
+ *  anything prepared for writing the data of images (see ImageChunks.c).
+ */
+
+static void DiscardDataBlocks (void)
+{
+    DataBlock *db;
+    VPointer value;
+
+    for (db = VListFirst (data_list); db; db = VListNext (data_list))
+	if (VGetAttrRepn (& db->posn) == VImageRepn) {
+	    VGetAttrValue (& db->posn, NULL, VImageRepn, & value);
+	    VImageDropChunks (value);
+	}
+    VListDestroy (data_list, VFree);
+}
+
+
+/*
+ *  WriteDataBlock
+ *
+ *  Write the binary data of an object queued by WriteAttr, either to the
+ *  stream (pos < 0) or at file position pos (see VWritePackedData).
+ */
+
+static VBoolean WriteDataBlock (FILE *f, long pos, DataBlock *db)
+{
+    VBundle b;
+    VTypeMethods *methods;
+    VRepnKind repn;
+    VPointer value, ptr;
+    VBoolean result, free_it;
+
+    repn = VGetAttrRepn (& db->posn);
+    if (repn == VBundleRepn) {
+
+	/* A typed value includes its binary data block explicitly: */
+	VGetAttrValue (& db->posn, NULL, VBundleRepn, & b);
+	ptr = b->data;
+	free_it = FALSE;
+
+    } else if (repn == VImageRepn) {
+
+	/* Images are packed and written in chunks: */
+	VGetAttrValue (& db->posn, NULL, repn, & value);
+	return VImageWriteData (f, pos, value, db->list, db->length);
+
+    } else {
+
+	/* For any other representation, obtain the binary data block
+	   from its encode_data method: */
+	VGetAttrValue (& db->posn, NULL, repn, & value);
+	methods = VRepnMethods (repn);
+	ptr = (methods->encode_data)
+	    (value, db->list, db->length, & free_it);
+	if (! ptr)
+	    return FALSE;
+    }
+
+    /* Write the binary data and free the buffer containing it if it was
+       allocated temporarily by an encode_data method: */
+    result = TRUE;
+    if (db->length > 0) {
+	result = VWritePackedData (f, pos, VUByteRepn, db->length, ptr,
+				   VMsbFirst);
+	if (free_it)
+	    VFree (ptr);
+    }
+    return result;
+}
+
+
+/*
+ *  IsRegularFile
+ *
+ *  Whether a stream refers to a regular file, which can be accessed
+ *  with pread and pwrite.
+ */
+
+static VBoolean IsRegularFile (FILE *f)
+{
+    struct stat st;
+
+    return fstat (fileno (f), & st) == 0 && S_ISREG (st.st_mode);
+}
+
+
+/*
+ *  CanWriteAt
+ *
+ *  Whether data can be written to a stream at given positions with
+ *  pwrite: it must refer to a regular file that is not open for
+ *  appending, since appending writes ignore the position.
+ */
+
+static VBoolean CanWriteAt (FILE *f)
+{
+    int flags = fcntl (fileno (f), F_GETFL);
+
+    return IsRegularFile (f) && flags != -1 && ! (flags & O_APPEND);
+}
+
+
 /*
  *  WriteAttrList
  *
@@ -760,11 +1742,12 @@ static VBoolean WriteAttr (FILE *f, VAttrListPosn *posn, int indent)
 			  (VLong) offset);
 
 	    /* Add it to the queue of binary data blocks to be written: */
-	    offset += b->length;
 	    db = VNew (DataBlock);
 	    db->posn = *posn;
 	    db->list = b->list;
 	    db->length = b->length;
+	    db->offset = offset;
+	    offset += b->length;
 	    VListAppend (data_list, db);
 	}
 
@@ -803,6 +1786,13 @@ static VBoolean WriteAttr (FILE *f, VAttrListPosn *posn, int indent)
 	VGetAttrValue (posn, NULL, repn, & value);
 	sublist = (methods->encode_attr) (value, & length);
 
+	/* Add the object to the queue of binary data blocks to be written: */
+	db = VNew (DataBlock);
+	db->posn = *posn;
+	db->list = sublist;
+	db->length = length;
+	db->offset = offset;
+
 	/* If binary data is indicated... */
 	if (length > 0) {
 
@@ -814,12 +1804,6 @@ static VBoolean WriteAttr (FILE *f, VAttrListPosn *posn, int indent)
 
 	    offset += length;
 	}
-
-	/* Add the object to the queue of binary data blocks to be written: */
-	db = VNew (DataBlock);
-	db->posn = *posn;
-	db->list = sublist;
-	db->length = length;
 	VListAppend (data_list, db);
 
 	/* Write the typed value's attribute list: */
@@ -46,11 +46,31 @@ VDictEntry VBandInterpDict[] = {
 };
 
 
+/*
+ *  ImageAllocSize
+ *
+ *  Returns the size of the single block allocated by VCreateImage.
+ */
+
+#define AlignUp(v, b) ((((v) + (b) - 1) / (b)) * (b))
+
+static size_t ImageAllocSize (VImage image)
+{
+  size_t pixel_size = VRepnSize (image->pixel_repn);
+  size_t nrows = (size_t) image->nbands * image->nrows;
+
+  return AlignUp (sizeof (VImageRec) + nrows * sizeof (char *) +
+		  image->nbands * sizeof (char **), pixel_size) +
+    nrows * image->ncolumns * pixel_size;
+}
+
+
 /*
  *  VCreateImage
  *
  *  Allocates memory for a new image with specified properties.
  *  Returns a pointer to the image if successful, zero otherwise.
+ *  The memory is obtained from the pool allocator (see ImagePool.c).
  */
 
 VImage VCreateImage (int nbands, int nrows, int ncolumns, VRepnKind pixel_repn)
@@ -64,8 +84,6 @@ VImage VCreateImage (int nbands, int nrows, int ncolumns, VRepnKind pixel_repn)
   VImage image;
   int band, row;
 
-#define AlignUp(v, b) ((((v) + (b) - 1) / (b)) * (b))
-
   /* Check parameters: */
   if (nbands < 1) {
     VWarning ("VCreateImage: Invalid number of bands: %d", (int) nbands);
@@ -92,8 +110,8 @@ VImage VCreateImage (int nbands, int nrows, int ncolumns, VRepnKind pixel_repn)
   /* Allocate memory for the VImage, its indices, and pixel values, while
      padding enough to ensure pixel values are appropriately aligned: */
   pixel_size = VRepnSize (pixel_repn);
-  p = VMalloc (AlignUp (sizeof (VImageRec) + row_index_size +
-			band_index_size, pixel_size) + data_size);
+  p = VPoolAlloc (AlignUp (sizeof (VImageRec) + row_index_size +
+			   band_index_size, pixel_size) + data_size);
 
   /* Initialize the VImage: */
   image = (VImage) p;
@@ -116,8 +134,6 @@ VImage VCreateImage (int nbands, int nrows, int ncolumns, VRepnKind pixel_repn)
     image->row_index[row] = p;
 
   return image;
-
-#undef AlignUp
 }
 
 
@@ -149,7 +165,10 @@ void VDestroyImage (VImage image)
     VFree ((VPointer) image->band_index);
   }
   VDestroyAttrList (VImageAttrList (image));
-  VFree ((VPointer) image);
+  if (image->flags & VImageSingleAlloc)
+    VPoolFree ((VPointer) image, ImageAllocSize (image));
+  else
+    VFree ((VPointer) image);
 }
 
 
@@ -296,6 +315,11 @@ VImage VCopyImageAttrs (VImage src, VImage dest)
   if (list)
     VDestroyAttrList (list);
 
+  /* Cached pixel statistics (see VCachePixelStats) describe the source's
+     pixels, not the destination's: */
+  VExtractAttr (VImageAttrList (dest), VPixelStatsAttr, NULL,
+		VAttrListRepn, NULL, FALSE);
+
   /* Preserve band interpretation attributes only if the source and
      destination images have the same number of bands: */
   if (VImageNBands (src) > 1 && VImageNBands (dest) == VImageNBands (src)) {
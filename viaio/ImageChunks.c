@@ -0,0 +1,628 @@
+/*
+ *  This file contains routines for storing images in chunks.
+ *
+ *  An image whose attribute list contains a "chunk_size" attribute
+ *  ("nbands nrows ncolumns", see VSetImageChunks) is written as a set of
+ *  3D chunks of that size instead of band by band, so that a small block
+ *  of a large volume can be read from a few places in the file. If its
+ *  "chunk_compression" attribute is "zlib", each chunk is compressed.
+ *
+ *  In the file header, such an image has a "chunk_data" attribute giving
+ *  the layout actually used ("nbands nrows ncolumns none|zlib"). Its
+ *  binary data starts with an index of nchunks + 1 offsets, relative to
+ *  the start of the data and stored as 8 byte MSB first integers. The
+ *  last offset is the length of the data. Chunks are numbered band chunk
+ *  first, column chunk last. A chunk holds the pixels of its box, which is
+ *  cropped at the image border, packed as by VPackData. A chunk that does
+ *  not become shorter by compression is stored uncompressed. Since the
+ *  header gives the length of the data, compressed chunks are encoded when
+ *  the header is written, and kept in a temporary file until the data are
+ *  written; uncompressed ones are encoded only then.
+ *
+ *  VReadFile turns such an image into an ordinary one. VCatalogImage reads
+ *  only the chunks covering the requested box, and keeps recently used
+ *  chunks in a cache.
+ */
+
+/* From the Vista library: */
+#include "viaio/Vlib.h"
+#include "viaio/file.h"
+#include "viaio/os.h"
+#include "viaio/VImage.h"
+
+/* From the standard C library: */
+#include <stdio.h>
+#include <string.h>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* Chunks are encoded and written in batches of about this many bytes: */
+#define ChunkBatchSize	(32 << 20)
+
+/* Layout of an image's chunks, from VImageEncodeAttrMethod until the
+   image's data is written. Compressed chunks are kept in a temporary
+   file meanwhile, since their offsets must be known for the header: */
+typedef struct V_PendingChunks {
+    VImage image;
+    long size[3];
+    long nchunks;
+    size_t *offsets;		/* nchunks + 1 offsets, as in the index */
+    FILE *spill;		/* the compressed chunks, or NULL */
+    struct V_PendingChunks *next;
+} PendingChunks;
+
+static PendingChunks *pending = NULL;
+
+/* Later in this file: */
+static PendingChunks *TakeChunks (VImage);
+static void FreeChunks (PendingChunks *);
+
+/*
+ *  VSetImageChunks
+ *
+ *  Have an image written in chunks of nbands x nrows x ncolumns pixels,
+ *  compressed if compress is TRUE. If the chunk size is not positive,
+ *  the image is written band by band again.
+ */
+
+void VSetImageChunks (VImage image, int nbands, int nrows, int ncolumns,
+		      VBoolean compress)
+{
+    VAttrListPosn posn;
+    char str[64];
+
+    if (nbands <= 0 || nrows <= 0 || ncolumns <= 0) {
+	if (VLookupAttr (VImageAttrList (image), VChunkSizeAttr, & posn))
+	    VDeleteAttr (& posn);
+	if (VLookupAttr (VImageAttrList (image), VChunkCompressionAttr, & posn))
+	    VDeleteAttr (& posn);
+	return;
+    }
+    sprintf (str, "%d %d %d", nbands, nrows, ncolumns);
+    VSetAttr (VImageAttrList (image), VChunkSizeAttr, NULL, VStringRepn, str);
+    VSetAttr (VImageAttrList (image), VChunkCompressionAttr, NULL,
+	      VStringRepn, compress ? "zlib" : "none");
+}
+
+
+/*
+ *  VChunkLayout
+ *
+ *  Parse a chunk size ("nbands nrows ncolumns"), optionally followed by
+ *  a compression method ("none" or "zlib").
+ */
+
+VBoolean VChunkLayout (VStringConst str, long size[3], VBoolean *compress)
+{
+    char method[16];
+    int n;
+
+    method[0] = 0;
+    n = sscanf (str, "%ld %ld %ld %15s", & size[0], & size[1], & size[2],
+		method);
+    if (n < 3 || size[0] <= 0 || size[1] <= 0 || size[2] <= 0)
+	return FALSE;
+    if (n == 4 && strcmp (method, "zlib") != 0 && strcmp (method, "none") != 0)
+	return FALSE;
+    if (compress)
+	*compress = (n == 4 && strcmp (method, "zlib") == 0);
+    return TRUE;
+}
+
+
+/*
+ *  VChunkCount
+ *
+ *  Return the number of chunks of an image of size dims, and the number
+ *  of chunks along each axis in n.
+ */
+
+long VChunkCount (long dims[3], long size[3], long n[3])
+{
+    int a;
+
+    for (a = 0; a < 3; a++)
+	n[a] = (dims[a] + size[a] - 1) / size[a];
+    return n[0] * n[1] * n[2];
+}
+
+
+/*
+ *  VChunkBox
+ *
+ *  Return the first pixel (start) and the size (ext) of chunk k.
+ */
+
+void VChunkBox (long k, long dims[3], long size[3], long n[3],
+		long start[3], long ext[3])
+{
+    long idx[3];
+    int a;
+
+    idx[2] = k % n[2];
+    idx[1] = (k / n[2]) % n[1];
+    idx[0] = k / (n[2] * n[1]);
+    for (a = 0; a < 3; a++) {
+	start[a] = idx[a] * size[a];
+	ext[a] = dims[a] - start[a] < size[a] ? dims[a] - start[a] : size[a];
+    }
+}
+
+
+/*
+ *  VChunkExpand
+ *
+ *  Expand a chunk of length bytes, as stored in the file, into its packed
+ *  pixel data of raw_length bytes.
+ */
+
+VBoolean VChunkExpand (VPointer chunk, size_t length,
+		       VPointer raw, size_t raw_length)
+{
+    if (length == raw_length) {
+	memcpy (raw, chunk, length);
+	return TRUE;
+    }
+#ifdef HAVE_ZLIB
+    {
+	uLongf n = raw_length;
+
+	if (uncompress ((Bytef *) raw, & n, (const Bytef *) chunk,
+			length) == Z_OK && n == raw_length)
+	    return TRUE;
+	VWarning ("VChunkExpand: Corrupt image chunk");
+    }
+#else
+    VWarning ("VChunkExpand: Image chunks are compressed, "
+	      "but the library was built without zlib");
+#endif
+    return FALSE;
+}
+
+
+/*
+ *  PackChunk
+ *
+ *  Gather the pixels of chunk k into native, and pack them into packed,
+ *  which has room for raw_length bytes. Returns the packed length.
+ */
+
+static size_t PackChunk (VImage image, long k, long dims[3], long size[3],
+			 long n[3], char *native, char *packed,
+			 size_t raw_length)
+{
+    size_t pixsize = VPixelSize (image);
+    long start[3], ext[3], b, r;
+
+    VChunkBox (k, dims, size, n, start, ext);
+    for (b = 0; b < ext[0]; b++)
+	for (r = 0; r < ext[1]; r++)
+	    memcpy (native + ((b * ext[1] + r) * ext[2]) * pixsize,
+		    VPixelPtr (image, start[0] + b, start[1] + r, start[2]),
+		    ext[2] * pixsize);
+    VPackData (VPixelRepn (image), ext[0] * ext[1] * ext[2], native,
+	       VMsbFirst, & raw_length, (VPointer *) & packed, NULL);
+    return raw_length;
+}
+
+
+/*
+ *  ChunkGeometry
+ *
+ *  Return the number of chunks of an image, the number along each axis in
+ *  n, the most pixels in a chunk in maxpix, and how many chunks are
+ *  encoded in a batch in batch.
+ */
+
+static long ChunkGeometry (VImage image, long size[3], long dims[3],
+			   long n[3], size_t *maxpix, long *batch)
+{
+    long nchunks;
+
+    dims[0] = VImageNBands (image);
+    dims[1] = VImageNRows (image);
+    dims[2] = VImageNColumns (image);
+    nchunks = VChunkCount (dims, size, n);
+    *maxpix = size[0] * size[1] * size[2];
+    if (*maxpix > (size_t) VImageNPixels (image))
+	*maxpix = VImageNPixels (image);
+    *batch = ChunkBatchSize / (*maxpix * VPixelSize (image));
+    if (*batch < 1)
+	*batch = 1;
+    return nchunks;
+}
+
+
+/*
+ *  SpillChunks
+ *
+ *  Compress the chunks of an image, a batch at a time and each batch in
+ *  parallel, and append them to the temporary file spill, recording their
+ *  offsets. Returns FALSE if the file can't be written.
+ */
+
+static VBoolean SpillChunks (VImage image, long size[3], size_t *offsets,
+			     FILE *spill)
+{
+#ifdef HAVE_ZLIB
+    long dims[3], n[3], nchunks, batch, k0, k1, k;
+    size_t maxpix, pixsize = VPixelSize (image), total, bound;
+    size_t *lengths;
+    char *chunks;
+    VBoolean result = TRUE;
+
+    nchunks = ChunkGeometry (image, size, dims, n, & maxpix, & batch);
+    if (batch > nchunks)
+	batch = nchunks;
+    bound = compressBound (maxpix * pixsize);
+    chunks = VMalloc (batch * bound);
+    lengths = VMalloc (batch * sizeof (size_t));
+    total = (nchunks + 1) * 8;
+
+    for (k0 = 0; k0 < nchunks && result; k0 = k1) {
+	k1 = k0 + batch < nchunks ? k0 + batch : nchunks;
+
+#pragma omp parallel
+	{
+	    char *native = VMalloc (maxpix * pixsize);
+	    char *packed = VMalloc (maxpix * pixsize);
+	    char *dp;
+	    size_t raw_length;
+	    uLongf clen;
+
+	    /* Keep the compressed chunk only if it is shorter: */
+#pragma omp for schedule(dynamic,1)
+	    for (k = k0; k < k1; k++) {
+		raw_length = PackChunk (image, k, dims, size, n, native,
+					packed, maxpix * pixsize);
+		dp = chunks + (k - k0) * bound;
+		clen = bound;
+		if (compress2 ((Bytef *) dp, & clen, (Bytef *) packed,
+			       raw_length, Z_BEST_SPEED) == Z_OK &&
+		    clen < raw_length)
+		    lengths[k - k0] = clen;
+		else {
+		    memcpy (dp, packed, raw_length);
+		    lengths[k - k0] = raw_length;
+		}
+	    }
+	    VFree (native);
+	    VFree (packed);
+	}
+
+	for (k = k0; k < k1 && result; k++) {
+	    offsets[k] = total;
+	    total += lengths[k - k0];
+	    result = fwrite (chunks + (k - k0) * bound, 1, lengths[k - k0],
+			     spill) == lengths[k - k0];
+	}
+    }
+    offsets[nchunks] = total;
+    VFree (chunks);
+    VFree (lengths);
+    return result && fflush (spill) == 0;
+#else
+    return FALSE;
+#endif
+}
+
+
+/*
+ *  VImageEncodeChunks
+ *
+ *  Prepare for writing the pixels of an image in chunks of the given size,
+ *  and return the length of the data. Without compression the offsets of
+ *  the chunks follow from their sizes, and the chunks are encoded only
+ *  when the data are written. Compressed chunks are encoded now, in
+ *  batches, and kept in a temporary file; if that can't be created, the
+ *  chunks are stored uncompressed and *compress is set to FALSE.
+ */
+
+size_t VImageEncodeChunks (VImage image, long size[3], VBoolean *compress)
+{
+    double tbegin = VTraceBegin ();
+    PendingChunks *p;
+    long dims[3], n[3], start[3], ext[3], batch, k;
+    size_t total, maxpix;
+
+#ifndef HAVE_ZLIB
+    *compress = FALSE;
+#endif
+
+    /* Forget the chunks of an earlier write of the image that failed: */
+    FreeChunks (TakeChunks (image));
+
+    p = VMalloc (sizeof (PendingChunks));
+    p->image = image;
+    memcpy (p->size, size, sizeof (p->size));
+    p->nchunks = ChunkGeometry (image, size, dims, n, & maxpix, & batch);
+    p->offsets = VMalloc ((p->nchunks + 1) * sizeof (size_t));
+    p->spill = NULL;
+
+    if (*compress) {
+	if (! (p->spill = tmpfile ()) ||
+	    ! SpillChunks (image, size, p->offsets, p->spill)) {
+	    VWarning ("VImageEncodeChunks: Can't write temporary file, "
+		      "image chunks are stored uncompressed");
+	    if (p->spill)
+		fclose (p->spill);
+	    p->spill = NULL;
+	    *compress = FALSE;
+	}
+    }
+    if (! *compress) {
+	total = (p->nchunks + 1) * 8;
+	for (k = 0; k < p->nchunks; k++) {
+	    VChunkBox (k, dims, size, n, start, ext);
+	    p->offsets[k] = total;
+	    total += (ext[0] * ext[1] * ext[2] *
+		      VRepnPrecision (VPixelRepn (image)) + 7) / 8;
+	}
+	p->offsets[p->nchunks] = total;
+    }
+
+#pragma omp critical (VImageChunks)
+    {
+	p->next = pending;
+	pending = p;
+    }
+    total = p->offsets[p->nchunks];
+    VTraceEnd ("VImageEncodeChunks", tbegin, VImageNPixels (image), total);
+    return total;
+}
+
+
+/*
+ *  WriteBytes
+ *
+ *  Write len bytes at position pos of an image's data, either into buf or,
+ *  if buf is NULL, to f as VWritePackedData does (offset is the position
+ *  of the data in the file, or negative to write at the stream's position).
+ */
+
+static VBoolean WriteBytes (FILE *f, long offset, char *buf, size_t pos,
+			    VPointer data, size_t len)
+{
+    if (buf) {
+	memcpy (buf + pos, data, len);
+	return TRUE;
+    }
+    return VWritePackedData (f, offset < 0 ? -1 : offset + (long) pos,
+			     VUByteRepn, len, data, VMsbFirst);
+}
+
+
+/*
+ *  VImageWriteChunks
+ *
+ *  Write the data of an image prepared by VImageEncodeChunks, length
+ *  bytes, to f (see WriteBytes for offset) or, if buf is not NULL, into
+ *  buf. Uncompressed chunks are encoded a batch at a time, each batch in
+ *  parallel; compressed ones are copied from the temporary file.
+ */
+
+VBoolean VImageWriteChunks (VImage image, FILE *f, long offset,
+			    VPointer buf, size_t length)
+{
+    double tbegin = VTraceBegin ();
+    PendingChunks *p;
+    long dims[3], n[3], batch, k0, k1, k;
+    size_t maxpix, pixsize = VPixelSize (image), len, *offsets;
+    char *data;
+    int i;
+    VBoolean result;
+
+    if (! (p = TakeChunks (image))) {
+	VWarning ("VImageWriteChunks: Image chunks were not encoded");
+	return FALSE;
+    }
+    offsets = p->offsets;
+    if (offsets[p->nchunks] != length)
+	VError ("VImageWriteChunks: Encoded data has unexpected length");
+
+    /* Write the index, MSB first: */
+    len = (p->nchunks + 1) * 8;
+    data = VMalloc (len);
+    for (k = 0; k <= p->nchunks; k++)
+	for (i = 0; i < 8; i++)
+	    data[k * 8 + i] = (char) ((offsets[k] >> (8 * (7 - i))) & 0xff);
+    result = WriteBytes (f, offset, buf, 0, data, len);
+    VFree (data);
+
+    if (p->spill) {
+
+	/* Copy the compressed chunks from the temporary file: */
+	data = VMalloc (ChunkBatchSize);
+	rewind (p->spill);
+	for (k = len; result && k < (long) length; k += len) {
+	    len = length - k < ChunkBatchSize ? length - k : ChunkBatchSize;
+	    result = fread (data, 1, len, p->spill) == len &&
+		WriteBytes (f, offset, buf, k, data, len);
+	}
+	VFree (data);
+
+    } else {
+
+	/* Encode the chunks, whose data are contiguous in a batch: */
+	ChunkGeometry (image, p->size, dims, n, & maxpix, & batch);
+	data = buf ? NULL : VMalloc (batch * maxpix * pixsize);
+	for (k0 = 0; k0 < p->nchunks && result; k0 = k1) {
+	    k1 = k0 + batch < p->nchunks ? k0 + batch : p->nchunks;
+
+#pragma omp parallel
+	    {
+		char *native = VMalloc (maxpix * pixsize);
+
+#pragma omp for schedule(dynamic,1)
+		for (k = k0; k < k1; k++)
+		    PackChunk (image, k, dims, p->size, n, native,
+			       buf ? (char *) buf + offsets[k] :
+			       data + (offsets[k] - offsets[k0]),
+			       offsets[k + 1] - offsets[k]);
+		VFree (native);
+	    }
+
+	    if (! buf)
+		result = WriteBytes (f, offset, NULL, offsets[k0], data,
+				     offsets[k1] - offsets[k0]);
+	}
+	VFree (data);
+    }
+
+    FreeChunks (p);
+    if (! result)
+	VWarning ("VImageWriteChunks: Write failed");
+    VTraceEnd ("VImageWriteChunks", tbegin, VImageNPixels (image), length);
+    return result;
+}
+
+
+/*
+ *  VChunkIndex
+ *
+ *  Decode the index of an image stored in nchunks chunks, checking that
+ *  it is consistent with a data length of length bytes. Returns a vector
+ *  of nchunks + 1 offsets, or NULL.
+ */
+
+long *VChunkIndex (VPointer data, long nchunks, size_t length)
+{
+    unsigned char *p = data;
+    long *offsets, k;
+    unsigned long x;
+    int i;
+
+    offsets = VMalloc ((nchunks + 1) * sizeof (long));
+    for (k = 0; k <= nchunks; k++) {
+	for (x = 0, i = 0; i < 8; i++)
+	    x = (x << 8) | p[k * 8 + i];
+	offsets[k] = (long) x;
+	if ((k == 0 && offsets[0] != (nchunks + 1) * 8) ||
+	    (k > 0 && offsets[k] < offsets[k - 1]))
+	    break;
+    }
+    if (k <= nchunks || offsets[nchunks] != (long) length) {
+	VWarning ("VChunkIndex: Image chunk index is corrupt");
+	VFree (offsets);
+	return NULL;
+    }
+    return offsets;
+}
+
+
+/*
+ *  VImageDecodeChunks
+ *
+ *  Fill the pixels of an image from its data stored in chunks of the
+ *  given size. Chunks are decoded in parallel.
+ */
+
+VBoolean VImageDecodeChunks (VImage image, long size[3],
+			     VPointer data, size_t length)
+{
+    double tbegin = VTraceBegin ();
+    VRepnKind repn = VPixelRepn (image);
+    long dims[3], n[3], nchunks, k, *offsets, maxpix;
+    size_t pixsize = VPixelSize (image);
+    VBoolean result = TRUE;
+
+    dims[0] = VImageNBands (image);
+    dims[1] = VImageNRows (image);
+    dims[2] = VImageNColumns (image);
+    nchunks = VChunkCount (dims, size, n);
+    if (length < (nchunks + 1) * 8 ||
+	! (offsets = VChunkIndex (data, nchunks, length)))
+	return FALSE;
+    maxpix = size[0] * size[1] * size[2];
+    if (maxpix > VImageNPixels (image))
+	maxpix = VImageNPixels (image);
+
+#pragma omp parallel
+    {
+	char *native = VMalloc (maxpix * pixsize);
+	char *packed = VMalloc (maxpix * pixsize);
+	long start[3], ext[3], b, r, npix;
+	size_t raw_length, len;
+
+#pragma omp for schedule(dynamic,1)
+	for (k = 0; k < nchunks; k++) {
+	    if (! result)
+		continue;
+	    VChunkBox (k, dims, size, n, start, ext);
+	    npix = ext[0] * ext[1] * ext[2];
+	    raw_length = (npix * VRepnPrecision (repn) + 7) / 8;
+	    if (! VChunkExpand ((char *) data + offsets[k],
+				offsets[k + 1] - offsets[k],
+				packed, raw_length)) {
+		result = FALSE;
+		continue;
+	    }
+	    len = maxpix * pixsize;
+	    VUnpackData (repn, npix, packed, VMsbFirst, & len,
+			 (VPointer *) & native, NULL);
+
+	    /* Scatter the chunk's pixels: */
+	    for (b = 0; b < ext[0]; b++)
+		for (r = 0; r < ext[1]; r++)
+		    memcpy (VPixelPtr (image, start[0] + b, start[1] + r,
+				       start[2]),
+			    native + ((b * ext[1] + r) * ext[2]) * pixsize,
+			    ext[2] * pixsize);
+	}
+	VFree (native);
+	VFree (packed);
+    }
+    VFree (offsets);
+    VTraceEnd ("VImageDecodeChunks", tbegin, VImageNPixels (image), length);
+    return result;
+}
+
+
+/*
+ *  VImageDropChunks
+ *
+ *  Discard the chunks prepared by VImageEncodeChunks for an image whose
+ *  data won't be written after all, e.g. because writing its header
+ *  failed.
+ */
+
+void VImageDropChunks (VPointer image)
+{
+    FreeChunks (TakeChunks (image));
+}
+
+
+/*
+ *  TakeChunks, FreeChunks
+ *
+ *  Remove the pending chunks of an image from the list, where they are kept
+ *  from the time its header is written until its data is written, which
+ *  may happen concurrently for several images; and free them.
+ */
+
+static PendingChunks *TakeChunks (VImage image)
+{
+    PendingChunks *p, **pp;
+
+#pragma omp critical (VImageChunks)
+    {
+	for (pp = & pending; (p = *pp); pp = & p->next)
+	    if (p->image == image) {
+		*pp = p->next;
+		break;
+	    }
+    }
+    return p;
+}
+
+static void FreeChunks (PendingChunks *p)
+{
+    if (! p)
+	return;
+    if (p->spill)
+	fclose (p->spill);
+    VFree (p->offsets);
+    VFree (p);
+}
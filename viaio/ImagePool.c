@@ -0,0 +1,271 @@
+/*
+ *  This file contains a pool allocator for image data and other large
+ *  scratch buffers.
+ *
+ *  Blocks of 64 KB and more fall into one of four size classes per power of
+ *  two. When a block is released it is kept on a free list for its size
+ *  class, so that a later request of similar size is served without calling
+ *  malloc() and without page-faulting a fresh mapping. This pays off in
+ *  batch jobs that run the same filters on volumes of the same size. While
+ *  caching is enabled, blocks are rounded up to the size of their class so
+ *  that they fit any later request of the class; a cached block records the
+ *  size it was released with, which it is known to have, since it may have
+ *  been allocated before caching was enabled.
+ *
+ *  Caching is off by default. It is enabled by VPoolConfig(), or by setting
+ *  the environment variable VIA_POOL_SIZE to the number of megabytes that
+ *  may be held in the free lists. If VIA_POOL_HUGEPAGES is set, blocks of
+ *  2 MB and more are aligned for transparent huge pages.
+ *
+ *  Blocks are obtained from malloc() or posix_memalign(), so a block may
+ *  still be released with free() by code that does not know about the pool.
+ */
+
+/* From the Vista library: */
+#include "viaio/Vlib.h"
+#include "viaio/os.h"
+#include "viaio/VImage.h"
+
+/* From the standard C library: */
+#include <stdlib.h>
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#endif
+
+/* Blocks smaller than 2^MinShift bytes are not pooled: */
+#define MinShift	16
+#define MaxShift	47
+#define NClasses	((MaxShift - MinShift) * 4 + 1)
+
+/* Size of a huge page: */
+#define HugePageSize	(2 * 1024 * 1024)
+
+/* A free block holds a pointer to the next free block of its class, and
+   its size: */
+typedef struct V_PoolBlock {
+    struct V_PoolBlock *next;
+    size_t size;
+} PoolBlock;
+
+static PoolBlock *free_list[NClasses];
+static VBoolean pool_init = FALSE;
+static VBoolean pool_huge = FALSE;
+static VPoolStatsRec stats;
+
+
+/*
+ *  SizeClass
+ *
+ *  Returns the size class of a block of the given size, and the rounded
+ *  size. Returns -1 if the block is not to be pooled.
+ */
+
+static int SizeClass (size_t size, size_t *csize)
+{
+    size_t step, n;
+    int k;
+
+    *csize = size;
+    if (size < ((size_t) 1 << MinShift) || size >= ((size_t) 1 << MaxShift))
+	return -1;
+
+    /* 2^k <= size < 2^(k+1), which is divided into four classes: */
+    for (k = MinShift; ((size_t) 1 << (k + 1)) <= size; k++)
+	;
+    step = (size_t) 1 << (k - 2);
+    n = (size + step - 1) / step;
+    *csize = n * step;
+    return (k - MinShift) * 4 + (int) (n - 4);
+}
+
+
+/*
+ *  PoolInit
+ *
+ *  Reads the pool configuration from the environment (called once).
+ */
+
+static void PoolInit (void)
+{
+    char *s;
+
+    pool_init = TRUE;
+    if ((s = getenv ("VIA_POOL_SIZE")) && atof (s) > 0)
+	stats.limit = (size_t) (atof (s) * 1024.0 * 1024.0);
+    if ((s = getenv ("VIA_POOL_HUGEPAGES")) && s[0] && s[0] != '0')
+	pool_huge = TRUE;
+}
+
+
+/*
+ *  VPoolAlloc
+ *
+ *  Allocates a block of at least size bytes, preferably one that was
+ *  released earlier by VPoolFree. The block must be released by VPoolFree
+ *  with the same size.
+ */
+
+VPointer VPoolAlloc (size_t size)
+{
+    PoolBlock *b = NULL, **bp;
+    size_t csize;
+    int cls;
+
+    if (size == 0)
+	return NULL;
+    cls = SizeClass (size, &csize);
+
+#pragma omp critical (V_Pool)
+    {
+	if (! pool_init)
+	    PoolInit ();
+	stats.nrequests++;
+	if (cls >= 0)
+	    for (bp = &free_list[cls]; (b = *bp); bp = &b->next)
+		if (b->size >= size) {
+		    *bp = b->next;
+		    stats.cached -= b->size;
+		    stats.nhits++;
+		    break;
+		}
+	if (stats.limit == 0)
+	    csize = size;
+	stats.in_use += size;
+	if (stats.in_use > stats.peak)
+	    stats.peak = stats.in_use;
+    }
+    if (b)
+	return (VPointer) b;
+
+#if defined(MADV_HUGEPAGE)
+    if (pool_huge && csize >= HugePageSize) {
+	VPointer p;
+	if (posix_memalign (&p, HugePageSize, csize) != 0)
+	    VSystemError ("VPoolAlloc: Memory allocation failure");
+	madvise (p, csize, MADV_HUGEPAGE);
+	return p;
+    }
+#endif
+    return VMalloc (csize);
+}
+
+
+/*
+ *  VPoolFree
+ *
+ *  Releases a block obtained from VPoolAlloc. The block is kept for reuse
+ *  unless the pool limit would be exceeded.
+ */
+
+void VPoolFree (VPointer p, size_t size)
+{
+    PoolBlock *b = (PoolBlock *) p;
+    size_t csize;
+    int cls;
+
+    if (! p)
+	return;
+    cls = SizeClass (size, &csize);
+
+#pragma omp critical (V_Pool)
+    {
+	stats.in_use -= size;
+	if (cls >= 0 && stats.cached + size <= stats.limit) {
+	    b->next = free_list[cls];
+	    b->size = size;
+	    free_list[cls] = b;
+	    stats.cached += size;
+	    b = NULL;
+	}
+    }
+    if (b)
+	VFree ((VPointer) b);
+}
+
+
+/*
+ *  VPoolConfig
+ *
+ *  Sets the maximum number of bytes kept in the free lists (0 disables
+ *  caching), and whether large blocks are backed by huge pages.
+ */
+
+void VPoolConfig (size_t limit, VBoolean hugepages)
+{
+    VBoolean trim;
+
+#pragma omp critical (V_Pool)
+    {
+	pool_init = TRUE;
+	stats.limit = limit;
+	pool_huge = hugepages;
+	trim = stats.cached > limit;
+    }
+    if (trim)
+	VPoolTrim ();
+}
+
+
+/*
+ *  VPoolTrim
+ *
+ *  Returns all cached blocks to the system.
+ */
+
+void VPoolTrim (void)
+{
+    PoolBlock *list[NClasses], *b;
+    int i;
+
+#pragma omp critical (V_Pool)
+    {
+	for (i = 0; i < NClasses; i++) {
+	    list[i] = free_list[i];
+	    free_list[i] = NULL;
+	}
+	stats.cached = 0;
+    }
+    for (i = 0; i < NClasses; i++)
+	while ((b = list[i])) {
+	    list[i] = b->next;
+	    VFree ((VPointer) b);
+	}
+}
+
+
+/*
+ *  VPoolGetStats
+ *
+ *  Returns allocation statistics: bytes in use, peak bytes in use, cached
+ *  bytes, and the number of requests served from the cache.
+ */
+
+void VPoolGetStats (VPoolStatsRec *s)
+{
+#pragma omp critical (V_Pool)
+    {
+	if (! pool_init)
+	    PoolInit ();
+	*s = stats;
+    }
+}
+
+
+/*
+ *  VPoolReport
+ *
+ *  Prints allocation statistics to a stream.
+ */
+
+void VPoolReport (FILE *f)
+{
+    VPoolStatsRec s;
+
+    VPoolGetStats (&s);
+    fprintf (f, "pool: peak %.1f MB, in use %.1f MB, cached %.1f MB "
+	     "(limit %.1f MB), %lu requests, %.1f%% reused\n",
+	     s.peak / 1048576.0, s.in_use / 1048576.0, s.cached / 1048576.0,
+	     s.limit / 1048576.0, s.nrequests,
+	     s.nrequests ? 100.0 * s.nhits / s.nrequests : 0.0);
+}
@@ -24,6 +24,10 @@
 #include "viaio/os.h"
 #include "viaio/VImage.h"
 
+/* From the standard C library: */
+#include <stdio.h>
+#include <string.h>
+
 /* File identification string: */
 VRcsId ("$Id: ImageType.c 3177 2008-04-01 14:47:24Z karstenm $");
 
@@ -37,6 +41,13 @@ static VCopyMethod VImageCopyMethod;
 static VDecodeMethod VImageDecodeMethod;
 static VEncodeAttrMethod VImageEncodeAttrMethod;
 static VEncodeDataMethod VImageEncodeDataMethod;
+static VBoolean RemoveEncodeAttrs (VAttrList);
+
+/* From ImageChunks.c: */
+extern VBoolean VChunkLayout (VStringConst, long [3], VBoolean *);
+extern size_t VImageEncodeChunks (VImage, long [3], VBoolean *);
+extern VBoolean VImageWriteChunks (VImage, FILE *, long, VPointer, size_t);
+extern VBoolean VImageDecodeChunks (VImage, long [3], VPointer, size_t);
 
 /* Used in Type.c to register this type: */
 VTypeMethods VImageMethods = {
@@ -74,6 +85,10 @@ static VPointer VImageDecodeMethod (VStringConst name, VBundle b)
   VLong nbands, nrows, ncolumns, pixel_repn;
   VLong nframes, nviewpoints, ncolors, ncomponents;
   VAttrList list;
+  VAttrListPosn posn;
+  VString str;
+  long chunk_size[3];
+  VBoolean chunked = FALSE;
   size_t length;
 
 #define Extract(name, dict, locn, required)	\
@@ -105,6 +120,18 @@ static VPointer VImageDecodeMethod (VStringConst name, VBundle b)
     }
   }
 
+  /* Extract the layout of an image stored in chunks: */
+  if (VLookupAttr (b->list, VChunkDataAttr, & posn)) {
+    if (! VGetAttrValue (& posn, NULL, VStringRepn, & str) ||
+	! VChunkLayout (str, chunk_size, NULL)) {
+      VWarning ("VImageDecodeMethod: %s image has bad %s attribute",
+		name, VChunkDataAttr);
+      return NULL;
+    }
+    VDeleteAttr (& posn);
+    chunked = TRUE;
+  }
+
   /* Create an image with the specified properties: */
   if (! (image = VCreateImage ((int) nbands, (int) nrows, (int) ncolumns,
 			       (VRepnKind) pixel_repn)))
@@ -119,6 +146,13 @@ static VPointer VImageDecodeMethod (VStringConst name, VBundle b)
   VImageAttrList (image) = b->list;
   b->list = list;
 
+  /* Reassemble the pixel data of an image stored in chunks: */
+  if (chunked) {
+    if (! VImageDecodeChunks (image, chunk_size, b->data, b->length))
+      goto Fail;
+    return image;
+  }
+
   /* Check that the expected amount of binary data was read: */
   length = VImageNPixels (image);
   if (VPixelRepn (image) == VBitRepn)
@@ -153,6 +187,10 @@ static VAttrList VImageEncodeAttrMethod (VPointer value, size_t *lengthp)
 {
   VImage image = value;
   VAttrList list;
+  VString str;
+  long chunk_size[3];
+  VBoolean chunked = FALSE, compress;
+  char layout[80];
   size_t length;
 
 #define OptionallyPrepend(value, name)				\
@@ -164,6 +202,26 @@ static VAttrList VImageEncodeAttrMethod (VPointer value, size_t *lengthp)
     list = VImageAttrList (image) = VCreateAttrList ();
   VPrependAttr (list, VRepnAttr, VNumericRepnDict,
 		VLongRepn, (VLong) VPixelRepn (image));
+
+  /* If the image has a chunk size, lay out its pixels in chunks now, since
+     their length depends on the layout (see ImageChunks.c): */
+  if (VGetAttr (list, VChunkSizeAttr, NULL, VStringRepn, & str) ==
+      VAttrFound && VChunkLayout (str, chunk_size, NULL)) {
+    compress = VGetAttr (list, VChunkCompressionAttr, NULL, VStringRepn,
+			 & str) == VAttrFound && strcmp (str, "zlib") == 0;
+#ifndef HAVE_ZLIB
+    if (compress)
+      VWarning ("VImageEncodeAttrMethod: No zlib, "
+		"image chunks are stored uncompressed");
+    compress = FALSE;
+#endif
+    length = VImageEncodeChunks (image, chunk_size, & compress);
+    chunked = TRUE;
+    sprintf (layout, "%ld %ld %ld %s", chunk_size[0], chunk_size[1],
+	     chunk_size[2], compress ? "zlib" : "none");
+    VPrependAttr (list, VChunkDataAttr, NULL, VStringRepn, layout);
+  }
+
   VPrependAttr (list, VNColumnsAttr, NULL,
 		VLongRepn, (VLong) VImageNColumns (image));
   VPrependAttr (list, VNRowsAttr, NULL,
@@ -175,10 +233,12 @@ static VAttrList VImageEncodeAttrMethod (VPointer value, size_t *lengthp)
   OptionallyPrepend (VImageNBands (image), VNBandsAttr);
 
   /* Compute the file space needed for the image's binary data: */
-  length = VImageNPixels (image);
-  if (VPixelRepn (image) == VBitRepn)
-    length = (length + 7) / 8;
-  else length *= VPixelPrecision (image) / 8;
+  if (! chunked) {
+    length = VImageNPixels (image);
+    if (VPixelRepn (image) == VBitRepn)
+      length = (length + 7) / 8;
+    else length *= VPixelPrecision (image) / 8;
+  }
   *lengthp = length;
 
   return list;
@@ -198,15 +258,20 @@ static VPointer VImageEncodeDataMethod (VPointer value, VAttrList list,
 					size_t length, VBoolean *free_itp)
 {
   VImage image = value;
-  VAttrListPosn posn;
   size_t len;
   VPointer ptr;
 
-  /* Remove the attributes prepended by the VImageEncodeAttrsMethod: */
-  for (VFirstAttr (list, & posn);
-       strcmp (VGetAttrName (& posn), VRepnAttr) != 0;
-       VDeleteAttr (& posn)) ;
-  VDeleteAttr (& posn);
+  /* Remove the attributes prepended by the VImageEncodeAttrsMethod, and
+     return the chunks it laid out, if any: */
+  if (RemoveEncodeAttrs (list)) {
+    ptr = VMalloc (length);
+    if (! VImageWriteChunks (image, NULL, -1, ptr, length)) {
+      VFree (ptr);
+      return NULL;
+    }
+    *free_itp = TRUE;
+    return ptr;
+  }
 
   /* Pack and return pixel data: */
   if (! VPackData (VPixelRepn (image), VImageNPixels (image),
@@ -216,3 +281,50 @@ static VPointer VImageEncodeDataMethod (VPointer value, VAttrList list,
     VError ("VImageEncodeDataMethod: Encoded data has unexpected length");
   return ptr;
 }
+
+
+/*
+ *  VImageWriteData
+ *
+ *  Does what VImageEncodeDataMethod does, but writes the packed pixel
+ *  data to a file instead of returning it (see VWritePackedData for the
+ *  meaning of offset). VWriteFile uses this for images so that no packed
+ *  copy of the whole image is needed.
+ */
+
+VBoolean VImageWriteData (FILE *f, long offset, VPointer value,
+			  VAttrList list, size_t length)
+{
+  VImage image = value;
+
+  if (RemoveEncodeAttrs (list))
+    return VImageWriteChunks (image, f, offset, NULL, length);
+  if (length != (VPixelRepn (image) == VBitRepn ?
+		 (VImageNPixels (image) + 7) / 8 :
+		 VImageNPixels (image) * (VPixelPrecision (image) / 8)))
+    VError ("VImageWriteData: Encoded data has unexpected length");
+  return VWritePackedData (f, offset, VPixelRepn (image),
+			   VImageNPixels (image), VImageData (image), VMsbFirst);
+}
+
+
+/*
+ *  RemoveEncodeAttrs
+ *
+ *  Remove the attributes prepended by VImageEncodeAttrMethod, returning
+ *  whether they included a chunk layout.
+ */
+
+static VBoolean RemoveEncodeAttrs (VAttrList list)
+{
+  VAttrListPosn posn;
+  VBoolean chunked = FALSE;
+
+  for (VFirstAttr (list, & posn);
+       strcmp (VGetAttrName (& posn), VRepnAttr) != 0;
+       VDeleteAttr (& posn))
+    if (strcmp (VGetAttrName (& posn), VChunkDataAttr) == 0)
+      chunked = TRUE;
+  VDeleteAttr (& posn);
+  return chunked;
+}
@@ -19,14 +19,24 @@
  *  Author: Arthur Pope, UBC Laboratory for Computational Intelligence
  */
 
+/* For pwrite (os.h only asks for the base X/Open interfaces): */
+#define _XOPEN_SOURCE 500
+
 /* From the Vista library: */
 #include "viaio/Vlib.h"
 #include "viaio/os.h"
 #include "viaio/file.h"
 
+/* From the standard C library: */
+#include <errno.h>
+#include <unistd.h>
+
 /* File identification string: */
 VRcsId ("$Id: PackData.c 3177 2008-04-01 14:47:24Z karstenm $");
 
+/* Size in bytes of the chunks packed by VWritePackedData: */
+#define VPackChunkSize	(4 << 20)
+
 /* Later in this file: */
 VPackOrder MachineByteOrder (void);
 void SwapBytes (size_t, size_t, char *);
@@ -226,6 +236,111 @@ VBoolean VUnpackData (VRepnKind repn,
 }
 
 
+/*
+ *  WriteAt
+ *
+ *  Write a buffer to a file descriptor at a given position.
+ */
+
+static VBoolean WriteAt (int fd, char *buf, size_t len, long pos)
+{
+    ssize_t n;
+
+    while (len > 0) {
+	if ((n = pwrite (fd, buf, len, (off_t) pos)) <= 0) {
+	    if (n < 0 && errno == EINTR)
+		continue;
+	    return FALSE;
+	}
+	buf += n;
+	len -= n;
+	pos += n;
+    }
+    return TRUE;
+}
+
+
+/*
+ *  VWritePackedData
+ *
+ *  Pack an array of data elements, as VPackData does, and write the
+ *  packed form to a file. If offset is negative the data are written
+ *  to the stream f at its current position; otherwise they are written
+ *  with pwrite at byte offset of the file underlying f, which must be
+ *  seekable and not open for appending, and the stream position is not
+ *  used.
+ *
+ *  If the packed and unpacked forms are identical, as they are for
+ *  single-byte elements in either byte order, the data are written
+ *  directly. Otherwise they are packed in chunks of about VPackChunkSize
+ *  bytes into two buffers that are used alternately, so that packing one
+ *  chunk overlaps with writing the previous one, and no packed copy of
+ *  the whole array is made.
+ */
+
+VBoolean VWritePackedData (FILE *f, long offset, VRepnKind repn, size_t nels,
+			   VPointer unpacked, VPackOrder packed_order)
+{
+    size_t unpacked_elsize = VRepnSize (repn) * CHAR_BIT;
+    size_t packed_elsize = VRepnPrecision (repn);
+    size_t packed_length = (nels * packed_elsize + 7) / 8;
+    size_t chunk, nchunks, k, len[2];
+    long pos = offset;
+    VPointer buf[2];
+    VBoolean ok = TRUE;
+
+#define WriteChunk(ptr, n)						\
+    (offset < 0 ? fwrite ((ptr), 1, (n), f) == (n) :			\
+     WriteAt (fileno (f), (char *) (ptr), (n), pos))
+
+    if (unpacked_elsize == packed_elsize &&
+	(packed_elsize == 8 || packed_order == MachineByteOrder ()))
+	return WriteChunk (unpacked, packed_length);
+
+    /* Elements per chunk, a multiple of 8 so that packed bits stay
+       byte aligned: */
+    chunk = VPackChunkSize / VRepnSize (repn);
+    if (chunk > nels)
+	chunk = nels + 7;
+    chunk -= chunk % 8;
+    nchunks = (nels + chunk - 1) / chunk;
+    buf[0] = VMalloc (chunk * VRepnSize (repn));
+    buf[1] = nchunks > 1 ? VMalloc (chunk * VRepnSize (repn)) : NULL;
+
+#define PackChunk(k)							\
+    len[(k) % 2] = chunk * VRepnSize (repn);				\
+    if (! VPackData (repn, (k) < nchunks - 1 ? chunk : nels - (k) * chunk, \
+		     (char *) unpacked + (k) * chunk * VRepnSize (repn),	\
+		     packed_order, & len[(k) % 2], & buf[(k) % 2], NULL)) \
+	ok = FALSE
+
+    if (nchunks > 0) {
+	PackChunk (0);
+    }
+    for (k = 0; k < nchunks && ok; k++) {
+#pragma omp parallel sections num_threads(2) if (k + 1 < nchunks)
+	{
+#pragma omp section
+	    if (! WriteChunk (buf[k % 2], len[k % 2]))
+		ok = FALSE;
+#pragma omp section
+	    if (k + 1 < nchunks) {
+		PackChunk (k + 1);
+	    }
+	}
+	pos += len[k % 2];
+    }
+
+#undef PackChunk
+#undef WriteChunk
+
+    VFree (buf[0]);
+    if (buf[1])
+	VFree (buf[1]);
+    return ok;
+}
+
+
 /*
  *  MachineByteOrder
  *
@@ -21,94 +21,489 @@
 #include "viaio/os.h"
 #include "viaio/VImage.h"
 
+/* From the standard C library: */
+#include <math.h>
+#include <string.h>
+
+/*
+ *  Pixels are tallied in blocks of BlockSize, in parallel. Within a block
+ *  the mean is found first and then the sum of squared deviations from
+ *  it, while the block is in cache. Blocks are then combined in order by
+ *  the pairwise update of Chan, Golub and LeVeque, so the variance is
+ *  accurate for float data too and the result does not depend on the
+ *  number of threads.
+ *
+ *  Integer pixels whose range spans at most MaxExactBins values are
+ *  histogrammed with one bin per value. For bit, ubyte, sbyte and short
+ *  images this range is known beforehand, so everything is done in one
+ *  pass; other images need a second pass once their range is known.
+ */
+
+#define BlockSize	65536		/* pixels tallied at a time */
+#define MaxExactBins	65536		/* max. bins of one value each */
+#define NBins		16384		/* bins for other pixel values */
+
+typedef struct {
+    double n, mean, m2;			/* count, mean, sum of squared dev. */
+    double min, max;
+} Moments;
+
+/* Later in this file: */
+static VPixelStats CachedPixelStats (VImage, VBand, VDouble, VBoolean);
+
+
+/*
+ *  MaskValue
+ *
+ *  Return whether pixel i of a mask is set.
+ */
+
+static VBoolean MaskValue (VImage mask, long i)
+{
+    VPointer p = VImageData (mask);
+
+    switch (VPixelRepn (mask)) {
+    case VBitRepn:	return ((VBit *) p)[i] != 0;
+    case VUByteRepn:	return ((VUByte *) p)[i] != 0;
+    case VSByteRepn:	return ((VSByte *) p)[i] != 0;
+    case VShortRepn:	return ((VShort *) p)[i] != 0;
+    case VLongRepn:	return ((VLong *) p)[i] != 0;
+    case VFloatRepn:	return ((VFloat *) p)[i] != 0;
+    case VDoubleRepn:	return ((VDouble *) p)[i] != 0;
+    default:		return FALSE;
+    }
+}
+
+
+/*
+ *  Selected
+ *
+ *  Whether a pixel value v at index i is tallied. NaN and infinite float
+ *  or double values are not, since (v) - (v) isn't 0 for them; for
+ *  integer pixels the test is always true and compiles away.
+ */
+
+#define Selected(v, i)							\
+    ((v) - (v) == 0 &&							\
+     (background <= 0 || (v) >= background || (v) <= -background) &&	\
+     (! mask || MaskValue (mask, moffset + (i))))
+
 
 /*
  *  TallyStats
  *
- *  Macro for computing the min, max, mean, and variance of pixel values.
+ *  Macro for computing the moments of pixels i0 ... i1-1 into m, and
+ *  adding them to the histogram h if it isn't NULL.
  */
 
 #define TallyStats(type)						\
     {									\
 	type *pp = first_pixel;						\
+	double sum = 0.0, d;						\
 									\
-	tmin = tmax = *pp;						\
-	for (i = 0; i < npixels; i++) {					\
-	    tmean += pixel = *pp++;					\
-	    tvar  += (pixel * pixel);					\
-	    if (pixel < tmin)						\
-		tmin = pixel;						\
-	    else if (pixel > tmax)					\
-		tmax = pixel;						\
+	for (i = i0; i < i1; i++) {					\
+	    if (! Selected (pp[i], i))					\
+		continue;						\
+	    sum += pp[i];						\
+	    m.n++;							\
+	    if (pp[i] < m.min)						\
+		m.min = pp[i];						\
+	    if (pp[i] > m.max)						\
+		m.max = pp[i];						\
 	}								\
-}
+	if (m.n > 0) {							\
+	    m.mean = sum / m.n;						\
+	    for (i = i0; i < i1; i++) {					\
+		if (! Selected (pp[i], i))				\
+		    continue;						\
+		d = pp[i] - m.mean;					\
+		m.m2 += d * d;						\
+		if (h)							\
+		    h[(long) ((pp[i] - lo) * scale)]++;			\
+	    }								\
+	}								\
+    }
 
 
 /*
- *  VImageStats
+ *  TallyHisto
  *
- *  Compute the min, max, mean, and variance of an image's pixel values.
+ *  Macro for adding pixels i0 ... i1-1 to the histogram h.
  */
 
-VBoolean VImageStats (VImage src, VBand band, VDouble *pmin, VDouble *pmax,
-		      VDouble *pmean, VDouble *pvar)
+#define TallyHisto(type)						\
+    {									\
+	type *pp = first_pixel;						\
+									\
+	for (i = i0; i < i1; i++) {					\
+	    if (! Selected (pp[i], i))					\
+		continue;						\
+	    k = (long) ((pp[i] - lo) * scale);				\
+	    if (k >= nbins)						\
+		k = nbins - 1;						\
+	    h[k]++;							\
+	}								\
+    }
+
+
+/*
+ *  VComputePixelStats
+ *
+ *  Compute the min, max, mean, and variance of an image's pixel values
+ *  and, if histo is TRUE, their histogram. Only pixels of the specified
+ *  band(s) with an absolute value of at least background, and where the
+ *  mask is non-zero if a mask is given, are counted; NaN and infinite
+ *  values never are. The mask must have as many pixels as the image or
+ *  the band. Statistics cached on the image by VCachePixelStats are
+ *  returned if they fit the request. The result should be freed with
+ *  VDestroyPixelStats.
+ */
+
+VPixelStats VComputePixelStats (VImage src, VBand band, VImage mask,
+				VDouble background, VBoolean histo)
 {
-    int npixels, i;
+    int npixels;
+    long nblocks, b, moffset = 0, nbins = 0;
     VPointer first_pixel;
-    VDouble pixel, tmin, tmax, tmean, tvar;
+    VPixelStats stats;
+    VRepnKind repn = VPixelRepn (src);
+    Moments *blocks, total;
+    double lo = 0.0, scale = 1.0, *histogram = NULL;
+    VBoolean exact, one_pass;
 
     /* Prepare to iterate over the specified band(s) of source pixels: */
-    if (! VSelectBand ("VImageStats", src, band, & npixels, & first_pixel))
-	return FALSE;
+    if (! VSelectBand ("VComputePixelStats", src, band, & npixels,
+		       & first_pixel))
+	return NULL;
+    if (mask) {
+	if (VImageNPixels (mask) == VImageNPixels (src) && band != VAllBands)
+	    moffset = (long) band * VImageNRows (src) * VImageNColumns (src);
+	else if (VImageNPixels (mask) != npixels) {
+	    VWarning ("VComputePixelStats: Mask and image differ in size");
+	    return NULL;
+	}
+    } else if ((stats = CachedPixelStats (src, band, background, histo)))
+	return stats;
 
-    /* Initialize accumulators: */
-    tmin = tmax = tmean = tvar = 0.0;
+    /* Integer pixels of at most 16 bits get one bin per value: */
+    exact = one_pass = (repn == VBitRepn || repn == VUByteRepn ||
+			repn == VSByteRepn || repn == VShortRepn);
+    if (histo && one_pass) {
+	lo = VRepnMinValue (repn);
+	nbins = (long) (VRepnMaxValue (repn) - lo) + 1;
+	histogram = VCalloc (nbins, sizeof (double));
+    }
 
-    /* Tally pixels: */
-    switch (VPixelRepn (src)) {
+    /* Tally the blocks of pixels: */
+    nblocks = ((long) npixels + BlockSize - 1) / BlockSize;
+    blocks = VMalloc ((nblocks > 0 ? nblocks : 1) * sizeof (Moments));
+#pragma omp parallel if (nblocks > 1)
+    {
+	Moments m;
+	double *h = NULL;
+	long i, i0, i1, k;
 
-    case VBitRepn:
-	TallyStats (VBit);
-	break;
+	if (histogram)
+	    h = VCalloc (nbins, sizeof (double));
+#pragma omp for schedule(static)
+	for (b = 0; b < nblocks; b++) {
+	    i0 = b * BlockSize;
+	    i1 = i0 + BlockSize < npixels ? i0 + BlockSize : npixels;
+	    m.n = m.mean = m.m2 = 0.0;
+	    m.min = HUGE_VAL;
+	    m.max = -HUGE_VAL;
+	    switch (repn) {
+	    case VBitRepn:	TallyStats (VBit);	break;
+	    case VUByteRepn:	TallyStats (VUByte);	break;
+	    case VSByteRepn:	TallyStats (VSByte);	break;
+	    case VShortRepn:	TallyStats (VShort);	break;
+	    case VLongRepn:	TallyStats (VLong);	break;
+	    case VFloatRepn:	TallyStats (VFloat);	break;
+	    case VDoubleRepn:	TallyStats (VDouble);	break;
+	    default:		break;
+	    }
+	    blocks[b] = m;
+	}
+	if (h) {
+#pragma omp critical (VComputePixelStats)
+	    for (k = 0; k < nbins; k++)
+		histogram[k] += h[k];
+	    VFree (h);
+	}
+    }
 
-    case VUByteRepn:
-	TallyStats (VUByte);
-	break;
+    /* Combine the blocks in order: */
+    total.n = total.mean = total.m2 = 0.0;
+    total.min = HUGE_VAL;
+    total.max = -HUGE_VAL;
+    for (b = 0; b < nblocks; b++) {
+	double n = total.n + blocks[b].n, d = blocks[b].mean - total.mean;
 
-    case VSByteRepn:
-	TallyStats (VSByte);
-	break;
+	if (blocks[b].n == 0)
+	    continue;
+	total.m2 += blocks[b].m2 + d * d * total.n * blocks[b].n / n;
+	total.mean += d * blocks[b].n / n;
+	total.n = n;
+	if (blocks[b].min < total.min)
+	    total.min = blocks[b].min;
+	if (blocks[b].max > total.max)
+	    total.max = blocks[b].max;
+    }
+    VFree (blocks);
+    if (total.n == 0) {
+	total.min = total.max = 0.0;
+	if (histogram)
+	    VFree (histogram);
+	histogram = NULL;
+    }
 
-    case VShortRepn:
-	TallyStats (VShort);
-	break;
+    /* Otherwise, now that the range is known, histogram the pixels: */
+    if (histo && ! one_pass && total.n > 0) {
+	exact = repn == VLongRepn && total.max - total.min < MaxExactBins;
+	lo = total.min;
+	if (exact)
+	    nbins = (long) (total.max - total.min) + 1;
+	else {
+	    nbins = NBins;
+	    if (total.max > total.min)
+		scale = NBins / (total.max - total.min);
+	}
+	histogram = VCalloc (nbins, sizeof (double));
+#pragma omp parallel if (nblocks > 1)
+	{
+	    double *h = VCalloc (nbins, sizeof (double));
+	    long i, i0, i1, k;
 
-    case VLongRepn:
-	TallyStats (VLong);
-	break;
+#pragma omp for schedule(static)
+	    for (b = 0; b < nblocks; b++) {
+		i0 = b * BlockSize;
+		i1 = i0 + BlockSize < npixels ? i0 + BlockSize : npixels;
+		switch (repn) {
+		case VLongRepn:		TallyHisto (VLong);	break;
+		case VFloatRepn:	TallyHisto (VFloat);	break;
+		case VDoubleRepn:	TallyHisto (VDouble);	break;
+		default:		break;
+		}
+	    }
+#pragma omp critical (VComputePixelStats)
+	    for (k = 0; k < nbins; k++)
+		histogram[k] += h[k];
+	    VFree (h);
+	}
+    }
 
-    case VFloatRepn:
-	TallyStats (VFloat);
-	break;
+    /* Return the results, trimming a histogram by value to the range: */
+    stats = VMalloc (sizeof (VPixelStatsRec));
+    stats->band = band;
+    stats->background = background;
+    stats->masked = mask != NULL;
+    stats->n = total.n;
+    stats->min = total.min;
+    stats->max = total.max;
+    stats->mean = total.mean;
+    stats->var = total.n > 0 ? total.m2 / total.n : 0.0;
+    stats->exact = exact;
+    stats->nbins = 0;
+    stats->histo = NULL;
+    if (histogram && exact) {
+	stats->nbins = (int) (total.max - total.min) + 1;
+	stats->lo = total.min - 0.5;
+	stats->width = 1.0;
+	stats->histo = VMalloc (stats->nbins * sizeof (double));
+	memcpy (stats->histo, histogram + (long) (total.min - lo),
+		stats->nbins * sizeof (double));
+	VFree (histogram);
+    } else if (histogram) {
+	stats->nbins = nbins;
+	stats->lo = lo;
+	stats->width = 1.0 / scale;
+	stats->histo = histogram;
+    }
+    return stats;
+}
 
-    case VDoubleRepn:
-	TallyStats (VDouble);
-	break;
 
-    default:
-	break;
+/*
+ *  VPixelPercentile
+ *
+ *  Return the value below which the given fraction of the pixels
+ *  described by a histogram lies. Histograms with one bin per value give
+ *  one of the pixel values, others are interpolated within a bin.
+ */
+
+VDouble VPixelPercentile (VPixelStats stats, VDouble fraction)
+{
+    double target, cum = 0.0, x;
+    int k;
+
+    if (stats->n == 0)
+	return 0.0;
+    if (! stats->histo) {
+	VWarning ("VPixelPercentile: Statistics have no histogram");
+	return stats->mean;
+    }
+    target = fraction * stats->n;
+    for (k = 0; k < stats->nbins - 1; k++) {
+	if (cum + stats->histo[k] > target)
+	    break;
+	cum += stats->histo[k];
+    }
+    if (stats->exact)
+	x = stats->min + k;
+    else {
+	x = stats->lo + k * stats->width;
+	if (stats->histo[k] > 0)
+	    x += (target - cum) / stats->histo[k] * stats->width;
+    }
+    if (x < stats->min)
+	x = stats->min;
+    if (x > stats->max)
+	x = stats->max;
+    return x;
+}
+
+
+/*
+ *  VCachePixelStats
+ *
+ *  Store statistics on the image they were computed from, for later calls
+ *  of VComputePixelStats to return. It is up to the caller to delete the
+ *  VPixelStatsAttr attribute when the image's pixels change;
+ *  VCopyImageAttrs doesn't pass it on. Statistics within a mask are not
+ *  cached.
+ */
+
+VBoolean VCachePixelStats (VImage image, VPixelStats stats)
+{
+    VAttrList list;
+    VImage histo;
+
+    if (stats->masked)
+	return FALSE;
+    list = VCreateAttrList ();
+    VSetAttr (list, "band", NULL, VLongRepn, (VLong) stats->band);
+    VSetAttr (list, "background", NULL, VDoubleRepn, stats->background);
+    VSetAttr (list, "n", NULL, VDoubleRepn, stats->n);
+    VSetAttr (list, "min", NULL, VDoubleRepn, stats->min);
+    VSetAttr (list, "max", NULL, VDoubleRepn, stats->max);
+    VSetAttr (list, "mean", NULL, VDoubleRepn, stats->mean);
+    VSetAttr (list, "var", NULL, VDoubleRepn, stats->var);
+    if (stats->histo) {
+	VSetAttr (list, "exact", NULL, VBitRepn, (VBit) stats->exact);
+	VSetAttr (list, "lo", NULL, VDoubleRepn, stats->lo);
+	VSetAttr (list, "width", NULL, VDoubleRepn, stats->width);
+	histo = VCreateImage (1, 1, stats->nbins, VDoubleRepn);
+	memcpy (VImageData (histo), stats->histo,
+		stats->nbins * sizeof (double));
+	VSetAttr (list, "histogram", NULL, VImageRepn, histo);
     }
+    if (VImageAttrList (image) == NULL)
+	VImageAttrList (image) = VCreateAttrList ();
+    VSetAttr (VImageAttrList (image), VPixelStatsAttr, NULL,
+	      VAttrListRepn, list);
+    return TRUE;
+}
+
+
+/*
+ *  CachedPixelStats
+ *
+ *  Return the statistics cached on an image if they fit the request.
+ */
+
+static VPixelStats CachedPixelStats (VImage src, VBand band,
+				     VDouble background, VBoolean histo)
+{
+    VAttrList list;
+    VPixelStats stats;
+    VImage image = NULL;
+    VLong cband;
+    VDouble cbackground;
+    VBit exact;
 
-    /* Compute and return the final results: */
-    tmean /= npixels;
-    tvar = tvar / npixels - (tmean * tmean);
+    if (VGetAttr (VImageAttrList (src), VPixelStatsAttr, NULL,
+		  VAttrListRepn, & list) != VAttrFound ||
+	VGetAttr (list, "band", NULL, VLongRepn, & cband) != VAttrFound ||
+	VGetAttr (list, "background", NULL, VDoubleRepn,
+		  & cbackground) != VAttrFound ||
+	cband != band || cbackground != background)
+	return NULL;
+    if (VGetAttr (list, "histogram", NULL, VImageRepn, & image) !=
+	VAttrFound && histo)
+	return NULL;
+
+    stats = VMalloc (sizeof (VPixelStatsRec));
+    stats->band = band;
+    stats->background = background;
+    stats->masked = FALSE;
+    stats->nbins = 0;
+    stats->histo = NULL;
+    stats->exact = FALSE;
+    if (VGetAttr (list, "n", NULL, VDoubleRepn, & stats->n) != VAttrFound ||
+	VGetAttr (list, "min", NULL, VDoubleRepn, & stats->min) != VAttrFound ||
+	VGetAttr (list, "max", NULL, VDoubleRepn, & stats->max) != VAttrFound ||
+	VGetAttr (list, "mean", NULL, VDoubleRepn, & stats->mean) != VAttrFound ||
+	VGetAttr (list, "var", NULL, VDoubleRepn, & stats->var) != VAttrFound)
+	goto Fail;
+    if (image) {
+	if (VPixelRepn (image) != VDoubleRepn ||
+	    VGetAttr (list, "exact", NULL, VBitRepn, & exact) != VAttrFound ||
+	    VGetAttr (list, "lo", NULL, VDoubleRepn, & stats->lo) != VAttrFound ||
+	    VGetAttr (list, "width", NULL, VDoubleRepn,
+		      & stats->width) != VAttrFound)
+	    goto Fail;
+	stats->exact = exact;
+	stats->nbins = VImageNPixels (image);
+	stats->histo = VMalloc (stats->nbins * sizeof (double));
+	memcpy (stats->histo, VImageData (image),
+		stats->nbins * sizeof (double));
+    }
+    return stats;
+
+Fail:
+    VWarning ("CachedPixelStats: Bad %s attribute", VPixelStatsAttr);
+    VFree (stats);
+    return NULL;
+}
+
+
+/*
+ *  VDestroyPixelStats
+ *
+ *  Free statistics returned by VComputePixelStats.
+ */
+
+void VDestroyPixelStats (VPixelStats stats)
+{
+    if (! stats)
+	return;
+    if (stats->histo)
+	VFree (stats->histo);
+    VFree (stats);
+}
+
+
+/*
+ *  VImageStats
+ *
+ *  Compute the min, max, mean, and variance of an image's pixel values.
+ */
+
+VBoolean VImageStats (VImage src, VBand band, VDouble *pmin, VDouble *pmax,
+		      VDouble *pmean, VDouble *pvar)
+{
+    VPixelStats stats;
+
+    if (! (stats = VComputePixelStats (src, band, NULL, 0.0, FALSE)))
+	return FALSE;
     if (pmin)
-	*pmin = tmin;
+	*pmin = stats->min;
     if (pmax)
-	*pmax = tmax;
+	*pmax = stats->max;
     if (pmean)
-	*pmean = tmean;
+	*pmean = stats->mean;
     if (pvar)
-	*pvar = tvar;
+	*pvar = stats->var;
+    VDestroyPixelStats (stats);
     return TRUE;
 }
@@ -0,0 +1,227 @@
+/*
+ *  This file contains routines for timing library calls.
+ *
+ *  Library entry points are bracketed by VTraceBegin and VTraceEnd (see
+ *  Vlib.h). Tracing is controlled by the environment variable VIA_TRACE:
+ *
+ *    unset		tracing is off; each bracket costs one test of a flag
+ *    VIA_TRACE=1	a table of call counts and times is printed at exit
+ *    VIA_TRACE=file	in addition, every call is written to file in the
+ *			Chrome trace event format, which can be loaded into
+ *			chrome://tracing or Perfetto
+ */
+
+/* From the Vista library: */
+#include "viaio/Vlib.h"
+#include "viaio/mu.h"
+#include "viaio/os.h"
+
+/* From the standard C library: */
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+/* Max. number of calls kept for the trace file: */
+#define MaxEvents	(1 << 20)
+
+/* Max. number of distinct entry points in the summary: */
+#define MaxNames	256
+
+typedef struct {
+    VStringConst name;
+    double ts, dur;			/* start and duration, microseconds */
+    double nvoxels, nbytes;
+    int tid;
+} TraceEvent;
+
+typedef struct {
+    VStringConst name;
+    long ncalls;
+    double total, max;			/* microseconds */
+    double nvoxels, nbytes;
+} TraceSum;
+
+/* -1 until VIA_TRACE has been read: */
+int V_TraceOn = -1;
+
+static char *trace_file = NULL;
+static double trace_t0 = 0;
+static TraceEvent *events = NULL;
+static int nevents = 0, nevents_alloc = 0;
+static long ndropped = 0;
+static TraceSum sums[MaxNames];
+static int nsums = 0;
+
+
+/*
+ *  Now
+ *
+ *  Returns wall clock time in microseconds.
+ */
+
+static double Now (void)
+{
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+
+    clock_gettime (CLOCK_MONOTONIC, & ts);
+    return ts.tv_sec * 1.0e6 + ts.tv_nsec * 1.0e-3;
+#else
+    struct timeval tv;
+
+    gettimeofday (& tv, NULL);
+    return tv.tv_sec * 1.0e6 + tv.tv_usec;
+#endif
+}
+
+
+/*
+ *  TraceReport
+ *
+ *  Prints the summary table and writes the trace file (called at exit).
+ */
+
+static void TraceReport (void)
+{
+    FILE *f;
+    TraceSum *s;
+    TraceEvent *e;
+    int i, j, pid = (int) getpid ();
+    double t;
+
+    /* Summary, sorted by total time: */
+    for (i = 1; i < nsums; i++)
+	for (j = i; j > 0 && sums[j].total > sums[j-1].total; j--) {
+	    TraceSum tmp = sums[j];
+	    sums[j] = sums[j-1];
+	    sums[j-1] = tmp;
+	}
+    fprintf (stderr, "\n %-28s %8s %12s %12s %12s %10s %10s\n", "function",
+	     "calls", "total ms", "mean ms", "max ms", "Mvoxel/s", "MB/s");
+    for (i = 0; i < nsums; i++) {
+	s = & sums[i];
+	t = s->total > 0 ? s->total : 1;
+	fprintf (stderr, " %-28s %8ld %12.3f %12.3f %12.3f %10.2f %10.2f\n",
+		 s->name, s->ncalls, s->total * 1.0e-3,
+		 s->total * 1.0e-3 / s->ncalls, s->max * 1.0e-3,
+		 s->nvoxels / t, s->nbytes / t);
+    }
+    if (ndropped > 0)
+	fprintf (stderr, " (%ld calls not written to the trace file)\n",
+		 ndropped);
+
+    if (! trace_file)
+	return;
+    if (! (f = fopen (trace_file, "w"))) {
+	VWarning ("Unable to open trace file %s", trace_file);
+	return;
+    }
+    fprintf (f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (i = 0; i < nevents; i++) {
+	e = & events[i];
+	fprintf (f, "%s{\"name\": \"%s\", \"cat\": \"via\", \"ph\": \"X\", "
+		 "\"ts\": %.3f, \"dur\": %.3f, \"pid\": %d, \"tid\": %d, "
+		 "\"args\": {\"voxels\": %.0f, \"bytes\": %.0f}}",
+		 i ? ",\n" : "", e->name, e->ts, e->dur, pid, e->tid,
+		 e->nvoxels, e->nbytes);
+    }
+    fprintf (f, "\n]}\n");
+    fclose (f);
+}
+
+
+/*
+ *  VTraceClock
+ *
+ *  Returns the current time for VTraceBegin, or 0 if tracing is off.
+ *  Reads VIA_TRACE on the first call.
+ */
+
+double VTraceClock (void)
+{
+    char *s;
+
+    if (V_TraceOn < 0) {
+#pragma omp critical (V_Trace)
+	{
+	    if (V_TraceOn < 0) {
+		s = getenv ("VIA_TRACE");
+		if (s && s[0] && strcmp (s, "0") != 0) {
+		    if (strcmp (s, "1") != 0)
+			trace_file = VNewString (s);
+		    trace_t0 = Now ();
+		    atexit (TraceReport);
+		    V_TraceOn = 1;
+		} else
+		    V_TraceOn = 0;
+	    }
+	}
+    }
+    return V_TraceOn ? Now () : 0.0;
+}
+
+
+/*
+ *  VTraceRecord
+ *
+ *  Records a call that started at time t0 (see VTraceEnd).
+ */
+
+void VTraceRecord (VStringConst name, double t0,
+		   double nvoxels, double nbytes)
+{
+    double t1 = Now ();
+    TraceSum *s = NULL;
+    TraceEvent *e;
+    int i, tid = 0;
+
+    if (t0 <= 0)
+	return;
+#ifdef _OPENMP
+    tid = omp_get_thread_num ();
+#endif
+
+#pragma omp critical (V_Trace)
+    {
+	for (i = 0; i < nsums; i++)
+	    if (sums[i].name == name || strcmp (sums[i].name, name) == 0) {
+		s = & sums[i];
+		break;
+	    }
+	if (! s && nsums < MaxNames) {
+	    s = & sums[nsums++];
+	    s->name = name;
+	}
+	if (s) {
+	    s->ncalls++;
+	    s->total += t1 - t0;
+	    if (t1 - t0 > s->max)
+		s->max = t1 - t0;
+	    s->nvoxels += nvoxels;
+	    s->nbytes += nbytes;
+	}
+
+	if (trace_file) {
+	    if (nevents >= nevents_alloc && nevents_alloc < MaxEvents) {
+		nevents_alloc = nevents_alloc ? 2 * nevents_alloc : 1024;
+		events = VRealloc (events, nevents_alloc * sizeof (TraceEvent));
+	    }
+	    if (nevents < nevents_alloc) {
+		e = & events[nevents++];
+		e->name = name;
+		e->ts = t0 - trace_t0;
+		e->dur = t1 - t0;
+		e->nvoxels = nvoxels;
+		e->nbytes = nbytes;
+		e->tid = tid;
+	    } else
+		ndropped++;
+	}
+    }
+}
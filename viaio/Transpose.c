@@ -1,7 +1,8 @@
 /*
  *  $Id: Transpose.c 3177 2008-04-01 14:47:24Z karstenm $
  *
- *  This file contains routines for transposing images
+ *  This file contains routines for transposing images and permuting
+ *  their axes.
  */
 
 /*
@@ -26,10 +27,109 @@
 
 /* From the standard C libaray: */
 #include <math.h>
+#include <string.h>
 
 /* File identification string: */
 VRcsId ("$Id: Transpose.c 3177 2008-04-01 14:47:24Z karstenm $");
 
+/* Pixels are transposed in square tiles whose lines are TileBytes long,
+   but at least MinTileSize pixels: */
+#define TileBytes	128
+#define MinTileSize	16
+
+
+/*
+ *  CopyTile
+ *
+ *  Copy pixels (a, c), a0 <= a < a1, c0 <= c < c1, from src + a * sa +
+ *  c * sc to dest + a * da + c, where src and dest point to pixels.
+ */
+
+static void CopyTile (VRepnKind repn, VPointer src, long sa, long sc,
+		      VPointer dest, long da, long a0, long a1, long c0, long c1)
+{
+  long a, c;
+
+#define Copy(type)							\
+  {									\
+    type *src_pp, *dest_pp;						\
+									\
+    for (a = a0; a < a1; a++) {						\
+      src_pp = (type *) src + a * sa;					\
+      dest_pp = (type *) dest + a * da;					\
+      if (sc == 1)							\
+	memcpy (dest_pp + c0, src_pp + c0, (c1 - c0) * sizeof (type));	\
+      else for (c = c0; c < c1; c++)					\
+	dest_pp[c] = src_pp[c * sc];					\
+    }									\
+  }
+
+  switch (repn) {
+  case VBitRepn:		Copy (VBit);	break;
+  case VUByteRepn:	Copy (VUByte);	break;
+  case VSByteRepn:	Copy (VSByte);	break;
+  case VShortRepn:	Copy (VShort);	break;
+  case VLongRepn:		Copy (VLong);	break;
+  case VFloatRepn:	Copy (VFloat);	break;
+  case VDoubleRepn:	Copy (VDouble);	break;
+  default: break;
+  }
+
+#undef Copy
+}
+
+
+/*
+ *  Permute
+ *
+ *  Fill a destination of n[0] x n[1] x n[2] pixels, stored contiguously,
+ *  from a source in which moving one pixel along destination axis i moves
+ *  stride[i] pixels (possibly a negative number) from src_first.
+ *
+ *  Reading the source in the order the destination is written would touch
+ *  a new cache line for every pixel whenever the source's columns don't
+ *  run along the destination's columns. Instead, of the two outer
+ *  destination axes the one along which the source is closest to
+ *  contiguous is cut into tiles, and the destination columns too, so
+ *  that each tile's source lines stay in cache while the tile is written.
+ *  Tiles are filled in parallel.
+ */
+
+static void Permute (VRepnKind repn, VPointer src_first, VPointer dest_first,
+		     long n[3], long stride[3])
+{
+  long dstride[3], k, o, tk, tc, nt, t, a0, a1, c0, c1;
+  int size = VRepnSize (repn);
+  char *src, *dest;
+
+  dstride[0] = n[1] * n[2];
+  dstride[1] = n[2];
+  dstride[2] = 1;
+
+  /* Choose the axis to tile along with the columns: */
+  k = labs (stride[1]) <= labs (stride[0]) ? 1 : 0;
+  o = 1 - k;
+  if (labs (stride[2]) == 1) {
+    tk = 1;				/* whole rows are contiguous */
+    tc = n[2] > 0 ? n[2] : 1;
+  } else tk = tc = TileBytes / size > MinTileSize ?
+	    TileBytes / size : MinTileSize;
+  nt = (n[k] + tk - 1) / tk;
+
+#pragma omp parallel for private(a0,a1,c0,c1,src,dest) schedule(static) if (n[o] * nt > 1)
+  for (t = 0; t < n[o] * nt; t++) {
+    a0 = (t % nt) * tk;
+    a1 = a0 + tk < n[k] ? a0 + tk : n[k];
+    src = (char *) src_first + (t / nt) * stride[o] * size;
+    dest = (char *) dest_first + (t / nt) * dstride[o] * size;
+    for (c0 = 0; c0 < n[2]; c0 += tc) {
+      c1 = c0 + tc < n[2] ? c0 + tc : n[2];
+      CopyTile (repn, src, stride[k], stride[2], dest, dstride[k],
+		a0, a1, c0, c1);
+    }
+  }
+}
+
 
 /*
  * VTransposeImage
@@ -44,7 +144,7 @@ VImage VTransposeImage (VImage src, VImage dest, VBand band)
   int src_nrows, src_ncols, src_nbands;
   int dest_nrows, dest_ncols, dest_nbands;
   VRepnKind src_repn, dest_repn;
-  int r, c, b, src_curband, dest_curband;
+  long n[3], stride[3];
   VImage result;
 
   /* Read properties of "src": */
@@ -78,46 +178,15 @@ VImage VTransposeImage (VImage src, VImage dest, VBand band)
       return NULL;
   }
     
-  /*
-   * Transpose an image of a particular type: 
-   */
-#define Transpose(type)                               \
-    {                                                     \
-	type src_pixel, *dest_pixels;                     \
-	dest_pixels = (type *) VPixelPtr (result,         \
-					  dest_curband,   \
-					  0,              \
-					  0);             \
-	for (r = 0; r < dest_nrows; r++) {                \
-            for (c = 0; c < dest_ncols; c++) {            \
-                src_pixel = VPixel (src,                  \
-				    src_curband,          \
-				    c,                    \
-				    r,                    \
-				    type);                \
-	        *dest_pixels++ = src_pixel;               \
-	    }                                             \
-	}                                                 \
-    }
-    
-  /* For each band in the dest image do: */
-  for (b = 0; b < dest_nbands; b++) {
-
-    src_curband = (band == VAllBands) ? b : band;
-    dest_curband = (band == VAllBands) ? b : 0;
-	
-    /* Perform transposition according to pixel representation: */
-    switch (src_repn) {
-    case VBitRepn:          Transpose(VBit);    break;
-    case VUByteRepn:	Transpose(VUByte);  break;
-    case VSByteRepn:	Transpose(VSByte);  break;
-    case VShortRepn:	Transpose(VShort);  break;
-    case VLongRepn:		Transpose(VLong);   break;
-    case VFloatRepn:	Transpose(VFloat);  break;
-    case VDoubleRepn:	Transpose(VDouble); break;
-    default: break;
-    }
-  }
+  /* Transpose all selected bands at once: */
+  n[0] = dest_nbands;
+  n[1] = dest_nrows;
+  n[2] = dest_ncols;
+  stride[0] = (long) src_nrows * src_ncols;
+  stride[1] = 1;
+  stride[2] = src_ncols;
+  Permute (src_repn, VPixelPtr (src, band == VAllBands ? 0 : band, 0, 0),
+	   VImageData (result), n, stride);
 
   if (src == dest) {
     VCopyImagePixels (result, dest, VAllBands);
@@ -127,6 +196,103 @@ VImage VTransposeImage (VImage src, VImage dest, VBand band)
     VCopyImageAttrs (src, result);
     return result;
   }
+}
+
+
+/*
+ * VPermuteAxes
+ *
+ * Reorient a volume by permuting its axes (0 for bands, 1 for rows,
+ * 2 for columns) and perhaps reversing some of them. Axis i of the
+ * destination image is axis order[i] of the source image, and runs
+ * backwards if flip is non-NULL and flip[i] is TRUE. For example,
+ * order = {1, 0, 2} turns the rows of an axial volume into its bands.
+ *
+ * The "voxel" attribute ("x y z") is permuted along with the axes;
+ * other attributes are copied unchanged. Band interpretation
+ * attributes are kept only if the bands remain bands.
+ */
+
+VImage VPermuteAxes (VImage src, VImage dest, int *order, VBoolean *flip)
+{
+  long src_n[3], src_stride[3], n[3], stride[3];
+  char *src_first, str[100];
+  float spacing[3];
+  int i, seen = 0;
+  VString voxel;
+  VImage result;
+
+  /* Check that order is a permutation: */
+  for (i = 0; i < 3; i++)
+    if (order[i] >= 0 && order[i] < 3)
+      seen |= 1 << order[i];
+  if (seen != 7) {
+    VWarning ("VPermuteAxes: Axis order %d %d %d is not a permutation",
+	      order[0], order[1], order[2]);
+    return NULL;
+  }
+
+  /* Determine the destination's size, and where its pixels are in src: */
+  src_n[0] = VImageNBands (src);
+  src_n[1] = VImageNRows (src);
+  src_n[2] = VImageNColumns (src);
+  src_stride[0] = src_n[1] * src_n[2];
+  src_stride[1] = src_n[2];
+  src_stride[2] = 1;
+  src_first = (char *) VImageData (src);
+  for (i = 0; i < 3; i++) {
+    n[i] = src_n[order[i]];
+    stride[i] = src_stride[order[i]];
+    if (flip && flip[i]) {
+      src_first += (n[i] - 1) * stride[i] * VPixelSize (src);
+      stride[i] = - stride[i];
+    }
+  }
+
+  /* Create/select result image: */
+  result = VSelectDestImage ("VPermuteAxes", dest, (int) n[0], (int) n[1],
+			     (int) n[2], VPixelRepn (src));
+  if (! result)
+    return NULL;
+  if (src == dest) {
+    result = VCreateImage ((int) n[0], (int) n[1], (int) n[2],
+			   VPixelRepn (src));
+    if (! result)
+      return NULL;
+  }
+
+  Permute (VPixelRepn (src), src_first, VImageData (result), n, stride);
+
+  if (src == dest) {
+    VCopyImagePixels (result, dest, VAllBands);
+    VDestroyImage (result);
+    result = dest;
+  } else VCopyImageAttrs (src, result);
+
+  /* Band interpretation doesn't survive moving the bands elsewhere: */
+  if (order[0] != 0) {
+    VExtractAttr (VImageAttrList (result), VFrameInterpAttr, NULL,
+		  VBitRepn, NULL, FALSE);
+    VExtractAttr (VImageAttrList (result), VViewpointInterpAttr, NULL,
+		  VBitRepn, NULL, FALSE);
+    VExtractAttr (VImageAttrList (result), VColorInterpAttr, NULL,
+		  VBitRepn, NULL, FALSE);
+    VExtractAttr (VImageAttrList (result), VComponentInterpAttr, NULL,
+		  VBitRepn, NULL, FALSE);
+    VImageNComponents (result) = VImageNColors (result) =
+      VImageNViewpoints (result) = 1;
+    VImageNFrames (result) = VImageNBands (result);
+  }
+
+  /* Permute the voxel spacing, which is given as "x y z": */
+  if (VGetAttr (VImageAttrList (result), "voxel", NULL,
+		VStringRepn, (VPointer) & voxel) == VAttrFound &&
+      sscanf (voxel, "%f %f %f", & spacing[2], & spacing[1],
+	      & spacing[0]) == 3) {
+    sprintf (str, "%g %g %g", spacing[order[2]], spacing[order[1]],
+	     spacing[order[0]]);
+    VSetAttr (VImageAttrList (result), "voxel", NULL, VStringRepn, str);
+  }
 
-#undef Transpose
+  return result;
 }
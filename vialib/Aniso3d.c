@@ -61,6 +61,7 @@ VImage
 VAniso3d(VImage src,VImage dest,VShort numiter,
 	 VShort type,VFloat kappa,VFloat alpha)
 {
+  double tbegin = VTraceBegin();
   VImage tmp1=NULL,tmp2=NULL;
   int nbands,nrows,ncols;
   int b,r,c,iter;
@@ -177,5 +178,6 @@ VAniso3d(VImage src,VImage dest,VShort numiter,
   VDestroyImage(tmp1);
   VDestroyImage(tmp2);
 
+  VTraceEnd("VAniso3d",tbegin,VImageNPixels(src) * numiter,VImageSize(src));
   return dest;
 }
@@ -36,6 +36,7 @@ Gabriele Lohmann, MPI-CBS
 VImage 
 VBinarizeImage (VImage src,VImage dest,VDouble xmin,VDouble xmax)
 {
+  double tbegin = VTraceBegin();
   VBit *dest_pp;
   int i,npixels;
   VFloat u;
@@ -76,5 +77,6 @@ VBinarizeImage (VImage src,VImage dest,VDouble xmin,VDouble xmax)
   }
 
   VCopyImageAttrs (src, dest);
+  VTraceEnd("VBinarizeImage",tbegin,VImageNPixels(src),VImageSize(src));
   return dest;
 }
@@ -0,0 +1,429 @@
+/*! \file
+  Box filters using running sums
+
+Local mean and local variance over cubic windows. The window sums
+are computed separably, one image axis at a time, as differences of
+prefix sums along each line. The cost per voxel is therefore
+independent of the window size.
+
+Pixel values are shifted by the image mean before they are summed, so
+that the variance is computed from moments about a value close to the
+local means, without cancellation. For integer repns the shift is an
+integer, and the sums are accumulated in 64 bit integers, which is exact;
+only the squares of long pixels are summed in double precision, as are
+float and double pixels.
+
+\par Author:
+Gabriele Lohmann, MPI-CBS
+*/
+
+/* From the Vista library: */
+#include <viaio/Vlib.h>
+#include <viaio/VImage.h>
+#include <viaio/mu.h>
+
+/* From the standard C library: */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <via.h>
+
+
+#define BlockSize 65536   /* voxels processed by a thread at a time */
+
+typedef long long Int64;
+
+
+/*
+** first element in <in> and <out> of line <l> along <axis>
+*/
+static void
+LineStart(long l,int axis,long n[3],long m[3],long *base,long *obase)
+{
+  if (axis == 2) {
+    *base  = l * n[2];
+    *obase = l * m[2];
+  }
+  else if (axis == 1) {
+    *base  = (l / n[2]) * n[1] * n[2] + l % n[2];
+    *obase = (l / n[2]) * m[1] * m[2] + l % n[2];
+  }
+  else {
+    *base = *obase = l;
+  }
+}
+
+
+/*
+** window sums of one line. With zero padding, only the values within the
+** line enter the prefix sums, and each window adds <padval> for each of
+** its positions outside the line.
+*/
+#define LineSums(type)                                          \
+{                                                               \
+  prefix[0] = 0;                                                \
+  if (pad == VConvolvePadBorder || pad == VConvolvePadWrap) {   \
+    for (k=0; k<len+2*half; k++) {                              \
+      p = k - half;                                             \
+      if (p < 0 || p >= len) {                                  \
+	if (pad == VConvolvePadBorder)                          \
+	  p = (p < 0) ? 0 : len-1;                              \
+	else                                                    \
+	  p = ((p % len) + len) % len;                          \
+      }                                                         \
+      prefix[k+1] = prefix[k] + in[base + p*stride];            \
+    }                                                           \
+    for (j=0; j<nout; j++)                                      \
+      out[obase + j*ostride] = prefix[j+dim] - prefix[j];       \
+  }                                                             \
+  else {                                                        \
+    for (k=0; k<len; k++)                                       \
+      prefix[k+1] = prefix[k] + in[base + k*stride];            \
+    for (j=0; j<nout; j++) {                                    \
+      lo = (pad == VConvolvePadTrim) ? j : j - half;            \
+      hi = lo + dim;                                            \
+      npad = 0;                                                 \
+      if (lo < 0) { npad -= lo; lo = 0; }                       \
+      if (hi > len) { npad += hi - len; hi = len; }             \
+      out[obase + j*ostride] = prefix[hi] - prefix[lo]          \
+	+ (type) npad * padval;                                 \
+    }                                                           \
+  }                                                             \
+}
+
+
+/*
+** geometry of a pass along <axis>: <m> receives the dimensions of the
+** output, and the function returns the number of lines
+*/
+static long
+PassSetup(long n[3],long m[3],int axis,int dim,VConvolvePadMethod pad,
+	  long *stride,long *ostride)
+{
+  m[0] = n[0]; m[1] = n[1]; m[2] = n[2];
+  if (pad == VConvolvePadTrim) m[axis] = n[axis] - dim + 1;
+
+  /* stride along the axis, identical layout for all other axes */
+  *stride  = (axis == 2) ? 1 : (axis == 1 ? n[2] : n[1] * n[2]);
+  *ostride = (axis == 2) ? 1 : (axis == 1 ? m[2] : m[1] * m[2]);
+  return n[0] * n[1] * n[2] / n[axis];
+}
+
+
+/*
+** window sums along one axis. <n> holds the dimensions (bands,rows,columns)
+** of <in>, and is updated to the dimensions of <out>. With zero padding,
+** values outside the image are <padval>.
+*/
+static void
+BoxPass(double *in,double *out,long n[3],int axis,int dim,VConvolvePadMethod pad,
+	double padval)
+{
+  long l,m[3],stride,ostride,nlines;
+  long len = n[axis];
+
+  nlines = PassSetup(n,m,axis,dim,pad,&stride,&ostride);
+
+#pragma omp parallel
+  {
+    double *prefix = (double *) VMalloc(sizeof(double) * (len + dim + 1));
+    long half = dim/2,nout = m[axis],j,k,p,lo,hi,npad,base,obase;
+
+#pragma omp for schedule(static)
+    for (l=0; l<nlines; l++) {
+      LineStart(l,axis,n,m,&base,&obase);
+      LineSums(double);
+    }
+    VFree(prefix);
+  }
+  n[0] = m[0]; n[1] = m[1]; n[2] = m[2];
+}
+
+
+/*
+** the same for 64 bit integer sums
+*/
+static void
+BoxPassInt(Int64 *in,Int64 *out,long n[3],int axis,int dim,VConvolvePadMethod pad,
+	   Int64 padval)
+{
+  long l,m[3],stride,ostride,nlines;
+  long len = n[axis];
+
+  nlines = PassSetup(n,m,axis,dim,pad,&stride,&ostride);
+
+#pragma omp parallel
+  {
+    Int64 *prefix = (Int64 *) VMalloc(sizeof(Int64) * (len + dim + 1));
+    long half = dim/2,nout = m[axis],j,k,p,lo,hi,npad,base,obase;
+
+#pragma omp for schedule(static)
+    for (l=0; l<nlines; l++) {
+      LineStart(l,axis,n,m,&base,&obase);
+      LineSums(Int64);
+    }
+    VFree(prefix);
+  }
+  n[0] = m[0]; n[1] = m[1]; n[2] = m[2];
+}
+
+
+/*
+** cubic window sums of <data>, result is returned in <data> or <tmp>.
+** <zero> is the value that zero padding stands for, which after each pass
+** is a sum of <dim> such values.
+*/
+static VPointer
+BoxSum(VPointer data,VPointer tmp,VBoolean integer,long n[3],int dim,
+       VConvolvePadMethod pad,double zero)
+{
+  if (integer) {
+    Int64 z = (Int64) zero;
+    BoxPassInt((Int64 *) data,(Int64 *) tmp,n,2,dim,pad,z);
+    BoxPassInt((Int64 *) tmp,(Int64 *) data,n,1,dim,pad,z * dim);
+    BoxPassInt((Int64 *) data,(Int64 *) tmp,n,0,dim,pad,z * dim * dim);
+  }
+  else {
+    BoxPass((double *) data,(double *) tmp,n,2,dim,pad,zero);
+    BoxPass((double *) tmp,(double *) data,n,1,dim,pad,zero * dim);
+    BoxPass((double *) data,(double *) tmp,n,0,dim,pad,zero * dim * dim);
+  }
+  return tmp;
+}
+
+
+/*
+** the mean of the pixel values, which they are shifted by
+*/
+#define PixelMean(type)                                         \
+{                                                               \
+  type *src_pp = (type *) VImageData(src);                      \
+  for (i=i0; i<i1; i++) part += (double) src_pp[i];             \
+}
+
+
+/*
+** shifted pixel values, and their squares, as integers or doubles
+*/
+#define LoadPixels(type)                                        \
+{                                                               \
+  type *src_pp = (type *) VImageData(src);                      \
+  if (integer) {                                                \
+    Int64 x,*s1 = (Int64 *) sum;                                \
+    Int64 *s2 = integer2 ? (Int64 *) sum2 : NULL;               \
+    double *d2 = integer2 ? NULL : (double *) sum2;             \
+    for (i=0; i<npixels; i++) {                                 \
+      s1[i] = x = (Int64) src_pp[i] - (Int64) shift;            \
+      if (s2) s2[i] = x * x;                                    \
+      else if (d2) d2[i] = (double) x * (double) x;             \
+    }                                                           \
+  }                                                             \
+  else {                                                        \
+    double x,*s1 = (double *) sum,*s2 = (double *) sum2;        \
+    for (i=0; i<npixels; i++) {                                 \
+      s1[i] = x = (double) src_pp[i] - shift;                   \
+      if (s2) s2[i] = x * x;                                    \
+    }                                                           \
+  }                                                             \
+}
+
+
+/*!
+\fn VBoolean VLocalMoments3d(VImage src,int dim,VConvolvePadMethod pad,
+     VImage *mean,VImage *var)
+\brief local mean and local variance over cubic windows.
+The cost per voxel does not depend on the window size.
+\param src   input image (any repn)
+\param dim   window size, must be odd
+\param pad   border handling. With VConvolvePadNone, voxels closer than dim/2
+to the image border are set to zero. With VConvolvePadTrim, the output
+images are smaller than <src> by dim-1 voxels along each axis.
+\param mean  output image of local means (float repn), or NULL if not needed
+\param var   output image of local variances (float repn), or NULL if not needed
+*/
+VBoolean
+VLocalMoments3d(VImage src,int dim,VConvolvePadMethod pad,VImage *mean,VImage *var)
+{
+  double tbegin = VTraceBegin();
+  int b,r,c,nbands,nrows,ncols,half;
+  long i,n[3],npixels,nout,blk,nblocks;
+  VPointer sum=NULL,sum2=NULL,tmp=NULL,s1=NULL,s2=NULL;
+  VBoolean integer,integer2;
+  double shift=0,nw;
+  VFloat *mean_pp=NULL,*var_pp=NULL;
+  VImage given_mean=NULL;
+
+  if (dim < 1 || dim%2 == 0)
+    VError("VLocalMoments3d: window size must be a positive odd number (%d)",dim);
+  if (VPixelRepn(src) < VBitRepn || VPixelRepn(src) > VDoubleRepn)
+    VError("VLocalMoments3d: illegal pixel repn");
+
+  nbands  = VImageNBands(src);
+  nrows   = VImageNRows(src);
+  ncols   = VImageNColumns(src);
+  npixels = VImageNPixels(src);
+  half    = dim/2;
+
+  if (pad == VConvolvePadTrim && (nbands < dim || nrows < dim || ncols < dim))
+    VError("VLocalMoments3d: image smaller than window");
+
+  /* output images, before any buffers are taken from the pool */
+  n[0] = nbands; n[1] = nrows; n[2] = ncols;
+  if (pad == VConvolvePadTrim)
+    for (i=0; i<3; i++) n[i] -= dim - 1;
+  if (mean) {
+    given_mean = *mean;
+    *mean = VSelectDestImage("VLocalMoments3d",*mean,n[0],n[1],n[2],VFloatRepn);
+    if (! *mean) return FALSE;
+    mean_pp = (VFloat *) VImageData(*mean);
+  }
+  if (var) {
+    *var = VSelectDestImage("VLocalMoments3d",*var,n[0],n[1],n[2],VFloatRepn);
+    if (! *var) {
+      if (mean && *mean != given_mean) {
+	VDestroyImage(*mean);
+	*mean = given_mean;
+      }
+      return FALSE;
+    }
+    var_pp = (VFloat *) VImageData(*var);
+  }
+
+  /* squares of long pixels may exceed 64 bits */
+  integer  = VIsIntegerRepn(VPixelRepn(src));
+  integer2 = (integer && VPixelRepn(src) != VLongRepn);
+
+  /* shift, the mean of the pixel values */
+  nblocks = (npixels + BlockSize - 1) / BlockSize;
+#pragma omp parallel for reduction(+:shift) schedule(static)
+  for (blk=0; blk<nblocks; blk++) {
+    long i,i0,i1;
+    double part = 0;
+
+    i0 = blk * BlockSize;
+    i1 = (i0 + BlockSize < npixels) ? i0 + BlockSize : npixels;
+
+    switch (VPixelRepn(src)) {
+    case VBitRepn:    PixelMean(VBit);    break;
+    case VUByteRepn:  PixelMean(VUByte);  break;
+    case VSByteRepn:  PixelMean(VSByte);  break;
+    case VShortRepn:  PixelMean(VShort);  break;
+    case VLongRepn:   PixelMean(VLong);   break;
+    case VFloatRepn:  PixelMean(VFloat);  break;
+    case VDoubleRepn: PixelMean(VDouble); break;
+    default: ;
+    }
+    shift += part;
+  }
+  shift /= (double) npixels;
+  if (integer) shift = floor(shift + 0.5);
+
+  /* load shifted pixel values, all buffers hold 8 byte elements */
+  sum = VPoolAlloc(sizeof(double) * npixels);
+  tmp = VPoolAlloc(sizeof(double) * npixels);
+  if (var) sum2 = VPoolAlloc(sizeof(double) * npixels);
+
+  switch (VPixelRepn(src)) {
+  case VBitRepn:
+    LoadPixels(VBit);
+    break;
+  case VUByteRepn:
+    LoadPixels(VUByte);
+    break;
+  case VSByteRepn:
+    LoadPixels(VSByte);
+    break;
+  case VShortRepn:
+    LoadPixels(VShort);
+    break;
+  case VLongRepn:
+    LoadPixels(VLong);
+    break;
+  case VFloatRepn:
+    LoadPixels(VFloat);
+    break;
+  case VDoubleRepn:
+    LoadPixels(VDouble);
+    break;
+  default: ;
+  }
+
+  /* window sums */
+  n[0] = nbands; n[1] = nrows; n[2] = ncols;
+  s1 = BoxSum(sum,tmp,integer,n,dim,pad,-shift);
+  if (sum2) {
+    n[0] = nbands; n[1] = nrows; n[2] = ncols;
+    s2 = BoxSum(sum2,(s1 == tmp) ? sum : tmp,integer2,n,dim,pad,shift * shift);
+  }
+
+  nw = (double) dim * (double) dim * (double) dim;
+  nout = n[0] * n[1] * n[2];
+
+#pragma omp parallel for schedule(static)
+  for (i=0; i<nout; i++) {
+    double u,v;
+
+    u = integer ? (double) ((Int64 *) s1)[i] : ((double *) s1)[i];
+    if (mean_pp) mean_pp[i] = shift + u / nw;
+    if (var_pp) {
+      v = integer2 ? (double) ((Int64 *) s2)[i] : ((double *) s2)[i];
+      v = (v - u * u / nw) / nw;
+      var_pp[i] = (v > 0) ? v : 0;
+    }
+  }
+
+  /* no padding, as in VConvolve3d */
+  if (pad == VConvolvePadNone && half > 0) {
+    for (b=0; b<nbands; b++) {
+      for (r=0; r<nrows; r++) {
+	for (c=0; c<ncols; c++) {
+	  if (b >= half && b < nbands-half && r >= half && r < nrows-half
+	      && c >= half && c < ncols-half) continue;
+	  if (mean) VPixel(*mean,b,r,c,VFloat) = 0;
+	  if (var)  VPixel(*var,b,r,c,VFloat) = 0;
+	}
+      }
+    }
+  }
+
+  VPoolFree(sum,sizeof(double) * npixels);
+  VPoolFree(sum2,sizeof(double) * npixels);
+  VPoolFree(tmp,sizeof(double) * npixels);
+
+  if (mean) VCopyImageAttrs (src, *mean);
+  if (var)  VCopyImageAttrs (src, *var);
+  VTraceEnd("VLocalMoments3d",tbegin,VImageNPixels(src),VImageSize(src));
+  return TRUE;
+}
+
+
+/*!
+\fn VImage VLocalMean3d(VImage src,VImage dest,int dim,VConvolvePadMethod pad)
+\brief local mean over cubic windows, see VLocalMoments3d.
+\param src   input image (any repn)
+\param dest  output image (float repn)
+\param dim   window size, must be odd
+\param pad   border handling
+*/
+VImage
+VLocalMean3d(VImage src,VImage dest,int dim,VConvolvePadMethod pad)
+{
+  if (! VLocalMoments3d(src,dim,pad,&dest,NULL)) return NULL;
+  return dest;
+}
+
+
+/*!
+\fn VImage VLocalVariance3d(VImage src,VImage dest,int dim,VConvolvePadMethod pad)
+\brief local variance over cubic windows, see VLocalMoments3d.
+\param src   input image (any repn)
+\param dest  output image (float repn)
+\param dim   window size, must be odd
+\param pad   border handling
+*/
+VImage
+VLocalVariance3d(VImage src,VImage dest,int dim,VConvolvePadMethod pad)
+{
+  if (! VLocalMoments3d(src,dim,pad,NULL,&dest)) return NULL;
+  return dest;
+}
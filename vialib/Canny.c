@@ -141,6 +141,7 @@ VCanny2d_row (VImage src,VImage dest,VImage tmp,VImage gkernel,VImage dkernel)
 void
 VCanny3d(VImage src,int dim,VImage *gradb,VImage *gradr,VImage *gradc)
 {
+  double tbegin = VTraceBegin();
   VImage xsrc=NULL,tmp=NULL;
   VImage gkernel=NULL,dkernel=NULL;
 
@@ -167,6 +168,7 @@ VCanny3d(VImage src,int dim,VImage *gradb,VImage *gradr,VImage *gradc)
   VDestroyImage(xsrc);
   VDestroyImage(dkernel);
   VDestroyImage(gkernel);
+  VTraceEnd("VCanny3d",tbegin,VImageNPixels(src),VImageSize(src));
 }
 
 
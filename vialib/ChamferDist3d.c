@@ -38,6 +38,7 @@ the distance values are multiplied by a factor of 10.
 VImage 
 VChamferDist3d(VImage src,VImage dest,VRepnKind repn)
 {
+  double tbegin = VTraceBegin();
   int nbands,nrows,ncols,b,r,c;
   int i,npixels;
   VShort id1=3,id2=4,id3=5;
@@ -366,5 +367,6 @@ VChamferDist3d(VImage src,VImage dest,VRepnKind repn)
 
   /* Let the destination inherit any attributes of the source image: */
   VCopyImageAttrs (src, dest);
+  VTraceEnd("VChamferDist3d",tbegin,VImageNPixels(src),VImageSize(src));
   return dest;
 }
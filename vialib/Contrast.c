@@ -10,6 +10,11 @@ The output pixel repn need not be identical to the input
 image. Thus, it is possible to convert to ubyte repn
 for easier visualization.
 
+The grey value statistics, including the histograms that percentile
+windows are taken from, are computed in one parallel pass by
+VComputePixelStats, which also picks up statistics cached on the
+input image by VCachePixelStats.
+
 
 \par Author:
 Gabriele Lohmann, MPI-CBS
@@ -44,8 +49,8 @@ VContrast(VImage src,VImage dest,VRepnKind repn,VFloat alpha,VFloat background)
 {
   int i,nbands,nrows,ncols,npixels;
   float u,xmin,xmax,ymin,ymax,slope,smin,smax;
-  float sum1,sum2,nx;
   float mean,sigma;
+  VPixelStats stats;
 
   if (repn == VDoubleRepn || repn == VLongRepn || repn == VSByteRepn)
     VError(" double, long and sbyte are not supported by VContrast");
@@ -62,23 +67,14 @@ VContrast(VImage src,VImage dest,VRepnKind repn,VFloat alpha,VFloat background)
   if (! dest) VError(" err creating dest image");
   VFillImage(dest,VAllBands,0);
 
-  smin = VPixelMaxValue(src);
-  smax = VPixelMinValue(src);
-
-  sum1 = sum2 = nx = 0;
-  for (i=0; i<npixels; i++) {
-    u = VGetPixelValue (src,i);
-    if (ABS(u) < background) continue;
-    if (u < smin) smin = u;
-    if (u > smax) smax = u;
-    sum1 += u;
-    sum2 += u*u;
-    nx++;
-  }
-  if (nx < 2) VError(" no foreground pixels found");
+  stats = VComputePixelStats(src,VAllBands,NULL,(VDouble) background,FALSE);
+  if (stats->n < 2) VError(" no foreground pixels found");
 
-  mean  = sum1/nx;
-  sigma = sqrt((double)((sum2 - nx * mean * mean) / (nx - 1.0)));
+  smin  = stats->min;
+  smax  = stats->max;
+  mean  = stats->mean;
+  sigma = sqrt(stats->var * stats->n / (stats->n - 1.0));
+  VDestroyPixelStats(stats);
 
   ymax = VPixelMaxValue(dest);
   ymin = VPixelMinValue(dest);
@@ -117,10 +113,10 @@ VImage
 VContrastUByte(VImage src,VImage dest,VFloat low,VFloat high)
 {
   int nbands,nrows,ncols,npixels;
-  float u,v,xmin,xmax,slope,sum,background;
-  float histo[256];
-  int i,j;
+  float u,v,xmin,xmax,slope;
+  int i;
   VUByte *src_pp,*dest_pp;
+  VPixelStats stats;
 
   if (VPixelRepn(src) != VUByteRepn) VError(" input pixel repn must be ubyte");
 
@@ -133,39 +129,13 @@ VContrastUByte(VImage src,VImage dest,VFloat low,VFloat high)
   if (! dest) VError(" err creating dest image");
   VFillImage(dest,VAllBands,0);
 
-  for (j=0; j<256; j++) histo[j] = 0;
-
-  xmin = VPixelMaxValue(src);
-  xmax = VPixelMinValue(src);
-  background = xmin;
-  
-  src_pp = (VUByte *) VImageData(src);
-  for (i=0; i<npixels; i++) {
-    j = *src_pp++;
-    if (j <= background) continue;
-    histo[j]++;
-  }
- 
-  sum = 0;
-  for (j=0; j<256; j++) sum += histo[j];
-  for (j=0; j<256; j++) histo[j] /= sum;
-
-  xmin = 0;
-  sum  = 0;
-  for (j=0; j<256; j++) {
-    if (j > background) sum += histo[j];
-    if (sum > low) break;
-  }
-  xmin = j;
-
-  xmax = 255.0;
-  sum = 0;
-  for (j=255; j>0; j--) {
-    if (j > background) sum += histo[j];
-    if (sum > high) break;
-  }
-  xmax = j;
-
+  /* zero is background */
+  stats = VComputePixelStats(src,VAllBands,NULL,(VDouble) 0.5,TRUE);
+  if (stats->n < 1) VError(" no foreground pixels found");
+  xmin = VPixelPercentile(stats,low);
+  xmax = VPixelPercentile(stats,1.0 - high);
+  VDestroyPixelStats(stats);
+  if (xmax <= xmin) xmax = xmin + 1;
 
   slope = (float) (255.0) / ((float) (xmax - xmin));
   
@@ -175,7 +145,7 @@ VContrastUByte(VImage src,VImage dest,VFloat low,VFloat high)
   for (i=0; i<npixels; i++) {
     u = *src_pp;
  
-    if (u <= background) {
+    if (u == 0) {
       v = 0;
     }
     else {
@@ -189,7 +159,6 @@ VContrastUByte(VImage src,VImage dest,VFloat low,VFloat high)
     dest_pp++;
   }
 
-  VFree(histo);
   VCopyImageAttrs (src, dest);
   return dest;
 }
@@ -205,13 +174,11 @@ VImage
 VContrastShort(VImage src,VImage dest,VFloat low,VFloat high)
 {
   int nbands,nrows,ncols,npixels;
-  float u,v,xmin,xmax,slope,sum;
-  float *histo;
-  int i,j,dim;
+  float u,v,xmin,xmax,slope;
+  int i;
   VShort *src_pp;
   VUByte *dest_pp;
-  double smin,smax;
-  double percent1,percent2;
+  VPixelStats stats;
 
   if (VPixelRepn(src) != VShortRepn) VError(" input pixel repn must be short");
 
@@ -224,46 +191,11 @@ VContrastShort(VImage src,VImage dest,VFloat low,VFloat high)
   if (! dest) VError(" err creating dest image");
   VFillImage(dest,VAllBands,0);
 
-
-  smin = VRepnMinValue(VShortRepn);
-  smax = VRepnMaxValue(VShortRepn);
-
-  percent1 = low;    /* unten  */
-  percent2 = high;   /* oben   */
-
-
-  dim = 2.0 * smax + 1.0;
-  histo = (float *) VCalloc(dim,sizeof(float));
-  for (j=0; j<dim; j++) histo[j] = 0;
-
-
-  src_pp = (VShort *) VImageData(src);
-  for (i=0; i<npixels; i++) {
-    j = *src_pp++;
-    j -= smin;
-    histo[j]++;
-  }
- 
-  sum = 0;
-  for (j=0; j<dim; j++) sum += histo[j];
-  for (j=0; j<dim; j++) histo[j] /= sum;
-
-  xmin = 0;
-  sum  = 0;
-  for (j=0; j<dim; j++) {
-    sum += histo[j];
-    if (sum > percent1) break;
-  }
-  xmin = j+smin;
-
-  xmax = dim;
-  sum = 0;
-  for (j=dim; j>0; j--) {
-    sum += histo[j];
-    if (sum > percent2) break;
-  }
-  xmax = j+smin;
-
+  stats = VComputePixelStats(src,VAllBands,NULL,(VDouble) 0,TRUE);
+  xmin = VPixelPercentile(stats,low);     /* unten  */
+  xmax = VPixelPercentile(stats,1.0 - high);   /* oben   */
+  VDestroyPixelStats(stats);
+  if (xmax <= xmin) xmax = xmin + 1;
 
   slope = 255.0f / (xmax - xmin);
   
@@ -277,7 +209,6 @@ VContrastShort(VImage src,VImage dest,VFloat low,VFloat high)
     *dest_pp++ = (VUByte) v;
   }
 
-  VFree(histo);
   VCopyImageAttrs (src, dest);
   return dest;
 }
@@ -388,6 +319,7 @@ VMapImageRange(VImage src,VImage dest,VRepnKind repn)
 {
   int i,nbands,nrows,ncols,npixels;
   float u,ymin,ymax,dmin,dmax,slope;
+  VDouble smin,smax;
 
   if (repn == VDoubleRepn || repn == VLongRepn || repn == VSByteRepn)
     VError(" VMapImageRange: double, long and sbyte are not supported");
@@ -402,14 +334,9 @@ VMapImageRange(VImage src,VImage dest,VRepnKind repn)
   VFillImage(dest,VAllBands,0);
 
 
-  ymin = VPixelMaxValue(src);
-  ymax = VPixelMinValue(src);
-
-  for (i=0; i<npixels; i++) {
-    u = VGetPixelValue (src,i);
-    if (u < ymin) ymin = u;
-    if (u > ymax) ymax = u;
-  }
+  VImageStats(src,VAllBands,&smin,&smax,NULL,NULL);
+  ymin = smin;
+  ymax = smax;
 
   dmax = VPixelMaxValue(dest);
   dmin = VPixelMinValue(dest);
@@ -435,11 +362,11 @@ VImage
 VContrastAny(VImage src,VImage dest,VFloat low,VFloat high)
 {
   int nbands,nrows,ncols;
-  double xmin,xmax,slope,sum,a;
-  float *histo;
-  int b,r,c,j,dim;
+  double xmin,xmax,slope;
+  int b,r,c;
   VUByte *dest_pp;
-  double smin,smax,u,v,tiny;
+  double u,v,tiny;
+  VPixelStats stats;
 
   nbands = VImageNBands(src);
   nrows  = VImageNRows(src);
@@ -449,61 +376,15 @@ VContrastAny(VImage src,VImage dest,VFloat low,VFloat high)
   if (! dest) VError(" err creating dest image");
   VFillImage(dest,VAllBands,0);
 
-  
-  smin = VPixelMaxValue(src);
-  smax = VPixelMinValue(src);
+  /* grey values close to zero are background */
+  tiny = 2.0/10000.0;
+  if (VPixelRepn(src) == VUByteRepn) tiny = 2.0/256.0;
 
-  for (b=0; b<nbands; b++) {
-    for (r=0; r<nrows; r++) {
-      for (c=0; c<ncols; c++) {
-	u = VGetPixel(src,b,r,c);
-	if (u < smin) smin = u;
-	if (u > smax) smax = u;
-      }
-    }
-  }
-  
-  dim = 10000;
-  if (VPixelRepn(src) == VUByteRepn) dim = 256;
-  histo = (float *) VCalloc(dim,sizeof(float));
-  for (j=0; j<dim; j++) histo[j] = 0;
-  tiny = 2.0/(double)dim;
-
-  a = ((double) dim) / (smax - smin);
-
-  for (b=0; b<nbands; b++) {
-    for (r=0; r<nrows; r++) {
-      for (c=0; c<ncols; c++) {
-	u = VGetPixel(src,b,r,c);
-	if (ABS(u) < tiny) continue;
-	j = (int) (a * (u - smin) + 0.5);
-	if (j < 0) j = 0;
-	if (j >= dim) j = dim-1;
-	histo[j]++;
-      }
-    }
-  }
-
- 
-  sum = 0;
-  for (j=0; j<dim; j++) sum += histo[j];
-  for (j=0; j<dim; j++) histo[j] /= sum;
-
-  xmin = 0;
-  sum  = 0;
-  for (j=0; j<dim; j++) {
-    sum += histo[j];
-    if (sum > low) break;
-  }
-  xmin = ((double)j)/a + smin;
-  
-  xmax = dim;
-  sum = 0;
-  for (j=dim; j>0; j--) {
-    sum += histo[j];
-    if (sum > high) break;
-  }
-  xmax = ((double)j)/a + smin;
+  stats = VComputePixelStats(src,VAllBands,NULL,tiny,TRUE);
+  xmin = VPixelPercentile(stats,low);
+  xmax = VPixelPercentile(stats,1.0 - high);
+  VDestroyPixelStats(stats);
+  if (xmax <= xmin) xmax = xmin + 1;
 
   slope = 255.0 / (xmax - xmin);
 
@@ -512,9 +393,9 @@ VContrastAny(VImage src,VImage dest,VFloat low,VFloat high)
     for (r=0; r<nrows; r++) {
       for (c=0; c<ncols; c++) {
 	u = VGetPixel(src,b,r,c);
-	v = (int) (slope * (u - xmin) + 0.5);
+	v = slope * (u - xmin) + 0.5;
 	if (ABS(u) < tiny) v = 0;
-	if (v < 0) v = 0;
+	if (! (v >= 0)) v = 0;    /* also NaN */
 	if (v > 255) v = 255;
 	*dest_pp++ = (VUByte) v;
       }
@@ -35,6 +35,7 @@ Gabriele Lohmann, MPI-CBS
 VImage
 VConvolve3d (VImage src,VImage dest,VImage kernel)
 {
+  double tbegin = VTraceBegin();
   int b,r,c,nbands,nrows,ncols;
   int b0,b1,r0,r1,c0,c1,bb,rr,cc;
   VFloat sum,*float_pp;
@@ -90,6 +91,7 @@ VConvolve3d (VImage src,VImage dest,VImage kernel)
       }
     }
   }
+  VTraceEnd("VConvolve3d",tbegin,VImageNPixels(src),VImageSize(src));
   return dest;
 }
 
@@ -30,6 +30,7 @@ Gabriele Lohmann, MPI-CBS
 VImage
 VDeleteSmall (VImage src,VImage dest,int msize)
 {
+  double tbegin = VTraceBegin();
   int i,j,npixels,nbands,nrows,ncols;
   long table[MAXVAL];
   VRepnKind repn;
@@ -111,5 +112,6 @@ VDeleteSmall (VImage src,VImage dest,int msize)
   }
 
   VCopyImageAttrs (src, dest);
+  VTraceEnd("VDeleteSmall",tbegin,VImageNPixels(src),VImageSize(src));
   return dest;
 }
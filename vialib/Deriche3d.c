@@ -1,9 +1,15 @@
 /*! \file
  3D Deriche filter for edge detection
- 
+
+Each gradient component is obtained by applying the recursive Deriche
+derivative along one axis and the Deriche smoothing filter along the
+other two. The input is converted to float once per component, all
+passes then run in place on that float volume (see VFilterLines3d).
+Lines are processed in parallel.
+
 \par Reference:
-R. Deriche. Fast algorithms for low-level vision. 
-IEEE Transactions on Pattern Analysis and Machine Intelligence, 
+R. Deriche. Fast algorithms for low-level vision.
+IEEE Transactions on Pattern Analysis and Machine Intelligence,
 1(12):78-88, January 1990.
 
 \par Author:
@@ -15,6 +21,7 @@ Gabriele Lohmann, MPI-CBS
 #include <viaio/VImage.h>
 #include <viaio/mu.h>
 #include <viaio/option.h>
+#include <via.h>
 
 /* From the standard C libaray: */
 
@@ -22,10 +29,136 @@ Gabriele Lohmann, MPI-CBS
 #include <stdlib.h>
 #include <math.h>
 
+
+typedef struct {
+  double a,a0,a1,a2,a3,b1,b2;
+} DericheCoeff;
+
+
+/*
+** filter coefficients for a given alpha
+*/
+static void
+DericheInit(DericheCoeff *k,double alpha)
+{
+  double s,exp_alpha;
+
+  exp_alpha = exp(-alpha);
+  k->a  = exp_alpha;
+  k->b1 = -2.0 * exp_alpha;
+  k->b2 = exp(-2.0 * alpha);
+
+  s = ((1.0 - exp_alpha) * (1.0 - exp_alpha)) / (1.0 + 2.0 * alpha * exp_alpha - k->b2);
+
+  k->a0 = s;
+  k->a1 = s * (alpha - 1.0) * exp_alpha;
+  k->a2 = k->a1 - s * k->b1;
+  k->a3 = - s * k->b2;
+}
+
+
+/*
+** derivative of one line of length n, in place. The line is padded
+** with zeros. <w> must hold 2n+4 values.
+*/
+static void
+DerivLine(float *x,int n,void *arg,double *w)
+{
+  DericheCoeff *k = (DericheCoeff *) arg;
+  double b1=k->b1,b2=k->b2,u;
+  double *left=w,*right=w+n+2;
+  int i;
+
+  /* left-to-right, left[i+2] holds the output at i */
+  left[0] = left[1] = 0;
+  u = 0;
+  for (i=0; i<n; i++) {
+    left[i+2] = u - b1 * left[i+1] - b2 * left[i];
+    u = x[i];
+  }
+
+  /* right-to-left */
+  right[n] = right[n+1] = 0;
+  u = 0;
+  for (i=n-1; i>=0; i--) {
+    right[i] = u - b1 * right[i+1] - b2 * right[i+2];
+    u = x[i];
+  }
+
+  /* combine */
+  for (i=0; i<n; i++)
+    x[i] = k->a * (left[i+2] - right[i]);
+}
+
+
+/*
+** smoothing of one line of length n, in place. The line is padded
+** with zeros. <w> must hold 2n+4 values.
+*/
+static void
+SmoothLine(float *x,int n,void *arg,double *w)
+{
+  DericheCoeff *k = (DericheCoeff *) arg;
+  double a0=k->a0,a1=k->a1,a2=k->a2,a3=k->a3,b1=k->b1,b2=k->b2;
+  double *left=w,*right=w+n+2;
+  double u,v;
+  int i;
+
+  /* left-to-right */
+  left[0] = left[1] = 0;
+  u = 0;
+  for (i=0; i<n; i++) {
+    left[i+2] = a0 * x[i] + a1 * u - b1 * left[i+1] - b2 * left[i];
+    u = x[i];
+  }
+
+  /* right-to-left */
+  right[n] = right[n+1] = 0;
+  u = v = 0;
+  for (i=n-1; i>=0; i--) {
+    right[i] = a2 * u + a3 * v - b1 * right[i+1] - b2 * right[i+2];
+    v = u;
+    u = x[i];
+  }
+
+  /* combine */
+  for (i=0; i<n; i++)
+    x[i] = left[i+2] + right[i];
+}
+
+
+/*
+** gradient component along <axis> (0: bands, 1: rows, 2: columns),
+** computed in the float image <work>
+*/
+static VImage
+DericheComponent(VImage src,VImage work,int axis,DericheCoeff *k)
+{
+  int i,nbands,nrows,ncols;
+  VFloat *data;
+
+  work = VConvertImageCopy(src,work,VAllBands,VFloatRepn);
+  if (! work) VError(" VDeriche3d: cannot convert input image");
+
+  nbands = VImageNBands(work);
+  nrows  = VImageNRows(work);
+  ncols  = VImageNColumns(work);
+  data   = (VFloat *) VImageData(work);
+
+  for (i=2; i>=0; i--) {
+    if (i == axis)
+      VFilterLines3d(data,nbands,nrows,ncols,i,DerivLine,k);
+    else
+      VFilterLines3d(data,nbands,nrows,ncols,i,SmoothLine,k);
+  }
+  return work;
+}
+
+
 /*!
-\fn void VDeriche3d (VImage src,,VFloat alpha,
+\fn void VDeriche3d (VImage src,VFloat alpha,
 	    VImage *gradb,VImage *gradr,VImage *gradc);
-\param src     input image (ubyte repn)
+\param src     input image (any repn)
 \param alpha   parameter controlling edge strength
 \param *gradb  output gradient in slice direction (float repn)
 \param *gradr  output gradient in row direction (float repn)
@@ -36,345 +169,67 @@ void
 VDeriche3d (VImage src,VFloat alpha,
 	    VImage *gradb,VImage *gradr,VImage *gradc)
 {
-  int b,r,c;
-  int nbands,nrows,ncols,npixels,len;
-  double s,a,a0,a1,a2,a3,b1,b2,exp_alpha;
-  double x;
-  float *left,*right;
-
-  if (VPixelRepn(src) != VUByteRepn)
-    VError(" input image must be of type ubyte.");
-  
-  nbands  = VImageNBands (src);
-  nrows   = VImageNRows (src);
-  ncols   = VImageNColumns (src);
-  npixels = nbands * nrows * ncols;
-
-  len = (ncols > nrows) ? ncols : nrows;
-  if (nbands > len) len = nbands;
-
-  left  = (float *) VMalloc(sizeof(float) * len);
-  right = (float *) VMalloc(sizeof(float) * len);
-
- 
-  exp_alpha = exp((double) ( - alpha));
-  a  = 1.0 * exp_alpha;
-  b1 = -2.0 * exp_alpha;
-  b2 = exp((double) (-2.0 * alpha));
-
-  s = ((1.0 - exp_alpha) * (1.0 - exp_alpha)) / (1.0 + 2.0 * alpha * exp_alpha - b2);
-
-  a0 = s;
-  a1 = s * (alpha - 1.0) * exp_alpha;
-  a2 = a1 - s * b1;
-  a3 = - s * b2;
-
-
-  /* col-grad */
-
-  *gradc = VCreateImage(nbands,nrows,ncols,VFloatRepn);
-
-  for (b=0; b<nbands; b++) {
-    for (r=0; r<nrows; r++) {
-
-      /* left-to-right */
-      left[0] = 0;
-      left[1] = 0;
-      for (c=2; c<ncols; c++) {
-	left[c] = (VFloat) VPixel(src,b,r,c-1,VUByte) 
-	  - b1 * left[c-1]  - b2 * left[c-2];
-      }
-
-      /* right-to-left */
-      right[ncols-1] = 0;
-      right[ncols-2] = 0;
-      for (c=ncols-3; c>=0; c--) {
-	right[c] = (VFloat) VPixel(src,b,r,c+1,VUByte) 
-	  - b1 * right[c+1]  - b2 * right[c+2];
-      }
-
-      /* combine */
-
-      for (c=0; c<ncols; c++) {
-	VPixel(*gradc,b,r,c,VFloat) =  a * (left[c] - right[c]);
-      }
-    }
-  }
-
-  /* row-smooth */
-
-  for (b=0; b<nbands; b++) {
-    for (c=0; c<ncols; c++) {
-
-      /* left-to-right */
-      left[0] = 0;
-      left[1] = 0;
-      for (r=2; r<nrows; r++) {
-	left[r] = 
-	    a0 * (VFloat) VPixel(*gradc,b,r,c,VFloat)
-	  + a1 * (VFloat) VPixel(*gradc,b,r-1,c,VFloat)
-	  - b1 * left[r-1] - b2 * left[r-2];
-      }
-
-      /* right-to-left */
-      right[nrows-1] = 0;
-      right[nrows-2] = 0;
-
-      for (r=nrows-3; r>=0; r--) {
-	right[r] = 
-	    a2 * (VFloat) VPixel(*gradc,b,r+1,c,VFloat)
-	  + a3 * (VFloat) VPixel(*gradc,b,r+2,c,VFloat)
-	  - b1 * right[r+1] - b2 * right[r+2];
-      }
-      /* combine */
-
-      for (r=0; r<nrows; r++) {
-	VPixel(*gradc,b,r,c,VFloat) += left[r] + right[r];
-      }
-    }
-  }
+  double tbegin = VTraceBegin();
+  DericheCoeff k;
 
-  /* band-smooth */
-
-  if (nbands < 3) goto next_c;
-
-  for (r=0; r<nrows; r++) {
-    for (c=0; c<ncols; c++) {
-
-      /* left-to-right */
-      left[0] = 0;
-      left[1] = 0;
-      for (b=2; b<nbands; b++) {
-	left[b] = 
-	    a0 * (VFloat) VPixel(*gradc,b,r,c,VFloat)
-	  + a1 * (VFloat) VPixel(*gradc,b-1,r,c,VFloat)
-	  - b1 * left[b-1] - b2 * left[b-2];
-      }
-
-      /* right-to-left */
-      right[nbands-1] = 0;
-      right[nbands-2] = 0;
-
-      for (b=nbands-3; b>=0; b--) {
-	right[b] = 
-	    a2 * (VFloat) VPixel(*gradc,b+1,r,c,VFloat)
-	  + a3 * (VFloat) VPixel(*gradc,b+2,r,c,VFloat)
-	  - b1 * right[b+1] - b2 * right[b+2];
-      }
-      /* combine */
-
-      for (b=0; b<nbands; b++) {
-	VPixel(*gradc,b,r,c,VFloat) += left[b] + right[b];
-	x = VPixel(*gradc,b,r,c,VFloat);
-      }
-    }
-  }
-next_c: ;
-
-
-  /* 
-  ** row-grad 
-  */
-  *gradr = VCreateImage(nbands,nrows,ncols,VFloatRepn);
-
-  /* row-deriv */
-  for (b=0; b<nbands; b++) {
-    for (c=0; c<ncols; c++) {
-
-      /* left-to-right */
-      left[0] = 0;
-      left[1] = 0;
-      for (r=2; r<nrows; r++) {
-	left[r] = (VFloat) VPixel(src,b,r-1,c,VUByte) 
-	  - b1 * left[r-1]  - b2 * left[r-2];
-      }
-
-      /* right-to-left */
-      right[ncols-1] = 0;
-      right[ncols-2] = 0;
-      for (r=nrows-3; r>=0; r--) {
-	right[r] = (VFloat) VPixel(src,b,r+1,c,VUByte) 
-	  - b1 * right[r+1]  - b2 * right[r+2];
-      }
-
-      /* combine */
-
-      for (r=0; r<nrows; r++) {
-	VPixel(*gradr,b,r,c,VFloat) =  a * (left[r] - right[r]);
-      }
-    }
-  }
+  DericheInit(&k,(double) alpha);
 
-  /* col-smooth */
-
-  for (b=0; b<nbands; b++) {
-    for (r=0; r<nrows; r++) {
-
-      /* left-to-right */
-      left[0] = 0;
-      left[1] = 0;
-      for (c=2; c<ncols; c++) {
-	left[c] = 
-	    a0 * (VFloat) VPixel(*gradr,b,r,c,VFloat)
-	  + a1 * (VFloat) VPixel(*gradr,b,r,c-1,VFloat)
-	  - b1 * left[c-1] - b2 * left[c-2];
-      }
-
-      /* right-to-left */
-      right[ncols-1] = 0;
-      right[ncols-2] = 0;
-
-      for (c=ncols-3; c>=0; c--) {
-	right[r] = 
-	    a2 * (VFloat) VPixel(*gradr,b,r,c+1,VFloat)
-	  + a3 * (VFloat) VPixel(*gradr,b,r,c+2,VFloat)
-	  - b1 * right[c+1] - b2 * right[c+2];
-      }
-      /* combine */
-
-      for (c=0; c<ncols; c++) {
-	VPixel(*gradr,b,r,c,VFloat) += left[c] + right[c];
-      }
-    }
-  }
+  *gradc = DericheComponent(src,NULL,2,&k);
+  *gradr = DericheComponent(src,NULL,1,&k);
+  *gradb = DericheComponent(src,NULL,0,&k);
 
-  /* band-smooth */
-
-  for (r=0; r<nrows; r++) {
-    for (c=0; c<ncols; c++) {
-
-      /* left-to-right */
-      left[0] = 0;
-      left[1] = 0;
-      for (b=2; b<nbands; b++) {
-	left[b] = 
-	    a0 * (VFloat) VPixel(*gradr,b,r,c,VFloat)
-	  + a1 * (VFloat) VPixel(*gradr,b-1,r,c,VFloat)
-	  - b1 * left[b-1] - b2 * left[b-2];
-      }
-
-      /* right-to-left */
-      right[nbands-1] = 0;
-      right[nbands-2] = 0;
-
-      for (b=nbands-3; b>=0; b--) {
-	right[b] = 
-	    a2 * (VFloat) VPixel(*gradr,b+1,r,c,VFloat)
-	  + a3 * (VFloat) VPixel(*gradr,b+2,r,c,VFloat)
-	  - b1 * right[b+1] - b2 * right[b+2];
-      }
-      /* combine */
-
-      for (b=0; b<nbands; b++) {
-	VPixel(*gradr,b,r,c,VFloat) += left[b] + right[b];
-	x = VPixel(*gradr,b,r,c,VFloat);
-      }
-    }
-  }
+  VTraceEnd("VDeriche3d",tbegin,VImageNPixels(src),VImageSize(src));
+}
 
 
-  /*
-  **  band-grad 
-  */
-  *gradb = VCreateImage(nbands,nrows,ncols,VFloatRepn);
-
-  /* band-deriv */
-  for (r=0; r<nrows; r++) {
-    for (c=0; c<ncols; c++) {
-
-      /* left-to-right */
-      left[0] =  VPixel(src,0,r,c,VUByte);
-      left[1] =  VPixel(src,1,r,c,VUByte);
-      for (b=2; b<nbands; b++) {
-	left[b] = (VFloat) VPixel(src,b-1,r,c,VUByte) 
-	  - b1 * left[b-1]  - b2 * left[b-2];
-      }
-
-      /* right-to-left */
-      right[nbands-1] = 0;
-      right[nbands-2] = 0;
-      for (b=nbands-3; b>=0; b--) {
-	right[b] = (VFloat) VPixel(src,b+1,r,c,VUByte) 
-	  - b1 * right[b+1]  - b2 * right[b+2];
-      }
-
-      /* combine */
-
-      for (b=0; b<nbands; b++) {
-	VPixel(*gradb,b,r,c,VFloat) =  a * (left[b] - right[b]);
-      }
+/*!
+\fn VImage VDericheMagnitude3d (VImage src,VFloat alpha,VImage dest)
+\brief gradient magnitude of the 3D Deriche filter. Same as VDeriche3d
+followed by VMagnitude3d, but the gradient components are computed one
+after the other in a single work image, so that only two float volumes
+are needed instead of four.
+\param src     input image (any repn)
+\param alpha   parameter controlling edge strength
+\param dest    output image (float repn)
+*/
+VImage
+VDericheMagnitude3d (VImage src,VFloat alpha,VImage dest)
+{
+  double tbegin = VTraceBegin();
+  DericheCoeff k;
+  VImage work=NULL;
+  VFloat *p,*q;
+  long i,npixels;
+  int axis;
+
+  DericheInit(&k,(double) alpha);
+
+  dest = VSelectDestImage("VDericheMagnitude3d",dest,
+			  VImageNBands(src),VImageNRows(src),VImageNColumns(src),
+			  VFloatRepn);
+  if (! dest) return NULL;
+  npixels = VImageNPixels(dest);
+  q = (VFloat *) VImageData(dest);
+
+  for (axis=0; axis<3; axis++) {
+    work = DericheComponent(src,work,axis,&k);
+    p = (VFloat *) VImageData(work);
+
+    if (axis == 0) {
+#pragma omp parallel for schedule(static)
+      for (i=0; i<npixels; i++) q[i] = p[i] * p[i];
     }
-  }
-
-  /* col-smooth */
-
-  for (b=0; b<nbands; b++) {
-    for (r=0; r<nrows; r++) {
-
-      /* left-to-right */
-      left[0] = 0;
-      left[1] = 0;
-      for (c=2; c<ncols; c++) {
-	left[c] = 
-	    a0 * (VFloat) VPixel(*gradb,b,r,c,VFloat)
-	  + a1 * (VFloat) VPixel(*gradb,b,r,c-1,VFloat)
-	  - b1 * left[c-1] - b2 * left[c-2];
-      }
-
-      /* right-to-left */
-      right[ncols-1] = 0;
-      right[ncols-2] = 0;
-
-      for (c=ncols-3; c>=0; c--) {
-	right[c] = 
-	    a2 * (VFloat) VPixel(*gradb,b,r,c+1,VFloat)
-	  + a3 * (VFloat) VPixel(*gradb,b,r,c+2,VFloat)
-	  - b1 * right[c+1] - b2 * right[c+2];
-      }
-      /* combine */
-
-      for (c=0; c<ncols; c++) {
-	VPixel(*gradb,b,r,c,VFloat) += left[c] + right[c];
-      }
+    else {
+#pragma omp parallel for schedule(static)
+      for (i=0; i<npixels; i++) q[i] += p[i] * p[i];
     }
   }
+  VDestroyImage(work);
 
-  /* row-smooth */
-
-  for (b=0; b<nbands; b++) {
-    for (c=0; c<ncols; c++) {
-
-      /* left-to-right */
-      left[0] = 0;
-      left[1] = 0;
-      for (r=2; r<nrows; r++) {
-	left[r] = 
-	    a0 * (VFloat) VPixel(*gradb,b,r,c,VFloat)
-	  + a1 * (VFloat) VPixel(*gradb,b,r-1,c,VFloat)
-	  - b1 * left[r-1] - b2 * left[r-2];
-      }
-
-      /* right-to-left */
-      right[nrows-1] = 0;
-      right[nrows-2] = 0;
-
-      for (r=nrows-3; r>=0; r--) {
-	right[r] = 
-	    a2 * (VFloat) VPixel(*gradb,b,r+1,c,VFloat)
-	  + a3 * (VFloat) VPixel(*gradb,b,r+2,c,VFloat)
-	  - b1 * right[r+1] - b2 * right[r+2];
-      }
-      /* combine */
-
-      for (r=0; r<nrows; r++) {
-	VPixel(*gradb,b,r,c,VFloat) += left[r] + right[r];
-	x = VPixel(*gradb,b,r,c,VFloat);
-      }
-    }
-  }
+#pragma omp parallel for schedule(static)
+  for (i=0; i<npixels; i++) q[i] = sqrt((double) q[i]);
 
-  VFree(left);
-  VFree(right);
+  VCopyImageAttrs (src, dest);
+  VTraceEnd("VDericheMagnitude3d",tbegin,VImageNPixels(src),VImageSize(src));
+  return dest;
 }
-
- 
@@ -1,10 +1,11 @@
 /*! \file
-2d chamfer distance transform.
+2d distance transforms.
 
-For each foreground pixel, the length of the shortest
-2D path to the nearest background pixel is computed.
+For each background pixel, the length of the shortest
+2D path to the nearest foreground pixel is computed.
 The chamfer distance metric is an approximation to the
-Euclidian distance.
+Euclidian distance. The Euclidean distance transform is exact
+and takes linear time per slice.
 
 
 \par References:
@@ -12,6 +13,10 @@ G. Borgefors (1984).
 "Distance Transforms in arbitrary dimensions",
 CVGIP 27, pp.321-345.
 
+P.F. Felzenszwalb, D.P. Huttenlocher (2004).
+"Distance Transforms of Sampled Functions",
+Cornell Computing and Information Science TR2004-1963.
+
 \par Author:
 Gabriele Lohmann, MPI-CBS
 */
@@ -26,7 +31,9 @@ Gabriele Lohmann, MPI-CBS
 
 /* From the standard C library: */
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
+#include <float.h>
 
 
 
@@ -71,6 +78,7 @@ VImage VChamferDist2d(VImage src,VImage dest,VBand band)
 
   inf = VPixelMaxValue(dest);    /* infinity  */
   
+#pragma omp parallel for private(r,c,i,x,z,src_pp,dest_pp) schedule(dynamic)
   for (b = 0; b < nbands; b++) {
     
     src_pp  = (VBit *)   VPixelPtr (src, b, 0, 0);
@@ -123,3 +131,152 @@ VImage VChamferDist2d(VImage src,VImage dest,VBand band)
   VCopyImageAttrs (src, dest);
   return dest;
 }
+
+
+
+
+/*
+** exact Euclidean distance transform of one slice.
+** <near> receives the row index of the nearest foreground pixel
+** in the same column, or -1.
+*/
+static void
+EDist2dSlice(VBit *src,VFloat *dest,VLong *feature,int *near,
+	     int nrows,int ncols,double dy,double dx,
+	     double *f,double *z,int *v)
+{
+  int r,c,q,k,*np;
+  double s,wx=dx*dx,wy=dy*dy,d;
+  VBit *sp;
+
+  /* columns, forward and backward */
+  for (r=0; r<nrows; r++) {
+    sp = src + (size_t) r * ncols;
+    np = near + (size_t) r * ncols;
+    if (r == 0) {
+      for (c=0; c<ncols; c++) np[c] = (sp[c] > 0) ? 0 : -1;
+    }
+    else {
+      for (c=0; c<ncols; c++) np[c] = (sp[c] > 0) ? r : np[c - ncols];
+    }
+  }
+  for (r=nrows-2; r>=0; r--) {
+    np = near + (size_t) r * ncols;
+    for (c=0; c<ncols; c++) {
+      q = np[c + ncols];
+      if (q < 0) continue;
+      if (np[c] < 0 || q - r < r - np[c]) np[c] = q;
+    }
+  }
+
+  /* rows, lower envelope of parabolas */
+  for (r=0; r<nrows; r++) {
+    np = near + (size_t) r * ncols;
+
+    k = -1;
+    for (q=0; q<ncols; q++) {
+      if (np[q] < 0) continue;
+      f[q] = wy * (double) (r - np[q]) * (double) (r - np[q]);
+      s = -DBL_MAX;
+      while (k >= 0) {
+	s = ((f[q] + wx*q*q) - (f[v[k]] + wx*v[k]*v[k])) / (2.0*wx*(q - v[k]));
+	if (s > z[k]) break;
+	k--;
+      }
+      if (k < 0) s = -DBL_MAX;
+      k++;
+      v[k] = q;
+      z[k] = s;
+      z[k+1] = DBL_MAX;
+    }
+
+    if (k < 0) {
+      for (c=0; c<ncols; c++) {
+	dest[(size_t) r * ncols + c] = FLT_MAX;
+	if (feature) feature[(size_t) r * ncols + c] = -1;
+      }
+      continue;
+    }
+
+    k = 0;
+    for (c=0; c<ncols; c++) {
+      while (z[k+1] < c) k++;
+      q = v[k];
+      d = wx * (double) (c - q) * (double) (c - q) + f[q];
+      dest[(size_t) r * ncols + c] = sqrt(d);
+      if (feature) feature[(size_t) r * ncols + c] = np[q] * ncols + q;
+    }
+  }
+}
+
+
+/*!
+\fn VImage VEuclideanDist2d (VImage src,VImage dest,VImage *feature)
+\brief Exact 2D Euclidean distance transform of every band.
+
+Each band is processed independently, bands are processed in parallel.
+The pixel spacing is taken from the "voxel" attribute of <src>
+("x y z", i.e. column, row, slice spacing). If it is missing,
+unit spacing is assumed. Pixels in bands without any foreground
+are set to the maximum float value.
+
+\param src     input image (bit repn)
+\param dest    output image (float repn)
+\param feature if not NULL, receives a long image holding for each pixel
+the index (row * ncolumns + column) of its nearest foreground pixel
+within the same band, or -1 if there is none.
+*/
+VImage
+VEuclideanDist2d(VImage src,VImage dest,VImage *feature)
+{
+  int b,nbands,nrows,ncols;
+  float x=1,y=1,zz=1;
+  VLong *fdata=NULL;
+  VString str;
+  VImage result;
+
+  if (VPixelRepn(src) != VBitRepn)
+    VError("VEuclideanDist2d: input image must be of type bit.");
+
+  nbands = VImageNBands(src);
+  nrows  = VImageNRows(src);
+  ncols  = VImageNColumns(src);
+
+  result = VSelectDestImage("VEuclideanDist2d",dest,nbands,nrows,ncols,VFloatRepn);
+  if (! result) return NULL;
+
+  if (feature) {
+    *feature = VCreateImage(nbands,nrows,ncols,VLongRepn);
+    if (! *feature) {
+      if (result != dest) VDestroyImage(result);
+      return NULL;
+    }
+    fdata = (VLong *) VImageData(*feature);
+  }
+
+  if (VGetAttr (VImageAttrList (src), "voxel", NULL,
+		VStringRepn, (VPointer) & str) == VAttrFound) {
+    sscanf(str,"%f %f %f",&x,&y,&zz);
+    if (x <= 0 || y <= 0) VError("VEuclideanDist2d: illegal voxel size");
+  }
+
+#pragma omp parallel for schedule(dynamic)
+  for (b=0; b<nbands; b++) {
+    size_t offset = (size_t) b * nrows * ncols;
+    int *near = (int *) VMalloc(sizeof(int) * nrows * ncols);
+    int *v = (int *) VMalloc(sizeof(int) * ncols);
+    double *f = (double *) VMalloc(sizeof(double) * ncols);
+    double *z = (double *) VMalloc(sizeof(double) * (ncols + 1));
+
+    EDist2dSlice((VBit *) VImageData(src) + offset,(VFloat *) VImageData(result) + offset,
+		 (fdata ? fdata + offset : NULL),near,nrows,ncols,y,x,f,z,v);
+
+    VFree(near);
+    VFree(v);
+    VFree(f);
+    VFree(z);
+  }
+
+  VCopyImageAttrs (src, result);
+  return result;
+}
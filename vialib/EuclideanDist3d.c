@@ -39,6 +39,7 @@ the distance values are multiplied by a factor of 10.
 VImage
 VEuclideanDist3d(VImage src,VImage dest,VRepnKind repn)
 {
+  double tbegin = VTraceBegin();
   if (VPixelRepn(src) != VBitRepn)
     VError(" input image must of type bit.");
 
@@ -51,6 +52,7 @@ VEuclideanDist3d(VImage src,VImage dest,VRepnKind repn)
   else
     VError("output pixel repn must be either short or float.");
 
+  VTraceEnd("VEuclideanDist3d",tbegin,VImageNPixels(src),VImageSize(src));
   return dest;
 }
 
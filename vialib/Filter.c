@@ -23,6 +23,7 @@ Gabriele Lohmann, MPI-CBS
 
 /*!
 \fn VImage VFilterBox3d (VImage src,VImage dest,int dim)
+\brief 3d box filter, see VLocalMean3d. Border voxels are set to zero.
 \param src  input image (any pixel repn)
 \param dest output image
 \param dim the 1D dimension of the convolution kernel
@@ -30,20 +31,12 @@ Gabriele Lohmann, MPI-CBS
 VImage
 VFilterBox3d(VImage src,VImage dest,int dim)
 {
-  VImage xsrc=NULL,xdest=NULL;
-  VImage kernel=NULL;
-  VDouble x;
-
-  kernel = VCreateImage(dim,dim,dim,VFloatRepn);
-  x = 1.0 / (float) (dim*dim*dim);
-  VFillImage(kernel,VAllBands,x);
+  VImage xdest=NULL;
 
-  /* convert image to float repn */
-  xsrc  = VConvertImageCopy(src,NULL,VAllBands,VFloatRepn);
-  xdest = VConvolve3d (xsrc,NULL,kernel);
-  xdest = VConvertImageCopy(xdest,NULL,VAllBands,VPixelRepn(src));
+  xdest = VLocalMean3d(src,NULL,dim,VConvolvePadNone);
+  if (! xdest) return NULL;
 
-  VDestroyImage(xsrc);
+  dest = VConvertImageCopy(xdest,dest,VAllBands,VPixelRepn(src));
   VDestroyImage(xdest);
 
   return dest;
@@ -137,6 +130,7 @@ VFilterGauss2d (VImage src,VImage dest,double sigma)
 VImage
 VFilterGauss3d (VImage src,VImage dest,double sigma)
 {
+  double tbegin = VTraceBegin();
   VImage xsrc=NULL,xdest=NULL,tmp=NULL,kernel=NULL;
 
   if (sigma <= 0) VError("VFilterGauss3d: sigma must be positive");
@@ -154,6 +148,7 @@ VFilterGauss3d (VImage src,VImage dest,double sigma)
   dest = VConvertImageCopy(xdest,NULL,VAllBands,VPixelRepn(src));
   VDestroyImage(xdest);
 
+  VTraceEnd("VFilterGauss3d",tbegin,VImageNPixels(src),VImageSize(src));
   return dest;
 }
 
@@ -1,6 +1,19 @@
 /*! \file
 Isodata clustering
 
+Grey values are clustered on a histogram of the full range of the
+data. Integer data whose range spans at most MaxBins values get one
+bin per value, other data MaxBins bins of equal width. The histogram
+is built in parallel with one histogram per thread. Each iteration
+assigns bins to their nearest center by a single sweep over the bins,
+since the centers are kept sorted. Voxels are then labelled by a lookup
+table over the bins or, if bins are not single values, by a binary
+search over the midpoints between centers.
+
+Up to MaxIter iterations are done, and a cluster that becomes empty
+keeps its center. (Formerly at most 15 iterations were done and the
+center of an empty cluster was reset to 0, so results for ubyte images
+may differ where that happened.)
 
 \par Author:
 Gabriele Lohmann, MPI-CBS
@@ -11,70 +24,95 @@ Gabriele Lohmann, MPI-CBS
 #include <viaio/VImage.h>
 #include <viaio/mu.h>
 #include <viaio/option.h>
+#include <via.h>
 
 /* From the standard C libaray: */
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <math.h>
 
-#define ABS(x) ((x) < 0 ? -(x) : (x))
+#define MaxBins  65536    /* histogram size for wide or non-integer data */
+#define MaxIter  100      /* maximum number of iterations */
+#define BlockSize 65536   /* voxels processed by a thread at a time */
+
+
+typedef struct {
+  double min,max;         /* range of the data */
+  double width;           /* width of a bin */
+  long nbins;
+  VBoolean exact;         /* whether a bin is a single integer value */
+} HistoRange;
+
+
+/*
+** whether voxel i is clustered
+*/
+#define Selected(v,i) \
+  ((double) (v) != xignore && (mask == NULL || VGetPixelValue(mask,i) != 0))
+
+
+/*
+ *  MinMax
+ *
+ *  This macro computes the range of the clustered voxels i0 ... i1-1
+ */
+#define MinMax(type)                                            \
+{                                                               \
+  type *p = (type *) VImageData(src);                           \
+  for (i=i0; i<i1; i++) {                                       \
+    if (! Selected(p[i],i)) continue;                           \
+    if (p[i] < lmin) lmin = p[i];                               \
+    if (p[i] > lmax) lmax = p[i];                               \
+  }                                                             \
+}
 
 
 /*
  *  Histo
  *
- *  This macro computes the 1-dim image histogram of all bands
+ *  This macro adds voxels i0 ... i1-1 to the histogram h
  */
-#define Histo(type)                                      \
-{                                                        \
-  for (m=0; m<256; m++) histo[m] = 0;                    \
-  for (band = 0; band < nbands; band++) {		 \
-    for (row = 0; row < nrows; row++) {			 \
-      for (col = 0; col < ncols; col++) {		 \
-	pixval = (VLong) VPixel(src,band,row,col,type);	 \
-        if (pixval == ignore) continue;                  \
-	if (pixval < 0)   pixval = 0;			 \
-	if (pixval > 255) pixval = 255;			 \
-	histo[pixval]++;				 \
-      }							 \
-    }							 \
-  }							 \
+#define Histo(type)                                             \
+{                                                               \
+  type *p = (type *) VImageData(src);                           \
+  for (i=i0; i<i1; i++) {                                       \
+    if (! Selected(p[i],i)) continue;                           \
+    k = (long) (((double) p[i] - range.min) * scale);           \
+    if (k < 0) k = 0;                                           \
+    if (k >= range.nbins) k = range.nbins - 1;                  \
+    h[k]++;                                                     \
+  }                                                             \
 }
 
+
 /*
- *  Output
+ *  Lutapply
  *
- *  This macro applies the output lut to the image
+ *  This macro labels voxels i0 ... i1-1, by the lookup table where it
+ *  applies, otherwise by the nearest center
  */
-#define Lutapply(type)                                        \
-{ \
-  for (i=0; i<256; i++) { \
-    dmin = 100000.0; \
-    j0 = 0; \
-    for (j=0; j<nclusters; j++) { \
-      if (ABS((double) i - center[j]) < dmin) { \
-	dmin = ABS((double)i - center[j]); \
-	j0 = j; \
-      } \
-    } \
-    lut[i] = (VUByte) j0; \
-  } \
-  for (band = 0; band < nbands; band++) {		      \
-    for (row=0; row< nrows; row++) {		              \
-      for (col=0; col < ncols; col++) {	                      \
-        pixval = (VLong) VPixel(src,band,row,col,type);	      \
-        if (pixval < 0)   pixval = 0;			      \
-        if (pixval > 255) pixval = 255;			      \
-        VPixel(dest,band,row,col,VUByte) = lut[pixval];       \
-      }							      \
-    }							      \
-  }                                                           \
+#define Lutapply(type)                                          \
+{                                                               \
+  type *p = (type *) VImageData(src);                           \
+  for (i=i0; i<i1; i++) {                                       \
+    if (mask && VGetPixelValue(mask,i) == 0) {                  \
+      q[i] = 0;                                                 \
+      continue;                                                 \
+    }                                                           \
+    if (range.exact && p[i] >= range.min && p[i] <= range.max)  \
+      q[i] = lut[(long) ((double) p[i] - range.min)];           \
+    else                                                        \
+      q[i] = Nearest((double) p[i],mid,nclusters) + offset;     \
+  }                                                             \
 }
 
+
 /*
 **  sort the array: Numerical recipes, p. 330
 */
 static void
-piksrt(double *array, VLong n) 
+piksrt(double *array, VLong n)
 {
   int i,j;
   double a=0;
@@ -91,146 +129,256 @@ piksrt(double *array, VLong n)
 }
 
 
+/*
+** index of the nearest of n sorted centers, given the midpoints
+** between them. Ties go to the lower center.
+*/
+static int
+Nearest(double x,double *mid,int n)
+{
+  int lo=0,hi=n-1,m;
 
-void Isodata3d(double *center, double *histo, VLong nclusters)
+  while (lo < hi) {
+    m = (lo + hi) / 2;
+    if (x > mid[m]) lo = m+1;
+    else hi = m;
+  }
+  return lo;
+}
+
+
+/*
+** cluster the histogram. On return <center> holds the sorted
+** cluster centers and <mid> the midpoints between them.
+*/
+static void
+Isodata3d(double *center,double *mid,double *histo,HistoRange *range,int nclusters)
 {
-  int i,j,jmin[256],count;
-  double cx=0,xnorm;
-  double dx,dmin,sum,diff;
+  double *sum,*norm,cx,x,dx,diff,tol;
+  long i;
+  int j,count;
+
+  sum  = (double *) VMalloc(nclusters * sizeof(double));
+  norm = (double *) VMalloc(nclusters * sizeof(double));
 
-/*  let initial cluster centers be evenly distributed between 0...255  */
-  cx = (int) (255.0 / (float) (nclusters + 1));
-  for (i=0; i<nclusters; i++) center[i] = (i + 1) * cx;
+  /* let initial cluster centers be evenly distributed over the range */
+  cx = (range->max - range->min) / (double) (nclusters + 1);
+  if (range->exact) cx = floor(cx);
+  for (j=0; j<nclusters; j++) center[j] = range->min + (j + 1) * cx;
 
-  diff = 1000000000.0;
+  /* stop if the centers move by less than a bin */
+  tol = range->width * range->width;
+  diff = HUGE_VAL;
   count = 0;
 
-  while (diff > 1.0 && count < 15) {
+  while (diff > tol && count < MaxIter) {
 
-    for (i=0; i<256; i++) {
-      dmin = 256.0 * 256.0;
-      for (j=0; j<nclusters; j++) {
-	dx = (double) i - center[j];
-	dx *= dx;
-	if (dx < dmin) {
-	  jmin[i] = j;  dmin = dx;
-	}
-      }
+    for (j=0; j<nclusters-1; j++) mid[j] = 0.5 * (center[j] + center[j+1]);
+    for (j=0; j<nclusters; j++) sum[j] = norm[j] = 0;
+
+    /* the bins of a cluster are contiguous */
+    j = 0;
+    for (i=0; i<range->nbins; i++) {
+      if (histo[i] == 0) continue;
+      x = range->min + (range->exact ? i : (i + 0.5) * range->width);
+      while (j < nclusters-1 && x > mid[j]) j++;
+      sum[j]  += x * histo[i];
+      norm[j] += histo[i];
     }
 
+    /* empty clusters keep their center */
     diff = 0;
-    for (i=0; i<nclusters; i++) {
-      xnorm = 0; sum = 0;
-      for (j=0; j<256; j++)
-        if (jmin[j] == i) xnorm += histo[j];
-      for (j=0; j<256; j++)
-        if (jmin[j] == i) sum += (double) j * histo[j];
-      if (xnorm > 0) sum /= xnorm;
-      else sum = 0;
-      dx = sum - center[i];
-      center[i] = sum;
-      dx *= dx;
-      diff += dx;
+    for (j=0; j<nclusters; j++) {
+      if (norm[j] == 0) continue;
+      dx = sum[j] / norm[j] - center[j];
+      center[j] += dx;
+      diff += dx * dx;
     }
+    piksrt(center,nclusters);
     count++;
   }
 
-  piksrt(center,nclusters);
+  for (j=0; j<nclusters-1; j++) mid[j] = 0.5 * (center[j] + center[j+1]);
+  VFree(sum);
+  VFree(norm);
 }
 
 
 
 /*!
-\fn VImage VIsodataImage3d (VImage src,VImage dest,VLong nclusters,VLong ignore)
-\param src   input image (any repn)
+\fn VImage VIsodataMask3d (VImage src,VImage dest,VImage mask,VLong nclusters,VLong ignore)
+\brief isodata clustering of the grey values of the voxels within a mask.
+\param src   input image (any repn except bit)
 \param dest  output image (ubyte repn)
+\param mask  voxels where the mask is non-zero are clustered, may be NULL
 \param nclusters number of clusters
 \param ignore grey value to be ignored in clustering (e.g. '0')
+
+Clusters are labelled 0 ... nclusters-1 in increasing order of their
+centers, or 1 ... nclusters if a mask is given, in which case voxels
+outside the mask are set to 0. Voxels with the value <ignore> do not
+contribute to the clusters, but are labelled as well.
 */
 VImage
-VIsodataImage3d (VImage src,VImage dest,VLong nclusters,VLong ignore)
+VIsodataMask3d (VImage src,VImage dest,VImage mask,VLong nclusters,VLong ignore)
 {
-  VLong   pixval;
-  double  *histo;
-  double  dmin;
-  int nbands,nrows,ncols;
-  int band,row, col, i, j,j0=0, m;
-  VRepnKind dest_repn;
-  double *center;
-  VUByte lut[256];
+  double tbegin = VTraceBegin();
+  long npixels;
+  double *histo,*center,*mid;
+  double xmin=HUGE_VAL,xmax=-HUGE_VAL,xignore=(double) ignore;
+  HistoRange range;
+  VUByte *lut=NULL;
+  int offset=0;
+  long i,blk,nblocks;
 
   /* Ensure that "c" is legal: */
   if (nclusters <= 1 || nclusters > 255 ) {
     VError ("VIsodataImage: illegal number of clusters (%d)", nclusters);
   }
+  if (VPixelRepn(src) == VBitRepn || VPixelRepn(src) == VUnknownRepn
+      || VPixelRepn(src) > VDoubleRepn)
+    VError("VIsodataImage3d: illegal pixel repn");
+  if (mask) {
+    if (VImageNPixels(mask) != VImageNPixels(src))
+      VError("VIsodataImage3d: mask and image must have the same size");
+    if (nclusters > 254)
+      VError ("VIsodataImage: illegal number of clusters (%d)", nclusters);
+    offset = 1;
+  }
 
-  /* Choose an appropriate destination representation: */
-  dest_repn = VUByteRepn;
-  nbands = VImageNBands (src);
-  nrows  = VImageNRows (src);
-  ncols  = VImageNColumns (src);
-
-  if (dest == NULL)
-    dest = VCreateImage (nbands,nrows,ncols,VUByteRepn);
+  dest = VSelectDestImage("VIsodataImage3d",dest,VImageNBands(src),
+			  VImageNRows(src),VImageNColumns(src),VUByteRepn);
   if (! dest) return NULL;
+  npixels = VImageNPixels(src);
+  nblocks = (npixels + BlockSize - 1) / BlockSize;
 
-  histo  = (double *) VMalloc(256 * sizeof(double));
+  /* Range of the data: */
+  if (VPixelRepn(src) == VUByteRepn) {
+    xmin = 0;
+    xmax = 255;
+  }
+  else {
+#pragma omp parallel
+    {
+      double lmin = HUGE_VAL, lmax = -HUGE_VAL;
+      long blk,i,i0,i1;
+
+#pragma omp for schedule(static) nowait
+      for (blk=0; blk<nblocks; blk++) {
+	i0 = blk * BlockSize;
+	i1 = (i0 + BlockSize < npixels) ? i0 + BlockSize : npixels;
+	switch (VPixelRepn(src)) {
+	case VSByteRepn:  MinMax(VSByte);  break;
+	case VShortRepn:  MinMax(VShort);  break;
+	case VLongRepn:   MinMax(VLong);   break;
+	case VFloatRepn:  MinMax(VFloat);  break;
+	case VDoubleRepn: MinMax(VDouble); break;
+	default: ;
+	}
+      }
+#pragma omp critical
+      {
+	if (lmin < xmin) xmin = lmin;
+	if (lmax > xmax) xmax = lmax;
+      }
+    }
+  }
+  if (xmin > xmax) {
+    VWarning("VIsodataImage3d: no voxels to cluster");
+    VFillImage (dest,VAllBands,0);
+    VCopyImageAttrs (src, dest);
+    return dest;
+  }
+  range.min = xmin;
+  range.max = xmax;
+  range.exact = (VPixelRepn(src) != VFloatRepn && VPixelRepn(src) != VDoubleRepn
+		 && xmax - xmin < MaxBins);
+  if (range.exact) {
+    range.nbins = (long) (xmax - xmin) + 1;
+    range.width = 1;
+  }
+  else {
+    range.nbins = MaxBins;
+    range.width = (xmax - xmin) / (double) MaxBins;
+    if (range.width <= 0) range.width = 1;
+  }
+
+  histo  = (double *) VCalloc(range.nbins,sizeof(double));
   center = (double *) VMalloc(nclusters * sizeof(double));
+  mid    = (double *) VMalloc(nclusters * sizeof(double));
+
+  /* Get histogram, one per thread, and perform clustering */
+#pragma omp parallel
+  {
+    double *h = (double *) VCalloc(range.nbins,sizeof(double));
+    double scale = 1.0 / range.width;
+    long blk,i,i0,i1,k;
+
+#pragma omp for schedule(static) nowait
+    for (blk=0; blk<nblocks; blk++) {
+      i0 = blk * BlockSize;
+      i1 = (i0 + BlockSize < npixels) ? i0 + BlockSize : npixels;
+      switch (VPixelRepn(src)) {
+      case VUByteRepn:  Histo(VUByte);  break;
+      case VSByteRepn:  Histo(VSByte);  break;
+      case VShortRepn:  Histo(VShort);  break;
+      case VLongRepn:   Histo(VLong);   break;
+      case VFloatRepn:  Histo(VFloat);  break;
+      case VDoubleRepn: Histo(VDouble); break;
+      default: ;
+      }
+    }
+#pragma omp critical
+    for (k=0; k<range.nbins; k++) histo[k] += h[k];
+    VFree(h);
+  }
+  Isodata3d(center,mid,histo,&range,(int) nclusters);
 
-  /* Get histogram and perform clustering */
-  switch (VPixelRepn(src)) {
-    
-  case VBitRepn:
-    VError("VIsodataImage3d: illegal pixel repn");
-    break;
-    
-  case VUByteRepn:
-    Histo(VUByte);
-    Isodata3d(center,histo,nclusters);
-    Lutapply(VUByte);
-    break;
-    
-  case VSByteRepn:
-    Histo(VSByte);
-    Isodata3d(center,histo,nclusters);
-    Lutapply(VSByte);
-    break;
-    
-  case VShortRepn:
-    Histo(VShort);
-    Isodata3d(center,histo,nclusters);
-    Lutapply(VShort);
-    break;
-    
-  case VLongRepn:
-    Histo(VLong);
-    Isodata3d(center,histo,nclusters);
-    Lutapply(VLong);
-    break;
-    
-  case VFloatRepn:
-    Histo(VFloat);
-    Isodata3d(center,histo,nclusters);
-    Lutapply(VFloat);
-    break;
-    
-  case VDoubleRepn:
-    Histo(VDouble);
-    Isodata3d(center,histo,nclusters);
-    Lutapply(VDouble);
-
-  default:
-    VWarning(" no legal image representation found in input file");
+  /* Label the voxels */
+  if (range.exact) {
+    lut = (VUByte *) VMalloc(range.nbins);
+    for (i=0; i<range.nbins; i++)
+      lut[i] = Nearest(range.min + i,mid,(int) nclusters) + offset;
+  }
+#pragma omp parallel for schedule(static)
+  for (blk=0; blk<nblocks; blk++) {
+    VUByte *q = (VUByte *) VImageData(dest);
+    long i,i0,i1;
+
+    i0 = blk * BlockSize;
+    i1 = (i0 + BlockSize < npixels) ? i0 + BlockSize : npixels;
+    switch (VPixelRepn(src)) {
+    case VUByteRepn:  Lutapply(VUByte);  break;
+    case VSByteRepn:  Lutapply(VSByte);  break;
+    case VShortRepn:  Lutapply(VShort);  break;
+    case VLongRepn:   Lutapply(VLong);   break;
+    case VFloatRepn:  Lutapply(VFloat);  break;
+    case VDoubleRepn: Lutapply(VDouble); break;
+    default: ;
+    }
   }
 
+  VFree(histo);
+  VFree(center);
+  VFree(mid);
+  if (lut) VFree(lut);
+
   /* Successful completion: */
   VCopyImageAttrs (src, dest);
+  VTraceEnd("VIsodataImage3d",tbegin,VImageNPixels(src),VImageSize(src));
   return dest;
 }
 
 
-
-
-
-
-
+/*!
+\fn VImage VIsodataImage3d (VImage src,VImage dest,VLong nclusters,VLong ignore)
+\param src   input image (any repn except bit)
+\param dest  output image (ubyte repn)
+\param nclusters number of clusters
+\param ignore grey value to be ignored in clustering (e.g. '0')
+*/
+VImage
+VIsodataImage3d (VImage src,VImage dest,VLong nclusters,VLong ignore)
+{
+  return VIsodataMask3d(src,dest,NULL,nclusters,ignore);
+}
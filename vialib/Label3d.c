@@ -28,11 +28,10 @@ Gabriele Lohmann, MPI-CBS
 typedef struct {
   Voxel *A;
   int front,rear;
+  int size;      /* allocated length of A */
+  int msize;     /* largest front seen */
 } Queue;
 
-static Queue queue;
-static int QueueSize=0;
-static int msize=0;
 typedef int BOOLEAN;
 
 static void QueueClear(Queue *);
@@ -58,14 +57,15 @@ identified.
 VImage
 VLabelImage3d(VImage src,VImage dest,int neighb,VRepnKind repn,int *numlabels)
 {
+  double tbegin = VTraceBegin();
   int i,nbands,nrows,ncols,npixels;
   VBit *src_pp;
   Voxel v,vv;
   int label,n,nblack;
   int b0,b1,r0,r1,c0,c1,b,r,c,bb,rr,cc;
   int ba[6],ra[6],ca[6],m;
+  Queue queue;
   
-  msize = 0;
   if (VPixelRepn(src) != VBitRepn) 
     VError("Input image must be of type VBit");
 
@@ -102,10 +102,10 @@ VLabelImage3d(VImage src,VImage dest,int neighb,VRepnKind repn,int *numlabels)
     if (*src_pp++ > 0) nblack++;
   if (nblack < 1) return dest;
 
-  QueueSize = (float)(nblack) * 0.666;
-  if (QueueSize < 128) QueueSize=128;
-  queue.A = (Voxel *) VMalloc(sizeof(Voxel) * QueueSize);
-  msize = 0;
+  queue.size = (float)(nblack) * 0.666;
+  if (queue.size < 128) queue.size=128;
+  queue.A = (Voxel *) VMalloc(sizeof(Voxel) * queue.size);
+  queue.msize = 0;
   label = 0;
 
   /*
@@ -256,6 +256,7 @@ VLabelImage3d(VImage src,VImage dest,int neighb,VRepnKind repn,int *numlabels)
   VFree(queue.A);
   if (numlabels != NULL) *numlabels = label;
   VCopyImageAttrs (src, dest);
+  VTraceEnd("VLabelImage3d",tbegin,VImageNPixels(src),VImageSize(src));
   return dest;
 }
 
@@ -299,9 +300,9 @@ deQueue(Queue *pQ, Voxel *pe)
 static BOOLEAN 
 enQueue(Queue *pQ, Voxel e)
 {
-  if (pQ->front > msize) msize = pQ->front;
+  if (pQ->front > pQ->msize) pQ->msize = pQ->front;
   
-  if (pQ->front < QueueSize - 1) {
+  if (pQ->front < pQ->size - 1) {
     pQ->A[(pQ->front)++] = e;
     return TRUE;
   }
@@ -310,8 +311,8 @@ enQueue(Queue *pQ, Voxel e)
     return TRUE;
   }
   else {
-    QueueSize += QueueSize * 0.333;
-    queue.A = (Voxel *) VRealloc(queue.A,sizeof(Voxel) * QueueSize);
+    pQ->size += pQ->size * 0.333;
+    pQ->A = (Voxel *) VRealloc(pQ->A,sizeof(Voxel) * pQ->size);
     pQ->A[(pQ->front)++] = e;
     return TRUE;
   }
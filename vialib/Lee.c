@@ -1,6 +1,31 @@
 /*! \file
 3D Lee filter
 
+Each voxel is replaced by the mean of those voxels in a wsize x wsize
+(x wsize) window whose grey values differ from its own by at most sigma.
+
+The window is kept as a histogram which is updated incrementally as the
+window slides along a row: one face of the window is added and one is
+removed per step. The number and sum of the grey values within +-sigma
+are read from the histogram, which is divided into blocks of about the
+square root of the number of bins within +-sigma, with running block
+totals, so the cost of this lookup does not depend on the window size.
+
+For integer pixel repns with a range of at most 65536 grey values, a bin
+is a grey value. Otherwise the distinct grey values are sorted and a bin
+is a rank in this table. The ranks within +-sigma of each grey value are
+found once, by comparing the grey values themselves, so exactly the
+voxels of a direct scan are averaged. Sums are kept as integers, the
+grey values being scaled by a power of two, so they are exact however
+the window has been updated; a direct scan, which sums in double
+precision, gives the same result whenever its sums are exact too. When
+the histogram would not be cheaper than scanning the window, e.g. for
+small windows over data with many distinct values within +-sigma, or
+when the data contain NaNs or infinities, or span too many binary
+orders of magnitude for exact integer sums (as double data with full
+precision values usually do), the window is scanned directly along
+contiguous rows. Rows are processed in parallel.
+
 \par Author:
 Gabriele Lohmann, MPI-CBS
 */
@@ -14,115 +39,520 @@ Gabriele Lohmann, MPI-CBS
 /* From the standard C library: */
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <math.h>
 
-#define ABS(x) ((x) < 0 ? -(x) : (x))
+/* max. number of grey values binned directly */
+#define MAXBINS 65536
+
+/* max. number of distinct grey values binned by rank */
+#define MAXRANKS (1 << 22)
+
+/* marks voxels to be ignored in the index image */
+#define NOBIN (-1)
+
+/* voxels processed by a thread at a time */
+#define BlockSize 65536
+
+/* cost per voxel of ranking the grey values, in scanned voxels */
+#define RANKCOST 150
+
+
+typedef struct {
+  int nbands,nrows,ncols;
+  long wb,wr,wc;              /* half window size along bands, rows, columns */
+  double sigma;
+  VLong ignoreval;
+} LeeParams;
+
+
+/*
+** bin of each voxel. Bin i is either grey value vmin+i, or the grey
+** value value[i] * 2^scale of rank i, in which case bins lo[i] ... hi[i]
+** are within +-sigma of it.
+*/
+typedef struct {
+  int *idx;
+  int nbins,shift,scale;
+  long vmin;
+  long *value;
+  int *lo,*hi;
+} LeeBins;
+
+
+/*
+** histogram of the current window. Blocks of 2^shift bins hold the count
+** and sum of their values, which are bin indices for integer bins.
+*/
+typedef struct {
+  int *count;
+  int *bcount;
+  long *bsum;
+  int shift;
+  long *value;
+} LeeHist;
+
+#define BinValue(h,i) ((h)->value ? (h)->value[i] : (long) (i))
+
+
+/*
+** add (d = 1) or remove (d = -1) column c of the window centered at (b,r)
+*/
+static void
+HistColumn(LeeHist *h,int *idx,LeeParams *p,
+	   long b0,long b1,long r0,long r1,long c,int d)
+{
+  long bb,rr;
+  int *q;
+  int i,k;
+
+  for (bb=b0; bb<=b1; bb++) {
+    q = idx + ((bb * p->nrows + r0) * p->ncols + c);
+    for (rr=r0; rr<=r1; rr++, q += p->ncols) {
+      i = *q;
+      if (i == NOBIN) continue;
+      k = i >> h->shift;
+      h->count[i] += d;
+      h->bcount[k] += d;
+      h->bsum[k] += d * BinValue(h,i);
+    }
+  }
+}
+
+
+/*
+** number and sum of the grey values of bins [lo,hi]
+*/
+static void
+HistQuery(LeeHist *h,int lo,int hi,long *n,long *s)
+{
+  int i,k,klo,khi;
+  long nn=0,ss=0;
+
+  klo = lo >> h->shift;
+  khi = hi >> h->shift;
+  if (klo == khi) {
+    for (i=lo; i<=hi; i++) {
+      nn += h->count[i];
+      ss += BinValue(h,i) * h->count[i];
+    }
+  }
+  else {
+    for (i=lo; i<((klo+1) << h->shift); i++) {
+      nn += h->count[i];
+      ss += BinValue(h,i) * h->count[i];
+    }
+    for (k=klo+1; k<khi; k++) {
+      nn += h->bcount[k];
+      ss += h->bsum[k];
+    }
+    for (i=(khi << h->shift); i<=hi; i++) {
+      nn += h->count[i];
+      ss += BinValue(h,i) * h->count[i];
+    }
+  }
+  *n = nn;
+  *s = ss;
+}
+
+
+/*
+** filter row (b,r) using the histogram, result in <out>
+*/
+static void
+HistLine(LeeHist *h,LeeBins *bins,LeeParams *p,long b,long r,double *out)
+{
+  long b0,b1,r0,r1,c,n,s,sum,wc=p->wc;
+  int i,lo,hi,nbins=bins->nbins;
+  int *idx=bins->idx,*q;
+
+  b0 = (b - p->wb < 0) ? 0 : b - p->wb;
+  b1 = (b + p->wb >= p->nbands) ? p->nbands-1 : b + p->wb;
+  r0 = (r - p->wr < 0) ? 0 : r - p->wr;
+  r1 = (r + p->wr >= p->nrows) ? p->nrows-1 : r + p->wr;
+  s  = (p->sigma >= nbins) ? nbins : (long) floor(p->sigma);
+  q  = idx + (b * p->nrows + r) * p->ncols;
+
+  for (c=0; c<=wc && c<p->ncols; c++)
+    HistColumn(h,idx,p,b0,b1,r0,r1,c,1);
+
+  for (c=0; c<p->ncols; c++) {
+    if (c > 0) {
+      if (c + wc < p->ncols) HistColumn(h,idx,p,b0,b1,r0,r1,c+wc,1);
+      if (c - wc - 1 >= 0) HistColumn(h,idx,p,b0,b1,r0,r1,c-wc-1,-1);
+    }
+    i = q[c];
+    if (i == NOBIN) {
+      out[c] = 0;
+      continue;
+    }
+    if (bins->value) {
+      HistQuery(h,bins->lo[i],bins->hi[i],&n,&sum);
+      out[c] = ldexp((double) sum,bins->scale) / n;
+    }
+    else {
+      lo = (i - s < 0) ? 0 : i - s;
+      hi = (i + s >= nbins) ? nbins-1 : i + s;
+      HistQuery(h,lo,hi,&n,&sum);
+      out[c] = (bins->vmin * n + sum) / n;
+    }
+  }
+
+  /* leave the histogram empty */
+  c = p->ncols - 1 - wc;
+  for (c = (c < 0) ? 0 : c; c<p->ncols; c++)
+    HistColumn(h,idx,p,b0,b1,r0,r1,c,-1);
+}
+
+
+/*
+** block size (as a shift) for histogram lookups over <range> bins
+*/
+static int
+BlockShift(double range)
+{
+  int shift;
+
+  for (shift=0; shift<12 && (double) (1L << (2*shift)) < range; shift++) ;
+  return shift;
+}
+
+
+/*
+** whether a histogram with lookups over <range> bins on average is
+** cheaper than scanning the window. Measured per voxel, a histogram
+** update costs about 2.5 scanned voxels, a lookup step about 2, and
+** ranking the values about RANKCOST.
+*/
+static VBoolean
+HistPays(LeeParams *p,double range)
+{
+  double face,shift;
+
+  face  = (double) (2*p->wb+1) * (double) (2*p->wr+1);
+  shift = BlockShift(range);
+  return 5 * face + 2 * (range / ldexp(1.0,shift) + ldexp(2.0,shift))
+    + RANKCOST < face * (double) (2*p->wc+1);
+}
+
+
+/*
+** filter row (b,r) by scanning the window, result in <out>
+*/
+#define LeeScan(type)                                              \
+{                                                                  \
+  type *data = (type *) VImageData(src),*q,y,v;                    \
+  double lo,hi;                                                    \
+  for (c=0; c<ncols; c++) {                                        \
+    y = data[(b * nrows + r) * ncols + c];                         \
+    if (ignoreval >= 0 && y == ignoreval) {                        \
+      out[c] = 0;                                                  \
+      continue;                                                    \
+    }                                                              \
+    lo = (double) y - sigma;                                       \
+    hi = (double) y + sigma;                                       \
+    c0 = (c - wc < 0) ? 0 : c - wc;                                \
+    c1 = (c + wc >= ncols) ? ncols-1 : c + wc;                     \
+    sum = 0;                                                       \
+    n = 0;                                                         \
+    for (bb=b0; bb<=b1; bb++) {                                    \
+      for (rr=r0; rr<=r1; rr++) {                                  \
+        q = data + (bb * nrows + rr) * ncols;                      \
+        if (ignoreval >= 0) {                                      \
+          for (cc=c0; cc<=c1; cc++) {                              \
+            v = q[cc];                                             \
+            m = (v >= lo) & (v <= hi) & (v != ignoreval);          \
+            sum += m * (double) v;                                 \
+            n += m;                                                \
+          }                                                        \
+        }                                                          \
+        else {                                                     \
+          for (cc=c0; cc<=c1; cc++) {                              \
+            v = q[cc];                                             \
+            m = (v >= lo) & (v <= hi);                             \
+            sum += m * (double) v;                                 \
+            n += m;                                                \
+          }                                                        \
+        }                                                          \
+      }                                                            \
+    }                                                              \
+    out[c] = sum / n;                                              \
+  }                                                                \
+}
+
+static void
+ScanLine(VImage src,LeeParams *p,long b,long r,double *out)
+{
+  long nrows=p->nrows,ncols=p->ncols,wc=p->wc;
+  long b0,b1,r0,r1,c0,c1,bb,rr,c,cc,n;
+  VLong ignoreval = p->ignoreval;
+  double sigma = p->sigma,sum;
+  int m;
+
+  b0 = (b - p->wb < 0) ? 0 : b - p->wb;
+  b1 = (b + p->wb >= p->nbands) ? p->nbands-1 : b + p->wb;
+  r0 = (r - p->wr < 0) ? 0 : r - p->wr;
+  r1 = (r + p->wr >= nrows) ? nrows-1 : r + p->wr;
+
+  switch (VPixelRepn(src)) {
+  case VLongRepn:
+    LeeScan(VLong);
+    break;
+  case VFloatRepn:
+    LeeScan(VFloat);
+    break;
+  case VDoubleRepn:
+    LeeScan(VDouble);
+    break;
+  default:
+    VError(" VLeeImage: illegal pixel repn");
+  }
+}
+
+
+/*
+** min and max grey value of an integer image
+*/
+#define LeeRange(type)                                  \
+{                                                       \
+  type *pp = (type *) VImageData(src);                  \
+  vmin = vmax = pp[0];                                  \
+  for (i=1; i<npixels; i++) {                           \
+    if (pp[i] < vmin) vmin = pp[i];                     \
+    if (pp[i] > vmax) vmax = pp[i];                     \
+  }                                                     \
+}
+
+/*
+** bin index of each voxel
+*/
+#define LeeIndex(type)                                          \
+{                                                               \
+  type *pp = (type *) VImageData(src);                          \
+  for (i=0; i<npixels; i++) {                                   \
+    if (ignoreval >= 0 && pp[i] == ignoreval) idx[i] = NOBIN;   \
+    else idx[i] = (int) (pp[i] - vmin);                         \
+  }                                                             \
+}
+
+/*
+** grey values of the voxels that are not ignored, stops at a NaN or
+** an infinity
+*/
+#define LeeGather(type)                                         \
+{                                                               \
+  type *pp = (type *) VImageData(src);                          \
+  for (i=0; i<npixels; i++) {                                   \
+    if (ignoreval >= 0 && pp[i] == ignoreval) continue;         \
+    if (pp[i] - pp[i] != 0) break;                              \
+    v[n++] = (double) pp[i];                                    \
+  }                                                             \
+}
+
+/*
+** rank of the grey value of voxels i0 ... i1-1
+*/
+#define LeeRankIndex(type)                                      \
+{                                                               \
+  type *pp = (type *) VImageData(src);                          \
+  for (i=i0; i<i1; i++) {                                       \
+    if (ignoreval >= 0 && pp[i] == ignoreval) {                 \
+      idx[i] = NOBIN;                                           \
+      continue;                                                 \
+    }                                                           \
+    x = (double) pp[i];                                         \
+    lo = 0;                                                     \
+    hi = nu - 1;                                                \
+    while (lo < hi) {                                           \
+      m = (lo + hi) / 2;                                        \
+      if (value[m] < x) lo = m + 1;                             \
+      else hi = m;                                              \
+    }                                                           \
+    idx[i] = lo;                                                \
+  }                                                             \
+}
 
 /*
-** this macro performs the sigma filtering (2D)
-*/
-#define Lee2d(type)                                         \
-{                                                           \
-    type *src_pp,*dest_pp;                                  \
-    src_pp = (type *) VPixelPtr(src,band,0,0);              \
-    dest_pp = (type *) VPixelPtr(result,band,0,0);          \
-    for (row = 0; row < nrows; row++) {                     \
-      for (col = 0; col < ncols; col++) {                   \
-	val1 = (long) *src_pp++;                            \
-        if (!((ignoreval >= 0)&&(val1 == ignoreval))) {     \
-	sum = 0;                                            \
-        dlen = 0;                                           \
-        rwm=row-wn2;rwp=row+wn2;cwm=col-wn2;cwp=col+wn2;    \
-        if (row < wn2) {rstart=0;rend=rwp;}                 \
-        if ((row >= wn2)&&(row<nr2)) {rstart=rwm;rend=rwp;} \
-        if (row>=nr2) {rstart=rwm;rend=nr1;}                \
-        if (col < wn2) {cstart=0;cend=cwp;}                 \
-        if ((col >= wn2)&&(col<nc2)) {cstart=cwm;cend=cwp;} \
-        if (col>=nc2) {cstart=cwm;cend=nc1;}                \
-	for (r = rstart; r <= rend; r++) {                  \
-	  for (c = cstart; c <= cend; c++) {                \
-            val2 = (long) VPixel(src,band,r,c,type);        \
-        if (ignoreval == -1) {                              \
-            if ((double) ABS(val1 - val2) <= sigma) {       \
-	      sum += val2;                                  \
-	      dlen++;                                       \
-	    }                                               \
-   	   }                                                \
-        if ((ignoreval >= 0)&&(val2 != ignoreval)) {        \
-            if ((double) ABS(val1 - val2) <= sigma) {       \
-	      sum += val2;                                  \
-	      dlen++;                                       \
-	    }                                               \
-   	   }                                                \
-	  }                                                 \
-    	}                                                   \
-	 *dest_pp++ = (type) (sum / dlen);                  \
-       }                                                    \
-	 else *dest_pp++ = (type) 0;                        \
-      }                                                     \
-    }                                                       \
+** store a filtered row
+*/
+#define LeeStore(type,out)                              \
+{                                                       \
+  type *pp = (type *) VImageData(result) + offset;      \
+  for (c=0; c<ncols; c++) pp[c] = (type) out[c];        \
+}
+
+
+static int
+CompareDouble(const void *a,const void *b)
+{
+  double x = *(const double *) a,y = *(const double *) b;
+  return (x < y) ? -1 : (x > y);
 }
 
+
 /*
-** this macro performs the sigma filtering (3D)
-*/
-#define Lee3d(type)                                           \
-{                                                             \
-    type *src_pp,*dest_pp;                                    \
-    src_pp = (type *) VPixelPtr(src,0,0,0);                   \
-    dest_pp = (type *) VPixelPtr(result,0,0,0);               \
-    for (band = 0; band < nbands; band++) {                   \
-     for (row = 0; row < nrows; row++) {                      \
-      for (col = 0; col < ncols; col++) {                     \
-        y = (long) *src_pp++;                                 \
-        if (!((ignoreval >= 0)&&(y == ignoreval))) {          \
-	sum = 0;                                              \
-        dlen = 0;                                             \
-        rwm=row-wn2;rwp=row+wn2;cwm=col-wn2;cwp=col+wn2;      \
-        bwm=band-wn2;bwp=band+wn2;                            \
-        if (band < wn2) {bstart=0;bend=bwp;}                  \
-        if ((band >= wn2)&&(band<nb2)) {bstart=bwm;bend=bwp;} \
-        if (band>=nb2) {bstart=bwm;bend=nb1;}                 \
-        if (row < wn2) {rstart=0;rend=rwp;}                   \
-        if ((row >= wn2)&&(row<nr2)) {rstart=rwm;rend=rwp;}   \
-        if (row>=nr2) {rstart=rwm;rend=nr1;}                  \
-        if (col < wn2) {cstart=0;cend=cwp;}                   \
-        if ((col >= wn2)&&(col<nc2)) {cstart=cwm;cend=cwp;}   \
-        if (col>=nc2) {cstart=cwm;cend=nc1;}                  \
-        for (b = bstart; b <= bend; b++) {                    \
-         for (r = rstart; r <= rend; r++) {                   \
-          for (c = cstart; c <= cend; c++) {                  \
-            pixval = (long) VPixel(src,b,r,c,type);           \
-        if (ignoreval == -1) {                                \
-            if ((double)ABS(pixval - y) <= sigma) {           \
-	      sum += pixval;                                  \
-	      dlen++;                                         \
-	    }                                                 \
-   	   }                                                  \
-        if ((ignoreval >= 0)&&(pixval != ignoreval)) {        \
-            if ((double)ABS(pixval - y) <= sigma) {           \
-	      sum += pixval;                                  \
-	      dlen++;                                         \
-	    }                                                 \
-   	   }                                                  \
-	  }                                                   \
-    	 }                                                    \
-    	}                                                     \
-         *dest_pp++ = (type) (sum / dlen);                    \
-       }                                                      \
-	 else *dest_pp++ = (type) 0;                          \
-      }                                                       \
-     }                                                        \
-    }                                                         \
+** exponent of the lowest set bit of x != 0
+*/
+static int
+LowBit(double x)
+{
+  int e,k;
+  long m;
+
+  m = (long) ldexp(frexp(fabs(x),&e),53);
+  frexp((double) (m & -m),&k);
+  return e + k - 54;
 }
 
 
+/*
+** bins by rank of the distinct grey values, see LeeBins. Returns FALSE,
+** leaving <bins> unset, if the data contain NaNs or too many distinct
+** values, if their sums over a window cannot be kept exactly in a long,
+** or if scanning the window is cheaper.
+*/
+static VBoolean
+LeeRanks(VImage src,LeeParams *p,LeeBins *bins)
+{
+  long i,j,n=0,ns,nu,npixels=VImageNPixels(src),blk,nblocks;
+  VLong ignoreval = p->ignoreval;
+  double *v,*value,range,step,x;
+  int *lo,*hi,scale,top;
+
+  v = (double *) VMalloc(sizeof(double) * (npixels > 0 ? npixels : 1));
+  switch (VPixelRepn(src)) {
+  case VLongRepn:
+    LeeGather(VLong);
+    break;
+  case VFloatRepn:
+    LeeGather(VFloat);
+    break;
+  case VDoubleRepn:
+    LeeGather(VDouble);
+    break;
+  default:
+    ;
+  }
+  if (i < npixels || n == 0) {
+    VFree(v);
+    return FALSE;
+  }
+
+  /* the values are multiples of 2^scale below 2^top in magnitude, so
+     the sum over a window is exact in a long if this bound fits */
+  scale = INT_MAX;
+  for (i=0, x=0; i<n; i++) {
+    if (v[i] != 0 && LowBit(v[i]) < scale) scale = LowBit(v[i]);
+    if (fabs(v[i]) > x) x = fabs(v[i]);
+  }
+  if (scale == INT_MAX) scale = 0;
+  frexp(x,&top);
+  x = ldexp((double) (2*p->wb+1) * (2*p->wr+1) * (2*p->wc+1),top - scale);
+  if (x >= (double) LONG_MAX) {
+    VFree(v);
+    return FALSE;
+  }
+
+  /* the distinct values of a sample have no more neighbours within
+     +-sigma than all values have, so give up before sorting if even
+     that lower bound does not pay */
+  step = (n > 4096) ? n / 4096.0 : 1.0;
+  value = (double *) VMalloc(sizeof(double) * 4096);
+  for (ns=0; ns<4096 && (long) (ns * step) < n; ns++)
+    value[ns] = v[(long) (ns * step)];
+  qsort(value,ns,sizeof(double),CompareDouble);
+  for (nu=1, i=1; i<ns; i++)
+    if (value[i] != value[nu-1]) value[nu++] = value[i];
+  for (range=0, i=0, j=0; i<nu; i++) {
+    while (value[j] < value[i] - p->sigma) j++;
+    range += i - j;
+  }
+  for (i=nu-1, j=nu-1; i>=0; i--) {
+    while (value[j] > value[i] + p->sigma) j--;
+    range += j - i;
+  }
+  VFree(value);
+  if (! HistPays(p,range / nu + 1)) {
+    VFree(v);
+    return FALSE;
+  }
+
+  /* table of distinct grey values */
+  qsort(v,n,sizeof(double),CompareDouble);
+  for (nu=1, i=1; i<n; i++)
+    if (v[i] != v[nu-1]) v[nu++] = v[i];
+  if (nu > MAXRANKS) {
+    VFree(v);
+    return FALSE;
+  }
+  value = (double *) VMalloc(sizeof(double) * nu);
+  for (i=0; i<nu; i++) value[i] = v[i];
+  VFree(v);
+
+  /* ranks within +-sigma, compared as in LeeScan */
+  lo = (int *) VMalloc(sizeof(int) * nu);
+  hi = (int *) VMalloc(sizeof(int) * nu);
+  range = 0;
+  for (i=0, j=0; i<nu; i++) {
+    while (! (value[j] >= value[i] - p->sigma)) j++;
+    lo[i] = j;
+  }
+  for (i=nu-1, j=nu-1; i>=0; i--) {
+    while (! (value[j] <= value[i] + p->sigma)) j--;
+    hi[i] = j;
+    range += hi[i] - lo[i] + 1;
+  }
+  if (! HistPays(p,range / nu)) {
+    VFree(value);
+    VFree(lo);
+    VFree(hi);
+    return FALSE;
+  }
+
+  bins->idx = (int *) VMalloc(sizeof(int) * npixels);
+  nblocks = (npixels + BlockSize - 1) / BlockSize;
+
+#pragma omp parallel for schedule(static)
+  for (blk=0; blk<nblocks; blk++) {
+    long i,i0,i1,lo,hi,m;
+    int *idx = bins->idx;
+    double x;
+
+    i0 = blk * BlockSize;
+    i1 = (i0 + BlockSize < npixels) ? i0 + BlockSize : npixels;
+    switch (VPixelRepn(src)) {
+    case VLongRepn:
+      LeeRankIndex(VLong);
+      break;
+    case VFloatRepn:
+      LeeRankIndex(VFloat);
+      break;
+    case VDoubleRepn:
+      LeeRankIndex(VDouble);
+      break;
+    default:
+      ;
+    }
+  }
+
+  bins->nbins = nu;
+  bins->shift = BlockShift(range / nu);
+  bins->scale = scale;
+  bins->vmin  = 0;
+  bins->value = (long *) VMalloc(sizeof(long) * nu);
+  for (i=0; i<nu; i++) bins->value[i] = (long) ldexp(value[i],-scale);
+  VFree(value);
+  bins->lo    = lo;
+  bins->hi    = hi;
+  return TRUE;
+}
+
 
 
 /*!
 \fn VImage VLeeImage (VImage src,VImage result,VLong wsize,VDouble sigma,VLong dim,VLong ignoreval)
-\param src   input image 
-\param result  output image 
+\param src   input image
+\param result  output image
 \param wsize window size
 \param sigma sigma
 \param dim dimension (0=2D, 1=3D)
@@ -132,17 +562,20 @@ Gabriele Lohmann, MPI-CBS
 VImage
 VLeeImage (VImage src,VImage result,VLong wsize,VDouble sigma,VLong dim,VLong ignoreval)
 {
+  double tbegin = VTraceBegin();
   VRepnKind result_repn;
-  long sum,val1,val2,pixval,y;
-  long b,r,c,band,row,col,nbands,nrows,ncols;
-  long wn2,dlen;
-  long cstart,cend,rstart,rend,nr2,nr1,nc2,nc1,rwp,cwp,rwm,cwm;
-  long bstart,bend,nb2,nb1,bwp,bwm;
+  long i,npixels,nlines,vmin=0,vmax=0;
+  int nbands,nrows,ncols;
+  int *idx;
+  VBoolean hist=FALSE;
+  LeeParams p;
+  LeeBins bins;
 
   nrows = VImageNRows (src);
   ncols = VImageNColumns (src);
   nbands = VImageNBands (src);
   result_repn = VPixelRepn (src);
+  npixels = VImageNPixels (src);
 
   /* Ensure that "wsize" is legal: */
   if (wsize <= 0 || wsize%2 == 0) {
@@ -154,84 +587,148 @@ VLeeImage (VImage src,VImage result,VLong wsize,VDouble sigma,VLong dim,VLong ig
     VWarning ("VBoxImage: wsize (%d) is greater than nbands (%d) for 3D", wsize,nbands);
     return NULL;
   }
+  if (sigma < 0) {
+    VWarning ("VLeeImage: sigma must not be negative (%g)", sigma);
+    return NULL;
+  }
   if (result == NULL)
     result = VCreateImage (nbands,nrows,ncols,result_repn);
   if (! result) return NULL;
 
-  dlen = 0;
-  wn2 = floor((double) wsize / 2.0);
-  nb2=nbands-wn2;
-  nr2=nrows-wn2;
-  nc2=ncols-wn2;
-  nb1=nbands-1;
-  nr1=nrows-1;
-  nc1=ncols-1;
-
-  if (dim==0) { 
-    for (band = 0; band < nbands; band++) {
-      switch (result_repn) {
-
-      case VBitRepn:
-        Lee2d(VBit);
-        break;
-
-      case VUByteRepn:
-        Lee2d(VUByte);
-        break;
-
-      case VSByteRepn:
-        Lee2d(VSByte);
-        break;
-
-      case VShortRepn:
-        Lee2d(VShort);
-        break;
-
-      case VLongRepn:
-        Lee2d(VLong);
-        break;
+  p.nbands = nbands;
+  p.nrows  = nrows;
+  p.ncols  = ncols;
+  p.wc = p.wr = wsize / 2;
+  p.wb = (dim == 1) ? wsize / 2 : 0;
+  p.sigma = sigma;
+  p.ignoreval = ignoreval;
 
-      case VFloatRepn:
-        Lee2d(VFloat);
-        break;
-
-      case VDoubleRepn:
-        Lee2d(VDouble);
-      }
-    }
+  /* one bin per grey value for integer repns with at most MAXBINS */
+  switch (result_repn) {
+  case VBitRepn:
+    LeeRange(VBit);
+    break;
+  case VUByteRepn:
+    LeeRange(VUByte);
+    break;
+  case VSByteRepn:
+    LeeRange(VSByte);
+    break;
+  case VShortRepn:
+    LeeRange(VShort);
+    break;
+  case VLongRepn:
+    LeeRange(VLong);
+    break;
+  default:
+    ;
   }
-  if (dim==1) { 
+  if (result_repn != VFloatRepn && result_repn != VDoubleRepn
+      && vmax - vmin < MAXBINS) {
+    hist = TRUE;
+    bins.nbins = vmax - vmin + 1;
+    i = (sigma >= bins.nbins) ? bins.nbins : (long) floor(sigma);
+    bins.shift = BlockShift(2*i+1);
+    bins.vmin  = vmin;
+    bins.value = NULL;
+    bins.scale = 0;
+    bins.lo = bins.hi = NULL;
+    bins.idx = idx = (int *) VMalloc(sizeof(int) * npixels);
     switch (result_repn) {
-
     case VBitRepn:
-      Lee3d(VBit);
+      LeeIndex(VBit);
       break;
-
     case VUByteRepn:
-      Lee3d(VUByte);
+      LeeIndex(VUByte);
       break;
-
     case VSByteRepn:
-      Lee3d(VSByte);
+      LeeIndex(VSByte);
       break;
-
     case VShortRepn:
-      Lee3d(VShort);
+      LeeIndex(VShort);
       break;
-
     case VLongRepn:
-      Lee3d(VLong);
+      LeeIndex(VLong);
       break;
+    default:
+      ;
+    }
+  }
 
-    case VFloatRepn:
-      Lee3d(VFloat);
-      break;
+  /* otherwise one bin per distinct grey value, if that pays */
+  else
+    hist = LeeRanks(src,&p,&bins);
 
-    case VDoubleRepn:
-      Lee3d(VDouble);
+  nlines = (long) nbands * nrows;
+
+#pragma omp parallel
+  {
+    double *out = (double *) VMalloc(sizeof(double) * ncols);
+    LeeHist h;
+    long line,b,r,c,offset;
+
+    if (hist) {
+      h.shift  = bins.shift;
+      h.value  = bins.value;
+      h.count  = (int *) VCalloc(bins.nbins,sizeof(int));
+      h.bcount = (int *) VCalloc((bins.nbins >> h.shift) + 1,sizeof(int));
+      h.bsum   = (long *) VCalloc((bins.nbins >> h.shift) + 1,sizeof(long));
     }
+
+#pragma omp for schedule(dynamic,8)
+    for (line=0; line<nlines; line++) {
+      b = line / nrows;
+      r = line % nrows;
+      offset = line * ncols;
+
+      if (hist)
+	HistLine(&h,&bins,&p,b,r,out);
+      else
+	ScanLine(src,&p,b,r,out);
+
+      switch (result_repn) {
+      case VBitRepn:
+	LeeStore(VBit,out);
+	break;
+      case VUByteRepn:
+	LeeStore(VUByte,out);
+	break;
+      case VSByteRepn:
+	LeeStore(VSByte,out);
+	break;
+      case VShortRepn:
+	LeeStore(VShort,out);
+	break;
+      case VLongRepn:
+	LeeStore(VLong,out);
+	break;
+      case VFloatRepn:
+	LeeStore(VFloat,out);
+	break;
+      case VDoubleRepn:
+	LeeStore(VDouble,out);
+	break;
+      default:
+	;
+      }
+    }
+
+    if (hist) {
+      VFree(h.count);
+      VFree(h.bcount);
+      VFree(h.bsum);
+    }
+    VFree(out);
+  }
+
+  if (hist) {
+    VFree(bins.idx);
+    if (bins.value) VFree(bins.value);
+    if (bins.lo) VFree(bins.lo);
+    if (bins.hi) VFree(bins.hi);
   }
 
   VCopyImageAttrs (src, result);
+  VTraceEnd("VLeeImage",tbegin,npixels,VImageSize(src));
   return result;
 }
@@ -0,0 +1,114 @@
+/*! \file
+  Apply a 1D filter to all lines of a 3D float volume
+
+Lines along the column axis are contiguous in memory and are filtered
+in place. For the row and band axes, tiles of adjacent columns are
+copied into a buffer of contiguous lines, filtered and copied back,
+so that all memory accesses run along rows. Lines are processed in
+parallel.
+
+\par Author:
+Gabriele Lohmann, MPI-CBS
+*/
+
+/* From the Vista library: */
+#include <viaio/Vlib.h>
+#include <viaio/VImage.h>
+#include <viaio/mu.h>
+#include <via.h>
+
+/* From the standard C library: */
+#include <stdio.h>
+#include <stdlib.h>
+
+/* number of adjacent columns copied together in the row and band passes */
+#define TILE 16
+
+typedef void (*VLineFilterProc)(float *,int,void *,double *);
+
+
+/*!
+\fn void VFilterLines3d(VFloat *data,int nbands,int nrows,int ncols,int axis,
+     VLineFilterProc proc,void *arg)
+\brief filter all lines of a volume along one axis.
+\param data   pixel data (float), filtered in place
+\param nbands number of bands
+\param nrows  number of rows
+\param ncols  number of columns
+\param axis   0 (bands), 1 (rows) or 2 (columns)
+\param proc   line filter, called as proc(line,length,arg,work). <work>
+provides 2*length+8 doubles of scratch memory.
+\param arg    passed to proc
+*/
+void
+VFilterLines3d(VFloat *data,int nbands,int nrows,int ncols,int axis,
+	       VLineFilterProc proc,void *arg)
+{
+  int len,nouter,ntiles;
+  long stride,outer_stride,njobs;
+
+  if (axis == 2) {
+    njobs = (long) nbands * nrows;
+
+#pragma omp parallel
+    {
+      double *work = (double *) VMalloc(sizeof(double) * (2*ncols + 8));
+      long l;
+
+#pragma omp for schedule(static)
+      for (l=0; l<njobs; l++)
+	proc(data + l * ncols,ncols,arg,work);
+      VFree(work);
+    }
+    return;
+  }
+
+  if (axis == 1) {
+    len = nrows;
+    stride = ncols;
+    nouter = nbands;
+    outer_stride = (long) nrows * ncols;
+  }
+  else if (axis == 0) {
+    len = nbands;
+    stride = (long) nrows * ncols;
+    nouter = nrows;
+    outer_stride = ncols;
+  }
+  else {
+    VError("VFilterLines3d: illegal axis %d",axis);
+    return;
+  }
+
+  ntiles = (ncols + TILE - 1) / TILE;
+  njobs  = (long) nouter * ntiles;
+
+#pragma omp parallel
+  {
+    float *buf   = (float *) VMalloc(sizeof(float) * len * TILE);
+    double *work = (double *) VMalloc(sizeof(double) * (2*len + 8));
+    long job;
+    int i,j,c0,nc;
+    VFloat *p;
+
+#pragma omp for schedule(dynamic,4)
+    for (job=0; job<njobs; job++) {
+      c0 = (int) (job % ntiles) * TILE;
+      nc = (c0 + TILE <= ncols) ? TILE : ncols - c0;
+      p  = data + (job / ntiles) * outer_stride + c0;
+
+      for (i=0; i<len; i++)
+	for (j=0; j<nc; j++)
+	  buf[j*len + i] = p[i*stride + j];
+
+      for (j=0; j<nc; j++)
+	proc(buf + j*len,len,arg,work);
+
+      for (i=0; i<len; i++)
+	for (j=0; j<nc; j++)
+	  p[i*stride + j] = buf[j*len + i];
+    }
+    VFree(buf);
+    VFree(work);
+  }
+}
@@ -37,6 +37,7 @@ extern void gsl_sort_vector(gsl_vector *);
 VImage 
 VMedianImage3d (VImage src, VImage dest, int dim, VBoolean ignore)
 {
+  double tbegin = VTraceBegin();
   int nbands,nrows,ncols;
   int i,len,len2,b,r,c,bb,rr,cc,b0,b1,r0,r1,c0,c1,d=0;
   gsl_vector *vec=NULL;
@@ -95,6 +96,7 @@ VMedianImage3d (VImage src, VImage dest, int dim, VBoolean ignore)
     }
   }
   gsl_vector_free(vec);
+  VTraceEnd("VMedianImage3d",tbegin,VImageNPixels(src),VImageSize(src));
   return dest;
 }
 
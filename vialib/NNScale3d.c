@@ -12,6 +12,7 @@ Gabriele Lohmann, MPI-CBS
 #include "viaio/mu.h"
 #include "viaio/os.h"
 #include "viaio/VImage.h"
+#include <via.h>
 
 /* From the standard C library: */
 #include <stdio.h>
@@ -34,50 +35,9 @@ VImage
 VNNScale3d (VImage src,VImage dest,int dst_nbands,int dst_nrows,int dst_ncols,
 	    float shift[3],float scale[3])
 {
-  int nrows,ncols,nbands; 
-  VRepnKind repn;
-  int b,r,c,bb,rr,cc;
-  VDouble v;
-  float xscale,yscale,zscale;
-  float bp,rp,cp;
-
-
-  /* Extract data from source image */
-  nrows   = VImageNRows(src);
-  ncols   = VImageNColumns(src);
-  nbands  = VImageNBands(src);
-  repn    = VPixelRepn(src);
-    
-  dest = VSelectDestImage("VNNScale3d",dest,dst_nbands,dst_nrows,dst_ncols,repn);
+  dest = VResampleScale3d(src,dest,dst_nbands,dst_nrows,dst_ncols,
+			  shift,scale,VPixelRepn(src),VInterpolNN);
   if (! dest) return NULL;
-  VFillImage(dest,VAllBands,0);
-
-  zscale = 1.0 / scale[0];
-  yscale = 1.0 / scale[1];
-  xscale = 1.0 / scale[2];
-
-
-  for (b=0; b<dst_nbands; b++) {
-    bp = zscale * ((float) b - shift[0]);
-    bb = (int) (bp + 0.5);
-    if (bb < 0 || bb >= nbands) continue;
-
-    for (r=0; r<dst_nrows; r++) {
-      rp = yscale * ((float) r  - shift[1]);
-      rr = (int) (rp + 0.5);
-      if (rr < 0 || rr >= nrows) continue;
-
-      for (c=0; c<dst_ncols; c++) {
-	cp = xscale * ((float) c - shift[2]);
-	cc = (int) (cp + 0.5);
-	if (cc < 0 || cc >= ncols) continue;
-	  
-	v = VGetPixel(src,bb,rr,cc);
-	if (repn == VUByteRepn) v = (int)(v + 0.4999);
-	VSetPixel(dest,b,r,c,v);
-      }
-    }
-  }
 
   VCopyImageAttrs (src, dest);
   return dest;
@@ -0,0 +1,381 @@
+/*! \file
+ Multi-resolution pyramids
+
+Each level of a pyramid halves the size of the previous one along
+every axis with more than one voxel. A 2x2x2 block of the finer
+level is reduced to one voxel by its mean (VReduceBox), by a
+binomial low pass filter (VReduceGauss, the 5-tap kernel 1 4 6 4 1
+along each axis), or by its most frequent value (VReduceMode, for
+label images). At odd sizes the last voxel along an axis is
+replicated. The binomial filter works in float, or in double for
+long and double images.
+
+The kernels run along contiguous rows, and slices of the output are
+processed in parallel. Each level is computed from the previous one,
+so the full resolution image is read only once. VCatalogLevel finds
+the levels of an image stored in a file.
+
+\par Author:
+Gabriele Lohmann, MPI-CBS
+*/
+
+/* From the Vista library: */
+#include <viaio/Vlib.h>
+#include <viaio/VImage.h>
+#include <viaio/mu.h>
+#include <via.h>
+
+/* From the standard C library: */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+
+/* size of an axis after reduction */
+#define Reduced(n) ((n) > 1 ? ((n) + 1) / 2 : 1)
+
+/* the two source indices of output index i along an axis of size n */
+#define Lo(i,n) ((n) > 1 ? 2 * (i) : 0)
+#define Hi(i,n) ((n) > 1 && 2 * (i) + 1 < (n) ? 2 * (i) + 1 : Lo(i,n))
+
+
+/*
+** mean of 2x2x2 blocks, row r of slice b of the output.
+** <acc> must hold the sum of 8 pixels, <norm> converts it back.
+*/
+#define BoxRow(type,acc,norm)                                           \
+{                                                                       \
+  type *p0 = (type *) VPixelPtr(src,b0,r0,0);                           \
+  type *p1 = (type *) VPixelPtr(src,b0,r1,0);                           \
+  type *p2 = (type *) VPixelPtr(src,b1,r0,0);                           \
+  type *p3 = (type *) VPixelPtr(src,b1,r1,0);                           \
+  type *q  = (type *) VPixelPtr(dest,b,r,0);                            \
+  acc s;                                                                \
+  if (ncols > 1) {                                                      \
+    for (c = 0; c < ncols / 2; c++) {                                   \
+      s = (acc) p0[2*c] + p0[2*c+1] + p1[2*c] + p1[2*c+1]               \
+	+ p2[2*c] + p2[2*c+1] + p3[2*c] + p3[2*c+1];                    \
+      q[c] = (type) (norm);                                             \
+    }                                                                   \
+    if (ncols % 2) {                                                    \
+      s = 2 * ((acc) p0[ncols-1] + p1[ncols-1] + p2[ncols-1] + p3[ncols-1]); \
+      q[c] = (type) (norm);                                             \
+    }                                                                   \
+  }                                                                     \
+  else {                                                                \
+    s = 2 * ((acc) p0[0] + p1[0] + p2[0] + p3[0]);                      \
+    q[0] = (type) (norm);                                               \
+  }                                                                     \
+}
+
+
+/*
+** most frequent value of 2x2x2 blocks, row r of slice b of the output.
+** Ties go to the value that occurs first in the block.
+*/
+#define ModeRow(type)                                                   \
+{                                                                       \
+  type *p0 = (type *) VPixelPtr(src,b0,r0,0);                           \
+  type *p1 = (type *) VPixelPtr(src,b0,r1,0);                           \
+  type *p2 = (type *) VPixelPtr(src,b1,r0,0);                           \
+  type *p3 = (type *) VPixelPtr(src,b1,r1,0);                           \
+  type *q  = (type *) VPixelPtr(dest,b,r,0);                            \
+  type v[8];                                                            \
+  int i,j,n,nbest;                                                      \
+  for (c = 0; c < dc; c++) {                                            \
+    c0 = Lo(c,ncols);                                                   \
+    c1 = Hi(c,ncols);                                                   \
+    v[0] = p0[c0]; v[1] = p0[c1]; v[2] = p1[c0]; v[3] = p1[c1];         \
+    v[4] = p2[c0]; v[5] = p2[c1]; v[6] = p3[c0]; v[7] = p3[c1];         \
+    q[c] = v[0];                                                        \
+    nbest = 0;                                                          \
+    for (i = 0; i < 8 - nbest; i++) {                                   \
+      for (j = i, n = 0; j < 8; j++)                                    \
+	n += (v[j] == v[i]);                                            \
+      if (n > nbest) {                                                  \
+	nbest = n;                                                      \
+	q[c] = v[i];                                                    \
+      }                                                                 \
+    }                                                                   \
+  }                                                                     \
+}
+
+
+/*
+** binomial filter of a row of length n, keeping every second value,
+** into row r of slice b of <t>, in precision <ftype>
+*/
+#define GaussColumns(type,ftype)                                        \
+{                                                                       \
+  type *p = (type *) VPixelPtr(src,b,r,0);                              \
+  ftype *q = (ftype *) t + (b * nrows + r) * dc;                        \
+  if (n == 1) {                                                         \
+    q[0] = p[0];                                                        \
+    break;                                                              \
+  }                                                                     \
+  for (c = 0; c < dc; c++) {                                            \
+    if (c >= 1 && 2*c + 2 < n)                                          \
+      q[c] = (p[2*c-2] + p[2*c+2] + 4 * ((ftype) p[2*c-1] + p[2*c+1])   \
+	      + 6 * (ftype) p[2*c]) * ((ftype) 1 / 16);                 \
+    else                                                                \
+      q[c] = (p[Clamp(2*c-2,n)] + p[Clamp(2*c+2,n)]                     \
+	      + 4 * ((ftype) p[Clamp(2*c-1,n)] + p[Clamp(2*c+1,n)])      \
+	      + 6 * (ftype) p[2*c]) * ((ftype) 1 / 16);                 \
+  }                                                                     \
+}
+
+#define Clamp(i,n) ((i) < 0 ? 0 : ((i) >= (n) ? (n) - 1 : (i)))
+
+
+/*
+** filter <n> input lines <p> of length <len> with the 1 4 6 4 1 kernel
+** around index i, clamping at 0 and n-1, in precision <ftype>
+*/
+#define GaussLines(ftype)                                               \
+{                                                                       \
+  ftype *a = p[Clamp(2*i-2,n)], *b = p[Clamp(2*i-1,n)], *m = p[2*i];    \
+  ftype *d = p[Clamp(2*i+1,n)], *e = p[Clamp(2*i+2,n)], *q = dest;      \
+  if (n == 1)                                                           \
+    for (j=0; j<len; j++) q[j] = m[j];                                  \
+  else                                                                  \
+    for (j=0; j<len; j++)                                               \
+      q[j] = (a[j] + e[j] + 4 * (b[j] + d[j]) + 6 * m[j]) * ((ftype) 1 / 16); \
+}
+
+
+/*
+** round and clip filtered values <v> to the pixel type
+*/
+#define StoreRow(type,ftype)                                            \
+{                                                                       \
+  type *q = (type *) VPixelPtr(dest,b,r,0);                             \
+  ftype *v = (ftype *) w + r * dc;                                      \
+  for (c = 0; c < dc; c++) {                                            \
+    x = v[c];                                                           \
+    if (x < xmin) x = xmin;                                             \
+    if (x > xmax) x = xmax;                                             \
+    q[c] = (type) floor(x + 0.5);                                       \
+  }                                                                     \
+}
+
+
+/*
+** filter lines in float, or in double if <wide>
+*/
+static void
+FilterLines(VPointer *p,int n,int i,long len,VPointer dest,VBoolean wide)
+{
+  long j;
+
+  if (wide)
+    GaussLines(double)
+  else
+    GaussLines(float)
+}
+
+
+/*
+** binomial reduction: columns, then rows, then bands. Long and double
+** images are filtered in double, all others in float.
+*/
+static void
+GaussReduce(VImage src,VImage dest)
+{
+  long nbands = VImageNBands(src), nrows = VImageNRows(src);
+  long ncols = VImageNColumns(src);
+  long db = VImageNBands(dest), dr = VImageNRows(dest), dc = VImageNColumns(dest);
+  VBoolean wide = VPixelRepn(src) == VLongRepn || VPixelRepn(src) == VDoubleRepn;
+  size_t size = wide ? sizeof(double) : sizeof(float);
+  char *t1,*t2;
+  long b,r;
+
+  t1 = (char *) VMalloc(size * nbands * nrows * dc);
+  t2 = (char *) VMalloc(size * nbands * dr * dc);
+
+  /* columns, converting to float or double */
+#pragma omp parallel for schedule(static) private(r)
+  for (b=0; b<nbands; b++) {
+    long c, n = ncols;
+    VPointer t = t1;
+
+    for (r=0; r<nrows; r++) {
+      switch (VPixelRepn(src)) {
+      case VBitRepn:    GaussColumns(VBit,float);      break;
+      case VUByteRepn:  GaussColumns(VUByte,float);    break;
+      case VSByteRepn:  GaussColumns(VSByte,float);    break;
+      case VShortRepn:  GaussColumns(VShort,float);    break;
+      case VLongRepn:   GaussColumns(VLong,double);    break;
+      case VFloatRepn:  GaussColumns(VFloat,float);    break;
+      case VDoubleRepn: GaussColumns(VDouble,double);  break;
+      default: ;
+      }
+    }
+  }
+
+  /* rows */
+#pragma omp parallel for schedule(static) private(r)
+  for (b=0; b<nbands; b++) {
+    VPointer *p = (VPointer *) VMalloc(sizeof(VPointer) * nrows);
+    for (r=0; r<nrows; r++) p[r] = t1 + size * (b * nrows + r) * dc;
+    for (r=0; r<dr; r++)
+      FilterLines(p,nrows,r,dc,t2 + size * (b * dr + r) * dc,wide);
+    VFree(p);
+  }
+  VFree(t1);
+
+  /* bands, storing the result */
+#pragma omp parallel for schedule(dynamic,1) private(r)
+  for (b=0; b<db; b++) {
+    VPointer *p = (VPointer *) VMalloc(sizeof(VPointer) * nbands);
+    VPointer w = VMalloc(size * dr * dc);
+    double x, xmin = VPixelMinValue(dest), xmax = VPixelMaxValue(dest);
+    long i,c;
+
+    for (i=0; i<nbands; i++) p[i] = t2 + size * i * dr * dc;
+    FilterLines(p,nbands,b,dr * dc,w,wide);
+    if (VPixelRepn(dest) == VFloatRepn) {
+      VFloat *q = (VFloat *) VPixelPtr(dest,b,0,0);
+      for (i=0; i<dr * dc; i++) q[i] = ((float *) w)[i];
+    }
+    else if (VPixelRepn(dest) == VDoubleRepn) {
+      VDouble *q = (VDouble *) VPixelPtr(dest,b,0,0);
+      for (i=0; i<dr * dc; i++) q[i] = ((double *) w)[i];
+    }
+    else {
+      for (r=0; r<dr; r++) {
+	switch (VPixelRepn(dest)) {
+	case VBitRepn:    StoreRow(VBit,float);    break;
+	case VUByteRepn:  StoreRow(VUByte,float);  break;
+	case VSByteRepn:  StoreRow(VSByte,float);  break;
+	case VShortRepn:  StoreRow(VShort,float);  break;
+	case VLongRepn:   StoreRow(VLong,double);  break;
+	default: ;
+	}
+      }
+    }
+    VFree(w);
+    VFree(p);
+  }
+  VFree(t2);
+}
+
+
+/*
+** scale the "voxel" attribute ("x y z") by the reduction factors
+*/
+static void
+ScaleVoxel(VImage src,VImage dest)
+{
+  float x,y,z;
+  char str[100];
+  VString voxel;
+
+  if (VGetAttr (VImageAttrList (dest), "voxel", NULL,
+		VStringRepn, (VPointer) & voxel) != VAttrFound) return;
+  if (sscanf(voxel,"%f %f %f",&x,&y,&z) != 3) return;
+  if (VImageNColumns(src) > 1) x *= 2;
+  if (VImageNRows(src) > 1)    y *= 2;
+  if (VImageNBands(src) > 1)   z *= 2;
+  sprintf(str,"%g %g %g",x,y,z);
+  VSetAttr (VImageAttrList (dest), "voxel", NULL, VStringRepn, str);
+}
+
+
+/*!
+\fn VImage VReduceImage3d (VImage src, VImage dest, VReduceKind kind)
+\brief reduce an image to half its size along each axis with more than
+one voxel.
+\param src   input image (any repn)
+\param dest  output image, same repn as <src>
+\param kind  VReduceBox (mean of 2x2x2 blocks), VReduceGauss (binomial
+low pass filter) or VReduceMode (most frequent value, for label images)
+*/
+VImage
+VReduceImage3d (VImage src, VImage dest, VReduceKind kind)
+{
+  double tbegin = VTraceBegin();
+  long nbands,nrows,ncols,db,dr,dc,b,r,c,b0,b1,r0,r1,c0,c1;
+
+  nbands = VImageNBands(src);
+  nrows  = VImageNRows(src);
+  ncols  = VImageNColumns(src);
+  db = Reduced(nbands);
+  dr = Reduced(nrows);
+  dc = Reduced(ncols);
+
+  dest = VSelectDestImage("VReduceImage3d",dest,db,dr,dc,VPixelRepn(src));
+  if (! dest) return NULL;
+
+  if (kind == VReduceGauss)
+    GaussReduce(src,dest);
+
+  else {
+#pragma omp parallel for schedule(dynamic,1) private(r,c,b0,b1,r0,r1,c0,c1)
+    for (b=0; b<db; b++) {
+      b0 = Lo(b,nbands);
+      b1 = Hi(b,nbands);
+      for (r=0; r<dr; r++) {
+	r0 = Lo(r,nrows);
+	r1 = Hi(r,nrows);
+	if (kind == VReduceMode) {
+	  switch (VPixelRepn(src)) {
+	  case VBitRepn:    ModeRow(VBit);    break;
+	  case VUByteRepn:  ModeRow(VUByte);  break;
+	  case VSByteRepn:  ModeRow(VSByte);  break;
+	  case VShortRepn:  ModeRow(VShort);  break;
+	  case VLongRepn:   ModeRow(VLong);   break;
+	  case VFloatRepn:  ModeRow(VFloat);  break;
+	  case VDoubleRepn: ModeRow(VDouble); break;
+	  default: ;
+	  }
+	}
+	else {
+	  switch (VPixelRepn(src)) {
+	  case VBitRepn:    BoxRow(VBit,int,(s + 4) >> 3);         break;
+	  case VUByteRepn:  BoxRow(VUByte,int,(s + 4) >> 3);       break;
+	  case VSByteRepn:  BoxRow(VSByte,int,(s + 4) >> 3);       break;
+	  case VShortRepn:  BoxRow(VShort,int,(s + 4) >> 3);       break;
+	  case VLongRepn:   BoxRow(VLong,double,floor(s * 0.125 + 0.5)); break;
+	  case VFloatRepn:  BoxRow(VFloat,float,s * 0.125f);       break;
+	  case VDoubleRepn: BoxRow(VDouble,double,s * 0.125);      break;
+	  default: ;
+	  }
+	}
+      }
+    }
+  }
+
+  VCopyImageAttrs (src, dest);
+  ScaleVoxel(src,dest);
+  VTraceEnd("VReduceImage3d",tbegin,VImageNPixels(src),VImageSize(src));
+  return dest;
+}
+
+
+/*!
+\fn int VImagePyramid (VImage src, int nlevels, VReduceKind kind, VImage *levels)
+\brief compute up to <nlevels> levels of a pyramid, each reduced by
+VReduceImage3d from the previous one, starting with <src>. Level k
+is stored in levels[k-1] and has a "pyramid_level" attribute k.
+Fewer levels are computed if the image cannot be reduced further.
+\param src      input image (any repn), level 0
+\param nlevels  number of levels to compute
+\param kind     reduction, see VReduceImage3d
+\param levels   output, must hold <nlevels> images
+\return the number of levels computed
+*/
+int
+VImagePyramid (VImage src, int nlevels, VReduceKind kind, VImage *levels)
+{
+  VImage prev = src;
+  int k;
+
+  for (k=0; k<nlevels; k++) {
+    if (VImageNPixels(prev) <= 1) break;
+    levels[k] = VReduceImage3d(prev,NULL,kind);
+    if (! levels[k]) break;
+    VSetAttr(VImageAttrList(levels[k]),VPyramidLevelAttr,NULL,VLongRepn,(VLong) (k+1));
+    prev = levels[k];
+  }
+  return k;
+}
@@ -6,6 +6,15 @@ transforms. This implementation is usually much faster than the
 Minkowski addition. However, only structuring elements of spherical
 shape are permitted.
 
+Erosions and dilations at any radius are thresholds of the distance
+maps of the input image, openings and closings need one more distance
+transform per radius. VDTMorphology computes the maps once for several
+radii, and caches them so that repeated calls with the same input image,
+e.g. a sweep over several radii, only compute them once. The cache is
+released by VDTFreeCache; since it is shared, VDTMorphology must not be
+called concurrently. VDTErode, VDTDilate, VDTOpen and VDTClose do not use
+the cache.
+
 \par Reference:
 G. Lohmann (1998). "Volumetric Image Analysis",
 John Wiley & Sons, Chichester, England.
@@ -19,230 +28,397 @@ John Wiley & Sons, Chichester, England.
 #include <viaio/Vlib.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <via.h>
 
 
 
-/*!
-  \fn VImage VDTErode(VImage src,VImage dest,VDouble radius)
-  \brief 3D morphological erosion
-  \param src   input image (bit repn)
-  \param dest  output image (bit repn)
-  \param radius radius of the spherical structural element
+/*
+** distance maps of an input image
 */
-VImage
-VDTErode(VImage src,VImage dest,VDouble radius)
-{
-  VImage float_image;
-  VBit *bin_pp,*src_pp;
-  VFloat *float_pp;
-  int i,nbands,nrows,ncols,npixels;
+typedef struct {
+  VImage   key;      /* the input image */
+  VBoolean exact;    /* Euclidean instead of chamfer distances */
+  VImage   inner;    /* distance of foreground voxels to the background */
+  VImage   outer;    /* distance to the foreground, on a padded grid */
+  int      pad;      /* padding of <outer> */
+} DistMaps;
+
+/*
+** maps of the most recent input image of VDTMorphology, whose key is a copy
+*/
+static DistMaps cache = {NULL,FALSE,NULL,NULL,0};
 
-  if (VPixelRepn(src) != VBitRepn) 
-    VError("Input image must be of type VBit");
 
-  nbands  = VImageNBands(src);
-  nrows   = VImageNRows(src);
-  ncols   = VImageNColumns(src);
-  npixels = nbands * nrows * ncols;
+/*
+** release the maps, but not the key
+*/
+static void
+FreeMaps(DistMaps *m)
+{
+  if (m->inner) VDestroyImage(m->inner);
+  if (m->outer) VDestroyImage(m->outer);
+  m->inner = m->outer = NULL;
+  m->pad = 0;
+}
 
-  dest = VSelectDestImage("VDTErode",dest,nbands,nrows,ncols,VBitRepn);
-  if (! dest) return NULL;
 
-  bin_pp    = (VBit *) VPixelPtr(dest,0,0,0);
-  src_pp    = (VBit *) VPixelPtr(src,0,0,0);
-  for (i=0; i<npixels; i++) {
-    *bin_pp++ = (*src_pp++ > 0 ? 0 : 1);
-  }
+static VImage
+DistMap(VImage bin,VBoolean exact)
+{
+  VImage dist=NULL;
+
+  if (exact)
+    dist = VEuclideanDist3d(bin,NULL,VFloatRepn);
+  else
+    dist = VChamferDist3d(bin,NULL,VFloatRepn);
+  if (! dist) VError(" VDTMorphology: distance transform failed");
+  return dist;
+}
 
-  float_image = VChamferDist3d(dest,NULL,VFloatRepn);
-  if (! float_image) 
-    VError(" VDTErode failed.\n");
 
-  float_pp  = (VFloat *) VPixelPtr(float_image,0,0,0);
-  bin_pp    = (VBit *) VPixelPtr(dest,0,0,0);
-  for (i=0; i<npixels; i++)
-    *bin_pp++ = ((*float_pp++ < radius) ? 0 : 1);
+/*!
+  \fn void VDTFreeCache(void)
+  \brief release the distance maps cached by VDTMorphology.
+*/
+void
+VDTFreeCache(void)
+{
+  if (cache.key) VDestroyImage(cache.key);
+  cache.key = NULL;
+  FreeMaps(&cache);
+}
 
-  VDestroyImage(float_image);
 
-  VCopyImageAttrs (src, dest);
-  return dest;
+/*
+** make sure the cache belongs to <src>, compare by content
+*/
+static void
+CacheLookup(VImage src,VBoolean exact)
+{
+  size_t npixels;
+
+  npixels = (size_t) VImageNPixels(src);
+  if (cache.key != NULL && cache.exact == exact
+      && VImageNBands(cache.key) == VImageNBands(src)
+      && VImageNRows(cache.key) == VImageNRows(src)
+      && VImageNColumns(cache.key) == VImageNColumns(src)
+      && memcmp(VImageData(cache.key),VImageData(src),npixels * sizeof(VBit)) == 0)
+    return;
+
+  VDTFreeCache();
+  cache.key = VCopyImagePixels(src,NULL,VAllBands);
+  cache.exact = exact;
 }
 
 
+/*
+** distance of foreground voxels to the background
+*/
+static VImage
+InnerMap(DistMaps *m)
+{
+  VImage tmp=NULL;
+  VBit *key_pp,*tmp_pp;
+  size_t i,npixels;
 
+  if (m->inner) return m->inner;
 
-/*!
-  \fn VImage VDTDilate(VImage src,VImage dest,VDouble radius)
-  \brief 3D morphological dilation
-  \param src   input image (bit repn)
-  \param dest  output image (bit repn)
-  \param radius radius of the spherical structural element
+  npixels = (size_t) VImageNPixels(m->key);
+  tmp = VCreateImage(VImageNBands(m->key),VImageNRows(m->key),
+		     VImageNColumns(m->key),VBitRepn);
+  key_pp = (VBit *) VImageData(m->key);
+  tmp_pp = (VBit *) VImageData(tmp);
+  for (i=0; i<npixels; i++)
+    tmp_pp[i] = (key_pp[i] > 0 ? 0 : 1);
+
+  m->inner = DistMap(tmp,m->exact);
+  VDestroyImage(tmp);
+  return m->inner;
+}
+
+
+/*
+** distance to the foreground on a grid padded by at least <pad> voxels
 */
-VImage
-VDTDilate(VImage src,VImage dest,VDouble radius)
+static VImage
+OuterMap(DistMaps *m,int pad)
 {
-  VImage float_image;
-  VBit *bin_pp;
-  VFloat *float_pp;
-  int i,nbands,nrows,ncols,npixels;
+  VImage tmp=NULL;
+  int b,r,c,nbands,nrows,ncols;
 
-  if (VPixelRepn(src) != VBitRepn) 
-    VError("Input image must be of type VBit");
+  if (m->outer && m->pad >= pad) return m->outer;
+  if (m->outer) VDestroyImage(m->outer);
 
-  nbands  = VImageNBands(src);
-  nrows   = VImageNRows(src);
-  ncols   = VImageNColumns(src);
-  npixels = nbands * nrows * ncols;
+  nbands = VImageNBands(m->key);
+  nrows  = VImageNRows(m->key);
+  ncols  = VImageNColumns(m->key);
 
-  float_image = VChamferDist3d(src,NULL,VFloatRepn);
-  if (! float_image) 
-    VError("VDTDilate failed.\n");
+  tmp = VCreateImage(nbands+2*pad,nrows+2*pad,ncols+2*pad,VBitRepn);
+  VFillImage(tmp,VAllBands,0);
+  for (b=0; b<nbands; b++)
+    for (r=0; r<nrows; r++)
+      for (c=0; c<ncols; c++)
+	VPixel(tmp,b+pad,r+pad,c+pad,VBit) = VPixel(m->key,b,r,c,VBit);
 
-  dest = VSelectDestImage("VDTDilate",dest,nbands,nrows,ncols,VBitRepn);
-  if (! dest) return NULL;
+  m->outer = DistMap(tmp,m->exact);
+  m->pad = pad;
+  VDestroyImage(tmp);
+  return m->outer;
+}
+
+
+/*
+** border used for closing, as in earlier versions of VDTClose
+*/
+static int
+CloseBorder(VDouble radius)
+{
+  int border = (int) (radius - 1);
+  return (border > 0) ? border : 0;
+}
+
+
+static void
+Erode(DistMaps *m,VImage dest,VDouble radius)
+{
+  VImage inner = InnerMap(m);
+  VFloat *float_pp = (VFloat *) VImageData(inner);
+  VBit *bin_pp = (VBit *) VImageData(dest);
+  long i,npixels = VImageNPixels(dest);
 
-  float_pp  = (VFloat *) VPixelPtr(float_image,0,0,0);
-  bin_pp    = (VBit *) VPixelPtr(dest,0,0,0);
+#pragma omp parallel for
   for (i=0; i<npixels; i++)
-    *bin_pp++ = ((*float_pp++ > radius) ? 0 : 1);
+    bin_pp[i] = ((float_pp[i] < radius) ? 0 : 1);
+}
 
-  VDestroyImage(float_image);
 
-  VCopyImageAttrs (src,dest);
-  return dest;
+static void
+Dilate(DistMaps *m,VImage dest,VDouble radius)
+{
+  VImage outer = OuterMap(m,0);
+  int b,r,c,nbands,nrows,ncols,pad=m->pad;
+
+  nbands = VImageNBands(dest);
+  nrows  = VImageNRows(dest);
+  ncols  = VImageNColumns(dest);
+
+#pragma omp parallel for private(r,c)
+  for (b=0; b<nbands; b++)
+    for (r=0; r<nrows; r++)
+      for (c=0; c<ncols; c++)
+	VPixel(dest,b,r,c,VBit) =
+	  ((VPixel(outer,b+pad,r+pad,c+pad,VFloat) > radius) ? 0 : 1);
 }
 
 
-/*!
-  \fn VImage VDTClose(VImage src,VImage dest,VDouble radius)
-  \brief 3D morphological closing (dilation+erosion)
-  \param src   input image (bit repn)
-  \param dest  output image (bit repn)
-  \param radius radius of the spherical structural element
-*/
-VImage
-VDTClose(VImage src,VImage dest,VDouble radius)
+static void
+Open(DistMaps *m,VImage dest,VDouble radius)
 {
-  VImage float_image=NULL,tmp=NULL;
-  VBit *bin_pp;
+  VImage dist=NULL;
   VFloat *float_pp;
-  int i,nbands,nrows,ncols,npixels,b,r,c;
-  int border = 7;
+  VBit *bin_pp;
+  long i,npixels = VImageNPixels(dest);
 
-  border = (int) (radius - 1);
+  Erode(m,dest,radius);
+  dist = DistMap(dest,m->exact);
 
-  if (VPixelRepn(src) != VBitRepn) 
-    VError("Input image must be of type VBit");
+  float_pp = (VFloat *) VImageData(dist);
+  bin_pp   = (VBit *) VImageData(dest);
+#pragma omp parallel for
+  for (i=0; i<npixels; i++)
+    bin_pp[i] = ((float_pp[i] > radius) ? 0 : 1);
+  VDestroyImage(dist);
+}
 
-  nbands  = VImageNBands(src) + 2*border;
-  nrows   = VImageNRows(src) + 2*border;
-  ncols   = VImageNColumns(src) + 2*border;
-  npixels = nbands * nrows * ncols;
 
+static void
+Close(DistMaps *m,VImage dest,VDouble radius,int maxborder)
+{
+  VImage outer=NULL,tmp=NULL,dist=NULL;
+  int b,r,c,nbands,nrows,ncols,border,shift;
+
+  border = CloseBorder(radius);
+  outer = OuterMap(m,maxborder);
+  shift = m->pad - border;
+
+  nbands = VImageNBands(dest) + 2*border;
+  nrows  = VImageNRows(dest) + 2*border;
+  ncols  = VImageNColumns(dest) + 2*border;
+
+  /* complement of the dilation */
   tmp = VCreateImage(nbands,nrows,ncols,VBitRepn);
+#pragma omp parallel for private(r,c)
+  for (b=0; b<nbands; b++)
+    for (r=0; r<nrows; r++)
+      for (c=0; c<ncols; c++)
+	VPixel(tmp,b,r,c,VBit) =
+	  ((VPixel(outer,b+shift,r+shift,c+shift,VFloat) > radius) ? 1 : 0);
+
+  dist = DistMap(tmp,m->exact);
+
+  nbands = VImageNBands(dest);
+  nrows  = VImageNRows(dest);
+  ncols  = VImageNColumns(dest);
+#pragma omp parallel for private(r,c)
+  for (b=0; b<nbands; b++)
+    for (r=0; r<nrows; r++)
+      for (c=0; c<ncols; c++)
+	VPixel(dest,b,r,c,VBit) =
+	  ((VPixel(dist,b+border,r+border,c+border,VFloat) > radius) ? 1 : 0);
+
+  VDestroyImage(dist);
+  VDestroyImage(tmp);
+}
 
-  for (b=border; b<nbands-border; b++) {
-    for (r=border; r<nrows-border; r++) {
-      for (c=border; c<ncols-border; c++) {
-	VPixel(tmp,b,r,c,VBit) = VPixel(src,b-border,r-border,c-border,VBit);
-      }
-    }
-  }
 
-  float_image = VChamferDist3d(tmp,NULL,VFloatRepn);
-  if (! float_image) 
-    VError("VDTClose failed.\n");
+/*
+** apply <op> at each radius, using the maps <m> of <src>
+*/
+static VBoolean
+Morphology(DistMaps *m,VImage src,VMorphOp op,VDouble *radius,int nradius,
+	   VImage *dest)
+{
+  int k,border,maxborder;
 
-  float_pp  = (VFloat *) VPixelPtr(float_image,0,0,0);
-  bin_pp    = (VBit *) VPixelPtr(tmp,0,0,0);
-  for (i=0; i<npixels; i++)
-    *bin_pp++ = ((*float_pp++ > radius) ? 1 : 0);
+  maxborder = 0;
+  for (k=0; k<nradius; k++) {
+    border = CloseBorder(radius[k]);
+    if (border > maxborder) maxborder = border;
+  }
 
-  float_image = VChamferDist3d(tmp,float_image,VFloatRepn);
-  if (! float_image) 
-    VError("VDTClose failed.\n");
+  for (k=0; k<nradius; k++) {
+    dest[k] = VSelectDestImage("VDTMorphology",dest[k],VImageNBands(src),
+			       VImageNRows(src),VImageNColumns(src),VBitRepn);
+    if (! dest[k]) return FALSE;
+
+    switch (op) {
+    case VMorphErode:
+      Erode(m,dest[k],radius[k]);
+      break;
+    case VMorphDilate:
+      Dilate(m,dest[k],radius[k]);
+      break;
+    case VMorphOpen:
+      Open(m,dest[k],radius[k]);
+      break;
+    case VMorphClose:
+      Close(m,dest[k],radius[k],maxborder);
+      break;
+    default:
+      VError(" VDTMorphology: illegal operation");
+    }
+    VCopyImageAttrs (src, dest[k]);
+  }
+  return TRUE;
+}
 
-  float_pp = (VFloat *) VPixelPtr(float_image,0,0,0);
-  bin_pp   = (VBit *) VPixelPtr(tmp,0,0,0);
-  for (i=0; i<npixels; i++)
-    *bin_pp++ = ((*float_pp++ > radius) ? 1 : 0);
 
-  VDestroyImage(float_image);
+/*
+** a single operation with maps that are released afterwards
+*/
+static VImage
+MorphOnce(VImage src,VMorphOp op,VDouble radius,VImage dest)
+{
+  DistMaps m = {NULL,FALSE,NULL,NULL,0};
+  VBoolean ok;
 
+  if (VPixelRepn(src) != VBitRepn)
+    VError("Input image must be of type VBit");
+  m.key = src;
+  ok = Morphology(&m,src,op,&radius,1,&dest);
+  FreeMaps(&m);
+  return ok ? dest : NULL;
+}
 
-  dest = VSelectDestImage("VDTClose",dest,VImageNBands(src),VImageNRows(src),VImageNColumns(src),
-			  VBitRepn);
-			  
-  if (! dest) return NULL;
 
-  for (b=border; b<nbands-border; b++) {
-    for (r=border; r<nrows-border; r++) {
-      for (c=border; c<ncols-border; c++) {
-	VPixel(dest,b-border,r-border,c-border,VBit) = VPixel(tmp,b,r,c,VBit);
-      }
-    }
-  }
-  VDestroyImage(tmp);
+/*!
+  \fn VBoolean VDTMorphology(VImage src,VMorphOp op,VDouble *radius,int nradius,
+       VBoolean exact,VImage *dest)
+  \brief 3D morphological operation at several radii.
+
+  The distance maps of <src> are computed once and cached, so that further
+  calls with an image of the same content reuse them. Call VDTFreeCache to
+  release them.
+
+  \param src     input image (bit repn)
+  \param op      VMorphErode, VMorphDilate, VMorphOpen or VMorphClose
+  \param radius  radii of the spherical structural elements
+  \param nradius number of radii
+  \param exact   use Euclidean instead of chamfer distances
+  \param dest    array of <nradius> output images (bit repn). Entries may be NULL,
+  in which case new images are created.
+*/
+VBoolean
+VDTMorphology(VImage src,VMorphOp op,VDouble *radius,int nradius,
+	      VBoolean exact,VImage *dest)
+{
+  double tbegin = VTraceBegin();
+
+  if (VPixelRepn(src) != VBitRepn) 
+    VError("Input image must be of type VBit");
 
-  VCopyImageAttrs (src, dest);
-  return dest;
+  CacheLookup(src,exact);
+  if (! Morphology(&cache,src,op,radius,nradius,dest)) return FALSE;
+  VTraceEnd("VDTMorphology",tbegin,VImageNPixels(src) * nradius,VImageSize(src));
+  return TRUE;
 }
 
 
 
 /*!
-  \fn VImage VDTOpen(VImage src,VImage dest,VDouble radius)
-  \brief 3D morphological closing (erosion+dilation)
+  \fn VImage VDTErode(VImage src,VImage dest,VDouble radius)
+  \brief 3D morphological erosion
   \param src   input image (bit repn)
   \param dest  output image (bit repn)
   \param radius radius of the spherical structural element
 */
 VImage
-VDTOpen(VImage src,VImage dest,VDouble radius)
+VDTErode(VImage src,VImage dest,VDouble radius)
 {
-  VImage float_image=NULL;
-  VBit *bin_pp,*src_pp;
-  VFloat *float_pp;
-  int i,nbands,nrows,ncols,npixels;
-
-  if (VPixelRepn(src) != VBitRepn) 
-    VError("Input image must be of type VBit");
-
-  nbands  = VImageNBands(src);
-  nrows   = VImageNRows(src);
-  ncols   = VImageNColumns(src);
-  npixels = nbands * nrows * ncols;
+  return MorphOnce(src,VMorphErode,radius,dest);
+}
 
-  dest = VSelectDestImage("VDTOpen",dest,nbands,nrows,ncols,VBitRepn);
-  if (! dest) return NULL;
 
-  bin_pp    = (VBit *) VPixelPtr(dest,0,0,0);
-  src_pp    = (VBit *) VPixelPtr(src,0,0,0);
-  for (i=0; i<npixels; i++) {
-    *bin_pp++ = (*src_pp++ > 0 ? 0 : 1);
-  }
 
-  float_image = VChamferDist3d(dest,NULL,VFloatRepn);
-  if (! float_image) VError(" VDTOpen failed.\n");
+/*!
+  \fn VImage VDTDilate(VImage src,VImage dest,VDouble radius)
+  \brief 3D morphological dilation
+  \param src   input image (bit repn)
+  \param dest  output image (bit repn)
+  \param radius radius of the spherical structural element
+*/
+VImage
+VDTDilate(VImage src,VImage dest,VDouble radius)
+{
+  return MorphOnce(src,VMorphDilate,radius,dest);
+}
 
-  float_pp  = (VFloat *) VPixelPtr(float_image,0,0,0);
-  bin_pp    = (VBit *) VPixelPtr(dest,0,0,0);
-  for (i=0; i<npixels; i++)
-    *bin_pp++ = ((*float_pp++ < radius) ? 0 : 1);
 
-  float_image = VChamferDist3d(dest,float_image,VFloatRepn);
-  if (! float_image) VError("VDTOpen failed.\n");
+/*!
+  \fn VImage VDTClose(VImage src,VImage dest,VDouble radius)
+  \brief 3D morphological closing (dilation+erosion)
+  \param src   input image (bit repn)
+  \param dest  output image (bit repn)
+  \param radius radius of the spherical structural element
+*/
+VImage
+VDTClose(VImage src,VImage dest,VDouble radius)
+{
+  return MorphOnce(src,VMorphClose,radius,dest);
+}
 
-  float_pp = (VFloat *) VPixelPtr(float_image,0,0,0);
-  bin_pp   = (VBit *) VPixelPtr(dest,0,0,0);
-  for (i=0; i<npixels; i++)
-    *bin_pp++ = ((*float_pp++ > radius) ? 0 : 1);
 
-  VDestroyImage(float_image);
 
-  VCopyImageAttrs (src, dest);
-  return dest;
+/*!
+  \fn VImage VDTOpen(VImage src,VImage dest,VDouble radius)
+  \brief 3D morphological opening (erosion+dilation)
+  \param src   input image (bit repn)
+  \param dest  output image (bit repn)
+  \param radius radius of the spherical structural element
+*/
+VImage
+VDTOpen(VImage src,VImage dest,VDouble radius)
+{
+  return MorphOnce(src,VMorphOpen,radius,dest);
 }
-
@@ -0,0 +1,254 @@
+/*! \file
+  Recursive Gaussian filter and Gaussian derivatives
+
+The Gaussian is approximated by a third order causal filter followed by
+its anti-causal counterpart (Young and van Vliet), so the cost per voxel
+does not depend on sigma. Derivatives are obtained by applying a central
+difference to the smoothed lines (van Vliet et al.). At the ends of each
+line the image is extended by replicating the border voxel. The state of
+the anti-causal pass at the right border is initialized as proposed by
+Triggs and Sdika, so the result does not depend on line length.
+
+The row and band passes work on tiles of adjacent columns (see
+VFilterLines3d), lines are processed in parallel.
+
+\par References:
+I.T. Young, L.J. van Vliet (1995). "Recursive implementation of the
+Gaussian filter", Signal Processing, Vol. 44, pp. 139--151.
+<br>
+L.J. van Vliet, I.T. Young, P.W. Verbeek (1998). "Recursive Gaussian
+derivative filters", Proc. 14th ICPR, pp. 509--514.
+<br>
+B. Triggs, M. Sdika (2006). "Boundary conditions for Young-van Vliet
+recursive filtering", IEEE Trans. Signal Processing, Vol. 54, pp. 2365--2367.
+
+\par Author:
+Gabriele Lohmann, MPI-CBS
+*/
+
+/* From the Vista library: */
+#include <viaio/Vlib.h>
+#include <viaio/VImage.h>
+#include <viaio/mu.h>
+
+/* From the standard C library: */
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <via.h>
+
+
+typedef struct {
+  int smooth;           /* apply the Gaussian */
+  int order;            /* derivative order 0,1,2 */
+  double B,a[3];        /* w[n] = B x[n] + a[0] w[n-1] + a[1] w[n-2] + a[2] w[n-3] */
+  double M[3][3];       /* right border initialization */
+} RGCoeff;
+
+
+/*
+** filter coefficients for a given sigma (Young and van Vliet, 1995)
+*/
+static void
+RGInit(RGCoeff *k,double sigma,int order)
+{
+  double q,q2,q3,b0,b1,b2,b3,*ext,*y;
+  int i,j,len;
+
+  k->order  = order;
+  k->smooth = (sigma > 0);
+  if (! k->smooth) return;
+
+  if (sigma < 0.5) VError("VRecursiveGauss3d: sigma must be at least 0.5 (%g)",sigma);
+  if (sigma >= 2.5)
+    q = 0.98711 * sigma - 0.96330;
+  else
+    q = 3.97156 - 4.14554 * sqrt(1.0 - 0.26891 * sigma);
+
+  q2 = q*q;
+  q3 = q2*q;
+  b0 = 1.57825 + 2.44413*q + 1.4281*q2 + 0.422205*q3;
+  b1 = 2.44413*q + 2.85619*q2 + 1.26661*q3;
+  b2 = -(1.4281*q2 + 1.26661*q3);
+  b3 = 0.422205*q3;
+
+  k->a[0] = b1/b0;
+  k->a[1] = b2/b0;
+  k->a[2] = b3/b0;
+  k->B = 1.0 - (k->a[0] + k->a[1] + k->a[2]);
+
+  /*
+  ** Right border. Beyond the end of a line the input is constant, so the
+  ** causal output deviates from that constant only by the decaying response
+  ** to its last three values. The anti-causal state it produces is linear
+  ** in these three deviations; the matrix M is obtained by running both
+  ** passes on the three unit responses over a sufficiently long extension.
+  */
+  len = (int) (12.0 * q) + 32;
+  ext = (double *) VMalloc(sizeof(double) * (len + 3));
+  y   = (double *) VMalloc(sizeof(double) * (len + 3));
+
+  for (j=0; j<3; j++) {
+    /* ext[0..2] holds w[N-3],w[N-2],w[N-1] */
+    for (i=0; i<3; i++) ext[i] = 0;
+    ext[2-j] = 1;
+    for (i=3; i<len+3; i++)
+      ext[i] = k->a[0]*ext[i-1] + k->a[1]*ext[i-2] + k->a[2]*ext[i-3];
+
+    y[len] = y[len+1] = y[len+2] = 0;
+    for (i=len-1; i>=0; i--)
+      y[i] = k->B*ext[i+3] + k->a[0]*y[i+1] + k->a[1]*y[i+2] + k->a[2]*y[i+3];
+
+    /* y[0],y[1],y[2] are the anti-causal values at N,N+1,N+2 */
+    for (i=0; i<3; i++) k->M[i][j] = y[i];
+  }
+  VFree(ext);
+  VFree(y);
+}
+
+
+/*
+** filter one line of length n in place. <w> must hold n+6 values.
+*/
+static void
+RGLine(float *x,int n,void *arg,double *w)
+{
+  RGCoeff *k = (RGCoeff *) arg;
+  int i;
+  double a0,a1,a2,B;
+  double u,d0,d1,d2,y0,y1,y2,prev,cur;
+
+  if (k->smooth) {
+    a0 = k->a[0];
+    a1 = k->a[1];
+    a2 = k->a[2];
+    B  = k->B;
+
+    /* causal pass, w[i+3] holds the output at i */
+    w[0] = w[1] = w[2] = x[0];
+    for (i=0; i<n; i++)
+      w[i+3] = B*x[i] + a0*w[i+2] + a1*w[i+1] + a2*w[i];
+
+    /* anti-causal pass, initialized at the right border */
+    u  = x[n-1];
+    d0 = w[n+2] - u;
+    d1 = w[n+1] - u;
+    d2 = w[n]   - u;
+    y0 = u + k->M[0][0]*d0 + k->M[0][1]*d1 + k->M[0][2]*d2;
+    y1 = u + k->M[1][0]*d0 + k->M[1][1]*d1 + k->M[1][2]*d2;
+    y2 = u + k->M[2][0]*d0 + k->M[2][1]*d1 + k->M[2][2]*d2;
+    for (i=n-1; i>=0; i--) {
+      u = B*w[i+3] + a0*y0 + a1*y1 + a2*y2;
+      y2 = y1;
+      y1 = y0;
+      y0 = u;
+      x[i] = u;
+    }
+  }
+
+  /* central differences */
+  if (k->order == 1 && n > 1) {
+    prev = x[0];
+    for (i=0; i<n; i++) {
+      cur = x[i];
+      x[i] = 0.5 * ((i < n-1 ? x[i+1] : cur) - prev);
+      prev = cur;
+    }
+  }
+  else if (k->order == 2 && n > 1) {
+    prev = x[0];
+    for (i=0; i<n; i++) {
+      cur = x[i];
+      x[i] = (i < n-1 ? x[i+1] : cur) - 2.0*cur + prev;
+      prev = cur;
+    }
+  }
+  else if (k->order > 0)
+    x[0] = 0;
+}
+
+
+/*!
+\fn VImage VRecursiveGauss3d(VImage src,VImage dest,VFloat *sigma,int *order,VRepnKind repn)
+\brief 3D Gaussian filter and Gaussian derivatives, implemented recursively.
+The cost per voxel does not depend on sigma.
+\param src   input image (any repn)
+\param dest  output image
+\param sigma standard deviations along bands, rows and columns, in voxels.
+An axis with sigma = 0 is not smoothed. Otherwise sigma must be at least 0.5.
+\param order order (0, 1 or 2) of the derivative along bands, rows and columns,
+or NULL for smoothing only. Derivatives are per voxel.
+\param repn  output pixel repn, or VUnknownRepn to use the repn of <src>
+*/
+VImage
+VRecursiveGauss3d(VImage src,VImage dest,VFloat *sigma,int *order,VRepnKind repn)
+{
+  double tbegin = VTraceBegin();
+  int i,nbands,nrows,ncols;
+  VImage work=NULL;
+  VFloat *data;
+  RGCoeff k[3];
+
+  nbands = VImageNBands(src);
+  nrows  = VImageNRows(src);
+  ncols  = VImageNColumns(src);
+  if (repn == VUnknownRepn) repn = VPixelRepn(src);
+
+  for (i=0; i<3; i++) {
+    if (sigma[i] < 0) VError("VRecursiveGauss3d: sigma must not be negative");
+    if (order && (order[i] < 0 || order[i] > 2))
+      VError("VRecursiveGauss3d: derivative order must be 0, 1 or 2");
+    RGInit(&k[i],(double) sigma[i],(order ? order[i] : 0));
+  }
+
+  /* float copy of the input, filtered in place */
+  if (repn == VFloatRepn) {
+    dest = VConvertImageCopy(src,dest,VAllBands,VFloatRepn);
+    if (! dest) return NULL;
+    work = dest;
+  }
+  else
+    work = VConvertImageCopy(src,NULL,VAllBands,VFloatRepn);
+  data = (VFloat *) VImageData(work);
+
+  for (i=2; i>=0; i--) {
+    if (k[i].smooth || k[i].order)
+      VFilterLines3d(data,nbands,nrows,ncols,i,RGLine,&k[i]);
+  }
+
+  if (work != dest) {
+    dest = VConvertImageCopy(work,dest,VAllBands,repn);
+    VDestroyImage(work);
+    if (! dest) return NULL;
+  }
+
+  VCopyImageAttrs (src, dest);
+  VTraceEnd("VRecursiveGauss3d",tbegin,VImageNPixels(src),VImageSize(src));
+  return dest;
+}
+
+
+/*!
+\fn void VVoxelSigma(VImage src,VDouble sigma,VFloat *s)
+\brief convert a standard deviation given in units of the "voxel" attribute
+("x y z", i.e. column, row, slice spacing) into voxels along bands, rows and
+columns. If <src> has no voxel attribute, <s> is set to <sigma> on all axes.
+\param src    image
+\param sigma  standard deviation, e.g. in mm
+\param s      output, sigma along bands, rows and columns in voxels
+*/
+void
+VVoxelSigma(VImage src,VDouble sigma,VFloat *s)
+{
+  float x=1,y=1,z=1;
+  VString str;
+
+  if (VGetAttr (VImageAttrList (src), "voxel", NULL,
+		VStringRepn, (VPointer) & str) == VAttrFound) {
+    sscanf(str,"%f %f %f",&x,&y,&z);
+    if (x <= 0 || y <= 0 || z <= 0) VError("VVoxelSigma: illegal voxel size");
+  }
+  s[0] = sigma / z;
+  s[1] = sigma / y;
+  s[2] = sigma / x;
+}
@@ -0,0 +1,650 @@
+/*! \file
+  Resampling engine shared by the 3D interpolators.
+
+
+This file contains the resampling loop used by nearest neighbour,
+trilinear and cubic spline interpolation. The transformation equation is:
+
+   y = A(x-x0) + b
+
+where x,x0,b,y are 1x3 vectors and A is a 3x3 matrix.
+The vector x0 can be used to specify a position that
+remains unchanged by the transformation.
+
+Since the mapping is affine, the source position changes by a
+constant vector from one output column to the next. Each output row is
+split into an interior span whose interpolation support lies entirely
+inside the source image and edge spans that need bounds checks.
+Output slices are processed in parallel. For spline interpolation,
+weights along the band and row axes are computed once per row when
+they are constant within it, and the column weights are tabulated once
+per call when the source column depends on the output column only, as
+for axis-aligned transformations.
+
+Nearest neighbour interpolation computes each source position directly,
+in the same order of operations as before, and accepts voxels whose
+rounded position (int) (x + 0.5) lies inside the source. So it picks
+the same voxels as the original VNNSample3d and VNNScale3d, including
+at exact .5 ties and for positions in (-1.5,-0.5), which go to voxel 0.
+
+
+\par Author:
+Gabriele Lohmann, MPI-CBS
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <float.h>
+
+/* From the Vista library: */
+#include <viaio/Vlib.h>
+#include <viaio/file.h>
+#include <viaio/mu.h>
+#include <via.h>
+
+
+/* safety margin for the interior span */
+#define MARGIN 0.001
+
+/* source position of output column c, x0 is the position at column 0 */
+#define Coord(x0,dx,c) ((x0) + (float) (c) * (dx))
+
+
+/*
+** accepted source positions lo <= x < hi, and positions ilo <= x < ihi
+** whose interpolation support is inside the source image
+*/
+typedef struct {
+  VInterpolKind kind;
+  int   n[3];
+  float lo[3],hi[3];
+  float ilo[3],ihi[3];
+  int   *cindex;     /* spline: start index per output column, or NULL */
+  float *cweight;    /* spline: four weights per output column */
+} ResampleInfo;
+
+
+static VBoolean
+InsideBox(float x0[3],float dx[3],int c,float lo[3],float hi[3],float margin)
+{
+  int i;
+  float x;
+
+  for (i=0; i<3; i++) {
+    x = Coord(x0[i],dx[i],c);
+    if (x < lo[i] + margin || x >= hi[i] - margin) return FALSE;
+  }
+  return TRUE;
+}
+
+
+/*
+** Columns of an output row whose source position lies in [lo,hi).
+** If <exact> is false, the span is widened by one column on each side
+** so that it contains all such columns. Otherwise it is shrunk until
+** both end points are verified to lie inside. Since the source position
+** is monotonic in c, all columns in between then lie inside as well.
+*/
+static void
+RowSpan(float x0[3],float dx[3],float lo[3],float hi[3],int ncols,
+	VBoolean exact,int *c0,int *c1)
+{
+  double a=0,b=ncols,t0,t1,t;
+  int i;
+
+  *c0 = *c1 = 0;
+  for (i=0; i<3; i++) {
+    if (lo[i] >= hi[i]) return;
+    if (dx[i] == 0) {
+      if (x0[i] < lo[i] || x0[i] >= hi[i]) return;
+      continue;
+    }
+    t0 = (lo[i] - x0[i]) / dx[i];
+    t1 = (hi[i] - x0[i]) / dx[i];
+    if (t0 > t1) {t = t0; t0 = t1; t1 = t;}
+    if (t0 > a) a = t0;
+    if (t1 < b) b = t1;
+  }
+  if (b < a) return;
+
+  if (! exact) {
+    *c0 = (int) floor(a) - 1;
+    *c1 = (int) ceil(b) + 1;
+    if (*c0 < 0) *c0 = 0;
+    if (*c1 > ncols) *c1 = ncols;
+    return;
+  }
+
+  *c0 = (int) ceil(a) + 1;
+  *c1 = (int) floor(b);
+  while (*c0 < *c1 && ! InsideBox(x0,dx,*c0,lo,hi,MARGIN)) (*c0)++;
+  while (*c1 > *c0 && ! InsideBox(x0,dx,*c1-1,lo,hi,MARGIN)) (*c1)--;
+}
+
+
+
+/*
+** nearest neighbour, copies pixel values without conversion.
+** <rowpos> holds the part of the source position due to the output
+** band and row, <ainv> the inverse matrix, as in the original code.
+*/
+#define NNRow(type) \
+{ \
+  type *s = (type *) VImageData(src); \
+  type *d = (type *) VPixelPtr(dest,b,r,0); \
+  for (c=0; c<ncols; c++) { \
+    float cx = (float) c - shift[2]; \
+    float xb = rowpos[0] + ainv[0][2] * cx; \
+    float xr = rowpos[1] + ainv[1][2] * cx; \
+    float xc = rowpos[2] + ainv[2][2] * cx; \
+    xb += origin[0]; \
+    xr += origin[1]; \
+    xc += origin[2]; \
+    bb = (int) (xb + 0.5); \
+    rr = (int) (xr + 0.5); \
+    cc = (int) (xc + 0.5); \
+    if (bb < 0 || bb >= info->n[0]) continue; \
+    if (rr < 0 || rr >= info->n[1]) continue; \
+    if (cc < 0 || cc >= info->n[2]) continue; \
+    d[c] = s[((size_t) bb * nr + rr) * nc + cc]; \
+  } \
+}
+
+static void
+NNSpan(ResampleInfo *info,VImage src,VImage dest,int b,int r,
+       float rowpos[3],float ainv[3][3],float shift[3],float origin[3],int ncols)
+{
+  size_t nr = info->n[1], nc = info->n[2];
+  int c,bb,rr,cc;
+
+  switch(VPixelRepn(src)) {
+  case VBitRepn:
+    NNRow(VBit);
+    break;
+  case VUByteRepn:
+    NNRow(VUByte);
+    break;
+  case VSByteRepn:
+    NNRow(VSByte);
+    break;
+  case VShortRepn:
+    NNRow(VShort);
+    break;
+  case VLongRepn:
+    NNRow(VLong);
+    break;
+  case VFloatRepn:
+    NNRow(VFloat);
+    break;
+  case VDoubleRepn:
+    NNRow(VDouble);
+    break;
+  default:
+    VError(" illegal pixel repn");
+  }
+}
+
+
+
+/*
+** trilinear interpolation. At the upper image border the
+** border voxel is replicated.
+*/
+#define LinearRow(type) \
+{ \
+  type *s = (type *) VImageData(src), *p; \
+  for (c=c0; c<c1; c++) { \
+    float xb = Coord(x0[0],dx[0],c); \
+    float xr = Coord(x0[1],dx[1],c); \
+    float xc = Coord(x0[2],dx[2],c); \
+    float pb,pr,pc,qb,qr,qc; \
+    int sb,sr,sc; \
+    size_t ob=nslice,orr=nc,oc=1; \
+    if (checked) { \
+      buf[c] = 0; \
+      if (xb < info->lo[0] || xb >= info->hi[0]) continue; \
+      if (xr < info->lo[1] || xr >= info->hi[1]) continue; \
+      if (xc < info->lo[2] || xc >= info->hi[2]) continue; \
+    } \
+    sb = (int) xb; sr = (int) xr; sc = (int) xc; \
+    if (checked) { \
+      if (sb >= info->n[0]-1) ob = 0; \
+      if (sr >= info->n[1]-1) orr = 0; \
+      if (sc >= info->n[2]-1) oc = 0; \
+    } \
+    qb = xb - sb; pb = 1 - qb; \
+    qr = xr - sr; pr = 1 - qr; \
+    qc = xc - sc; pc = 1 - qc; \
+    p = s + ((size_t) sb * nr + sr) * nc + sc; \
+    buf[c] = \
+      pb * (pr * (pc * p[0]     + qc * p[oc]) + \
+	    qr * (pc * p[orr]    + qc * p[orr+oc])) + \
+      qb * (pr * (pc * p[ob]    + qc * p[ob+oc]) + \
+	    qr * (pc * p[ob+orr] + qc * p[ob+orr+oc])); \
+  } \
+}
+
+static void
+LinearSpan(ResampleInfo *info,VImage src,float *buf,
+	   float x0[3],float dx[3],int c0,int c1,VBoolean checked)
+{
+  size_t nr = info->n[1], nc = info->n[2], nslice = nr * nc;
+  int c;
+
+  switch(VPixelRepn(src)) {
+  case VUByteRepn:
+    LinearRow(VUByte);
+    break;
+  case VSByteRepn:
+    LinearRow(VSByte);
+    break;
+  case VShortRepn:
+    LinearRow(VShort);
+    break;
+  case VLongRepn:
+    LinearRow(VLong);
+    break;
+  case VFloatRepn:
+    LinearRow(VFloat);
+    break;
+  case VDoubleRepn:
+    LinearRow(VDouble);
+    break;
+  default:
+    VError(" illegal pixel repn");
+  }
+}
+
+
+
+/*
+** cubic B-spline weights of the four samples floor(x)-1 ... floor(x)+2
+*/
+static int
+SplineWeights(float x,float w[4])
+{
+  float fl = floor(x);
+  float t = x - fl, s = 1.0 - t;
+  float t2 = t*t, s2 = s*s;
+
+  w[0] = s2*s / 6.0;
+  w[1] = 0.666666667 - t2 + t2*t*0.5;
+  w[2] = 0.666666667 - s2 + s2*s*0.5;
+  w[3] = t2*t / 6.0;
+  return (int) fl - 1;
+}
+
+
+/*
+** cubic B-spline interpolation from a coefficient image.
+** Samples outside the image do not contribute. Weights along
+** axes that do not change within the row are computed once per row.
+** If the source column does not depend on the output band and row,
+** the column weights are taken from the tables in <info>.
+*/
+static void
+SplineSpan(ResampleInfo *info,VImage coeff,float *buf,
+	   float x0[3],float dx[3],int c0,int c1,VBoolean checked)
+{
+  int nb = info->n[0], nr = info->n[1], nc = info->n[2];
+  size_t nslice = (size_t) nr * nc;
+  VFloat *data = (VFloat *) VImageData(coeff), *p;
+  float wb[4],wr[4],wtmp[4],*wc=wtmp,sum,row;
+  int b1=0,r1=0,c1s,c,i,j,k;
+  int imin=0,imax=3,jmin=0,jmax=3,kmin=0,kmax=3;
+
+  if (dx[0] == 0) b1 = SplineWeights(x0[0],wb);
+  if (dx[1] == 0) r1 = SplineWeights(x0[1],wr);
+
+  for (c=c0; c<c1; c++) {
+    float xb = Coord(x0[0],dx[0],c);
+    float xr = Coord(x0[1],dx[1],c);
+    float xc = Coord(x0[2],dx[2],c);
+
+    if (checked) {
+      buf[c] = 0;
+      if (xb < info->lo[0] || xb >= info->hi[0]) continue;
+      if (xr < info->lo[1] || xr >= info->hi[1]) continue;
+      if (xc < info->lo[2] || xc >= info->hi[2]) continue;
+    }
+    if (dx[0] != 0) b1 = SplineWeights(xb,wb);
+    if (dx[1] != 0) r1 = SplineWeights(xr,wr);
+    if (info->cweight) {
+      c1s = info->cindex[c];
+      wc  = info->cweight + 4*c;
+    }
+    else
+      c1s = SplineWeights(xc,wc);
+
+    if (checked) {
+      imin = (b1 < 0) ? -b1 : 0;
+      imax = (b1 + 3 >= nb) ? nb - b1 - 1 : 3;
+      jmin = (r1 < 0) ? -r1 : 0;
+      jmax = (r1 + 3 >= nr) ? nr - r1 - 1 : 3;
+      kmin = (c1s < 0) ? -c1s : 0;
+      kmax = (c1s + 3 >= nc) ? nc - c1s - 1 : 3;
+    }
+
+    sum = 0;
+    for (i=imin; i<=imax; i++) {
+      for (j=jmin; j<=jmax; j++) {
+	p = data + (b1+i) * nslice + (size_t) (r1+j) * nc + c1s;
+	row = 0;
+	for (k=kmin; k<=kmax; k++) row += wc[k] * p[k];
+	sum += wb[i] * wr[j] * row;
+      }
+    }
+    buf[c] = sum;
+  }
+}
+
+
+
+/*
+** write interpolated values, clipped to the range of the output repn
+*/
+#define StoreRow(type) \
+{ \
+  type *d = (type *) VPixelPtr(dest,b,r,0); \
+  for (c=c0; c<c1; c++) { \
+    double v = buf[c]; \
+    if (v < vmin) v = vmin; \
+    if (v > vmax) v = vmax; \
+    d[c] = (type) v; \
+  } \
+}
+
+static void
+StoreSpan(VImage dest,int b,int r,float *buf,int c0,int c1)
+{
+  double vmin = VPixelMinValue(dest), vmax = VPixelMaxValue(dest);
+  int c;
+
+  switch(VPixelRepn(dest)) {
+  case VBitRepn:
+    StoreRow(VBit);
+    break;
+  case VUByteRepn:
+    StoreRow(VUByte);
+    break;
+  case VSByteRepn:
+    StoreRow(VSByte);
+    break;
+  case VShortRepn:
+    StoreRow(VShort);
+    break;
+  case VLongRepn:
+    StoreRow(VLong);
+    break;
+  case VFloatRepn:
+    StoreRow(VFloat);
+    break;
+  case VDoubleRepn:
+    StoreRow(VDouble);
+    break;
+  default:
+    VError(" illegal pixel repn");
+  }
+}
+
+
+static void
+ResampleSpan(ResampleInfo *info,VImage src,VImage dest,float *buf,int b,int r,
+	     float x0[3],float dx[3],int c0,int c1,VBoolean checked)
+{
+  if (c0 >= c1) return;
+
+  switch(info->kind) {
+  case VInterpolTriLinear:
+    LinearSpan(info,src,buf,x0,dx,c0,c1,checked);
+    break;
+  case VInterpolCubicSpline:
+    SplineSpan(info,src,buf,x0,dx,c0,c1,checked);
+    break;
+  default:	/* nearest neighbour is handled by NNSpan */
+    return;
+  }
+  StoreSpan(dest,b,r,buf,c0,c1);
+}
+
+
+
+/*
+** the resampling loop. <ainv> maps output to source positions,
+** see VResample3d.
+*/
+static VImage
+Resample(const char *name,VImage src,VImage dest,float ainv[3][3],
+	 float shift[3],float origin[3],
+	 int dst_nbands,int dst_nrows,int dst_ncolumns,
+	 VRepnKind repn,VInterpolKind kind)
+{
+  double tbegin = VTraceBegin();
+  ResampleInfo info;
+  int b,i;
+
+  if (kind == VInterpolNN && repn != VPixelRepn(src))
+    VError(" %s: nearest neighbour output must have the input repn",name);
+  if (kind == VInterpolCubicSpline && VPixelRepn(src) != VFloatRepn)
+    VError(" %s: spline coefficient image must be float repn",name);
+
+  info.kind = kind;
+  info.cindex  = NULL;
+  info.cweight = NULL;
+  info.n[0] = VImageNBands(src);
+  info.n[1] = VImageNRows(src);
+  info.n[2] = VImageNColumns(src);
+
+  for (i=0; i<3; i++) {
+    switch(kind) {
+    case VInterpolNN:
+      break;
+    case VInterpolTriLinear:
+      info.lo[i]  = info.ilo[i] = 0;
+      info.hi[i]  = info.n[i];
+      info.ihi[i] = info.n[i] - 1;
+      break;
+    case VInterpolCubicSpline:
+      info.lo[i]  = -1;
+      info.hi[i]  = info.n[i];
+      info.ilo[i] = 1;
+      info.ihi[i] = info.n[i] - 2;
+      break;
+    default:
+      VError(" %s: illegal interpolation method",name);
+    }
+  }
+
+
+  /*
+  ** create output image
+  */
+  dest = VSelectDestImage(name,dest,dst_nbands,dst_nrows,dst_ncolumns,repn);
+  if (! dest) return NULL;
+  VFillImage(dest,VAllBands,0);
+
+
+  /*
+  ** spline resampling where the source column depends on the output
+  ** column only (e.g. scaling): its weights are tabulated once. The
+  ** position is computed as in the loop below, the other terms being zero.
+  */
+  if (kind == VInterpolCubicSpline && ainv[2][0] == 0 && ainv[2][1] == 0) {
+    float xc0 = ainv[2][2] * (- shift[2]) + origin[2];
+    int c;
+
+    info.cindex  = (int *) VMalloc(sizeof(int) * (dst_ncolumns > 0 ? dst_ncolumns : 1));
+    info.cweight = (float *) VMalloc(sizeof(float) * 4 * (dst_ncolumns > 0 ? dst_ncolumns : 1));
+    for (c=0; c<dst_ncolumns; c++)
+      info.cindex[c] = SplineWeights(Coord(xc0,ainv[2][2],c),info.cweight + 4*c);
+  }
+
+
+#pragma omp parallel for schedule(dynamic)
+  for (b=0; b<dst_nbands; b++) {
+    float x0[3],dx[3],rowpos[3],bx,rx;
+    float *buf;
+    int r,k,a0,a1,i0,i1;
+
+    buf = (float *) VMalloc(sizeof(float) * (dst_ncolumns > 0 ? dst_ncolumns : 1));
+
+    for (r=0; r<dst_nrows; r++) {
+
+      if (kind == VInterpolNN) {
+	bx = (float) b - shift[0];
+	rx = (float) r - shift[1];
+	for (k=0; k<3; k++)
+	  rowpos[k] = ainv[k][0] * bx + ainv[k][1] * rx;
+	NNSpan(&info,src,dest,b,r,rowpos,ainv,shift,origin,dst_ncolumns);
+	continue;
+      }
+
+      /* source position of column 0 and step per column */
+      for (k=0; k<3; k++) {
+	x0[k] = ainv[k][0] * ((float) b - shift[0])
+	  + ainv[k][1] * ((float) r - shift[1])
+	  + ainv[k][2] * (- shift[2]) + origin[k];
+	dx[k] = ainv[k][2];
+      }
+
+      RowSpan(x0,dx,info.lo,info.hi,dst_ncolumns,FALSE,&a0,&a1);
+      if (a0 >= a1) continue;
+      RowSpan(x0,dx,info.ilo,info.ihi,dst_ncolumns,TRUE,&i0,&i1);
+      if (i0 < a0) i0 = a0;
+      if (i1 > a1) i1 = a1;
+      if (i0 >= i1) i0 = i1 = a1;
+
+      ResampleSpan(&info,src,dest,buf,b,r,x0,dx,a0,i0,TRUE);
+      ResampleSpan(&info,src,dest,buf,b,r,x0,dx,i0,i1,FALSE);
+      ResampleSpan(&info,src,dest,buf,b,r,x0,dx,i1,a1,TRUE);
+    }
+    VFree(buf);
+  }
+  VFree(info.cindex);
+  VFree(info.cweight);
+
+  VTraceEnd(name,tbegin,VImageNPixels(dest),VImageSize(dest));
+  return dest;
+}
+
+
+
+/*!
+\fn VImage VResample3d (VImage src,VImage dest,VImage transform,
+     float b0,float r0,float c0,int dst_nbands,int dst_nrows,int dst_ncolumns,
+     VRepnKind repn,VInterpolKind kind)
+\brief Resample a 3D image using a given interpolation method.
+
+\param src   input image (any repn). For <kind> = VInterpolCubicSpline, this
+must be a coefficient image as produced by VCubicSplineCoeff3d().
+\param dest  output image
+\param transform  4x3 transformation image (float or double repn).
+The first column of <transform> contains the translation vector.
+The remaining three columns contains the 3x3 linear transformation matrix.
+\param b0            slice address that remains fixed
+\param r0            row address that remains fixed
+\param c0            column address that remains fixed
+\param dst_nbands    number of output slices
+\param dst_nrows     number of output rows
+\param dst_ncolumns  number of output columns
+\param repn          pixel repn of the output image. Nearest neighbour
+interpolation requires it to be the repn of <src>.
+\param kind          interpolation method (VInterpolNN, VInterpolTriLinear,
+VInterpolCubicSpline)
+*/
+VImage
+VResample3d(VImage src,VImage dest,VImage transform,
+	    float b0,float r0,float c0,
+	    int dst_nbands,int dst_nrows,int dst_ncolumns,
+	    VRepnKind repn,VInterpolKind kind)
+{
+  float a[3][3],ainv[3][3],detA;
+  float shift[3],origin[3];
+  int i,j;
+
+  if (VPixelRepn(transform) != VFloatRepn && VPixelRepn(transform) != VDoubleRepn)
+    VError("transform image must be float or double repn");
+
+  /* get transformation matrix : */
+  for (i=0; i<3; i++) {
+    for (j=0; j<3; j++) {
+      a[i][j]  = VGetPixel(transform,0,i,j+1);
+    }
+  }
+
+  /* get its inverse : */
+  ainv[0][0] =  a[1][1]*a[2][2] - a[1][2]*a[2][1];
+  ainv[1][0] = -a[1][0]*a[2][2] + a[1][2]*a[2][0];
+  ainv[2][0] =  a[1][0]*a[2][1] - a[1][1]*a[2][0];
+
+  ainv[0][1] = -a[0][1]*a[2][2] + a[0][2]*a[2][1];
+  ainv[1][1] =  a[0][0]*a[2][2] - a[0][2]*a[2][0];
+  ainv[2][1] = -a[0][0]*a[2][1] + a[0][1]*a[2][0];
+
+  ainv[0][2] =  a[0][1]*a[1][2] - a[0][2]*a[1][1];
+  ainv[1][2] = -a[0][0]*a[1][2] + a[0][2]*a[1][0];
+  ainv[2][2] =  a[0][0]*a[1][1] - a[0][1]*a[1][0];
+
+  /* determinant */
+  detA = a[0][0]*ainv[0][0] + a[0][1]*ainv[1][0] + a[0][2]*ainv[2][0];
+  if (detA == 0) VError(" VResample3d: transformation matrix is singular");
+
+  for (i=0; i<3; i++) {
+    for (j=0; j<3; j++) {
+      ainv[i][j] /= detA;
+    }
+  }
+
+  /* get translation vector */
+  for (i=0; i<3; i++)
+    shift[i] = VGetPixel(transform,0,i,0);
+  origin[0] = b0;
+  origin[1] = r0;
+  origin[2] = c0;
+
+  return Resample("VResample3d",src,dest,ainv,shift,origin,
+		  dst_nbands,dst_nrows,dst_ncolumns,repn,kind);
+}
+
+
+
+/*!
+\fn VImage VResampleScale3d (VImage src,VImage dest,
+     int dst_nbands,int dst_nrows,int dst_ncols,
+     float shift[3],float scale[3],VRepnKind repn,VInterpolKind kind)
+\brief Scale a 3D image using a given interpolation method, where
+Ax+b = y, and A is the scaling matrix.
+
+Like VResample3d with a diagonal transformation, but the inverse
+scaling factors are computed as 1/scale, as VNNScale3d and
+VTriLinearScale3d always did.
+
+\param src        input image (any repn), see VResample3d
+\param dest       output image
+\param dst_nbands number of output slices
+\param dst_nrows  number of output rows
+\param dst_ncols  number of output columns
+\param shift[3]   translation vector (band,row,column)
+\param scale[3]   scaling vector (band,row,column)
+\param repn       pixel repn of the output image, see VResample3d
+\param kind       interpolation method, see VResample3d
+*/
+VImage
+VResampleScale3d(VImage src,VImage dest,int dst_nbands,int dst_nrows,int dst_ncols,
+		 float shift[3],float scale[3],VRepnKind repn,VInterpolKind kind)
+{
+  float ainv[3][3],origin[3];
+  int i,j;
+
+  for (i=0; i<3; i++) {
+    if (scale[i] == 0) VError(" VResampleScale3d: scale factor is zero");
+    for (j=0; j<3; j++)
+      ainv[i][j] = 0;
+    ainv[i][i] = 1.0 / scale[i];
+    origin[i] = 0;
+  }
+
+  return Resample("VResampleScale3d",src,dest,ainv,shift,origin,
+		  dst_nbands,dst_nrows,dst_ncols,repn,kind);
+}
@@ -28,6 +28,7 @@ Gabriele Lohmann, MPI-CBS
 VImage
 VSelectBig (VImage src,VImage dest)
 {
+  double tbegin = VTraceBegin();
   int i,j,i0,npixels,nbands,nrows,ncols;
   long table[MAXVAL],maxsize;
   VRepnKind repn;
@@ -125,5 +126,6 @@ VSelectBig (VImage src,VImage dest)
   }
 
   VCopyImageAttrs (src, dest);
+  VTraceEnd("VSelectBig",tbegin,VImageNPixels(src),VImageSize(src));
   return dest;
 }
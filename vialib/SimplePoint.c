@@ -236,145 +236,200 @@ VOneComp6(VBit src_pp[])
 
 
 
-/*!
-\fn VBoolean VSimplePoint(VImage src,int b,int r,int c,int adj)
-\param src  input image (bit repn)
-\param b    slice address
-\param r    row address
-\param c    column address
-\param adj  neighbourhood type (6 or 26)
+/*
+** bit masks of the 26- and 6-adjacency tables above,
+** bit l of adjmask26[j] is set if l is in ad26[j]
 */
-int
-VSimplePoint(VImage src,int b, int r, int c,int adj)
+static unsigned int adjmask26[27],adjmask6[27];
+static VBoolean masks_ready = FALSE;
 
-{
-  int i,nblack;
-  int bb,rr,cc;
-  int nbands,nrows,ncols;
-  VBit adj_6[27],adj_26[27],u,nbg,nfg;
+/* the six face neighbours of the centre voxel */
+#define SIX_MASK ((1u<<4) | (1u<<10) | (1u<<12) | (1u<<14) | (1u<<16) | (1u<<22))
 
-  nfg = nbg = 0;
+/* the 18-neighbourhood without the centre voxel */
+#define N18_MASK (0x7FFFFFFu & ~((1u<<0) | (1u<<2) | (1u<<6) | (1u<<8) | (1u<<13) | \
+				 (1u<<18) | (1u<<20) | (1u<<24) | (1u<<26)))
 
-  nbands = VImageNBands(src);
-  nrows  = VImageNRows(src);
-  ncols  = VImageNColumns(src);
+static void
+GenMasks()
+{
+  int j,k;
+
+#pragma omp critical (simplepoint_masks)
+  {
+    if (! masks_ready) {
+      for (j=0; j<27; j++) {
+	adjmask26[j] = adjmask6[j] = 0;
+	for (k=0; k<nad26[j]; k++) adjmask26[j] |= 1u << ad26[j][k];
+	for (k=0; k<nad6[j]; k++)  adjmask6[j]  |= 1u << ad6[j][k];
+      }
+      adjmask26[13] = 0;
+#pragma omp flush
+      masks_ready = TRUE;
+    }
+  }
+}
 
 
-  switch(adj) {
-  case 26:
+/*
+** number of connected components of <set> that contain a voxel of <seeds>,
+** counting stops at 2
+*/
+static int
+NumCompMask(unsigned int set,unsigned int seeds,unsigned int adjmask[27])
+{
+  unsigned int todo,comp,frontier,grow;
+  int i,n=0;
 
+  todo = set & seeds;
+  while (todo) {
     i = 0;
-    nblack = 0;
-    for (bb=b-1; bb<=b+1; bb++) {
-      for (rr=r-1; rr<=r+1; rr++) {
-	for (cc=c-1; cc<=c+1; cc++) {
-	  if (bb >= 0 && bb < nbands
-	      && rr >= 0 && rr < nrows 
-	      && cc >= 0 && cc < ncols)
-	    u = VPixel(src,bb,rr,cc,VBit);
-	  else
-	    u = 0;
-	  adj_26[i++] = u;
-	  if (u > 0) nblack++;
-	}
-      }
-    }
-
-    /*
-    ** get number of 6-connected components in -N18
-    */
-    for (i=0; i<27; i++) {
-      u = adj_26[i];
-      adj_6[i] = (u > 0) ? 0 : 1;
+    while (((todo >> i) & 1) == 0) i++;
+    comp = frontier = 1u << i;
+
+    while (frontier) {
+      i = 0;
+      while (((frontier >> i) & 1) == 0) i++;
+      frontier &= ~(1u << i);
+      grow = adjmask[i] & set & ~comp;
+      comp |= grow;
+      frontier |= grow;
     }
 
-    adj_6[13] = 0;
-    adj_6[0]  = 0;
-    adj_6[2]  = 0;
-    adj_6[6]  = 0;
-    adj_6[8]  = 0;
-    adj_6[18] = 0;
-    adj_6[20] = 0;
-    adj_6[24] = 0;
-    adj_6[26] = 0;
-
-    nbg = VOneComp6(adj_6);
+    n++;
+    if (n > 1) return n;
+    todo &= ~comp;
+  }
+  return n;
+}
 
-    if (nbg != 1) return 0;
 
-    /*
-    ** get number of 26-connected components in N26
-    */
-    adj_26[13] = 0;
-    nfg = VOneComp26(adj_26);
+/*
+** simple point test on a 3x3x3 neighbourhood. Bit i of <nbr> holds
+** voxel i in the order used throughout this file, the centre bit is ignored.
+**
+** Components are grown over the whole neighbourhood. VOneComp6 starts
+** its scan at j=i, the index of the first seed in six[], so voxels
+** 0 ... i-1 are never labelled. That does not change its result: six[k]
+** for k < i are background, so the skipped edge voxels 1 and 3 have no
+** labelled 6-neighbours within N18, and the rest are corners or six[].
+** Both tests agree on all 2^26 neighbourhoods for 6 and 26 adjacency.
+*/
+static int
+SimpleTest(unsigned int nbr,int adj)
+{
+  unsigned int fg = nbr & 0x7FFFFFFu & ~(1u << 13);
+  unsigned int bg = ~nbr & 0x7FFFFFFu & ~(1u << 13);
 
-    /* return 1 if simple point, and return 0 if not */
-    if (nbg == 1 && nfg == 1) return 1;
-    else return 0;
+  if (! masks_ready) GenMasks();
 
-    break;
+  if (adj == 26) {
+    if (NumCompMask(bg & N18_MASK,SIX_MASK,adjmask6) != 1) return 0;
+    return (NumCompMask(fg,fg,adjmask26) == 1) ? 1 : 0;
+  }
+  else {
+    if (NumCompMask(fg & N18_MASK,SIX_MASK,adjmask6) != 1) return 0;
+    return (NumCompMask(bg,bg,adjmask26) == 1) ? 1 : 0;
+  }
+}
 
 
+/*
+** Lookup tables for the 2^26 configurations of the 26-neighbourhood,
+** one for each adjacency. Entries are computed on first use and use
+** two bits each (known, simple), so that only configurations that
+** actually occur are ever evaluated.
+*/
+static unsigned int *simple_lut6=NULL,*simple_lut26=NULL;
 
-    /* 6-adjacency case */
-  case 6:
-    
-    i = 0;
-    nblack = 0;
-    for (bb=b-1; bb<=b+1; bb++) {
-      for (rr=r-1; rr<=r+1; rr++) {
-	for (cc=c-1; cc<=c+1; cc++) {
-	  if (bb >= 0 && bb < nbands
-	      && rr >= 0 && rr < nrows 
-	      && cc >= 0 && cc < ncols)
-	    u = VPixel(src,bb,rr,cc,VBit);
-	  else
-	    u = 0;
-	  adj_26[i] = u;
-	  adj_6[i] = u;
-	  i++;
-	  if (u > 0) nblack++;
-	}
+static unsigned int *
+SimpleLUT(int adj)
+{
+  unsigned int **lut = (adj == 26) ? &simple_lut26 : &simple_lut6;
+
+  if (*lut == NULL) {
+#pragma omp critical (simplepoint_lut)
+    {
+      if (*lut == NULL) {
+	unsigned int *tmp = (unsigned int *) calloc((1u << 26) / 16,sizeof(unsigned int));
+	if (! tmp) VError("VSimplePoint: out of memory");
+#pragma omp flush
+	*lut = tmp;
       }
     }
+  }
+  return *lut;
+}
 
-    /*
-    ** get number of 6-connected components in +N18
-    */
-    adj_6[13] = 0;
-    adj_6[0]  = 0;
-    adj_6[2]  = 0;
-    adj_6[6]  = 0;
-    adj_6[8]  = 0;
-    adj_6[18] = 0;
-    adj_6[20] = 0;
-    adj_6[24] = 0;
-    adj_6[26] = 0;
-
-    nbg = VOneComp6(adj_6);
-    if (nbg != 1) return 0;
-
-
-    /*
-    ** get number of 26-connected components in -N26
-    */
-    for (i=0; i<27; i++) {
-      u = adj_26[i];
-      adj_26[i] = (u > 0) ? 0 : 1;
-    }
 
-    adj_26[13] = 0;
-    nfg = VOneComp26(adj_26);
-    if (nfg != 1) return 0;
+/*!
+\fn int VSimplePointMask(unsigned int nbr,int adj)
+\brief simple point test on a 3x3x3 neighbourhood given as a bit mask.
+
+Bit 9*(db+1) + 3*(dr+1) + (dc+1) of <nbr> is set if the neighbour
+at offset (db,dr,dc) is a foreground voxel. The centre bit is ignored.
+Results are cached in a lookup table shared by all threads.
+
+\param nbr  neighbourhood bit mask
+\param adj  neighbourhood type (6 or 26)
+*/
+int
+VSimplePointMask(unsigned int nbr,int adj)
+{
+  unsigned int *lut,key,word,shift,result;
+
+  if (adj != 6 && adj != 26) VError("SimplePoint: illegal adjacency");
+
+  lut = SimpleLUT(adj);
+  key = (nbr & 0x1FFFu) | ((nbr >> 14) & 0x1FFFu) << 13;
+  shift = (key & 15) * 2;
+  word = lut[key >> 4];
+
+  if ((word >> shift) & 1) return (word >> (shift + 1)) & 1;
+
+  result = SimpleTest(nbr,adj);
+  word = (1u | (result << 1)) << shift;
+#pragma omp atomic
+  lut[key >> 4] |= word;
+
+  return result;
+}
+
 
+/*!
+\fn VBoolean VSimplePoint(VImage src,int b,int r,int c,int adj)
+\param src  input image (bit repn)
+\param b    slice address
+\param r    row address
+\param c    column address
+\param adj  neighbourhood type (6 or 26)
+*/
+int
+VSimplePoint(VImage src,int b, int r, int c,int adj)
+{
+  int i,bb,rr,cc;
+  int nbands,nrows,ncols;
+  unsigned int nbr=0;
 
-    /* return 1 if simple point, and return 0 if not */
-    if (nbg == 1 && nfg == 1) return 1;
-    else return 0;
-    break;
+  nbands = VImageNBands(src);
+  nrows  = VImageNRows(src);
+  ncols  = VImageNColumns(src);
 
-  default:
-    VError("SimplePoint: illegal adjacency");
+  if (adj != 6 && adj != 26) VError("SimplePoint: illegal adjacency");
+
+  i = 0;
+  for (bb=b-1; bb<=b+1; bb++) {
+    for (rr=r-1; rr<=r+1; rr++) {
+      for (cc=c-1; cc<=c+1; cc++) {
+	if (bb >= 0 && bb < nbands
+	    && rr >= 0 && rr < nrows 
+	    && cc >= 0 && cc < ncols
+	    && VPixel(src,bb,rr,cc,VBit) > 0)
+	  nbr |= 1u << i;
+	i++;
+      }
+    }
   }
-  return 0;
+
+  return VSimplePointMask(nbr,adj);
 }
@@ -36,9 +36,30 @@ extern void GenerateMaps(void);
 
 VImage alpha0_pos=NULL,alpha1_pos=NULL,alpha2_pos=NULL;
 VImage alpha0_neg=NULL,alpha1_neg=NULL,alpha2_neg=NULL;
+static VBoolean maps_ready = FALSE;	/* alpha maps are complete */
 
 
 
+/*
+** deletion test, all marked voxels of a pass are deleted simultaneously
+*/
+static int
+SkelTest(VImage dest,int b,int r,int c,int dir)
+{
+  if (Border_3d(dest,b,r,c) == FALSE) return 0;
+
+  if (Beta1_3d(dest,b,r,c) == FALSE) return 0;
+  if (Beta0_3d(dest,b,r,c) == FALSE) return 0;
+
+  /* alpha conditions */
+  if (Alpha_3d(dest,alpha0_pos,alpha0_neg,b,r,c) == FALSE &&
+      Alpha_3d(dest,alpha1_pos,alpha1_neg,b,r,c) == FALSE &&
+      Alpha_3d(dest,alpha2_pos,alpha2_neg,b,r,c) == FALSE) return 0;
+
+  return 1;
+}
+
+
 /*!
 \fn VImage VSkel3d (VImage src,VImage dest)
 \param src   input image (bit repn)
@@ -47,15 +68,12 @@ VImage alpha0_neg=NULL,alpha1_neg=NULL,alpha2_neg=NULL;
 VImage
 VSkel3d(VImage src,VImage dest)
 {
+  double tbegin = VTraceBegin();
   int b,r,c,nbands,nrows,ncols,npixels;
-  int ndel=0;
-  VBit *tmp_pp,*dst_pp;
-  VImage tmp=NULL,dt=NULL;
-  int i,j,n,n0,n1,mdel;
-
-  float depth,maxdepth,step=0.5;
-  VPoint *array;
-  VBit *src_pp,*dest_pp;
+  VImage dt=NULL;
+  int i;
+  float step=0.5;
+  VBit *src_pp;
 
 
   nrows  = VImageNRows (src);
@@ -65,8 +83,6 @@ VSkel3d(VImage src,VImage dest)
 
   dest = VCopyImage(src,dest,VAllBands);
   VFillImage(dest,VAllBands,0);
-  tmp = VCreateImage(nbands,nrows,ncols,VBitRepn);
-  VFillImage(tmp,VAllBands,0);
 
   for (b=2; b<nbands-2; b++) {
     for (r=2; r<nrows-2; r++) {
@@ -77,19 +93,25 @@ VSkel3d(VImage src,VImage dest)
   }
 
   /*
-  ** generate masks
+  ** generate masks, once for all threads
   */
-  GenerateMaps();
+  if (! maps_ready) {
+#pragma omp critical (skel3d_maps)
+    {
+      if (! maps_ready) {
+	GenerateMaps();
+#pragma omp flush
+	maps_ready = TRUE;
+      }
+    }
+  }
 
 
   /*
-  ** sort foreground voxels by depth
+  ** depth of foreground voxels
   */
   src_pp  = (VBit *) VPixelPtr(src, 0, 0, 0);
-  dest_pp = (VBit *) VPixelPtr(dest, 0, 0, 0);
-  n = 0;
   for (i=0; i<npixels; i++) {
-    if (*src_pp > 0) n++;
     *src_pp = (*src_pp > 0) ? 0 : 1;
     src_pp++;
   }
@@ -102,108 +124,14 @@ VSkel3d(VImage src,VImage dest)
     src_pp++;
   }
 
-  array = (VPoint *) VMalloc(sizeof(VPoint) * (n+1));
-
-  array[0].b = 0;
-  array[0].r = 0;
-  array[0].c = 0;
-  array[0].val = 0;
-
-  n = 1;
-  for (b=0; b<nbands; b++) {
-    for (r=0; r<nrows; r++) {
-      for (c=0; c<ncols; c++) {
-        if (VPixel(dt, b, r, c,VFloat) > 0.1) {
-          array[n].b = b;
-          array[n].r = r;
-          array[n].c = c;
-          array[n].val = VPixel(dt,b,r,c,VFloat);
-          n++;
-        }
-      }
-    }
-  }
-  VDestroyImage(dt);
-  VPoint_hpsort((n-1),array);
-
 
   /*
-  ** now start deleting voxels
+  ** now start deleting voxels, in order of increasing depth
   */  
-  maxdepth = array[n-1].val;
-  fprintf(stderr," maxdepth= %f\n",maxdepth);
-
-  mdel = 0;
-  for (depth=0; depth <= maxdepth; depth += step) {
-
-    fprintf(stderr,"   depth= %7.2f\r",depth); fflush(stderr);
+  VQueueThinning(dest,dt,step,2,1,SkelTest);
 
-    n0 = 1;
-    for (j=n-1; j>=1; j--) {
-      if (array[j].val < depth-2.0*step) {
-        n0 = j;
-        break;
-      }
-    }
-
-    n1 = n;
-    for (j=1; j<=n; j++) {
-      if (array[j].val > depth) {
-        n1 = j-1;
-        break;
-      }
-    }
-
-    /*
-    ** delete all deletable voxels within this depth level
-    */
-    ndel = 1;
-    while (ndel > 0) {
-      ndel = 0;
-
-      VFillImage(tmp,VAllBands,0);
-
-      for (j=n0; j<=n1; j++) {
-
-	if (array[j].val > depth) continue;
-
-	b = array[j].b;
-	r = array[j].r;
-	c = array[j].c;
-	if (b < 2 || b >= nbands-2) continue;
-	if (r < 2 || r >= nrows-2) continue;
-	if (c < 2 || c >= ncols-2) continue;
-
-
-	if (VPixel(dest,b,r,c,VBit) == 0) continue;
-	if (Border_3d(dest,b,r,c) == FALSE) continue;
-
-	if (Beta1_3d(dest,b,r,c) == FALSE) continue;
-	if (Beta0_3d(dest,b,r,c) == FALSE) continue;
-
-	/* alpha conditions */
-	if (Alpha_3d(dest,alpha0_pos,alpha0_neg,b,r,c) == FALSE &&
-	    Alpha_3d(dest,alpha1_pos,alpha1_neg,b,r,c) == FALSE &&
-	    Alpha_3d(dest,alpha2_pos,alpha2_neg,b,r,c) == FALSE) continue;
-
-	/* mark for deletion */
-	VPixel(tmp,b,r,c,VBit) = 1; 
-	ndel++;
-      }
-    
-      /* perform parallel deletion */
-      tmp_pp = (VBit *) VPixelPtr(tmp,0,0,0);
-      dst_pp = (VBit *) VPixelPtr(dest,0,0,0);
-
-      for (i=0; i<npixels; i++) {
-	if (*tmp_pp == 1) *dst_pp = 0;
-	tmp_pp++;
-	dst_pp++;
-      }
-    }
-  }
-
-  VDestroyImage(tmp);
+  VDestroyImage(dt);
+  VTraceEnd("VSkel3d",tbegin,VImageNPixels(src),VImageSize(src));
   return dest;
 }
 
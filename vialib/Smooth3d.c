@@ -1,11 +1,20 @@
-
 /*! \file
  A non-linear 3d smoothing filter
 
-The smoothing filter computes the most frequent value in a 6 (or 18)
-neighbourhood and replaces the center pixel with this value.
-The pixels within the neighbourhood are weighted.
+The smoothing filter computes a weighted mean of the grey values
+in a 6, 18 or 26 neighbourhood, rounds it to an integer, and replaces
+the center pixel with this value. The filter may be applied repeatedly.
+
+Iterations alternate between two buffers, the input image is not
+modified. Each slice keeps track of whether it changed in the previous
+iteration. A slice whose neighbourhood of slices did not change is not
+recomputed, so converged regions cost nothing in later iterations.
+Slices are processed in parallel.
 
+Results differ from earlier versions for the 26 neighbourhood, which
+left out the edge neighbours but still divided by their weight, and
+for float images in the 18 neighbourhood, where one neighbour was
+truncated to an integer before it was summed.
 
 \par Author:
 Gabriele Lohmann, MPI-CBS
@@ -23,70 +32,147 @@ Gabriele Lohmann, MPI-CBS
 #include <stdlib.h>
 #include <math.h>
 
+
+/* weights of the center, face, edge and corner neighbours */
+#define N1  8
+#define N6  4
+#define N18 2
+#define N26 1
+
+/*
+** weighted sums over the face, edge and corner neighbours of column c,
+** p[1+db][1+dr] points to the row at offset (db,dr)
+*/
+#define S6(c,cm,cp)                                                     \
+  (N1 * (int) p[1][1][c]                                                \
+   + N6 * ((int) p[1][1][cm] + (int) p[1][1][cp]                        \
+	   + (int) p[1][0][c] + (int) p[1][2][c]                        \
+	   + (int) p[0][1][c] + (int) p[2][1][c]))
+
+#define S18(c,cm,cp)                                                    \
+  (N18 * ((int) p[1][0][cm] + (int) p[1][0][cp]                         \
+	  + (int) p[1][2][cm] + (int) p[1][2][cp]                       \
+	  + (int) p[0][1][cm] + (int) p[0][1][cp]                       \
+	  + (int) p[2][1][cm] + (int) p[2][1][cp]                       \
+	  + (int) p[0][0][c] + (int) p[0][2][c]                         \
+	  + (int) p[2][0][c] + (int) p[2][2][c]))
+
+#define S26(c,cm,cp)                                                    \
+  (N26 * ((int) p[0][0][cm] + (int) p[0][0][cp]                         \
+	  + (int) p[0][2][cm] + (int) p[0][2][cp]                       \
+	  + (int) p[2][0][cm] + (int) p[2][0][cp]                       \
+	  + (int) p[2][2][cm] + (int) p[2][2][cp]))
+
+/*
+** round sum/norm (half away from zero) and store, count changes
+*/
+#define SmoothStore(type,norm)                                          \
+{                                                                       \
+  for (c = 0; c < ncols; c++) {                                         \
+    s = sum[c];                                                         \
+    i0 = (s >= 0) ? (2*s + norm) / (2*norm) : -((norm - 2*s) / (2*norm)); \
+    dest_pp[c] = (type) i0;                                             \
+    if (i0 != (int) p[1][1][c]) n++;                                    \
+  }                                                                     \
+}
+
 /*
  *  Smooth3d
- * 
- *  apply a voting filter in a small neighbourhood
  *
+ *  apply the filter to slice b. Border voxels are replicated:
+ *  rows and slices by clamping the row pointers, columns separately.
+ *  The interior loops run over contiguous rows.
  */
-#define Smooth3d(type) \
-{ \
-  type *dest_pp,*src_pp; \
-  dest_pp = (type *) VPixelPtr(dest,0,0,0); \
-  for (b = 0; b < nbands; b++) { \
-    b0 = (b < 1) ? 0 : b-1; \
-    b1 = (b > nbands - 2) ?  nbands - 1 : b+1; \
-    for (r = 0; r < nrows; r++) { \
-      r0 = (r < 1) ? 0 : r-1; \
-      r1 = (r > nrows - 2) ?  nrows - 1 : r+1; \
-      for (c = 0; c < ncols; c++) { \
-	c0 = (c < 1) ? 0 : c-1; \
-	c1 = (c > ncols - 2) ?  ncols - 1 : c+1; \
-        isum = 0; \
-        i1 = VPixel(src,b,r,c,type); \
-	isum += (int) i1 * n1; \
-	isum += (int) VPixel(src,b0,r,c,type) * n6; \
-	isum += (int) VPixel(src,b,r0,c,type) * n6; \
-	isum += (int) VPixel(src,b,r,c0,type) * n6; \
-	isum += (int) VPixel(src,b1,r,c,type) * n6; \
-	isum += (int) VPixel(src,b,r1,c,type) * n6; \
-	isum += (int) VPixel(src,b,r,c1,type) * n6; \
-        if (neighb == 1) { \
-	  isum += VPixel(src,b0,r0,c,type) * n18; \
-	  isum += (int) VPixel(src,b,r0,c0,type) * n18; \
-	  isum += (int) VPixel(src,b0,r,c0,type) * n18; \
-	  isum += (int) VPixel(src,b1,r1,c,type) * n18; \
-	  isum += (int) VPixel(src,b,r1,c1,type) * n18; \
-	  isum += (int) VPixel(src,b1,r,c1,type) * n18; \
-	  isum += (int) VPixel(src,b1,r0,c,type) * n18; \
-	  isum += (int) VPixel(src,b,r1,c0,type) * n18; \
-	  isum += (int) VPixel(src,b1,r,c0,type) * n18; \
-	  isum += (int) VPixel(src,b0,r1,c,type) * n18; \
-	  isum += (int) VPixel(src,b,r0,c1,type) * n18; \
-	  isum += (int) VPixel(src,b0,r,c1,type) * n18; \
-        } \
-        if (neighb == 2) { \
-	  isum += (int) VPixel(src,b0,r0,c0,type) * n26; \
-	  isum += (int) VPixel(src,b1,r0,c0,type) * n26; \
-	  isum += (int) VPixel(src,b0,r1,c0,type) * n26; \
-	  isum += (int) VPixel(src,b0,r0,c1,type) * n26; \
-	  isum += (int) VPixel(src,b1,r1,c0,type) * n26; \
-	  isum += (int) VPixel(src,b1,r0,c1,type) * n26; \
-	  isum += (int) VPixel(src,b0,r1,c1,type) * n26; \
-	  isum += (int) VPixel(src,b1,r1,c1,type) * n26; \
-        } \
-        sum = (double) isum / (double) norm; \
-        i0 = (int) VRint((double)sum); \
-	*dest_pp++ = (type) i0; \
-        if (i0 != i1) n++; \
-      } \
-    } \
-  } \
-  if (numiter > 1) { \
-    src_pp = (type *) VPixelPtr(src,0,0,0); \
-    dest_pp = (type *) VPixelPtr(dest,0,0,0); \
-    for (i=0; i<npixels; i++) *src_pp++ = *dest_pp++; \
-  } \
+#define Smooth3d(type)                                                  \
+{                                                                       \
+  type *src_pp = (type *) in, *dest_pp, *p[3][3];                       \
+  for (r = 0; r < nrows; r++) {                                         \
+    for (i = 0; i < 3; i++) {                                           \
+      bb = b + i - 1;                                                   \
+      if (bb < 0) bb = 0;                                               \
+      if (bb >= nbands) bb = nbands - 1;                                \
+      for (j = 0; j < 3; j++) {                                         \
+	rr = r + j - 1;                                                 \
+	if (rr < 0) rr = 0;                                             \
+	if (rr >= nrows) rr = nrows - 1;                                \
+	p[i][j] = src_pp + (bb * nrows + rr) * ncols;                   \
+      }                                                                 \
+    }                                                                   \
+    for (c = 1; c < ncols - 1; c++)                                     \
+      sum[c] = S6(c,c-1,c+1);                                           \
+    if (neighb >= 1)                                                    \
+      for (c = 1; c < ncols - 1; c++)                                   \
+	sum[c] += S18(c,c-1,c+1);                                       \
+    if (neighb == 2)                                                    \
+      for (c = 1; c < ncols - 1; c++)                                   \
+	sum[c] += S26(c,c-1,c+1);                                       \
+    for (c = 0; c < ncols; c += (ncols > 1 ? ncols - 1 : 1)) {          \
+      c0 = (c < 1) ? 0 : c-1;                                           \
+      c1 = (c > ncols - 2) ? ncols - 1 : c+1;                           \
+      sum[c] = S6(c,c0,c1);                                             \
+      if (neighb >= 1) sum[c] += S18(c,c0,c1);                          \
+      if (neighb == 2) sum[c] += S26(c,c0,c1);                          \
+    }                                                                   \
+    dest_pp = (type *) out + (b * nrows + r) * ncols;                   \
+    switch (neighb) {                                                   \
+    case 0:                                                             \
+      SmoothStore(type,(N1 + 6 * N6));                                  \
+      break;                                                            \
+    case 1:                                                             \
+      SmoothStore(type,(N1 + 6 * N6 + 12 * N18));                       \
+      break;                                                            \
+    default:                                                            \
+      SmoothStore(type,(N1 + 6 * N6 + 12 * N18 + 8 * N26));             \
+    }                                                                   \
+  }                                                                     \
+}
+
+
+/*
+** filter slice b from <in> into <out>, returns the number of changed voxels.
+** <sum> must hold ncols values.
+*/
+static long
+SmoothSlice(VRepnKind repn,VPointer in,VPointer out,long b,
+	    long nbands,long nrows,long ncols,VLong neighb,int *sum)
+{
+  long i,j,bb,rr,r,c,c0,c1,n=0;
+  int s,i0;
+
+  switch (repn) {
+
+  case VBitRepn:
+    Smooth3d(VBit);
+    break;
+
+  case VUByteRepn:
+    Smooth3d(VUByte);
+    break;
+
+  case VSByteRepn:
+    Smooth3d(VSByte);
+    break;
+
+  case VShortRepn:
+    Smooth3d(VShort);
+    break;
+
+  case VLongRepn:
+    Smooth3d(VLong);
+    break;
+
+  case VFloatRepn:
+    Smooth3d(VFloat);
+    break;
+
+  case VDoubleRepn:
+    Smooth3d(VDouble);
+    break;
+
+  default:
+    VError("Illegal representation type");
+  }
+  return n;
 }
 
 
@@ -95,89 +181,89 @@ Gabriele Lohmann, MPI-CBS
 \fn VImage VSmoothImage3d (VImage src, VImage dest, VLong neighb, VLong numiter)
 \param src  input image (any repn)
 \param dest output image (any repn)
-\param neighb adjacency type (6,18, or 26)
-\param numiter number of iterations (filtering may be applied repeatedly)
+\param neighb adjacency type (0: 6, 1: 18, or 2: 26)
+\param numiter number of iterations (filtering may be applied repeatedly).
+Iterations stop early once at most one voxel changes.
 */
-VImage 
+VImage
 VSmoothImage3d (VImage src, VImage dest, VLong neighb, VLong numiter)
 {
-  long nbands,nrows,ncols,npixels;
+  double tbegin = VTraceBegin();
+  long nbands,nrows,ncols;
   VRepnKind repn;
-  long i,i0,i1,n,iter;
-  long b0,b1,r0,r1,c0,c1,b,r,c;
-  long n1,n6,n18,n26;
-  int isum;
-  double sum,norm;
+  long b,n,iter;
+  VImage in,out,tmp=NULL,copy=NULL;
+  char *changed,*prev,*t;
 
   repn   = VPixelRepn (src);
   nbands = VImageNBands (src);
   nrows  = VImageNRows (src);
   ncols  = VImageNColumns (src);
-  npixels = nbands * nrows * ncols;
-  if (dest == NULL) 
+  if (neighb < 0 || neighb > 2)
+    VError("VSmoothImage3d: illegal neighbourhood type (%d)",neighb);
+
+  if (dest == NULL)
     dest = VCreateImage (nbands,nrows,ncols,repn);
   if (! dest) return NULL;
 
-  n1  = 8;
-  n6  = 4;
-  n18 = 2;
-  n26 = 1;
+  /* the input must not be overwritten before the first iteration is done */
+  if (dest == src) src = copy = VCopyImage (src,NULL,VAllBands);
 
-  switch(neighb) {
-  case 0:
-    norm = n1 + 6 * n6;
-    break;
-  case 1:
-    norm = n1 + 6 * n6 + 12 * n18;
-    break;
-  case 2:
-    norm = n1 + 6 * n6 + 12 * n18 + 8 * n26;
-    break;
-  default: ;
-  }
+  if (numiter > 1)
+    tmp = VCreateImage (nbands,nrows,ncols,repn);
+  changed = (char *) VCalloc(nbands,sizeof(char));
+  prev    = (char *) VCalloc(nbands,sizeof(char));
 
+  /*
+  ** Iteration k writes to the buffer read in iteration k-1, which holds
+  ** the result of iteration k-2. A slice with no changes in the slices
+  ** b-1..b+1 in iteration k-1 has the same result in iteration k as in
+  ** k-2, so it is already in place and can be skipped from k = 3 on.
+  ** The buffers are chosen so that the last of numiter iterations
+  ** writes to dest.
+  */
+  in = src;
   iter = 0;
   n = 100;
   while (n > 1 && iter < numiter) {
     iter++;
+    out = ((numiter - iter) % 2 == 0) ? dest : tmp;
     n = 0;
-    switch (repn) {
-
-    case VBitRepn:
-      Smooth3d(VBit);
-      break;
-		
-    case VUByteRepn:
-      Smooth3d(VUByte);
-      break;
-		
-    case VSByteRepn:
-      Smooth3d(VSByte);
-      break;
-		
-    case VShortRepn:
-      Smooth3d(VShort);
-      break;
-		
-    case VLongRepn:
-      Smooth3d(VLong);
-      break;
-
-    case VFloatRepn:
-      Smooth3d(VFloat);
-      break;
-
-    case VDoubleRepn:
-      Smooth3d(VDouble);
-      break;
-
-    default:
-      VError("Illegal representation type");
+
+#pragma omp parallel reduction(+:n)
+    {
+      int *sum = (int *) VMalloc(sizeof(int) * ncols);
+      long m;
+
+#pragma omp for schedule(dynamic,1)
+      for (b = 0; b < nbands; b++) {
+	if (iter > 2 && ! prev[b]
+	    && (b == 0 || ! prev[b-1]) && (b == nbands-1 || ! prev[b+1])) {
+	  changed[b] = 0;
+	  continue;
+	}
+	m = SmoothSlice(repn,VImageData(in),VImageData(out),b,
+			nbands,nrows,ncols,neighb,sum);
+	changed[b] = (m > 0);
+	n += m;
+      }
+      VFree(sum);
     }
+
+    t = prev;
+    prev = changed;
+    changed = t;
+    in = out;
   }
 
+  if (in != dest) VCopyImagePixels (in,dest,VAllBands);
+  if (tmp) VDestroyImage (tmp);
+  VFree(changed);
+  VFree(prev);
 
   VCopyImageAttrs (src, dest);
   VSetAttr (VImageAttrList(dest), "component_interp", NULL, VStringRepn, "image");
+  VTraceEnd("VSmoothImage3d",tbegin,VImageNPixels(dest) * iter,VImageSize(dest));
+  if (copy) VDestroyImage (copy);
   return dest;
 }
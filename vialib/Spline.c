@@ -11,6 +11,11 @@ where x,x0,b,y are 1x3 vectors and A is a 3x3 matrix.
 The vector x0 can be used to specify a position that
 remains unchanged by the transformation.
 
+The B-spline coefficients of an image can be computed once
+using VCubicSplineCoeff3d() and then be resampled repeatedly
+using VCubicSplineCoeffSample3d(), e.g. when many candidate
+transformations must be evaluated during registration.
+
 
 \par Authors:
 A.Hagert <hagert@cns.mpg.de>, 07.01.2003,
@@ -18,20 +23,11 @@ G.Lohmann, MPI-CBS
 */
 
 
-
-/**************************************************/
-/* Resample a 3D image cubic spline interpolation */
-/*                                                */
-/* A.Hagert <hagert@cns.mpg.de>, 07.01.2003       */
-/*                                                */
-/* bei 160x200x160 -> ca. 7-8 Minuten (gesamt)    */
-/**************************************************/
-
-
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 #include <float.h>
+#include <string.h>
 
 /* From the Vista library: */
 #include <viaio/Vlib.h>
@@ -41,126 +37,172 @@ G.Lohmann, MPI-CBS
 #include <via.h>
 
 
-#define ABS(x) ((x) > 0 ? (x) : -(x))
-#define CEIL(x) ((int) ((x) + 0.9999999))
+/* pole of the cubic B-spline prefilter */
+#define SPLINE_POLE   (-0.267949192431123)  /* sqrt(3) - 2 */
+
+/* tolerance for truncating the causal initialisation */
+#define SPLINE_EPS    1.0e-6
 
-/* Hilfsfunktionen: */
+/* number of independent lines handled per block in the band pass */
+#define SPLINE_LANES  1024
 
-/*****************************/
-/* der kubische B-Spline ... */
-/*****************************/
 
-float beta3 (float x)    
+/*
+** Recursive cubic B-spline prefilter applied in place to <width> adjacent
+** lines of length n. Sample k of lane i is found at data[k*stride + i].
+** The innermost loops run over the lanes, i.e. over contiguous memory.
+*/
+static void
+SplinePrefilter(float *data,int n,size_t stride,int width)
 {
-  float r = 0.0;
-  float y,y2;
+  const float z = SPLINE_POLE;
+  const float lambda = 6.0;
+  float zk,*d0,*d1;
+  int i,k,horizon;
+
+  if (n < 2) {
+    for (i=0; i<width; i++) data[i] *= 1.5;
+    return;
+  }
 
-  y  = ABS(x);
-  y2 = 2 - y;
+  horizon = (int) ceil(log(SPLINE_EPS) / log(fabs(z)));
+  if (horizon > n) horizon = n;
 
-  if ((0 <= y) && (y < 1)) {
-    r = 0.666666 - y*y + y*y*y*0.5;
+  /* causal initialisation */
+  zk = z;
+  for (k=1; k<horizon; k++) {
+    d1 = data + k*stride;
+    for (i=0; i<width; i++) data[i] += zk * d1[i];
+    zk *= z;
   }
-  else if ((1 <= y) && (y < 2)) {
-    r = y2*y2*y2 / 6.0;
+
+  /* causal filter */
+  for (k=1; k<n; k++) {
+    d0 = data + (k-1)*stride;
+    d1 = data + k*stride;
+    for (i=0; i<width; i++) d1[i] += z * d0[i];
   }
 
-  return r;
+  /* anticausal initialisation */
+  d0 = data + (n-2)*stride;
+  d1 = data + (n-1)*stride;
+  for (i=0; i<width; i++) d1[i] = z / (z*z - 1.0) * (d1[i] + z * d0[i]);
+
+  /* anticausal filter */
+  for (k=n-2; k>=0; k--) {
+    d0 = data + k*stride;
+    d1 = data + (k+1)*stride;
+    for (i=0; i<width; i++) d0[i] = z * (d1[i] - d0[i]);
+  }
+
+  for (k=0; k<n; k++) {
+    d0 = data + k*stride;
+    for (i=0; i<width; i++) d0[i] *= lambda;
+  }
 }
 
-/**********************************/
-/* komplette Spline-Funktion (3d) */
-/**********************************/
 
-float f (VImage field,float z,float y,float x)
+
+/*!
+\fn VImage VCubicSplineCoeff3d (VImage src,VImage dest)
+\brief Compute the cubic B-spline coefficients of a 3D image.
+
+The result can be passed to VCubicSplineCoeffSample3d() any number
+of times, so that repeated resamplings of the same image do not need
+to recompute the coefficients.
+
+\param src   input image (any repn)
+\param dest  output image (float repn)
+*/
+VImage
+VCubicSplineCoeff3d (VImage src,VImage dest)
 {
   int nbands,nrows,ncols;
-  int b, r, c, b_low, r_low, c_low, b_high, r_high, c_high;
-  float temp = 0.0, t1 = 0.0, t2 = 0.0, t0=0;
+  int b;
+  size_t npixels,nslice,i;
+  VFloat *data;
 
-  r_low = CEIL ((y-2)); /* ceil (y - (degree+1)/2); */
-  c_low = CEIL ((x-2)); /* ceil (x - (degree+1)/2); */
-  b_low = CEIL ((z-2)); /* ceil (z - (degree+1)/2); */
+  nbands = VImageNBands(src);
+  nrows  = VImageNRows(src);
+  ncols  = VImageNColumns(src);
+  nslice = (size_t) nrows * ncols;
+  npixels = (size_t) nbands * nslice;
 
-  nbands = VImageNBands(field);
-  nrows  = VImageNRows(field);
-  ncols  = VImageNColumns(field);
-
-  r_high = r_low + 3; /* "3" ist der Grad der Interpolationspolynome */
-  c_high = c_low + 3;
-  b_high = b_low + 3;
+  dest = VSelectDestImage("VCubicSplineCoeff3d",dest,nbands,nrows,ncols,VFloatRepn);
+  if (! dest) return NULL;
 
-  if (c_low < 0) c_low = 0;
-  if (r_low < 0) r_low = 0;
-  if (b_low < 0) b_low = 0;
+  if (VPixelRepn(src) == VFloatRepn) {
+    if (dest != src) memcpy(VImageData(dest),VImageData(src),npixels * sizeof(VFloat));
+  }
+  else {
+    data = (VFloat *) VImageData(dest);
+    for (i=0; i<npixels; i++) data[i] = VGetPixelValue(src,i);
+  }
+  data = (VFloat *) VImageData(dest);
+
+  /* along rows and columns, one slice at a time */
+#pragma omp parallel for schedule(dynamic)
+  for (b=0; b<nbands; b++) {
+    VFloat *slice = data + (size_t) b * nslice;
+    int r;
+    for (r=0; r<nrows; r++) 
+      SplinePrefilter(slice + (size_t) r * ncols,ncols,1,1);
+    SplinePrefilter(slice,nrows,ncols,ncols);
+  }
 
-  if (c_high >= ncols)  c_high = ncols-1;
-  if (r_high >= nrows)  r_high = nrows-1;
-  if (b_high >= nbands) b_high = nbands-1;
-  
-  for (b = b_low; b <= b_high; b++) {
-    t1 = beta3 (z-b);
-    for (r = r_low; r <= r_high; r++) {
-      t2 = t1 * beta3 (y-r);
-      for (c = c_low; c <= c_high; c++) {
-	t0 = VPixel(field,b,r,c,VFloat);
-	temp += t0 * t2 * beta3 (x-c);
-      }
-    }
+  /* along bands, in blocks of adjacent lines */
+#pragma omp parallel for schedule(dynamic)
+  for (b=0; b<(int) ((nslice + SPLINE_LANES - 1) / SPLINE_LANES); b++) {
+    size_t offset = (size_t) b * SPLINE_LANES;
+    int width = SPLINE_LANES;
+    if (offset + width > nslice) width = nslice - offset;
+    SplinePrefilter(data + offset,nbands,nslice,width);
   }
-  
-  if (temp < 0.0) temp = 0.0;
-  if (temp > 255.0) temp = 255.0; 
-  
-  return (temp);
-}
 
-/*******************************************************/
-/* Bestimmung der Koeffizienten c[k] - 1 dimensional ! */
-/*******************************************************/
+  return dest;
+}
 
-void compute_koeffizients (float *data, int anz)   
-{
-  int n;
-  float z1;
-  float c1[anz];
-  float u;
-
-  z1 = sqrt((double)3.0) - 2.0;
-
-  /* Hinrichtung (wie brutal) */
-  c1[0] = 0;
-  u = 1;
-  for (n = 0; n <= anz-1; n++) {  /* c1[0] - Startbedingung */
-    c1[0] += data[n] * u;
-    u *= z1;
-  }
-   
-  for (n = 1; n <= anz-1; n++)  /* Filtern von links nach rechts */
-    c1[n] = data[n] + z1 * c1[n-1];
 
-  /* Rueckrichtung */
 
-  data[anz-1] = z1 / (z1*z1 -1) * (c1[anz-1] + z1 * c1[anz-2]);
+/*!
+\fn VImage VCubicSplineCoeffSample3d (VImage coeff,VImage dest,VImage transform,
+                                float b0,float r0,float c0,
+			        int dst_nbands,int dst_nrows,int dst_ncolumns,VRepnKind repn)
+\brief Resample a 3D image from precomputed cubic B-spline coefficients.
 
-  for (n = anz-2; n >= 0; n--)  /* Filtern von rechts nach links */
-    data[n] = z1 * (data[n+1] - c1[n]);
-    
-  for (n = 0; n <= anz-1; n++) data[n] *= 6.0;
+\param coeff coefficient image as produced by VCubicSplineCoeff3d (float repn)
+\param dest  output image
+\param transform  4x3 transformation image (float or double repn).
+The first column of <transform> contains the translation vector.
+The remaining three columns contains the 3x3 linear transformation matrix.
+\param b0           slice address that remains fixed 
+\param r0           row address that remains fixed 
+\param c0           column address that remains fixed 
+\param dst_nbands   number of output slices
+\param dst_nrows    number of output rows
+\param dst_ncolumns number of output columns
+\param repn         pixel repn of the output image
+*/
+VImage 
+VCubicSplineCoeffSample3d (VImage coeff,VImage dest,VImage transform,
+			   float b0,float r0,float c0,
+			   int dst_nbands,int dst_nrows,int dst_ncolumns,VRepnKind repn)
+{
+  return VResample3d(coeff,dest,transform,b0,r0,c0,
+		     dst_nbands,dst_nrows,dst_ncolumns,repn,VInterpolCubicSpline);
 }
 
-/*******************************************************/
-/* Hauptfunktion: Ermittlung des interpolierten Bildes */
-/*******************************************************/
+
+
 /*!
 \fn VImage VCubicSplineSample3d (VImage src,VImage dest,VImage transform,
                                 float b0,float r0,float c0,
 			        int dst_nbands,int dst_nrows,int dst_ncolumns)
-\brief Resample a 3D image using trilinear interpolation.
+\brief Resample a 3D image using cubic spline interpolation.
 
 \param src   input image (any repn)
 \param dest  output image (any repn)
-\param transform  4x3 transformation image (float repn).
+\param transform  4x3 transformation image (float or double repn).
 The first column of <transform> contains the translation vector.
 The remaining three columns contains the 3x3 linear transformation matrix.
 \param b0           slice address that remains fixed 
@@ -175,173 +217,14 @@ VCubicSplineSample3d (VImage src, VImage dest,VImage transform,
 		      float b0,float r0,float c0,
 		      int dest_nbands,int dest_nrows,int dest_ncolumns)
 {
-  VImage int_koeff=NULL;           /* Interpolationskoeffizienten (3d - Feld) */
-  float *data;                     /* da kommen mal die Stuetzstellen rein */
-  int b, r, c;                     /* Zaehler */
-  VRepnKind src_repn;
-  int src_nrows, src_ncolumns, src_nbands; 
-  float a[3][3],ainv[3][3],detA;
-  float bp, rp, cp, bx, rx, cx;
-  float shift[3];
-  float val;
-  int i,j,n,m;
-
-/* ================================================================================================ */
-
-  /* V O R B E R E I T U N G E N */
-
-  /* Daten einlesen, Speicher allokieren, ... */
-
-  /* Bildgroesse */
-  src_nrows    = VImageNRows (src);
-  src_ncolumns = VImageNColumns (src);
-  src_nbands   = VImageNBands (src);
-  src_repn     = VPixelRepn (src);
-  
-  /* Allokierung des dynamischen 3D - Koeffizientenfeldes */
-  int_koeff = VCreateImage(src_nbands,src_nrows,src_ncolumns,VFloatRepn);
-  VFillImage(int_koeff,VAllBands,0);
-  
-  /* Ausgabebild erzeugen (noch leer) */
-  dest = VSelectDestImage("VCubicSplineSample3d",dest,dest_nbands,dest_nrows,dest_ncolumns,src_repn);
-  if (! dest) return NULL;
-  VFillImage(dest,VAllBands,0);
-  
-  /* fertig mit den V O R B E R E I T U N G E N */
-  
-/* ------------------------------------------------------------------------------------------------- */
-
-  /* get inverse of transformation matrix : */
-
-  /* get transformation matrix : */
-  for (i=0; i<3; i++) {
-    for (j=0; j<3; j++) {
-      a[i][j]  = VGetPixel(transform,0,i,j+1);
-    }
-  }
+  VImage coeff=NULL;
 
-  /* get its inverse : */
-  ainv[0][0] =  a[1][1]*a[2][2] - a[1][2]*a[2][1];
-  ainv[1][0] = -a[1][0]*a[2][2] + a[1][2]*a[2][0];
-  ainv[2][0] =  a[1][0]*a[2][1] - a[1][1]*a[2][0];
+  coeff = VCubicSplineCoeff3d(src,NULL);
+  if (! coeff) return NULL;
 
-  ainv[0][1] = -a[0][1]*a[2][2] + a[0][2]*a[2][1];
-  ainv[1][1] =  a[0][0]*a[2][2] - a[0][2]*a[2][0];
-  ainv[2][1] = -a[0][0]*a[2][1] + a[0][1]*a[2][0];
-
-  ainv[0][2] =  a[0][1]*a[1][2] - a[0][2]*a[1][1];
-  ainv[1][2] = -a[0][0]*a[1][2] + a[0][2]*a[1][0];
-  ainv[2][2] =  a[0][0]*a[1][1] - a[0][1]*a[1][0];
-
-
-  /* determinant */
-  detA = a[0][0]*ainv[0][0] + a[0][1]*ainv[1][0] + a[0][2]*ainv[2][0];
-  if (detA == 0) VError(" VCubicSplineSample3d: transformation matrix is singular");
-
-  for (i=0; i<3; i++) {
-    for (j=0; j<3; j++) {
-      ainv[i][j] /= detA;
-    }
-  }
-
-  for (i=0; i<3; i++) 
-    shift[i] = VPixel(transform,0,i,0,VFloat);
-
-
-  /* Ermittlung der Splinekoeffizienten ... */
-
-  /* erstmal die horizontal waagerechten Abhaengigkeiten */
-  data = (float *) VMalloc (src_ncolumns * sizeof (float));  /* Stuetzstellen */
-  for (b = 0; b < src_nbands; b++) {
-    for (r = 0; r < src_nrows; r++) {
-
-      /* Einlesen der Stuetzstellen (1 Zeile) */
-      for (c = 0; c < src_ncolumns; c++) {
-	data[c] = VGetPixel(src, b, r, c);
-      }
-
-      /* Berechnen der Koeffizienten */
-      compute_koeffizients (data, src_ncolumns);
-
-      /* Eintragen in 3D-Koeffizientenfeld */
-      for (c = 0; c < src_ncolumns; c++)
-        VPixel(int_koeff,b,r,c,VFloat) = data[c];
-    }
-  }
-  VFree (data);
-  
-  /* jetzt die horizontal senkrechten Abhaengigkeiten */
-  data = (float *) VMalloc (src_nrows * sizeof (float));  /* Stuetzstellen */
-  for (b = 0; b < src_nbands; b++) {
-    for (c = 0; c < src_ncolumns; c++) {
-
-      /* Einlesen der Stuetzstellen (1 Spalte) */
-      for (r = 0; r < src_nrows; r++)
-        data[r] = VPixel(int_koeff,b,r,c,VFloat);
-
-      /* Berechnen der Koeffizienten */
-      compute_koeffizients (data, src_nrows);
-    
-      /* Eintragen in 3D-Koeffizientenfeld */
-      for (r = 0; r < src_nrows; r++)
-        VPixel(int_koeff,b,r,c,VFloat) = data[r];
-    }
-  }
-  VFree (data);
-    
-  /* jetzt die vertikal senkrechten Abhaengigkeiten */
-  data = (float *) VMalloc (src_nbands * sizeof (float)); /* Stuetzstellen */
-  for (r = 0; r < src_nrows; r++) {
-    for (c = 0; c < src_ncolumns; c++) {
-
-      /* Einlesen der Stuetzstellen (1 Spalte) */    
-      for (b = 0; b < src_nbands; b++)
-        data[b] = VPixel(int_koeff,b,r,c,VFloat);
-
-      /* Berechnen der Koeffizienten */
-      compute_koeffizients (data, src_nbands);
-    
-      /* Eintragen in 3D-Koeffizientenfeld */
-      for (b = 0; b < src_nbands; b++)
-        VPixel(int_koeff,b,r,c,VFloat) = data[b];
-    }
-  }
-  VFree (data);
-    
-  /* ... Splinekoeffizienten liegen vor */
-
-
-  /* Determines the value of each pixel in the destination image: */
-
-  for (b = 0; b < dest_nbands; b++) {
-    for (r = 0; r < dest_nrows; r++) {
-      for (c = 0; c < dest_ncolumns; c++) {
-
-	/* Ermittlung der transformierten Koordinaten */
-
-	bx = (float) b - shift[0]; 
-	rx = (float) r - shift[1]; 
-	cx = (float) c - shift[2];
-
-	bp = ainv[0][0] * bx + ainv[0][1] * rx + ainv[0][2] * cx;
-	rp = ainv[1][0] * bx + ainv[1][1] * rx + ainv[1][2] * cx;
-	cp = ainv[2][0] * bx + ainv[2][1] * rx + ainv[2][2] * cx;
-
-	bp += b0;
-	rp += r0;
-	cp += c0;
-        
-	if (bp < -1.0 || bp > src_nbands) continue;
-	if (rp < -1.0 || rp > src_nrows) continue;
-	if (cp < -1.0 || cp > src_ncolumns) continue;
-	
-	val = f(int_koeff, bp, rp, cp);
-	VSetPixel(dest, b, r, c, (VDouble) val);
-      }
-    }
-  }
-  
-  VDestroyImage(int_koeff);
+  dest = VCubicSplineCoeffSample3d(coeff,dest,transform,b0,r0,c0,
+				   dest_nbands,dest_nrows,dest_ncolumns,VPixelRepn(src));
+  VDestroyImage(coeff);
   return dest;
 }
 
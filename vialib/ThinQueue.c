@@ -0,0 +1,205 @@
+/*! \file
+  Queue-ordered thinning.
+
+Driver for distance-ordered topological thinning (VThin3d, VSkel3d).
+Foreground voxels are processed in the order of their distance from
+the background. Only border voxels are held in a bucket queue indexed
+by quantized depth. A voxel enters the queue when it first becomes a
+border voxel, i.e. when one of its neighbours is deleted, so empty
+depth levels and interior voxels cost nothing.
+
+Within a directional subiteration, all candidates of the current depth
+level are tested in parallel against the same image, and the voxels
+that pass are deleted together afterwards. This is the parallel
+deletion scheme the deletion criteria of both algorithms were designed
+for, so the order in which candidates are tested does not matter.
+
+\par Author:
+Gabriele Lohmann, MPI-CBS
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+/* From the Vista library: */
+#include <viaio/Vlib.h>
+#include <viaio/mu.h>
+#include <via.h>
+
+
+typedef int (*VThinTestProc)(VImage,int,int,int,int);
+
+typedef struct {
+  size_t n;
+  size_t size;
+  size_t *v;
+} Bucket;
+
+
+static void
+BucketPush(Bucket *bucket,size_t i)
+{
+  if (bucket->n >= bucket->size) {
+    bucket->size = (bucket->size < 64) ? 64 : 2 * bucket->size;
+    bucket->v = (size_t *) VRealloc(bucket->v,bucket->size * sizeof(size_t));
+  }
+  bucket->v[bucket->n++] = i;
+}
+
+
+/*!
+\fn void VQueueThinning(VImage dest,VImage depth,float step,int margin,
+     int ndir,VThinTestProc test)
+\brief Distance-ordered thinning of a bit image in place.
+
+\param dest    image to be thinned (bit repn), modified in place
+\param depth   depth of each foreground voxel (float repn), e.g. a chamfer
+distance map. Voxels with depth <= 0.1 are never deleted.
+\param step    quantization of depth levels
+\param margin  voxels closer than <margin> to the image border are never deleted
+\param ndir    number of directional subiterations, passed to <test> as 0..ndir-1
+\param test    returns nonzero if voxel (b,r,c) may be deleted in direction dir.
+*/
+void
+VQueueThinning(VImage dest,VImage depth,float step,int margin,
+	       int ndir,VThinTestProc test)
+{
+  int nbands,nrows,ncols,nlevels,level,dir;
+  size_t i,j,k,n,npixels,nslice;
+  long ndel;
+  int b,r,c,db,dr,dc,bb,rr,cc;
+  VBit *data;
+  VFloat *dp,maxdepth;
+  VUByte *queued;
+  char *mark;
+  Bucket *buckets,list;
+
+  nbands = VImageNBands(dest);
+  nrows  = VImageNRows(dest);
+  ncols  = VImageNColumns(dest);
+  nslice = (size_t) nrows * ncols;
+  npixels = (size_t) nbands * nslice;
+  data = (VBit *) VImageData(dest);
+  dp = (VFloat *) VImageData(depth);
+
+  if (VPixelRepn(dest) != VBitRepn || VPixelRepn(depth) != VFloatRepn)
+    VError(" VQueueThinning: illegal pixel repn");
+
+#define Inside(b,r,c) \
+  ((b) >= margin && (b) < nbands-margin && \
+   (r) >= margin && (r) < nrows-margin && \
+   (c) >= margin && (c) < ncols-margin)
+
+#define Level(x) ((int) ceil((x) / step))
+
+  maxdepth = 0;
+  for (i=0; i<npixels; i++) if (dp[i] > maxdepth) maxdepth = dp[i];
+  nlevels = Level(maxdepth) + 1;
+
+  buckets = (Bucket *) VCalloc(nlevels,sizeof(Bucket));
+  queued = (VUByte *) VCalloc(npixels,sizeof(VUByte));
+
+
+  /*
+  ** initial border voxels
+  */
+  for (b=margin; b<nbands-margin; b++) {
+    for (r=margin; r<nrows-margin; r++) {
+      for (c=margin; c<ncols-margin; c++) {
+	i = b*nslice + (size_t) r*ncols + c;
+	if (data[i] == 0 || dp[i] <= 0.1) continue;
+
+	for (db=-1; db<=1; db++) {
+	  for (dr=-1; dr<=1; dr++) {
+	    for (dc=-1; dc<=1; dc++) {
+	      if (data[i + db*nslice + dr*ncols + dc] == 0) goto border;
+	    }
+	  }
+	}
+	continue;
+
+      border:
+	queued[i] = 1;
+	BucketPush(&buckets[Level(dp[i])],i);
+      }
+    }
+  }
+
+
+  /*
+  ** process depth levels in increasing order
+  */
+  for (level=0; level<nlevels; level++) {
+    if (buckets[level].n == 0) continue;
+
+    list = buckets[level];
+    buckets[level].n = buckets[level].size = 0;
+    buckets[level].v = NULL;
+
+    ndel = 1;
+    while (ndel > 0) {
+      ndel = 0;
+
+      for (dir=0; dir<ndir; dir++) {
+
+	n = list.n;
+	if (n == 0) break;
+	mark = (char *) VCalloc(n,sizeof(char));
+
+#pragma omp parallel for private(b,r,c,i) schedule(dynamic,256)
+	for (j=0; j<n; j++) {
+	  i = list.v[j];
+	  if (data[i] == 0) continue;
+	  b = i / nslice;
+	  r = (i % nslice) / ncols;
+	  c = i % ncols;
+	  mark[j] = (test(dest,b,r,c,dir) != 0);
+	}
+
+	/* delete marked voxels, their neighbours become border voxels */
+	k = 0;
+	for (j=0; j<n; j++) {
+	  i = list.v[j];
+	  if (mark[j] == 0) {
+	    list.v[k++] = i;
+	    continue;
+	  }
+	  data[i] = 0;
+	  queued[i] = 0;
+	  ndel++;
+
+	  b = i / nslice;
+	  r = (i % nslice) / ncols;
+	  c = i % ncols;
+	  for (bb=b-1; bb<=b+1; bb++) {
+	    for (rr=r-1; rr<=r+1; rr++) {
+	      for (cc=c-1; cc<=c+1; cc++) {
+		size_t u = bb*nslice + (size_t) rr*ncols + cc;
+		int l;
+		if (! Inside(bb,rr,cc)) continue;
+		if (data[u] == 0 || queued[u] || dp[u] <= 0.1) continue;
+		queued[u] = 1;
+		l = Level(dp[u]);
+		if (l <= level) BucketPush(&list,u);
+		else BucketPush(&buckets[l],u);
+	      }
+	    }
+	  }
+	}
+	/* voxels appended while deleting follow the survivors */
+	for (j=n; j<list.n; j++) list.v[k++] = list.v[j];
+	list.n = k;
+	VFree(mark);
+      }
+    }
+
+    /* survivors are re-queued when one of their neighbours is deleted */
+    for (j=0; j<list.n; j++) queued[list.v[j]] = 0;
+    VFree(list.v);
+  }
+
+  for (level=0; level<nlevels; level++) VFree(buckets[level].v);
+  VFree(buckets);
+  VFree(queued);
+}
@@ -222,6 +222,7 @@ VNumComp6(VBit src_pp[])
 VImage
 VTopoclass(VImage src, VImage dest)
 {
+  double tbegin = VTraceBegin();
   int b=0,r=0,c=0,i,u=0;
   int bb,rr,cc,n;
   int b0,b1,r0,r1,c0;
@@ -354,6 +355,7 @@ VTopoclass(VImage src, VImage dest)
     }
   }
   
+  VTraceEnd("VTopoclass",tbegin,VImageNPixels(src),VImageSize(src));
   return dest;
 }
 